@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cinttypes>    // uint64_t
+
+namespace NetLib {
+
+	// =======================================
+	// ===      Allocation counter hook    ===
+	// =======================================
+	//
+	// Test builds only: If the library is built with NETLIB_COUNT_ALLOCATIONS, it replaces the global operator
+	// new and counts every heap allocation in the process. This is used to verify that the receive paths don't
+	// allocate in steady state (netlib-loadgen alloc-check). Without the option, counting is disabled and the
+	// count stays 0.
+	//
+
+	bool IsAllocationCountingEnabled();
+	uint64_t GetAllocationCount();
+
+}
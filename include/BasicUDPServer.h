@@ -0,0 +1,273 @@
+#pragma once
+
+#include <array>
+#include <thread>
+#include <type_traits>
+
+#include "NetLib.h"
+
+namespace NetLib {
+
+	// =========================================
+	// ===      UDPReceiveSocket Class       ===
+	// =========================================
+	//
+	// The non-template part of BasicUDPServer: A bound IPv4 UDP socket that is read without blocking once
+	// Wait() reported it readable. Keeps asio out of the headers like every other class.
+	//
+
+	struct UDPReceiveSocketMembers;
+
+	class UDPReceiveSocket {
+	public:
+		UDPReceiveSocket(uint16_t port);
+		~UDPReceiveSocket();
+
+		/// <summary>
+		/// Blocks until a datagram is queued. Returns false once Shutdown() was called.
+		/// </summary>
+		bool Wait();
+
+		/// <summary>
+		/// Reads one queued datagram without blocking. Returns false if the queue is empty.
+		/// </summary>
+		bool TryReceive(uint8_t* data, size_t capacity, size_t& bytes, IPv4Address& source, uint16_t& sourcePort);
+
+		/// <summary>
+		/// Scatters one queued datagram over the buffers in order, truncated to their total size.
+		/// </summary>
+		bool TryReceive(const MutableBuffer* buffers, size_t count, size_t& bytes, IPv4Address& source, uint16_t& sourcePort);
+
+		/// <summary>
+		/// Like TryReceive(), but with EnableAdaptiveBuffer() a datagram larger than 'capacity' is received into
+		/// a buffer of the socket instead. 'data' then points to that buffer, until the next receive.
+		/// </summary>
+		bool TryReceiveAdaptive(uint8_t*& data, size_t capacity, size_t& bytes, IPv4Address& source, uint16_t& sourcePort);
+
+		/// <summary>
+		/// Reads up to 'count' queued datagrams into buffers[i] of 'capacity' bytes each, and returns how many.
+		/// Takes a single system call on Linux (recvmmsg) unless shared memory, the TOS byte or the adaptive
+		/// buffer need the path of TryReceive(). Longer datagrams are truncated.
+		/// </summary>
+		size_t TryReceiveBatch(uint8_t* const* buffers, size_t capacity, size_t count, size_t* bytes, IPv4Address* sources, uint16_t* sourcePorts);
+
+		/// <summary>
+		/// Wakes up Wait(), can be called from any thread.
+		/// </summary>
+		void Shutdown();
+
+		/// <summary>
+		/// Sends a datagram from the bound port, e.g. a reply to the source of a received one. Can be called
+		/// from any thread, waits while the send buffer of the socket is full. Returns false on errors.
+		/// </summary>
+		bool SendTo(IPv4Address destination, uint16_t port, const uint8_t* data, size_t length);
+
+		std::string GetLocalIP();
+		uint16_t GetLocalPort();
+		bool SetFilter(const PacketFilter& filter);
+		void ClearFilter();
+
+		/// <summary>
+		/// Timers fire inside Wait(), on the thread that waits.
+		/// </summary>
+		TimerId ScheduleTimer(std::chrono::nanoseconds delay, std::function<void()> callback);
+		bool CancelTimer(TimerId id);
+
+		/// <summary>
+		/// Datagrams of local senders also arrive through TryReceive(), from 127.0.0.1.
+		/// </summary>
+		bool EnableSharedMemory(const SharedMemoryOptions& options);
+
+		/// <summary>
+		/// Reads the TOS byte of every datagram, ReceivedTos() returns the one of the last TryReceive().
+		/// </summary>
+		bool EnableTrafficClass();
+		uint8_t ReceivedTos();
+
+		/// <summary>
+		/// Truncated datagrams are always counted, the adaptive buffer only works with TryReceiveAdaptive().
+		/// </summary>
+		bool EnableAdaptiveBuffer(const AdaptiveBufferOptions& options);
+		ReceiveBufferStatistics GetReceiveBufferStatistics();
+
+	private:
+		IncompleteTypeWrapper<UDPReceiveSocketMembers> members;
+	};
+
+
+
+
+
+	// =====================================
+	// ===      BasicUDPServer Policies  ===
+	// =====================================
+
+	/// <summary>
+	/// Heap buffer with its size chosen at runtime.
+	/// </summary>
+	class DynamicBuffer {
+	public:
+		explicit DynamicBuffer(size_t size = NETLIB_DEFAULT_UDP_BUFFER_SIZE) : buffer(size) {}
+
+		uint8_t* Data() { return buffer.data(); }
+		size_t Size() const { return buffer.size(); }
+
+	private:
+		std::vector<uint8_t> buffer;
+	};
+
+	/// <summary>
+	/// Buffer of a compile-time size, stored inside the server object.
+	/// </summary>
+	template<size_t N>
+	class StaticBuffer {
+	public:
+		uint8_t* Data() { return buffer.data(); }
+		constexpr size_t Size() const { return N; }
+
+	private:
+		std::array<uint8_t, N> buffer;
+	};
+
+	// Defined in the library, so the policies don't need the logger
+	void LogReceivedPacket(const char* component, const uint8_t* data, size_t length, IPv4Address source, uint16_t sourcePort);
+	void LogListenerError(const char* component, const char* message);
+
+	/// <summary>
+	/// Writes to the NetLib log. Packets are only formatted if the log level asks for them.
+	/// </summary>
+	struct DefaultLog {
+		static constexpr bool enabled = true;
+
+		static void Received(const uint8_t* data, size_t length, IPv4Address source, uint16_t sourcePort) {
+			LogReceivedPacket("BasicUDPServer", data, length, source, sourcePort);
+		}
+
+		static void Error(const char* message) {
+			LogListenerError("BasicUDPServer", message);
+		}
+	};
+
+	/// <summary>
+	/// Removes every log statement from the receive loop at compile time.
+	/// </summary>
+	struct NoLog {
+		static constexpr bool enabled = false;
+
+		static void Received(const uint8_t*, size_t, IPv4Address, uint16_t) {}
+		static void Error(const char*) {}
+	};
+
+
+
+
+
+	// =======================================
+	// ===      BasicUDPServer Class       ===
+	// =======================================
+	//
+	// Receives on its own thread like UDPServerAsync, but the handler is a template parameter and called
+	// directly, so it can be inlined into the receive loop. The handler is any callable taking either
+	// (uint8_t* packet, size_t packetSize) or (uint8_t* packet, size_t packetSize, IPv4Address source, uint16_t sourcePort).
+	//
+	//     auto server = NetLib::MakeUDPServer([](uint8_t* packet, size_t size) { ... }, 5000);
+	//     NetLib::BasicUDPServer<MyHandler, NetLib::StaticBuffer<1500>, NetLib::NoLog> fast(MyHandler(), 5001);
+	//
+
+	template<typename Handler, typename BufferPolicy = DynamicBuffer, typename LogPolicy = DefaultLog>
+	class BasicUDPServer {
+	public:
+		BasicUDPServer(Handler handler, uint16_t port, BufferPolicy buffer = BufferPolicy())
+			: handler(std::move(handler)), buffer(std::move(buffer)), socket(port)
+		{
+			listenerThread = std::thread([this] { ListenerThread(); });
+		}
+
+		~BasicUDPServer() {
+			socket.Shutdown();
+			listenerThread.join();
+		}
+
+		BasicUDPServer(const BasicUDPServer&) = delete;
+		BasicUDPServer& operator=(const BasicUDPServer&) = delete;
+
+		std::string GetLocalIP() { return socket.GetLocalIP(); }
+		uint16_t GetLocalPort() { return socket.GetLocalPort(); }
+		bool SetFilter(const PacketFilter& filter) { return socket.SetFilter(filter); }
+
+		/// <summary>
+		/// Replies from the port of the server, any thread.
+		/// </summary>
+		bool SendTo(IPv4Address destination, uint16_t port, const uint8_t* data, size_t length) { return socket.SendTo(destination, port, data, length); }
+		void ClearFilter() { socket.ClearFilter(); }
+
+		/// <summary>
+		/// The callback runs on the listener thread, between two calls of the handler.
+		/// </summary>
+		TimerId ScheduleTimer(std::chrono::nanoseconds delay, std::function<void()> callback) { return socket.ScheduleTimer(delay, std::move(callback)); }
+		bool CancelTimer(TimerId id) { return socket.CancelTimer(id); }
+
+		bool EnableSharedMemory(const SharedMemoryOptions& options = SharedMemoryOptions()) { return socket.EnableSharedMemory(options); }
+
+		/// <summary>
+		/// With EnableTrafficClass(), ReceivedTos() is the TOS byte of the datagram the handler is called for.
+		/// </summary>
+		bool EnableTrafficClass() { return socket.EnableTrafficClass(); }
+		uint8_t ReceivedTos() { return socket.ReceivedTos(); }
+
+		/// <summary>
+		/// Datagrams larger than the buffer policy are handed to the handler from a grown buffer of the socket.
+		/// </summary>
+		bool EnableAdaptiveBuffer(const AdaptiveBufferOptions& options = AdaptiveBufferOptions()) { return socket.EnableAdaptiveBuffer(options); }
+		ReceiveBufferStatistics GetReceiveBufferStatistics() { return socket.GetReceiveBufferStatistics(); }
+
+	private:
+		void ListenerThread() {
+			try {
+				while (socket.Wait()) {
+					for (size_t i = 0; i < NETLIB_UDP_RECEIVE_BATCH; i++) {
+						uint8_t* data = buffer.Data();
+						size_t bytes = 0;
+						IPv4Address source;
+						uint16_t sourcePort = 0;
+						if (!socket.TryReceiveAdaptive(data, buffer.Size(), bytes, source, sourcePort))
+							break;
+
+						if constexpr (LogPolicy::enabled) {
+							LogPolicy::Received(data, bytes, source, sourcePort);
+						}
+
+						if constexpr (std::is_invocable_v<Handler&, uint8_t*, size_t, IPv4Address, uint16_t>) {
+							handler(data, bytes, source, sourcePort);
+						}
+						else {
+							static_assert(std::is_invocable_v<Handler&, uint8_t*, size_t>,
+								"The handler must be callable with (uint8_t*, size_t) or (uint8_t*, size_t, IPv4Address, uint16_t)");
+							handler(data, bytes);
+						}
+					}
+				}
+			}
+			catch (std::exception& e) {
+				LogPolicy::Error(e.what());
+			}
+			catch (...) {
+				LogPolicy::Error("Unknown exception");
+			}
+		}
+
+		Handler handler;
+		BufferPolicy buffer;
+		UDPReceiveSocket socket;
+		std::thread listenerThread;
+	};
+
+	/// <summary>
+	/// Deduces the handler type, e.g. for lambdas.
+	/// </summary>
+	template<typename BufferPolicy = DynamicBuffer, typename LogPolicy = DefaultLog, typename Handler>
+	std::unique_ptr<BasicUDPServer<Handler, BufferPolicy, LogPolicy>> MakeUDPServer(Handler handler, uint16_t port, BufferPolicy buffer = BufferPolicy()) {
+		return std::make_unique<BasicUDPServer<Handler, BufferPolicy, LogPolicy>>(std::move(handler), port, std::move(buffer));
+	}
+
+}
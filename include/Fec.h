@@ -0,0 +1,151 @@
+#pragma once
+
+#include "NetLib.h"
+
+#define NETLIB_FEC_HEADER_SIZE 10		// Added to every datagram: Block, position, block size and the payload length
+
+namespace NetLib {
+
+	// =====================================
+	// ===      Forward error correction ===
+	// =====================================
+	//
+	// For streams where a retransmission would arrive too late, e.g. video or sensor data. The FecSender groups
+	// the datagrams of a UDPClient into blocks of 'dataPackets' and sends 'repairPackets' repair datagrams after
+	// each block. The FecReceiver, fed from a UDPServerAsync callback, delivers every data datagram as soon as it
+	// arrives and rebuilds lost ones from the repair datagrams of their block, without any feedback to the sender.
+	//
+	//     NetLib::UDPClient client("10.0.0.2", 5000);
+	//     NetLib::FecSender fec(client);
+	//     fec.send(frame, size);                  // ... and fec.Flush() at the end of a burst
+	//
+	//     NetLib::FecReceiver fec([](uint8_t* packet, size_t size) { ... });
+	//     NetLib::UDPServerAsync server([&](uint8_t* packet, size_t size) { fec.OnPacket(packet, size); }, 5000, 2048);
+	//
+	// Recovered datagrams are delivered after the later datagrams of their block, so the order is not kept.
+	// Every datagram grows by NETLIB_FEC_HEADER_SIZE bytes, the server buffer must fit that.
+	//
+
+	enum FecScheme : uint8_t {
+		FEC_XOR,							// Repair packet j is the parity of the data packets i with (i % repairPackets) == j.
+											// Recovers one loss per group, the cheapest to compute.
+		FEC_REED_SOLOMON					// Any 'repairPackets' losses per block (Cauchy Reed-Solomon over GF(2^8))
+	};
+
+	struct FecOptions {
+		FecScheme scheme = FEC_REED_SOLOMON;
+		uint8_t dataPackets = 8;			// Per block, 1-255
+		uint8_t repairPackets = 2;			// Per block, dataPackets + repairPackets must not exceed 255
+		size_t maxPacketSize = 1400;		// Largest payload passed to FecSender::send()
+	};
+
+	struct FecStatistics {
+		uint64_t dataPackets = 0;			// Sent or received data datagrams
+		uint64_t repairPackets = 0;			// Sent or received repair datagrams
+		uint64_t blocks = 0;				// Completed blocks, including the ones cut short by Flush()
+		uint64_t recovered = 0;				// Receiver: Lost data datagrams rebuilt from the repair datagrams
+		uint64_t unrecoverable = 0;			// Receiver: Lost data datagrams of blocks that left the window
+		uint64_t invalid = 0;				// Receiver: Datagrams without a valid FEC header, or too late
+	};
+
+	// GF(2^8) kernels, chosen at startup by the CPU features
+	enum FecKernel {
+		FEC_KERNEL_AUTO,
+		FEC_KERNEL_SCALAR,
+		FEC_KERNEL_SSSE3,
+		FEC_KERNEL_AVX2
+	};
+
+	/// <summary>
+	/// Selects the kernel for all FEC coding, e.g. to compare them. Returns false if the CPU does not support it.
+	/// </summary>
+	bool SetFecKernel(FecKernel kernel);
+	FecKernel GetFecKernel();
+	const char* GetFecKernelName(FecKernel kernel);
+
+
+
+	struct FecCodecMembers;
+
+	/// <summary>
+	/// The block code without any framing. All symbols of a block have the same length, shorter datagrams are
+	/// padded with zeros. The coefficients only depend on the position, so a block may have fewer data symbols
+	/// than configured. Not thread-safe, the codec keeps scratch memory between calls.
+	/// </summary>
+	class FecCodec {
+	public:
+		FecCodec(FecScheme scheme);
+		~FecCodec();
+
+		/// <summary>
+		/// Computes 'repairCount' repair symbols from 'dataCount' data symbols of 'length' bytes each.
+		/// </summary>
+		void Encode(const uint8_t* const* data, size_t dataCount, uint8_t* const* repair, size_t repairCount, size_t length);
+
+		/// <summary>
+		/// Rebuilds the missing data symbols in place (the buffers of data[i] with present[i] == false) and sets
+		/// their flags. Returns false if some of them can't be recovered with the present repair symbols.
+		/// </summary>
+		bool Decode(uint8_t* const* data, bool* present, size_t dataCount,
+			const uint8_t* const* repair, const bool* repairPresent, size_t repairCount, size_t length);
+
+	private:
+		IncompleteTypeWrapper<FecCodecMembers> members;
+	};
+
+
+
+	struct FecSenderMembers;
+
+	class FecSender {
+	public:
+		/// <summary>
+		/// The client must outlive the sender. Throws std::runtime_error for invalid options.
+		/// </summary>
+		FecSender(UDPClient& client, const FecOptions& options = FecOptions());
+		~FecSender();
+
+		/// <summary>
+		/// Sends the datagram right away and the repair datagrams once the block is full. Thread-safe.
+		/// Throws std::runtime_error if 'length' exceeds maxPacketSize.
+		/// </summary>
+		size_t send(uint8_t* data, size_t length);
+
+		/// <summary>
+		/// Ends the current block early and sends its repair datagrams, e.g. at the end of a video frame.
+		/// Until then, the datagrams of an incomplete block can't be recovered.
+		/// </summary>
+		void Flush();
+
+		FecStatistics GetStatistics();
+
+	private:
+		IncompleteTypeWrapper<FecSenderMembers> members;
+	};
+
+
+
+	struct FecReceiverMembers;
+
+	class FecReceiver {
+	public:
+		/// <summary>
+		/// 'deliver' is called for every data datagram, received or recovered, on the thread calling OnPacket().
+		/// The receiver keeps the last 'window' blocks for recovery. Only maxPacketSize of the options is used,
+		/// the scheme and the block sizes come with the datagrams.
+		/// </summary>
+		FecReceiver(std::function<void(uint8_t* packet, size_t packetSize)> deliver, const FecOptions& options = FecOptions(), size_t window = 32);
+		~FecReceiver();
+
+		/// <summary>
+		/// Feed every received datagram. Not thread-safe, call it from one thread, e.g. the receive callback.
+		/// </summary>
+		void OnPacket(uint8_t* packet, size_t packetSize);
+
+		FecStatistics GetStatistics();
+
+	private:
+		IncompleteTypeWrapper<FecReceiverMembers> members;
+	};
+
+}
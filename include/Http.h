@@ -0,0 +1,114 @@
+#pragma once
+
+#include "NetLib.h"
+
+#define NETLIB_HTTP_MAX_REDIRECTS 5
+#define NETLIB_HTTP_MAX_IDLE_CONNECTIONS 4
+
+namespace NetLib {
+
+	// =================================================
+	// ===      File download / HTTP Utilities       ===
+	// =================================================
+	//
+	// Plain HTTP/1.1 client (no TLS). Connections are kept alive and pooled per host, bodies are streamed
+	// to the caller in pieces and never buffered as a whole, unless a function explicitly returns a buffer.
+	//
+
+	struct HttpResponse {
+		std::string body;
+		size_t status = 0;
+		std::string reason;
+
+		HttpResponse() = default;
+		HttpResponse(const std::string& body, size_t status, std::string reason) :
+			body(body), status(status), reason(reason) {}
+	};
+
+	/// <summary>
+	/// Called whenever a piece of the body was received. 'total' is 0 if the server did not announce the size.
+	/// Return false to cancel the transfer.
+	/// </summary>
+	using HttpProgressCallback = std::function<bool(uint64_t progress, uint64_t total)>;
+
+	struct HttpDownloadOptions {
+		size_t maxRedirects = NETLIB_HTTP_MAX_REDIRECTS;
+		HttpProgressCallback onProgress;
+
+		/// <summary>
+		/// Files of at least 'parallelThreshold' bytes are split into HTTP Range requests which are downloaded
+		/// on 'parallelConnections' connections at once, if the server supports ranges.
+		/// </summary>
+		size_t parallelConnections = 4;
+		uint64_t parallelThreshold = 8 * 1024 * 1024;
+	};
+
+	struct HttpClientMembers;
+
+	class HttpClient {
+	public:
+		HttpClient(size_t maxIdleConnectionsPerHost = NETLIB_HTTP_MAX_IDLE_CONNECTIONS);
+		~HttpClient();
+
+		/// <summary>
+		/// Do a HTTP GET request, at most 'maxRedirects' redirects are followed. Return value
+		/// is empty when the server can't be reached, otherwise the body and HTTP code can be retrieved.
+		/// </summary>
+		std::optional<HttpResponse> Get(const std::string& url, size_t maxRedirects = NETLIB_HTTP_MAX_REDIRECTS);
+
+		/// <summary>
+		/// Do a HTTP GET request and stream the body into the callback instead of buffering it.
+		/// The body of the returned response is always empty.
+		/// </summary>
+		std::optional<HttpResponse> GetChunked(
+			const std::string& url,
+			std::function<bool(const char* data, size_t length)> onReceiveCallback,
+			HttpProgressCallback onProgressCallback = nullptr,
+			size_t maxRedirects = NETLIB_HTTP_MAX_REDIRECTS);
+
+		/// <summary>
+		/// Download an online resource and return the buffer. Returns an empty string on failure.
+		/// </summary>
+		std::string DownloadToBuffer(const std::string& url, HttpProgressCallback onProgressCallback = nullptr,
+			size_t maxRedirects = NETLIB_HTTP_MAX_REDIRECTS);
+
+		/// <summary>
+		/// Download an online resource and write it to disk under the given filename, the parent directories are
+		/// created. The body is written with positional writes as it arrives, large files are downloaded in
+		/// parallel ranges. A partially written file is removed on failure.
+		/// </summary>
+		bool DownloadToFile(const std::string& url, const std::string& targetFile, const HttpDownloadOptions& options = HttpDownloadOptions());
+
+		/// <summary>
+		/// Close all idle keep-alive connections.
+		/// </summary>
+		void ClearConnectionPool();
+
+	private:
+		IncompleteTypeWrapper<HttpClientMembers> members;
+	};
+
+	/// <summary>
+	/// Splits an url into server hostname and server path. E.g: "http://www.google.at/my/page.html"
+	///  -> "http://www.google.at" and "/my/page.html"
+	/// </summary>
+	std::pair<std::string, std::string> SplitUrl(const std::string& url);
+
+	// The following functions share one process-wide HttpClient, so consecutive requests to the same host reuse
+	// the connection.
+
+	std::optional<HttpResponse> GetHttpRequest(const std::string& url, bool followRedirect = true);
+
+	std::optional<HttpResponse> GetHttpRequestChunked(
+		const std::string& url,
+		std::function<bool(const char* data, size_t length)> onReceiveCallback,
+		HttpProgressCallback onProgressCallback = nullptr,
+		bool followRedirect = true);
+
+	std::string DownloadUrlToBuffer(const std::string& url, HttpProgressCallback onProgressCallback = nullptr,
+		bool followRedirect = true);
+
+	bool DownloadUrlToFile(const std::string& url, const std::string& targetFile,
+		HttpProgressCallback onProgressCallback = nullptr, bool followRedirect = true);
+
+}
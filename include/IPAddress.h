@@ -0,0 +1,515 @@
+#pragma once
+
+#include <cstddef>      // size_t
+#include <cinttypes>    // uint8_t, ...
+#include <string>       // std::string
+#include <string_view>  // std::string_view
+#include <optional>
+#include <array>
+#include <cstring>      // memcpy
+
+// Binary IP address value types. Parsing, formatting into a caller buffer and all subnet math are
+// allocation-free and constexpr, only ToString() creates a std::string.
+
+namespace NetLib {
+
+	namespace Detail {
+
+		constexpr int HexDigit(char c) {
+			if (c >= '0' && c <= '9') return c - '0';
+			if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+			if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+			return -1;
+		}
+
+		// Parses a decimal number of at most 'maxDigits' digits at 'pos', advancing it. Returns -1 on failure.
+		constexpr int ParseDecimal(std::string_view text, size_t& pos, int maxDigits, int maxValue) {
+			int value = 0;
+			int digits = 0;
+			while (pos < text.size() && text[pos] >= '0' && text[pos] <= '9') {
+				if (digits == 1 && value == 0)		// No leading zeros, "010" is ambiguous (octal)
+					return -1;
+				value = value * 10 + (text[pos] - '0');
+				digits++;
+				pos++;
+				if (digits > maxDigits || value > maxValue)
+					return -1;
+			}
+			return digits > 0 ? value : -1;
+		}
+
+		constexpr size_t WriteDecimal(char* out, unsigned value) {
+			char digits[10] = {};
+			size_t count = 0;
+			do {
+				digits[count++] = (char)('0' + value % 10);
+				value /= 10;
+			} while (value > 0);
+
+			for (size_t i = 0; i < count; i++) {
+				out[i] = digits[count - 1 - i];
+			}
+			return count;
+		}
+
+	}
+
+
+
+	// ====================================
+	// ===      IPv4Address Class       ===
+	// ====================================
+
+	class IPv4Address {
+	public:
+		static constexpr size_t MAX_STRING_LENGTH = 15;		// "255.255.255.255"
+
+		constexpr IPv4Address() = default;
+		constexpr explicit IPv4Address(uint32_t hostOrder) : value(hostOrder) {}
+		constexpr IPv4Address(uint8_t a, uint8_t b, uint8_t c, uint8_t d)
+			: value(((uint32_t)a << 24) | ((uint32_t)b << 16) | ((uint32_t)c << 8) | (uint32_t)d) {}
+
+		static constexpr IPv4Address Any() { return IPv4Address(0u); }
+		static constexpr IPv4Address Loopback() { return IPv4Address(127, 0, 0, 1); }
+		static constexpr IPv4Address Broadcast() { return IPv4Address(0xFFFFFFFFu); }
+
+		/// <summary>
+		/// Converts the raw value of an in_addr (s_addr), independent of the host byte order.
+		/// </summary>
+		static IPv4Address FromNetworkOrder(uint32_t networkOrder) {
+			uint8_t b[4] = {};
+			memcpy(b, &networkOrder, 4);
+			return IPv4Address(b[0], b[1], b[2], b[3]);
+		}
+
+		/// <summary>
+		/// Parses strict dotted-quad notation ("192.168.0.1"). Returns nullopt for anything else.
+		/// </summary>
+		static constexpr std::optional<IPv4Address> Parse(std::string_view text) {
+			uint32_t result = 0;
+			size_t pos = 0;
+			for (int i = 0; i < 4; i++) {
+				if (i > 0) {
+					if (pos >= text.size() || text[pos] != '.')
+						return std::nullopt;
+					pos++;
+				}
+				int octet = Detail::ParseDecimal(text, pos, 3, 255);
+				if (octet < 0)
+					return std::nullopt;
+				result = (result << 8) | (uint32_t)octet;
+			}
+
+			if (pos != text.size())
+				return std::nullopt;
+
+			return IPv4Address(result);
+		}
+
+		constexpr uint32_t ToUint() const { return value; }					// Host byte order
+
+		uint32_t ToNetworkOrder() const {		// As stored in in_addr (s_addr)
+			auto b = ToBytes();
+			uint32_t result = 0;
+			memcpy(&result, b.data(), 4);
+			return result;
+		}
+
+		constexpr std::array<uint8_t, 4> ToBytes() const {
+			return { (uint8_t)(value >> 24), (uint8_t)(value >> 16), (uint8_t)(value >> 8), (uint8_t)value };
+		}
+
+		/// <summary>
+		/// Writes the dotted-quad notation without terminating zero, 'out' needs MAX_STRING_LENGTH bytes.
+		/// Returns the number of characters written.
+		/// </summary>
+		constexpr size_t ToChars(char* out) const {
+			size_t length = 0;
+			for (int i = 0; i < 4; i++) {
+				if (i > 0) {
+					out[length++] = '.';
+				}
+				length += Detail::WriteDecimal(out + length, (value >> (24 - 8 * i)) & 0xFF);
+			}
+			return length;
+		}
+
+		std::string ToString() const {
+			char buffer[MAX_STRING_LENGTH] = {};
+			return std::string(buffer, ToChars(buffer));
+		}
+
+		constexpr bool IsUnspecified() const { return value == 0; }
+		constexpr bool IsLoopback() const { return (value >> 24) == 127; }
+		constexpr bool IsMulticast() const { return (value >> 28) == 0xE; }
+		constexpr bool IsBroadcast() const { return value == 0xFFFFFFFFu; }
+
+		constexpr bool operator==(const IPv4Address& other) const { return value == other.value; }
+		constexpr bool operator!=(const IPv4Address& other) const { return value != other.value; }
+		constexpr bool operator<(const IPv4Address& other) const { return value < other.value; }
+
+	private:
+		uint32_t value = 0;
+	};
+
+
+
+	// ====================================
+	// ===      IPv6Address Class       ===
+	// ====================================
+
+	class IPv6Address {
+	public:
+		static constexpr size_t MAX_STRING_LENGTH = 45;		// "ffff:ffff:ffff:ffff:ffff:ffff:255.255.255.255"
+
+		using Bytes = std::array<uint8_t, 16>;
+
+		constexpr IPv6Address() = default;
+		constexpr explicit IPv6Address(const Bytes& bytes) : bytes(bytes) {}
+
+		static constexpr IPv6Address Any() { return IPv6Address(); }
+		static constexpr IPv6Address Loopback() {
+			Bytes b = {};
+			b[15] = 1;
+			return IPv6Address(b);
+		}
+
+		/// <summary>
+		/// The IPv4-mapped form ::ffff:a.b.c.d, as used by dual-stack sockets.
+		/// </summary>
+		static constexpr IPv6Address FromV4Mapped(IPv4Address address) {
+			Bytes b = {};
+			b[10] = 0xFF;
+			b[11] = 0xFF;
+			auto v4 = address.ToBytes();
+			for (int i = 0; i < 4; i++) {
+				b[12 + i] = v4[i];
+			}
+			return IPv6Address(b);
+		}
+
+		/// <summary>
+		/// Parses RFC 4291 text notation including "::" compression and a trailing dotted IPv4 part.
+		/// Zone ids ("%eth0") are not accepted.
+		/// </summary>
+		static constexpr std::optional<IPv6Address> Parse(std::string_view text) {
+			uint16_t groups[8] = {};
+			int count = 0;
+			int compressAt = -1;
+			size_t pos = 0;
+
+			if (text.size() >= 2 && text[0] == ':' && text[1] == ':') {
+				compressAt = 0;
+				pos = 2;
+			}
+			else if (!text.empty() && text[0] == ':') {
+				return std::nullopt;
+			}
+
+			while (pos < text.size()) {
+				if (count >= 8)
+					return std::nullopt;
+
+				// A dotted IPv4 tail occupies the last two groups
+				size_t end = pos;
+				while (end < text.size() && text[end] != ':') {
+					end++;
+				}
+				if (end == text.size() && text.substr(pos).find('.') != std::string_view::npos) {
+					auto v4 = IPv4Address::Parse(text.substr(pos));
+					if (!v4.has_value() || count > 6)
+						return std::nullopt;
+					groups[count++] = (uint16_t)(v4->ToUint() >> 16);
+					groups[count++] = (uint16_t)(v4->ToUint() & 0xFFFF);
+					pos = text.size();
+					break;
+				}
+
+				uint32_t group = 0;
+				int digits = 0;
+				while (pos < text.size() && Detail::HexDigit(text[pos]) >= 0) {
+					group = (group << 4) | (uint32_t)Detail::HexDigit(text[pos]);
+					pos++;
+					if (++digits > 4)
+						return std::nullopt;
+				}
+				if (digits == 0)
+					return std::nullopt;
+				groups[count++] = (uint16_t)group;
+
+				if (pos == text.size())
+					break;
+				if (text[pos] != ':')
+					return std::nullopt;
+				pos++;
+
+				if (pos < text.size() && text[pos] == ':') {
+					if (compressAt >= 0)
+						return std::nullopt;
+					compressAt = count;
+					pos++;
+				}
+				else if (pos == text.size()) {		// Trailing single colon
+					return std::nullopt;
+				}
+			}
+
+			if ((compressAt < 0 && count != 8) || (compressAt >= 0 && count > 7))
+				return std::nullopt;
+
+			Bytes b = {};
+			int tail = compressAt >= 0 ? count - compressAt : 0;
+			for (int i = 0; i < count; i++) {
+				int index = (compressAt >= 0 && i >= compressAt) ? 8 - tail + (i - compressAt) : i;
+				b[2 * index] = (uint8_t)(groups[i] >> 8);
+				b[2 * index + 1] = (uint8_t)(groups[i] & 0xFF);
+			}
+			return IPv6Address(b);
+		}
+
+		constexpr const Bytes& ToBytes() const { return bytes; }
+
+		constexpr bool IsUnspecified() const {
+			for (uint8_t b : bytes) {
+				if (b != 0) return false;
+			}
+			return true;
+		}
+
+		constexpr bool IsLoopback() const { return *this == Loopback(); }
+		constexpr bool IsMulticast() const { return bytes[0] == 0xFF; }
+
+		constexpr bool IsV4Mapped() const {
+			for (int i = 0; i < 10; i++) {
+				if (bytes[i] != 0) return false;
+			}
+			return bytes[10] == 0xFF && bytes[11] == 0xFF;
+		}
+
+		constexpr IPv4Address ToV4() const {
+			return IPv4Address(bytes[12], bytes[13], bytes[14], bytes[15]);
+		}
+
+		/// <summary>
+		/// Writes the RFC 5952 notation without terminating zero, 'out' needs MAX_STRING_LENGTH bytes.
+		/// Returns the number of characters written.
+		/// </summary>
+		constexpr size_t ToChars(char* out) const {
+			if (IsV4Mapped()) {
+				const char prefix[] = "::ffff:";
+				for (size_t i = 0; i < 7; i++) {
+					out[i] = prefix[i];
+				}
+				return 7 + ToV4().ToChars(out + 7);
+			}
+
+			// The longest run of at least two zero groups is compressed
+			int bestStart = -1, bestLength = 0;
+			for (int i = 0; i < 8; ) {
+				if (Group(i) != 0) {
+					i++;
+					continue;
+				}
+				int start = i;
+				while (i < 8 && Group(i) == 0) {
+					i++;
+				}
+				if (i - start > bestLength && i - start >= 2) {
+					bestStart = start;
+					bestLength = i - start;
+				}
+			}
+
+			const char hex[] = "0123456789abcdef";
+			size_t length = 0;
+			for (int i = 0; i < 8; i++) {
+				if (i == bestStart) {
+					out[length++] = ':';
+					if (i == 0) {
+						out[length++] = ':';
+					}
+					i += bestLength - 1;
+					continue;
+				}
+
+				uint16_t group = Group(i);
+				bool leading = true;
+				for (int shift = 12; shift >= 0; shift -= 4) {
+					int digit = (group >> shift) & 0xF;
+					if (digit == 0 && leading && shift > 0)
+						continue;
+					leading = false;
+					out[length++] = hex[digit];
+				}
+				if (i < 7) {
+					out[length++] = ':';
+				}
+			}
+			return length;
+		}
+
+		std::string ToString() const {
+			char buffer[MAX_STRING_LENGTH] = {};
+			return std::string(buffer, ToChars(buffer));
+		}
+
+		constexpr bool operator==(const IPv6Address& other) const {
+			for (size_t i = 0; i < 16; i++) {
+				if (bytes[i] != other.bytes[i]) return false;
+			}
+			return true;
+		}
+		constexpr bool operator!=(const IPv6Address& other) const { return !(*this == other); }
+
+	private:
+		constexpr uint16_t Group(int i) const {
+			return (uint16_t)((bytes[2 * i] << 8) | bytes[2 * i + 1]);
+		}
+
+		Bytes bytes = {};
+	};
+
+
+
+	// ======================================
+	// ===      Cidr / Cidr6 Classes      ===
+	// ======================================
+
+	class Cidr {
+	public:
+		constexpr Cidr() = default;
+		constexpr Cidr(IPv4Address address, uint8_t prefixLength)
+			: address(address), prefixLength(prefixLength > 32 ? 32 : prefixLength) {}
+
+		/// <summary>
+		/// Parses "a.b.c.d/n". A plain address is accepted as a /32.
+		/// </summary>
+		static constexpr std::optional<Cidr> Parse(std::string_view text) {
+			size_t slash = text.find('/');
+			auto address = IPv4Address::Parse(text.substr(0, slash));
+			if (!address.has_value())
+				return std::nullopt;
+			if (slash == std::string_view::npos)
+				return Cidr(*address, 32);
+
+			size_t pos = slash + 1;
+			int prefix = Detail::ParseDecimal(text, pos, 2, 32);
+			if (prefix < 0 || pos != text.size())
+				return std::nullopt;
+			return Cidr(*address, (uint8_t)prefix);
+		}
+
+		/// <summary>
+		/// Builds the subnet from an address and a dotted netmask like "255.255.255.0".
+		/// Returns nullopt if the netmask is not contiguous.
+		/// </summary>
+		static constexpr std::optional<Cidr> FromNetmask(IPv4Address address, IPv4Address netmask) {
+			uint32_t mask = netmask.ToUint();
+			uint32_t inverted = ~mask;
+			if ((inverted & (inverted + 1)) != 0)
+				return std::nullopt;
+
+			uint8_t prefix = 0;
+			while (prefix < 32 && (mask & (0x80000000u >> prefix))) {
+				prefix++;
+			}
+			return Cidr(address, prefix);
+		}
+
+		constexpr IPv4Address Address() const { return address; }
+		constexpr uint8_t PrefixLength() const { return prefixLength; }
+
+		constexpr IPv4Address Netmask() const {
+			return IPv4Address(prefixLength == 0 ? 0u : 0xFFFFFFFFu << (32 - prefixLength));
+		}
+		constexpr IPv4Address Network() const { return IPv4Address(address.ToUint() & Netmask().ToUint()); }
+		constexpr IPv4Address Broadcast() const { return IPv4Address(address.ToUint() | ~Netmask().ToUint()); }
+
+		constexpr bool Contains(IPv4Address other) const {
+			return ((other.ToUint() ^ address.ToUint()) & Netmask().ToUint()) == 0;
+		}
+
+		constexpr bool Contains(const Cidr& other) const {
+			return other.prefixLength >= prefixLength && Contains(other.address);
+		}
+
+		std::string ToString() const {
+			return address.ToString() + "/" + std::to_string(prefixLength);
+		}
+
+		constexpr bool operator==(const Cidr& other) const {
+			return address == other.address && prefixLength == other.prefixLength;
+		}
+		constexpr bool operator!=(const Cidr& other) const { return !(*this == other); }
+
+	private:
+		IPv4Address address;
+		uint8_t prefixLength = 32;
+	};
+
+	class Cidr6 {
+	public:
+		constexpr Cidr6() = default;
+		constexpr Cidr6(IPv6Address address, uint8_t prefixLength)
+			: address(address), prefixLength(prefixLength > 128 ? 128 : prefixLength) {}
+
+		static constexpr std::optional<Cidr6> Parse(std::string_view text) {
+			size_t slash = text.find('/');
+			auto address = IPv6Address::Parse(text.substr(0, slash));
+			if (!address.has_value())
+				return std::nullopt;
+			if (slash == std::string_view::npos)
+				return Cidr6(*address, 128);
+
+			size_t pos = slash + 1;
+			int prefix = Detail::ParseDecimal(text, pos, 3, 128);
+			if (prefix < 0 || pos != text.size())
+				return std::nullopt;
+			return Cidr6(*address, (uint8_t)prefix);
+		}
+
+		constexpr IPv6Address Address() const { return address; }
+		constexpr uint8_t PrefixLength() const { return prefixLength; }
+
+		constexpr IPv6Address Network() const {
+			IPv6Address::Bytes bytes = address.ToBytes();
+			for (int i = 0; i < 16; i++) {
+				bytes[i] &= MaskByte(i);
+			}
+			return IPv6Address(bytes);
+		}
+
+		constexpr bool Contains(const IPv6Address& other) const {
+			for (int i = 0; i < 16; i++) {
+				if (((address.ToBytes()[i] ^ other.ToBytes()[i]) & MaskByte(i)) != 0)
+					return false;
+			}
+			return true;
+		}
+
+		constexpr bool Contains(const Cidr6& other) const {
+			return other.prefixLength >= prefixLength && Contains(other.address);
+		}
+
+		std::string ToString() const {
+			return address.ToString() + "/" + std::to_string(prefixLength);
+		}
+
+		constexpr bool operator==(const Cidr6& other) const {
+			return address == other.address && prefixLength == other.prefixLength;
+		}
+		constexpr bool operator!=(const Cidr6& other) const { return !(*this == other); }
+
+	private:
+		constexpr uint8_t MaskByte(int i) const {
+			int bits = (int)prefixLength - 8 * i;
+			if (bits >= 8) return 0xFF;
+			if (bits <= 0) return 0x00;
+			return (uint8_t)(0xFF << (8 - bits));
+		}
+
+		IPv6Address address;
+		uint8_t prefixLength = 128;
+	};
+
+}
@@ -10,9 +10,15 @@
 #include <atomic>	
 #include <mutex>		
 #include <utility>		// std::pair
-#include <queue>		
+#include <vector>		
+#include <memory>		// std::shared_ptr
+#include <chrono>		// std::chrono::nanoseconds
+#include <array>		// std::array
+#include <initializer_list>
 
 #include "NetworkInterfaces.h"
+#include "PacketFilter.h"
+#include "TimingWheel.h"
 
 /// <summary>
 /// Great care was taken that the asio headers are only included in the source file. Keeping the asio headers
@@ -23,6 +29,11 @@
 
 #define NETLIB_DEFAULT_UDP_BUFFER_SIZE 1024
 #define NETLIB_MAX_PACKET_COUNT 50
+#define NETLIB_UDP_RECEIVE_BATCH 64		// Datagrams read per wakeup of the async listener
+#define NETLIB_TIMER_TICK_NS 1000000		// Resolution of the event loop timers
+#define NETLIB_ZEROCOPY_THRESHOLD 10240		// Smaller datagrams are copied, zero-copy only pays off for large buffers
+#define NETLIB_MAX_DATAGRAM_BUFFERS 64		// Buffers a datagram may be gathered from or scattered into
+#define NETLIB_PRODUCER_SHARD_CACHE 8		// Clients per thread whose multi-producer shard is remembered
 
 namespace NetLib {
 
@@ -41,6 +52,22 @@ namespace NetLib {
 		T* data;
 	};
 
+	/// <summary>
+	/// One piece of a gathered write. The memory is not owned and must stay valid until the send call returns.
+	/// </summary>
+	struct ConstBuffer {
+		const void* data = nullptr;
+		size_t size = 0;
+	};
+
+	/// <summary>
+	/// One piece of a scattered read, the buffers are filled in order. The memory is not owned.
+	/// </summary>
+	struct MutableBuffer {
+		void* data = nullptr;
+		size_t size = 0;
+	};
+
 
 
 	// ==========================
@@ -72,6 +99,39 @@ namespace NetLib {
 
 
 
+	// ===================================
+	// ===      Traffic Class          ===
+	// ===================================
+	//
+	// Marking of outgoing datagrams for the network (DSCP, the upper six bits of the TOS byte) and for the
+	// local egress queues (SO_PRIORITY). Receivers can read the TOS byte of each datagram.
+	//
+
+	// Common DSCP values (RFC 4594)
+	enum Dscp : uint8_t {
+		DSCP_DEFAULT = 0,		// Best effort
+		DSCP_LE = 1,			// Lower effort (RFC 8622)
+		DSCP_CS1 = 8,			// Bulk data, scavenger
+		DSCP_AF11 = 10,
+		DSCP_AF21 = 18,			// Low-latency data
+		DSCP_AF31 = 26,
+		DSCP_AF41 = 34,			// Interactive video
+		DSCP_CS5 = 40,			// Signaling
+		DSCP_EF = 46,			// Real-time, e.g. voice
+		DSCP_CS6 = 48,			// Network control
+		DSCP_CS7 = 56
+	};
+
+	struct TrafficClass {
+		uint8_t dscp = DSCP_DEFAULT;		// 0-63
+		int priority = -1;					// SO_PRIORITY (0-6 without privileges), -1 = Unchanged. Linux only.
+	};
+
+
+
+
+
+
 	// ==================================
 	// ===      NetLib::SendUDP       ===
 	// ==================================
@@ -79,6 +139,10 @@ namespace NetLib {
 	// This function simply creates a UDP socket, sends the message and closes it again. The principle is
 	// the same as in the UDPClient class. The difference is that the UDPClient keeps the socket open while
 	// the object is alive. Use this function for sending a few packets sporadically.
+	// The string overloads also take hostnames, resolved by the default resolver (see Resolver.h). Only cached
+	// names are sent to, so the call never waits for DNS: A name that was never resolved fails the send and starts
+	// the lookup in the background. Warm the cache with GetDefaultResolver().ResolveAsync() before the first send.
+	// Once its TTL expired, a name is still sent to the previous address while the lookup refreshes it.
 	//
 	bool SendUDP(uint32_t ipAddress, uint16_t port, uint8_t* data, size_t length, bool broadcastPermissions = false);
 	bool SendUDP(uint32_t ipAddress, uint16_t port, const char* data, bool broadcastPermissions = false);
@@ -88,9 +152,111 @@ namespace NetLib {
 	bool SendUDP(const std::string& ipAddress, uint16_t port, const char* data, bool broadcastPermissions = false);
 	bool SendUDP(const std::string& ipAddress, uint16_t port, const std::string& data, bool broadcastPermissions = false);
 
+	bool SendUDP(IPv4Address ipAddress, uint16_t port, uint8_t* data, size_t length, bool broadcastPermissions = false);
+	bool SendUDP(IPv4Address ipAddress, uint16_t port, const char* data, bool broadcastPermissions = false);
+	bool SendUDP(IPv4Address ipAddress, uint16_t port, const std::string& data, bool broadcastPermissions = false);
+
+	bool SendUDP(const IPv6Address& ipAddress, uint16_t port, uint8_t* data, size_t length);
+	bool SendUDP(const IPv6Address& ipAddress, uint16_t port, const char* data);
+	bool SendUDP(const IPv6Address& ipAddress, uint16_t port, const std::string& data);
+
+	bool SendUDP(const std::string& ipAddress, uint16_t port, uint8_t* data, size_t length, const TrafficClass& trafficClass);
+	bool SendUDP(IPv4Address ipAddress, uint16_t port, uint8_t* data, size_t length, const TrafficClass& trafficClass);
+
+	/// <summary>
+	/// Sends the buffers as one datagram, e.g. a header and a separately owned payload, without concatenating
+	/// them first. At most NETLIB_MAX_DATAGRAM_BUFFERS buffers.
+	/// </summary>
+	bool SendUDP(const std::string& ipAddress, uint16_t port, const ConstBuffer* buffers, size_t count, bool broadcastPermissions = false);
+	bool SendUDP(IPv4Address ipAddress, uint16_t port, const ConstBuffer* buffers, size_t count, bool broadcastPermissions = false);
+	bool SendUDP(const IPv6Address& ipAddress, uint16_t port, const ConstBuffer* buffers, size_t count);
+
     
 
 
+	// =====================================
+	// ===      Shared Memory Options    ===
+	// =====================================
+	//
+	// Opt-in fast path for senders and receivers on the same host: A server advertises itself, a UDPClient
+	// sending to a loopback address connects and writes its datagrams into a shared-memory ring instead of the
+	// kernel UDP stack. Datagrams keep UDP semantics, a full ring drops them. Linux only.
+	// Only processes of the same user may attach by default (SO_PEERCRED). The source port of ring datagrams is
+	// reported by the sender itself, a PacketFilter port range therefore only keeps out well-behaved senders.
+	//
+
+	struct SharedMemoryOptions {
+		size_t ringSize = 4 * 1024 * 1024;									// Per local sender, at least 256 KiB
+		std::chrono::nanoseconds spin = std::chrono::microseconds(50);		// Busy polling before the listener
+																			// sleeps, trades CPU time for latency.
+																			// Not used on single-core machines.
+		bool allowOtherUsers = false;										// Accept senders running as another
+																			// user, not only the own uid
+	};
+
+
+
+
+
+
+	// =====================================
+	// ===      Receive Buffer Options   ===
+	// =====================================
+	//
+	// Datagrams larger than the buffer of a server are truncated by the kernel. The servers detect and count
+	// that. In the opt-in adaptive mode, the listener peeks the size of every pending datagram and receives the
+	// large ones into a buffer from a process-wide pool of size classes, which goes back to the pool after a
+	// quiet period. The configured buffer then only needs to fit the common datagrams.
+	//
+
+	struct AdaptiveBufferOptions {
+		size_t maxSize = 65536;												// Larger datagrams are still truncated
+		std::chrono::nanoseconds quietPeriod = std::chrono::seconds(10);	// Without large datagrams, after
+																			// which the grown buffer is returned
+	};
+
+	struct ReceiveBufferStatistics {
+		uint64_t truncated = 0;				// Datagrams that did not fit and were cut off
+		uint64_t grown = 0;					// Times the adaptive buffer was taken from the pool or enlarged
+		uint64_t shrunk = 0;				// Times it was returned to the pool after the quiet period
+		size_t adaptiveBufferSize = 0;		// Size of the current adaptive buffer, 0 = None
+	};
+
+
+
+
+
+
+	// ==================================
+	// ===      Worker Pool Options   ===
+	// ==================================
+	//
+	// Opt-in dispatch mode of UDPServerAsync: The listener thread only receives and copies every datagram into
+	// the queue of a worker, the workers run the callbacks. Datagrams of the same sender always go to the same
+	// worker, so they are handled in order. The queues take workers * queueSize * bufferSize bytes.
+	//
+
+	struct WorkerPoolOptions {
+		size_t workers = 0;									// 0 = One per hardware thread
+		size_t queueSize = 1024;							// Datagrams per worker, a full queue drops like a socket
+		std::chrono::nanoseconds callbackBudget{ 0 };		// Watchdog: Callbacks running longer are reported. 0 = Off
+
+		// Called on the listener thread while a callback is still running over its budget, once per callback.
+		// Logs a warning if empty.
+		std::function<void(std::chrono::nanoseconds elapsed, IPv4Address source, uint16_t sourcePort)> onOverrun;
+	};
+
+	struct WorkerPoolStatistics {
+		uint64_t dispatched = 0;			// Datagrams queued for the workers
+		uint64_t dropped = 0;				// Datagrams dropped because the queue of their worker was full
+		uint64_t overruns = 0;				// Callbacks that exceeded the budget, counted when they return
+	};
+
+
+
+
+
+
 	// ==================================
 	// ===      UDPClient Class       ===
 	// ==================================
@@ -98,18 +264,141 @@ namespace NetLib {
 	// This class creates a UDP socket and keeps it alive for the lifetime of the object. 
 	// Use this class for streaming a lot of packets to the same IP and port.
 	
+	enum PacingMode {
+		PACING_USERSPACE,	// send() waits until the token bucket allows the packet to leave
+		PACING_KERNEL		// send() returns immediately, the departure time is attached with SO_TXTIME.
+							// Requires the fq qdisc on the egress interface (as root, or on every queue of mq).
+							// Other qdiscs accept SO_TXTIME but ignore the departure times, so SetPacing()
+							// checks the qdisc and falls back to PACING_USERSPACE without fq.
+	};
+
+	struct PacingOptions {
+		uint64_t bytesPerSecond = 0;		// 0 = No byte limit
+		uint64_t packetsPerSecond = 0;		// 0 = No packet limit
+		size_t burstPackets = 1;			// Packets that may leave back-to-back
+		size_t burstBytes = 0;				// Bytes that may leave back-to-back, 0 = 'burstPackets' full-sized packets
+		PacingMode mode = PACING_USERSPACE;
+	};
+
+	struct PacingStatistics {
+		uint64_t packets = 0;				// Packets sent while pacing was enabled
+		uint64_t delayedPackets = 0;		// Packets that had to wait for tokens
+		uint64_t totalDelayNs = 0;			// Sum of the scheduled waiting times
+		uint64_t totalLagNs = 0;			// Sum of (actual - scheduled) departure times, user space pacing only
+		uint64_t maxLagNs = 0;				// Worst (actual - scheduled) departure time, user space pacing only
+		bool kernelPacing = false;			// Whether the kernel paces this socket
+	};
+
+	struct ZeroCopyStatistics {
+		uint64_t zeroCopySends = 0;			// Datagrams handed to the kernel without copying
+		uint64_t copiedSends = 0;			// Datagrams below the threshold, or sent while zero-copy was not possible
+		uint64_t kernelCopies = 0;			// Zero-copy datagrams the kernel copied anyway, e.g. on loopback
+		uint64_t pending = 0;				// Buffers not released yet
+	};
+
+	struct MultiProducerOptions {
+		size_t shards = 0;					// Sockets to the destination, 0 = One per hardware thread
+		bool perCpu = false;				// Use the shard of the CPU the sender runs on instead of one per thread. Linux only.
+		bool shareSourcePort = true;		// All shards send from the same local port (SO_REUSEPORT), so receivers
+											// see one sender. Linux only, and only before the first datagram was sent.
+	};
+
+	struct MultiProducerStatistics {
+		size_t shards = 0;
+		uint64_t datagrams = 0;				// Sent through the shards, summed up
+		uint64_t bytes = 0;
+		uint64_t errors = 0;				// Sends that threw
+		uint64_t busiestShard = 0;			// Datagrams of the busiest shard, shows an uneven spread of the threads
+	};
+
     struct UDPClientMembers;
 
 	class UDPClient {
 	public:
+		/// <summary>
+		/// 'ipAddress' may also be a hostname, it is resolved once through the default resolver. Unless the name
+		/// is cached, the constructor blocks for the lookup, up to the resolver timeout. Throws std::runtime_error
+		/// if that fails.
+		/// </summary>
 		UDPClient(const std::string& ipAddress, uint16_t port, bool broadcastPermission = false);
+		UDPClient(IPv4Address ipAddress, uint16_t port, bool broadcastPermission = false);
+		UDPClient(const IPv6Address& ipAddress, uint16_t port);
 		~UDPClient();
 
 		size_t send(uint8_t* data, size_t length);
 		size_t send(const char* data);
 		size_t send(const std::string& data);
 
+		/// <summary>
+		/// Sends all buffers as a single datagram, gathered by the kernel (sendmsg) instead of being concatenated
+		/// in user space. Takes the same paths as send(data, length), including pacing and the shared memory.
+		/// Throws std::runtime_error for more than NETLIB_MAX_DATAGRAM_BUFFERS buffers.
+		/// </summary>
+		size_t send(const ConstBuffer* buffers, size_t count);
+		size_t send(std::initializer_list<ConstBuffer> buffers);
+
+		/// <summary>
+		/// Sends one datagram with its own DSCP, the class of the socket stays as it is. Linux only, on other
+		/// platforms the class of the socket applies.
+		/// </summary>
+		size_t send(uint8_t* data, size_t length, uint8_t dscp);
+
+		/// <summary>
+		/// Marks every following datagram of this client. Returns false if the system refused a value, e.g. a
+		/// priority above 6 without CAP_NET_ADMIN.
+		/// </summary>
+		bool SetTrafficClass(const TrafficClass& trafficClass);
+
+		/// <summary>
+		/// Send large datagrams without copying them into the kernel (MSG_ZEROCOPY). Only the send() overload
+		/// with onRelease uses it, and only for datagrams of at least 'threshold' bytes. If the kernel reports
+		/// that it had to copy anyway, later datagrams are copied right away. Returns false if the platform does
+		/// not support it. Linux only.
+		/// </summary>
+		bool EnableZeroCopy(size_t threshold = NETLIB_ZEROCOPY_THRESHOLD);
+
+		/// <summary>
+		/// 'data' must stay unchanged until onRelease is called. That happens on the I/O thread of this client once
+		/// the kernel is done with the memory, or right away on the calling thread if the datagram was copied.
+		/// Buffers still in flight are released when the client is destroyed.
+		/// </summary>
+		size_t send(uint8_t* data, size_t length, std::function<void()> onRelease);
+		ZeroCopyStatistics GetZeroCopyStatistics();
+
+		/// <summary>
+		/// Limit the send rate so the receiver is not flooded by bursts. Both limits apply if both are set.
+		/// Passing a default-constructed PacingOptions disables pacing again. May be called while other threads
+		/// send, they switch to the new limits with their next datagram.
+		/// </summary>
+		void SetPacing(const PacingOptions& options);
+		PacingStatistics GetPacingStatistics();
+
+		/// <summary>
+		/// Run the callback once after 'delay' on the I/O thread of this client, which is started with the first
+		/// timer. Can be called from any thread, also from timer callbacks.
+		/// </summary>
+		TimerId ScheduleTimer(std::chrono::nanoseconds delay, std::function<void()> callback);
+		bool CancelTimer(TimerId id);
+
+		/// <summary>
+		/// Sends through the shared-memory ring of a local server with EnableSharedMemory(), if the destination
+		/// is a loopback address. Returns false if no such server is listening. Falls back to UDP when the server
+		/// goes away, and while pacing is enabled. A restarted server is attached again, checked once a second.
+		/// </summary>
+		bool EnableSharedMemory();
+
+		/// <summary>
+		/// For many threads sending through this client at once: Every producer thread gets a socket of its own
+		/// (or the one of its CPU), so the threads don't contend on one socket.
+		/// Applies to send() without DSCP while neither pacing nor the shared memory is active, the other paths
+		/// keep using the main socket. Call it before the producer threads start sending. Returns false if the
+		/// shard sockets could not be created.
+		/// </summary>
+		bool EnableMultiProducer(const MultiProducerOptions& options = MultiProducerOptions());
+		MultiProducerStatistics GetMultiProducerStatistics();
+
     private:
+        void Initialize(bool broadcastPermission);
         void logPacket(uint8_t* data, size_t length, const std::string& ipAddress, uint16_t port);
 
         IncompleteTypeWrapper<UDPClientMembers> members;
@@ -120,11 +409,73 @@ namespace NetLib {
 
 
 
+	// =======================================
+	// ===      BroadcastSender Class      ===
+	// =======================================
+	//
+	// Keeps one socket per IPv4 interface, bound to its address (and to the device on Linux), so discovery does
+	// not open a socket per interface and datagram like SendUDP() with broadcastPermissions. The sockets follow
+	// the interface cache (see NetworkInterfaces.h): Sockets of removed interfaces are closed and new interfaces
+	// get one with the next send. Thread-safe.
+	//
+	//     NetLib::BroadcastSender sender;
+	//     sender.Send(data, length, 5000);                      // To the broadcast address of every interface
+	//     sender.SendTo(IPv4Address(10, 0, 0, 7), 5000, data, length);   // From the interface of 10.0.0.0/x
+	//
+
+	struct BroadcastSenderMembers;
+
+	class BroadcastSender {
+	public:
+		BroadcastSender(bool includeLoopback = false);
+		~BroadcastSender();
+
+		/// <summary>
+		/// Sends the datagram to the broadcast address of every interface. Returns the number of interfaces it
+		/// was sent on, failures are logged.
+		/// </summary>
+		size_t Send(uint8_t* data, size_t length, uint16_t port);
+
+		/// <summary>
+		/// Like Send(), but only on the interfaces with one of the given names or addresses, e.g. "eth0" or "10.0.0.2".
+		/// </summary>
+		size_t Send(uint8_t* data, size_t length, uint16_t port, const std::vector<std::string>& interfaces);
+
+		/// <summary>
+		/// Unicast from the interface whose subnet contains the destination, the longest prefix wins. Destinations
+		/// outside of all subnets are sent from an unbound socket, routed by the system. Returns false on failure.
+		/// </summary>
+		bool SendTo(IPv4Address destination, uint16_t port, uint8_t* data, size_t length);
+
+		/// <summary>
+		/// The interface SendTo() would use, nullopt if the destination is routed by the system.
+		/// </summary>
+		std::optional<Interface> SelectInterface(IPv4Address destination);
+
+		/// <summary>
+		/// The interfaces that currently have a socket.
+		/// </summary>
+		std::vector<Interface> GetInterfaces();
+
+	private:
+		IncompleteTypeWrapper<BroadcastSenderMembers> members;
+	};
+
+
+
+
+
+
 	// =======================================
 	// ===      UDPServerAsync Class       ===
 	// =======================================
+	//
+	// Receives on a background thread and calls the callback for every datagram. This is a BasicUDPServer
+	// (see BasicUDPServer.h) behind a stable interface, use the template directly if the callback should be inlined.
+	//
 
 	struct UDPServerAsyncMembers;
+	class TrafficRecorder;
 
 	class UDPServerAsync {
 	public:
@@ -140,17 +491,81 @@ namespace NetLib {
 			size_t bufferSize = NETLIB_DEFAULT_UDP_BUFFER_SIZE
 		);
 
+		/// <summary>
+		/// The sender as binary address, e.g. as key of a PeerTable (see PeerTable.h). Nothing is formatted.
+		/// </summary>
+		UDPServerAsync(
+			std::function<void(uint8_t* packet, size_t packetSize, IPv4Address source, uint16_t sourcePort)> callback,
+			uint16_t port,
+			size_t bufferSize = NETLIB_DEFAULT_UDP_BUFFER_SIZE
+		);
+
 		~UDPServerAsync();
 
 		std::string GetLocalIP();
+		uint16_t GetLocalPort();
+
+		/// <summary>
+		/// Sends a datagram from the port of the server, e.g. a reply to the source passed to the callback.
+		/// Can be called from any thread, also from the callback. Returns false on errors.
+		/// </summary>
+		bool SendTo(IPv4Address destination, uint16_t port, const uint8_t* data, size_t length);
+
+		/// <summary>
+		/// Attach a kernel-side filter to the socket, replacing the previous one. Can be called at any time
+		/// without reopening the socket. Returns false if the platform does not support socket filters.
+		/// </summary>
+		bool SetFilter(const PacketFilter& filter);
+		void ClearFilter();
+
+		/// <summary>
+		/// Every received datagram is appended to the recorder before the callback is called (see TrafficLog.h).
+		/// </summary>
+		void StartRecording(std::shared_ptr<TrafficRecorder> recorder);
+		void StopRecording();
+
+		/// <summary>
+		/// Run the callback once after 'delay' on the listener thread, between two receive callbacks. Timers
+		/// scheduled from the receive callback need no locking. Can be called from any thread.
+		/// </summary>
+		TimerId ScheduleTimer(std::chrono::nanoseconds delay, std::function<void()> callback);
+		bool CancelTimer(TimerId id);
+
+		/// <summary>
+		/// Advertise a shared-memory ring to UDPClients on the same host (see SharedMemoryOptions). Their
+		/// datagrams arrive through the same callback, with 127.0.0.1 and the local port of the client as source.
+		/// The filter of SetFilter() is applied to them in software. Returns false if the platform does not support it.
+		/// </summary>
+		bool EnableSharedMemory(const SharedMemoryOptions& options = SharedMemoryOptions());
+
+		/// <summary>
+		/// Read the TOS byte of every datagram (IP_RECVTOS). Returns false if the platform does not support it.
+		/// </summary>
+		bool EnableTrafficClass();
+
+		/// <summary>
+		/// Only valid inside the callback: The TOS byte of the current datagram, the DSCP is (tos >> 2).
+		/// 0 without EnableTrafficClass().
+		/// </summary>
+		uint8_t ReceivedTos();
+
+		/// <summary>
+		/// Run the callbacks on a pool of worker threads instead of the listener thread (see WorkerPoolOptions),
+		/// so a slow callback no longer stops the socket from being drained. Callbacks of different senders then
+		/// run concurrently. Can only be enabled once, returns false after that.
+		/// </summary>
+		bool EnableWorkerPool(const WorkerPoolOptions& options = WorkerPoolOptions());
+		WorkerPoolStatistics GetWorkerPoolStatistics();
+
+		/// <summary>
+		/// Receive datagrams larger than 'bufferSize' into a buffer that grows on demand (see AdaptiveBufferOptions).
+		/// Costs one more system call per datagram. The worker pool still drops datagrams larger than 'bufferSize'.
+		/// </summary>
+		bool EnableAdaptiveBuffer(const AdaptiveBufferOptions& options = AdaptiveBufferOptions());
+		ReceiveBufferStatistics GetReceiveBufferStatistics();
 
 	private:
 		void Initialize(uint16_t port, size_t bufferSize);
-		void OnReceive(const std::error_code& error, size_t bytes);
-		void StartAsyncListener();
-		void ListenerThread();
-
-		void logPacket(uint8_t* data, size_t length, const std::string& ipAddress, uint16_t port);
 
 		IncompleteTypeWrapper<UDPServerAsyncMembers> members;
 
@@ -169,6 +584,7 @@ namespace NetLib {
 		std::vector<uint8_t> data;
 		std::string remoteIP;
 		uint16_t remotePort = 0;
+		uint8_t tos = 0;			// TOS byte, the DSCP is (tos >> 2). Only set with priority queues.
 	};
 
 	class UDPServer {
@@ -177,14 +593,46 @@ namespace NetLib {
 		~UDPServer();
 
 		std::optional<Packet> ReceivePacket();
+
+		/// <summary>
+		/// Moves the oldest packet into 'packet' and keeps the previous buffers of 'packet' for later packets.
+		/// A receive loop that reuses one Packet object does not allocate. Returns false if no packet is waiting.
+		/// </summary>
+		bool ReceivePacket(Packet& packet);
+
 		std::string GetLocalIP();
 
+		bool SetFilter(const PacketFilter& filter);
+		void ClearFilter();
+		bool EnableSharedMemory(const SharedMemoryOptions& options = SharedMemoryOptions());
+
+		/// <summary>
+		/// Sorts the packets by their DSCP into 'classes' queues of NETLIB_MAX_PACKET_COUNT packets each.
+		/// ReceivePacket() drains queue 0 first, so bulk traffic can neither delay nor displace control packets.
+		/// 'classOf' maps a DSCP (0-63) to a queue. The default puts CS5 and above (signaling, voice, network
+		/// control) into queue 0, CS1 and LE (bulk) into the last queue and everything else in between.
+		/// Returns false if the TOS byte can't be read on this platform.
+		/// </summary>
+		bool EnablePriorityQueues(size_t classes = 3, std::function<size_t(uint8_t dscp)> classOf = nullptr);
+
+		bool EnableAdaptiveBuffer(const AdaptiveBufferOptions& options = AdaptiveBufferOptions());
+		ReceiveBufferStatistics GetReceiveBufferStatistics();
+
 	private:
 		void OnReceive(uint8_t* packet, size_t packetSize, const std::string& remoteIP, uint16_t remotePort);
 
-		UDPServerAsync server;
+		struct PacketQueue {
+			std::vector<Packet> packets = std::vector<Packet>(NETLIB_MAX_PACKET_COUNT);	// Ring buffer
+			size_t head = 0;
+			size_t count = 0;
+		};
+
+		// Declared before the server, the listener thread may deliver packets as soon as it is constructed
 		std::mutex bufferMutex;
-		std::queue<Packet> packetBuffer;
+		std::vector<PacketQueue> queues = std::vector<PacketQueue>(1);		// Drained in order
+		std::array<uint8_t, 64> queueOfDscp = {};
+
+		UDPServerAsync server;
 
 	};
 
@@ -206,123 +654,33 @@ namespace NetLib {
 
 		std::optional<std::vector<uint8_t>> ReceivePacket();
 
-	private:
-		void logPacket(uint8_t* data, size_t length, const std::string& ipAddress, uint16_t port);
-
-		IncompleteTypeWrapper<UDPServerBlockingMembers> members;
-
-	};
-
-
-}
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
+		/// <summary>
+		/// Blocks until a packet arrives. The buffers of 'packet' are reused, so this does not allocate once
+		/// they are large enough.
+		/// </summary>
+		bool ReceivePacket(Packet& packet);
 
+		/// <summary>
+		/// Blocks until a datagram arrives and scatters it over the buffers in order, e.g. a fixed-size header
+		/// and the payload, without the copy out of the buffer of the server. 'bytes' is the received length,
+		/// a datagram longer than all buffers together is truncated.
+		/// </summary>
+		bool ReceivePacket(const MutableBuffer* buffers, size_t count, size_t& bytes, IPv4Address& source, uint16_t& sourcePort);
 
+		bool SetFilter(const PacketFilter& filter);
+		void ClearFilter();
 
+		/// <summary>
+		/// Only 'truncated' is counted, the buffer of the blocking server has a fixed size.
+		/// </summary>
+		ReceiveBufferStatistics GetReceiveBufferStatistics();
 
+	private:
+		void logPacket(uint8_t* data, size_t length, const std::string& ipAddress, uint16_t port);
 
+		IncompleteTypeWrapper<UDPServerBlockingMembers> members;
 
-
-
-
-
-
-
-/*
-
-#pragma once
-
-#include "Battery/pch.h"
-#include "Battery/Core/Config.h"
-#include "Battery/Utils/TypeUtils.h"
-
-struct ALLEGRO_FILE;
-
-namespace Battery {
-
-
-
-
-
-	
-
-
-
-
-
-
-
-
-
-
-	// =================================================
-	// ===      File download / HTTP Utilities       ===
-	// =================================================
-
-	struct HttpResponse {
-		std::string body;
-		size_t status;
-		std::string reason;
-
-		HttpResponse(const std::string& body, size_t status, std::string reason) :
-			body(body), status(status), reason(reason) {}
 	};
 
-	/// <summary>
-	/// Splits an url into server hostname and server path. E.g: "https://www.google.at/my/page.html"
-	///  -> "https://www.google.at" and "/my/page.html"
-	/// </summary>
-	std::pair<std::string, std::string> SplitUrl(const std::string& url);
 
-	/// <summary>
-	/// Do a HTTP GET request, redirects are automatically followed by default. Return value
-	/// is empty when the server can't be reached, otherwise the body and HTTP code can be retrieved.
-	/// </summary>
-	std::optional<HttpResponse> GetHttpRequest(const std::string& url, bool followRedirect = true);
-
-	/// <summary>
-	/// Advanced HTTP GET request, use this only if you know what you're doing.
-	/// </summary>
-	std::optional<HttpResponse> GetHttpRequestChunked(
-		const std::string& url,
-		std::function<void()> onClearDataCallback,
-		std::function<bool(const char*, size_t)> onReceiveCallback,
-		std::optional<std::function<bool(uint64_t, uint64_t)>> onProgressCallback = std::nullopt,
-		bool followRedirect = true);
-
-	/// <summary>
-	/// Download an online resource and return the buffer.
-	/// OnProgress callback is optional and just for monitoring progress. Return false
-	/// to cancel the download.
-	/// </summary>
-	std::string DownloadUrlToBuffer(
-		const std::string& url, std::optional<std::function<bool(uint64_t, uint64_t)>> onProgressCallback = std::nullopt,
-		bool followRedirect = true);
-
-	/// <summary>
-	/// Download an online resource and write it to disk under the given filename.
-	/// OnProgress callback is optional and just for monitoring progress. Return false
-	/// to cancel the download.
-	/// </summary>
-	bool DownloadUrlToFile(
-		const std::string& url, const std::string& targetFile, bool binary = false,
-		std::optional<std::function<bool(uint64_t, uint64_t)>> onProgressCallback = std::nullopt,
-		bool followRedirect = true);
-}*/
\ No newline at end of file
+}
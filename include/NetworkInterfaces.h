@@ -2,6 +2,10 @@
 
 #include <string>
 #include <vector>
+#include <memory>
+#include <functional>
+
+#include "IPAddress.h"
 
 namespace NetLib {
 
@@ -15,19 +19,57 @@ namespace NetLib {
     };
 
     struct Interface {
-        size_t index;           // Windows only
-        std::string address;
-        std::string name;       // Non-windows only
-        std::string subnet;     // Windows only
-        std::string broadcast;  // Windows only
-        size_t reassemblySize;  // Windows only
-        InterfaceState state;   // Windows only
+        size_t index = 0;           // Windows only
+        IPv4Address address;
+        std::string name;           // Non-windows only
+        IPv4Address subnet;         // Netmask, e.g. 255.255.255.0
+        IPv4Address broadcast;
+        size_t reassemblySize = 0;  // Windows only
+        InterfaceState state = NONE;    // Windows only
     };
 
 	std::vector<Interface> GetNetworkInterfaces();
 
-    std::string CreateBroadcastAddress(const Interface& ifc);
+    // ==================================
+    // ===      Interface cache       ===
+    // ==================================
+    //
+    // Process-wide table of the network interfaces. It is only rebuilt when the operating system reports
+    // an address or link change (netlink on Linux, NotifyAddrChange on Windows), on other platforms only
+    // through RefreshNetworkInterfaces(). Reading it does not make a syscall.
+    //
+
+    using InterfaceSnapshot = std::shared_ptr<const std::vector<Interface>>;
+    using InterfaceChangeCallback = std::function<void(const InterfaceSnapshot& interfaces)>;
+
+    /// <summary>
+    /// Returns the current interface table. The snapshot is immutable and stays valid while it is held,
+    /// even if the table is replaced in the meantime.
+    /// </summary>
+    InterfaceSnapshot GetCachedNetworkInterfaces();
+
+    /// <summary>
+    /// Rebuild the table immediately. Subscribers are only notified if something changed.
+    /// </summary>
+    void RefreshNetworkInterfaces();
+
+    /// <summary>
+    /// The callback is invoked on the monitor thread whenever the table changed. Keep it short and do not
+    /// (un)subscribe from within it. Returns an id for UnsubscribeInterfaceChanges().
+    /// </summary>
+    size_t SubscribeInterfaceChanges(InterfaceChangeCallback callback);
+    void UnsubscribeInterfaceChanges(size_t subscription);
+
+    IPv4Address CreateBroadcastAddress(const Interface& ifc);
+
+    /// <summary>
+    /// The subnet of the interface, e.g. 192.168.0.0/24 for 192.168.0.12 with netmask 255.255.255.0
+    /// </summary>
+    Cidr GetInterfaceSubnet(const Interface& ifc);
 
+    /// <summary>
+    /// Returns the address in network byte order like inet_addr() did, INADDR_NONE (0xFFFFFFFF) if it is invalid.
+    /// </summary>
     uint32_t ipToBytes(const std::string& ip);
 
 }
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <vector>
+#include <utility>
+
+#include "IPAddress.h"
+
+namespace NetLib {
+
+	// ===================================
+	// ===      PacketFilter Struct    ===
+	// ===================================
+	//
+	// Describes which datagrams a server socket accepts. The filter is compiled to a classic BPF program and
+	// attached to the socket (SO_ATTACH_FILTER, Linux only), so rejected datagrams are dropped in the kernel
+	// and never wake up the listener. A datagram must pass every configured criterion.
+	//
+	struct PacketFilter {
+		std::vector<Cidr> allowedSources;							// Empty: Any source address
+		std::vector<std::pair<uint16_t, uint16_t>> allowedSourcePorts;	// Inclusive ranges, empty: Any source port
+		size_t minLength = 0;										// Minimum payload length in bytes
+		size_t maxLength = 0;										// Maximum payload length in bytes, 0: No limit
+		std::vector<uint8_t> magic;									// The payload must start with these bytes
+	};
+
+}
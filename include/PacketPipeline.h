@@ -0,0 +1,226 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <stdexcept>
+
+#include "NetLib.h"
+
+#define NETLIB_PIPELINE_MAX_BATCH 256		// Datagrams per batch, the arrays of a PacketBatch have this size
+
+namespace NetLib {
+
+	// ===================================
+	// ===      PacketBatch Class      ===
+	// ===================================
+	//
+	// The datagrams one stage of a PacketPipeline works on. The fields are kept as separate contiguous arrays,
+	// so a stage can loop over one field of all datagrams, e.g. compare all sources with SIMD. The datagrams
+	// themselves stay in the receive buffers, moving them between stages only moves the pointers.
+	//
+
+	struct PacketPipelineMembers;
+
+	class PacketBatch {
+	public:
+		static constexpr uint16_t DROP = 0xFFFF;
+
+		size_t Size() const { return count; }
+
+		uint8_t* Data(size_t i) { return packets[i]; }
+		size_t Length(size_t i) const { return lengths[i]; }
+		IPv4Address Source(size_t i) const { return sources[i]; }
+		uint16_t SourcePort(size_t i) const { return sourcePorts[i]; }
+
+		/// <summary>
+		/// Free for the stages, e.g. the result of a classification for the following ones. 0 on receive.
+		/// </summary>
+		uint32_t& Tag(size_t i) { return tags[i]; }
+
+		uint8_t* const* Packets() const { return packets.data(); }
+		const uint32_t* Lengths() const { return lengths.data(); }
+		const IPv4Address* Sources() const { return sources.data(); }
+		const uint16_t* SourcePorts() const { return sourcePorts.data(); }
+		uint32_t* Tags() { return tags.data(); }
+
+		/// <summary>
+		/// Skips 'bytes' at the start of the datagram for the following stages, e.g. a parsed header.
+		/// </summary>
+		void Advance(size_t i, size_t bytes) {
+			bytes = std::min<size_t>(bytes, lengths[i]);
+			packets[i] += bytes;
+			lengths[i] -= (uint32_t)bytes;
+		}
+
+		/// <summary>
+		/// The datagram leaves the pipeline after this stage.
+		/// </summary>
+		void Drop(size_t i) { targets[i] = DROP; }
+
+		/// <summary>
+		/// The datagram skips to 'stage' instead of the next one. Only later stages can be targets, so every
+		/// datagram passes each stage at most once. Otherwise the datagram is dropped and counted as an invalid redirect.
+		/// </summary>
+		void Redirect(size_t i, size_t stage) {
+			if (stage <= current || stage >= stages) {
+				targets[i] = DROP;
+				invalidRedirects++;
+				return;
+			}
+			targets[i] = (uint16_t)stage;
+		}
+
+		/// <summary>
+		/// The stage this batch is processed by.
+		/// </summary>
+		size_t Stage() const { return current; }
+
+	private:
+		friend class PacketPipeline;
+		friend struct PacketPipelineMembers;
+
+		void Append(uint8_t* packet, uint32_t length, IPv4Address source, uint16_t sourcePort, uint32_t tag) {
+			if (count >= NETLIB_PIPELINE_MAX_BATCH)
+				throw std::runtime_error("PacketPipeline: Batch of stage " + std::to_string(current) + " overflowed");
+			packets[count] = packet;
+			lengths[count] = length;
+			sources[count] = source;
+			sourcePorts[count] = sourcePort;
+			tags[count] = tag;
+			count++;
+		}
+
+		std::array<uint8_t*, NETLIB_PIPELINE_MAX_BATCH> packets;
+		std::array<uint32_t, NETLIB_PIPELINE_MAX_BATCH> lengths;
+		std::array<IPv4Address, NETLIB_PIPELINE_MAX_BATCH> sources;
+		std::array<uint16_t, NETLIB_PIPELINE_MAX_BATCH> sourcePorts;
+		std::array<uint32_t, NETLIB_PIPELINE_MAX_BATCH> tags;
+		std::array<uint16_t, NETLIB_PIPELINE_MAX_BATCH> targets;
+		size_t count = 0;
+		size_t invalidRedirects = 0;
+		uint16_t current = 0;
+		uint16_t stages = 0;
+	};
+
+
+
+
+
+	// ======================================
+	// ===      PacketPipeline Class      ===
+	// ======================================
+	//
+	// Runs datagrams through a chain of stages a batch at a time instead of calling a callback per datagram.
+	// Each stage sees all datagrams of the batch that reached it before the next stage runs, so its code and
+	// data stay in the caches, and per-call costs are paid once per batch.
+	//
+	//     NetLib::PacketPipeline pipeline;
+	//     pipeline.AddStage("parse", [](NetLib::PacketBatch& batch) { for (size_t i = 0; i < batch.Size(); i++) ... batch.Drop(i); });
+	//     size_t control = pipeline.AddStage("route", ...);     // batch.Redirect(i, control) skips the stages in between
+	//     pipeline.AddStage("consume", ...);
+	//     NetLib::UDPPipelineServer server(pipeline, 5000);
+	//
+	// Datagrams that pass the last stage leave the pipeline, like dropped ones.
+	//
+
+	struct PipelineOptions {
+		size_t batchSize = NETLIB_UDP_RECEIVE_BATCH;		// Datagrams per batch, at most NETLIB_PIPELINE_MAX_BATCH
+		size_t bufferSize = 2048;							// Per datagram, longer ones are truncated
+	};
+
+	struct PipelineStageStatistics {
+		std::string name;
+		uint64_t batches = 0;
+		uint64_t packets = 0;				// Datagrams that reached the stage
+		uint64_t dropped = 0;				// Including the invalid redirects
+		uint64_t redirected = 0;
+		uint64_t invalidRedirects = 0;		// Redirect() to an earlier or a missing stage
+	};
+
+	class PacketPipeline {
+	public:
+		/// <summary>
+		/// Only Push() uses the options, it copies the datagrams into a batch of its own.
+		/// </summary>
+		PacketPipeline(const PipelineOptions& options = PipelineOptions());
+		~PacketPipeline();
+
+		/// <summary>
+		/// Appends a stage and returns its index, the target of PacketBatch::Redirect(). Add all stages before
+		/// the first datagram is processed.
+		/// </summary>
+		size_t AddStage(const std::string& name, std::function<void(PacketBatch& batch)> stage);
+
+		/// <summary>
+		/// Runs 'count' datagrams through the stages right away, in batches of at most NETLIB_PIPELINE_MAX_BATCH.
+		/// The datagrams are not copied, the stages may modify them. Not thread-safe, like Push() and Flush().
+		/// </summary>
+		void Process(uint8_t* const* packets, const size_t* lengths, const IPv4Address* sources, const uint16_t* sourcePorts, size_t count);
+
+		/// <summary>
+		/// Copies the datagram into the pending batch, which is processed once it is full. Feeds the pipeline
+		/// from sources that hand out one datagram at a time, e.g. the callback of a UDPServerAsync.
+		/// </summary>
+		void Push(const uint8_t* packet, size_t length, IPv4Address source, uint16_t sourcePort);
+
+		/// <summary>
+		/// Processes the datagrams of the pending batch, e.g. at the end of a burst.
+		/// </summary>
+		void Flush();
+
+		std::vector<PipelineStageStatistics> GetStatistics();
+
+		PacketPipeline(const PacketPipeline&) = delete;
+		PacketPipeline& operator=(const PacketPipeline&) = delete;
+
+	private:
+		IncompleteTypeWrapper<PacketPipelineMembers> members;
+	};
+
+
+
+
+
+	// =========================================
+	// ===      UDPPipelineServer Class      ===
+	// =========================================
+	//
+	// Receives on its own thread like UDPServerAsync, but reads a whole batch per wakeup (recvmmsg on Linux)
+	// and runs it through a PacketPipeline.
+	//
+
+	struct UDPPipelineServerMembers;
+
+	class UDPPipelineServer {
+	public:
+		/// <summary>
+		/// The pipeline must outlive the server and be used by no one else, the stages run on the listener thread.
+		/// </summary>
+		UDPPipelineServer(PacketPipeline& pipeline, uint16_t port, const PipelineOptions& options = PipelineOptions());
+		~UDPPipelineServer();
+
+		uint16_t GetLocalPort();
+
+		/// <summary>
+		/// Sends from the port of the server, e.g. replies from a stage. Any thread.
+		/// </summary>
+		bool SendTo(IPv4Address destination, uint16_t port, const uint8_t* data, size_t length);
+
+		bool SetFilter(const PacketFilter& filter);
+		void ClearFilter();
+		bool EnableSharedMemory(const SharedMemoryOptions& options = SharedMemoryOptions());
+
+		/// <summary>
+		/// The callback runs on the listener thread, between two batches.
+		/// </summary>
+		TimerId ScheduleTimer(std::chrono::nanoseconds delay, std::function<void()> callback);
+		bool CancelTimer(TimerId id);
+
+		UDPPipelineServer(const UDPPipelineServer&) = delete;
+		UDPPipelineServer& operator=(const UDPPipelineServer&) = delete;
+
+	private:
+		IncompleteTypeWrapper<UDPPipelineServerMembers> members;
+	};
+
+}
@@ -0,0 +1,396 @@
+#pragma once
+
+#include <cinttypes>    // uint64_t, ...
+#include <vector>       // std::vector
+#include <functional>   // std::function
+#include <chrono>       // std::chrono::nanoseconds
+#include <atomic>       // std::atomic
+#include <random>       // std::random_device
+#include <algorithm>    // std::min, std::max
+#include <memory>       // std::shared_ptr
+#include <mutex>        // std::recursive_mutex
+
+#include "IPAddress.h"
+#include "TokenBucket.h"
+#include "TimingWheel.h"
+
+namespace NetLib {
+
+	// ================================
+	// ===      PeerTable Class     ===
+	// ================================
+	//
+	// Per-sender state for servers, keyed by the binary endpoint instead of the formatted remote host.
+	// The hash table uses open addressing with linear probing over 16-byte slots, the peers live in a separate
+	// array whose memory is reserved once for 'maxPeers', so the table never rehashes and pointers to the
+	// state stay valid until the peer is removed. Each peer gets a token bucket for admission control and
+	// idle peers are evicted in least-recently-seen order, e.g. from a timer of the server.
+	// Not thread-safe: Use it from the listener thread, where the receive callback and the timers run.
+	//
+	//     NetLib::PeerTable<Session> peers(options);       // Declared before the server, which stops first
+	//     NetLib::UDPServerAsync server([&](uint8_t* packet, size_t size, NetLib::IPv4Address source, uint16_t port) {
+	//         if (Session* session = peers.Admit(source, port, peers.Now())) { ... }
+	//     }, 5000);
+	//     peers.StartEviction(server);
+	//
+
+	struct PeerKey {
+		IPv4Address address;
+		uint16_t port = 0;
+
+		bool operator==(const PeerKey& other) const { return address == other.address && port == other.port; }
+		bool operator!=(const PeerKey& other) const { return !(*this == other); }
+	};
+
+	struct PeerTableOptions {
+		size_t maxPeers = 65536;				// Memory for this many peers is reserved up front
+		double ratePerSecond = 0;				// Tokens per second and peer, one per packet by default. 0 = No limit
+		double burst = 0;						// Bucket capacity, 0 = One second worth of tokens
+		std::chrono::nanoseconds idleTimeout = std::chrono::seconds(60);	// 0 = Peers are never evicted
+	};
+
+	struct PeerTableStatistics {
+		uint64_t admitted = 0;					// Packets that passed Admit()
+		uint64_t rateLimited = 0;				// Packets dropped by the token bucket of their peer
+		uint64_t rejected = 0;					// Packets of new peers dropped because the table was full
+		uint64_t evicted = 0;					// Peers removed for being idle
+	};
+
+	template<typename State>
+	class PeerTable {
+	public:
+		explicit PeerTable(const PeerTableOptions& options = PeerTableOptions()) : options(options) {
+			if (this->options.burst <= 0) {
+				this->options.burst = this->options.ratePerSecond > 1 ? this->options.ratePerSecond : 1;
+			}
+			this->options.maxPeers = std::min<size_t>(std::max<size_t>(this->options.maxPeers, 1), NONE - 1);
+
+			// Load factor of at most 0.5 keeps the probe sequences short
+			size_t capacity = 16;
+			while (capacity < this->options.maxPeers * 2) {
+				capacity *= 2;
+			}
+			slots.resize(capacity);
+			mask = capacity - 1;
+			entries.reserve(this->options.maxPeers);
+
+			// Random seed, so remote senders can't choose endpoints that collide
+			std::random_device random;
+			seed = ((uint64_t)random() << 32) | random();
+		}
+
+		// The scheduler may be gone already, so the timer is not cancelled. If it still fires, it finds the
+		// eviction stopped and doesn't touch the table.
+		~PeerTable() {
+			if (eviction) {
+				std::lock_guard<std::recursive_mutex> lock(eviction->mutex);
+				eviction->active = false;
+			}
+		}
+
+		PeerTable(const PeerTable&) = delete;
+		PeerTable& operator=(const PeerTable&) = delete;
+
+		/// <summary>
+		/// The clock Admit() and EvictIdle() expect, the same one the timers of the servers use.
+		/// </summary>
+		static int64_t Now() {
+			return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+		}
+
+		/// <summary>
+		/// Looks up the peer, creates it with a default-constructed State if it is new, and takes 'cost' tokens
+		/// from its bucket. Returns nullptr if the packet should be dropped, because the peer exceeded its rate
+		/// or the table is full and no peer is idle.
+		/// </summary>
+		State* Admit(IPv4Address address, uint16_t port, int64_t nowNs, double cost = 1) {
+			uint64_t key = Pack(address, port);
+			size_t slot = Probe(key);
+			uint32_t index = slots[slot].entry;
+
+			if (slots[slot].key == 0) {
+				if (count >= options.maxPeers) {
+					if (EvictIdle(nowNs) == 0) {
+						statistics.rejected++;
+						return nullptr;
+					}
+					slot = Probe(key);			// Eviction shifts slots
+				}
+
+				index = AllocateEntry();
+				slots[slot].key = key;
+				slots[slot].entry = index;
+				count++;
+
+				Entry& entry = entries[index];
+				entry.key = PeerKey{ address, port };
+				entry.bucket.Configure(options.ratePerSecond, options.burst, nowNs);
+				LinkFront(index);
+			}
+			else if (index != head) {
+				Unlink(index);
+				LinkFront(index);
+			}
+
+			// A peer that is over its rate is still active, so it is not evicted and can't return with a full bucket
+			Entry& entry = entries[index];
+			entry.lastSeen = nowNs;
+
+			if (options.ratePerSecond > 0 && !entry.bucket.TryConsume(cost, nowNs)) {
+				statistics.rateLimited++;
+				return nullptr;
+			}
+
+			statistics.admitted++;
+			return &entry.state;
+		}
+
+		/// <summary>
+		/// Returns nullptr if the peer is unknown. Does not count as activity of the peer.
+		/// </summary>
+		State* Find(IPv4Address address, uint16_t port) {
+			size_t slot = Probe(Pack(address, port));
+			if (slots[slot].key == 0)
+				return nullptr;
+
+			return &entries[slots[slot].entry].state;
+		}
+
+		/// <summary>
+		/// Removes the peer without calling the eviction callback. Returns false if the peer is unknown.
+		/// </summary>
+		bool Remove(IPv4Address address, uint16_t port) {
+			size_t slot = Probe(Pack(address, port));
+			if (slots[slot].key == 0)
+				return false;
+
+			uint32_t index = slots[slot].entry;
+			EraseSlot(slot);
+			ReleaseEntry(index);
+			return true;
+		}
+
+		/// <summary>
+		/// Removes every peer that was not seen within the idle timeout, the cost is proportional to the
+		/// number of evicted peers. Returns that number.
+		/// </summary>
+		size_t EvictIdle(int64_t nowNs) {
+			if (options.idleTimeout.count() <= 0)
+				return 0;
+
+			size_t evicted = 0;
+			int64_t limit = nowNs - options.idleTimeout.count();
+			while (tail != NONE && entries[tail].lastSeen <= limit) {
+				uint32_t index = tail;
+				Entry& entry = entries[index];
+				if (onEvict) {
+					onEvict(entry.key, entry.state);
+				}
+
+				EraseSlot(Probe(Pack(entry.key.address, entry.key.port)));
+				ReleaseEntry(index);
+				evicted++;
+			}
+
+			statistics.evicted += evicted;
+			return evicted;
+		}
+
+		/// <summary>
+		/// Called for every idle peer right before it is removed. Must not modify the table.
+		/// </summary>
+		void SetEvictionCallback(std::function<void(const PeerKey& peer, State& state)> callback) {
+			onEvict = std::move(callback);
+		}
+
+		/// <summary>
+		/// Runs EvictIdle() periodically on a timer of 'scheduler', which is any class with ScheduleTimer() and
+		/// CancelTimer() like UDPServerAsync or BasicUDPServer. StopEviction() and the destructor may run on
+		/// any thread, they wait for an eviction that is running on the timer. StopEviction() needs the scheduler
+		/// to be alive still.
+		/// </summary>
+		template<typename Scheduler>
+		void StartEviction(Scheduler& scheduler, std::chrono::nanoseconds interval = std::chrono::seconds(1)) {
+			StopEviction();
+			cancelEviction = [&scheduler](TimerId id) { scheduler.CancelTimer(id); };
+			eviction = std::make_shared<EvictionControl>();
+			std::lock_guard<std::recursive_mutex> lock(eviction->mutex);
+			ScheduleEviction(scheduler, interval, eviction);
+		}
+
+		void StopEviction() {
+			if (!eviction)
+				return;
+
+			{
+				std::lock_guard<std::recursive_mutex> lock(eviction->mutex);
+				eviction->active = false;
+			}
+			cancelEviction(evictionTimer.exchange(INVALID_TIMER));
+			cancelEviction = nullptr;
+			eviction.reset();
+		}
+
+		/// <summary>
+		/// Calls function(const PeerKey&, State&) for every peer, the most recently seen first.
+		/// The function must not modify the table.
+		/// </summary>
+		template<typename Function>
+		void ForEach(Function function) {
+			for (uint32_t index = head; index != NONE; index = entries[index].next) {
+				Entry& entry = entries[index];
+				function(static_cast<const PeerKey&>(entry.key), entry.state);
+			}
+		}
+
+		size_t Size() const { return count; }
+		size_t MaxPeers() const { return options.maxPeers; }
+		PeerTableStatistics GetStatistics() const { return statistics; }
+
+	private:
+		static constexpr uint32_t NONE = 0xFFFFFFFF;
+
+		struct Slot {
+			uint64_t key = 0;					// Packed endpoint, 0 = Empty
+			uint32_t entry = NONE;
+		};
+
+		struct Entry {
+			PeerKey key;
+			uint32_t prev = NONE;				// Recency list, 'next' also links the free entries
+			uint32_t next = NONE;
+			int64_t lastSeen = 0;
+			TokenBucket bucket;
+			State state = State();
+		};
+
+		// Bit 48 marks the slot as used, so 0.0.0.0:0 is a valid key as well
+		static uint64_t Pack(IPv4Address address, uint16_t port) {
+			return (1ull << 48) | ((uint64_t)address.ToUint() << 16) | port;
+		}
+
+		size_t Home(uint64_t key) const {
+			uint64_t h = key ^ seed;			// Finalizer of MurmurHash3
+			h ^= h >> 33;
+			h *= 0xff51afd7ed558ccdull;
+			h ^= h >> 33;
+			h *= 0xc4ceb9fe1a85ec53ull;
+			h ^= h >> 33;
+			return (size_t)h & mask;
+		}
+
+		// Returns the slot holding 'key', or the empty slot where it would be inserted
+		size_t Probe(uint64_t key) const {
+			size_t slot = Home(key);
+			while (slots[slot].key != 0 && slots[slot].key != key) {
+				slot = (slot + 1) & mask;
+			}
+			return slot;
+		}
+
+		// Backward-shift deletion: Moves the following entries of the cluster up, so no tombstones are needed
+		void EraseSlot(size_t slot) {
+			size_t next = slot;
+			while (true) {
+				next = (next + 1) & mask;
+				if (slots[next].key == 0)
+					break;
+
+				size_t home = Home(slots[next].key);
+				if (((next - home) & mask) >= ((next - slot) & mask)) {
+					slots[slot] = slots[next];
+					slot = next;
+				}
+			}
+			slots[slot] = Slot();
+		}
+
+		uint32_t AllocateEntry() {
+			if (freeList != NONE) {
+				uint32_t index = freeList;
+				freeList = entries[index].next;
+				return index;
+			}
+			entries.emplace_back();				// Never exceeds the reserved capacity
+			return (uint32_t)(entries.size() - 1);
+		}
+
+		void ReleaseEntry(uint32_t index) {
+			Unlink(index);
+			Entry& entry = entries[index];
+			entry.state = State();				// Releases what the state holds right away
+			entry.next = freeList;
+			freeList = index;
+			count--;
+		}
+
+		void LinkFront(uint32_t index) {
+			Entry& entry = entries[index];
+			entry.prev = NONE;
+			entry.next = head;
+			if (head != NONE) {
+				entries[head].prev = index;
+			}
+			else {
+				tail = index;
+			}
+			head = index;
+		}
+
+		void Unlink(uint32_t index) {
+			Entry& entry = entries[index];
+			if (entry.prev != NONE) {
+				entries[entry.prev].next = entry.next;
+			}
+			else {
+				head = entry.next;
+			}
+			if (entry.next != NONE) {
+				entries[entry.next].prev = entry.prev;
+			}
+			else {
+				tail = entry.prev;
+			}
+			entry.prev = NONE;
+			entry.next = NONE;
+		}
+
+		// Shared with the timer callbacks, which hold the mutex while they run, so the table can't be stopped or
+		// destroyed under them. Recursive, so an eviction callback may still stop the eviction.
+		struct EvictionControl {
+			std::recursive_mutex mutex;
+			bool active = true;
+		};
+
+		template<typename Scheduler>
+		void ScheduleEviction(Scheduler& scheduler, std::chrono::nanoseconds interval, std::shared_ptr<EvictionControl> control) {
+			evictionTimer = scheduler.ScheduleTimer(interval, [this, &scheduler, interval, control] {
+				std::lock_guard<std::recursive_mutex> lock(control->mutex);
+				if (!control->active)
+					return;
+
+				EvictIdle(Now());
+				if (control->active) {
+					ScheduleEviction(scheduler, interval, control);
+				}
+			});
+		}
+
+		PeerTableOptions options;
+		std::vector<Slot> slots;
+		std::vector<Entry> entries;
+		size_t mask = 0;
+		uint64_t seed = 0;
+		size_t count = 0;
+		uint32_t head = NONE;					// Most recently seen
+		uint32_t tail = NONE;					// Least recently seen
+		uint32_t freeList = NONE;
+
+		PeerTableStatistics statistics;
+		std::function<void(const PeerKey&, State&)> onEvict;
+		std::function<void(TimerId)> cancelEviction;
+		std::shared_ptr<EvictionControl> eviction;
+		std::atomic<TimerId> evictionTimer = INVALID_TIMER;
+	};
+
+}
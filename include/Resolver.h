@@ -0,0 +1,103 @@
+#pragma once
+
+#include "NetLib.h"
+
+namespace NetLib {
+
+	// ===============================
+	// ===      Resolver Class     ===
+	// ===============================
+	//
+	// Resolves hostnames on background threads, so no caller blocks in getaddrinfo(). Results are kept in a
+	// sharded cache until their TTL expires, failed lookups for 'negativeTtl', and concurrent lookups of the
+	// same name wait for a single query. SendUDP() and UDPClient accept hostnames through the default resolver.
+	//
+	//     NetLib::GetDefaultResolver().ResolveAsync("sensor.local", [](const NetLib::ResolveResult& result) { ... });
+	//
+	// By default the system resolver does the lookups. With 'nameServer' the resolver queries that DNS server
+	// itself and honors the TTLs of the records, after looking into 'hostsFile'.
+	//
+
+	enum ResolveStatus {
+		RESOLVE_OK,
+		RESOLVE_NOT_FOUND,			// The name does not exist or has no addresses
+		RESOLVE_TIMEOUT,			// No answer within the timeout, the lookup may still complete later
+		RESOLVE_FAILED				// Other errors, e.g. the name server is unreachable
+	};
+
+	struct ResolveResult {
+		ResolveStatus status = RESOLVE_FAILED;
+		std::vector<IPv4Address> ipv4;
+		std::vector<IPv6Address> ipv6;
+	};
+
+	struct ResolverOptions {
+		std::chrono::seconds ttl = std::chrono::seconds(60);			// For system lookups and the hosts file, the upper bound for DNS records
+		std::chrono::seconds negativeTtl = std::chrono::seconds(5);		// Failed lookups are repeated after this
+		std::chrono::milliseconds timeout = std::chrono::seconds(5);	// How long Resolve() waits, and per DNS query
+		size_t threads = 2;							// Background threads doing the lookups
+		size_t shards = 16;							// Cache shards, each with its own lock
+		std::string nameServer;						// "IP" or "IP:port" to query directly, empty = system resolver
+		std::string hostsFile = "/etc/hosts";		// Looked into before the name server, only used with 'nameServer'
+	};
+
+	struct ResolverStatistics {
+		uint64_t hits = 0;					// Answered from the cache, including negative entries
+		uint64_t stale = 0;					// Answered with an expired result while it is refreshed
+		uint64_t misses = 0;				// Started a lookup
+		uint64_t coalesced = 0;				// Waited for a lookup of another caller
+		uint64_t lookups = 0;				// Completed lookups
+		uint64_t failures = 0;				// Lookups without an address
+		uint64_t queries = 0;				// DNS queries sent, only with 'nameServer'
+	};
+
+	const char* GetResolveStatusName(ResolveStatus status);
+
+	struct ResolverMembers;
+
+	class Resolver {
+	public:
+		Resolver(const ResolverOptions& options = ResolverOptions());
+		~Resolver();
+
+		/// <summary>
+		/// Calls 'callback' with the addresses of 'host'. Cached results are passed right away on the calling thread,
+		/// otherwise the callback runs on a resolver thread once the lookup completed. Keep it short.
+		/// </summary>
+		void ResolveAsync(const std::string& host, std::function<void(const ResolveResult& result)> callback);
+
+		/// <summary>
+		/// Waits for the lookup, at most for the timeout of the options. Cache hits don't block.
+		/// </summary>
+		ResolveResult Resolve(const std::string& host);
+
+		/// <summary>
+		/// Returns the cached result without starting a lookup, nullopt if there is none or it expired. With 'allowStale'
+		/// an expired result is still returned and refreshed in the background, and a name that was never resolved
+		/// returns nullopt and starts its lookup. Expired results are kept for another 'ttl' of the options.
+		/// </summary>
+		std::optional<ResolveResult> TryResolveCached(const std::string& host, bool allowStale = false);
+
+		/// <summary>
+		/// Replaces the options and clears the cache. Lookups in flight complete with the old options, the number
+		/// of threads and shards stays as constructed.
+		/// </summary>
+		void SetOptions(const ResolverOptions& options);
+
+		void ClearCache();
+		ResolverStatistics GetStatistics();
+
+		Resolver(const Resolver&) = delete;
+		Resolver& operator=(const Resolver&) = delete;
+
+	private:
+		IncompleteTypeWrapper<ResolverMembers> members;
+	};
+
+	/// <summary>
+	/// The resolver behind the hostname support of SendUDP() and UDPClient, created with the first use.
+	/// Configure it with SetOptions().
+	/// </summary>
+	Resolver& GetDefaultResolver();
+
+}
@@ -0,0 +1,166 @@
+#pragma once
+
+#include <future>
+
+#include "NetLib.h"
+
+#define NETLIB_RPC_HEADER_SIZE 8		// Added to every request and response: Version, type, method and correlation id
+
+namespace NetLib {
+
+	// ===========================
+	// ===      RPC over UDP   ===
+	// ===========================
+	//
+	// Request/response on top of UDPServerAsync. Every request carries a correlation id, so a client can have
+	// thousands of requests in flight to one server and match the responses in any order. Lost requests or
+	// responses are repeated every 'retryInterval' until the deadline of the request.
+	//
+	//     NetLib::RpcServer server(6000);
+	//     server.Register(1, [](const uint8_t* request, size_t size, uint8_t* response, size_t capacity) { ...; return responseSize; });
+	//
+	//     NetLib::RpcClient client("10.0.0.2", 6000);
+	//     client.Call(1, request, size, [](NetLib::RpcStatus status, const uint8_t* response, size_t size) { ... });
+	//     NetLib::RpcResponse response = client.CallAsync(1, request, size).get();
+	//
+	// A retried request may run the handler more than once, handlers should be idempotent.
+	//
+
+	enum RpcStatus {
+		RPC_OK,
+		RPC_TIMEOUT,					// No response before the deadline
+		RPC_NO_HANDLER,					// The server has no handler for the method
+		RPC_HANDLER_FAILED,				// The handler threw, or its response did not fit
+		RPC_REJECTED,					// Not sent: Too many requests in flight, or the request is too large
+		RPC_CANCELLED					// The client was destroyed with the request in flight
+	};
+
+	const char* GetRpcStatusName(RpcStatus status);
+
+	struct RpcResponse {
+		RpcStatus status = RPC_CANCELLED;
+		std::vector<uint8_t> data;
+	};
+
+	/// <summary>
+	/// Called once per request on the listener thread of the client. 'response' is only valid during the call
+	/// and empty unless the status is RPC_OK.
+	/// </summary>
+	using RpcCallback = std::function<void(RpcStatus status, const uint8_t* response, size_t responseSize)>;
+
+	/// <summary>
+	/// Writes the response into 'response' and returns its size, at most 'responseCapacity' bytes.
+	/// </summary>
+	using RpcHandler = std::function<size_t(const uint8_t* request, size_t requestSize, uint8_t* response, size_t responseCapacity)>;
+
+	struct RpcClientOptions {
+		size_t maxInFlight = 4096;										// Rounded up to a power of two
+		size_t maxRequestSize = 1400;
+		size_t maxResponseSize = 1400;
+		std::chrono::milliseconds timeout = std::chrono::seconds(1);	// Deadline of a request unless Call() passes one
+		std::chrono::milliseconds retryInterval = std::chrono::milliseconds(200);	// 0 = Never repeat a request
+		std::chrono::milliseconds resolution = std::chrono::milliseconds(5);		// How often deadlines are checked
+	};
+
+	struct RpcClientStatistics {
+		uint64_t requests = 0;				// Calls that were sent
+		uint64_t retries = 0;				// Repeated requests
+		uint64_t responses = 0;				// Completed by a response, including errors of the server
+		uint64_t timeouts = 0;
+		uint64_t rejected = 0;
+		uint64_t late = 0;					// Responses without a pending request, e.g. after a timeout or a retry
+		uint64_t invalid = 0;				// Datagrams from other sources or without a valid header
+		size_t inFlight = 0;
+	};
+
+	struct RpcServerOptions {
+		size_t maxRequestSize = 1400;
+		size_t maxResponseSize = 1400;
+	};
+
+	struct RpcServerStatistics {
+		uint64_t requests = 0;
+		uint64_t noHandler = 0;				// Requests for methods without a handler
+		uint64_t failures = 0;				// Handlers that threw
+		uint64_t invalid = 0;				// Datagrams without a valid header
+	};
+
+
+
+
+
+	struct RpcClientMembers;
+
+	class RpcClient {
+	public:
+		/// <summary>
+		/// Receives the responses on its own ephemeral port. 'host' may be a hostname, which is resolved once
+		/// through the default resolver. Throws std::runtime_error if it can't be resolved.
+		/// </summary>
+		RpcClient(const std::string& host, uint16_t port, const RpcClientOptions& options = RpcClientOptions());
+		RpcClient(IPv4Address server, uint16_t port, const RpcClientOptions& options = RpcClientOptions());
+
+		/// <summary>
+		/// Pending requests complete with RPC_CANCELLED on the destroying thread.
+		/// </summary>
+		~RpcClient();
+
+		/// <summary>
+		/// Sends the request and returns right away, 'callback' runs once the response arrived or the deadline
+		/// passed. 'timeout' of 0 uses the one of the options. Thread-safe and lock-free. Returns false without
+		/// calling the callback if the request is larger than maxRequestSize or maxInFlight requests are pending.
+		/// </summary>
+		bool Call(uint16_t method, const uint8_t* request, size_t requestSize, RpcCallback callback,
+			std::chrono::milliseconds timeout = std::chrono::milliseconds(0));
+
+		/// <summary>
+		/// Like Call(), the future holds RPC_REJECTED if the request could not be sent. Don't wait for it on
+		/// the listener thread, i.e. inside a callback.
+		/// </summary>
+		std::future<RpcResponse> CallAsync(uint16_t method, const uint8_t* request, size_t requestSize,
+			std::chrono::milliseconds timeout = std::chrono::milliseconds(0));
+
+		uint16_t GetLocalPort();
+		RpcClientStatistics GetStatistics();
+
+		RpcClient(const RpcClient&) = delete;
+		RpcClient& operator=(const RpcClient&) = delete;
+
+	private:
+		IncompleteTypeWrapper<RpcClientMembers> members;
+	};
+
+
+
+
+
+	struct RpcServerMembers;
+
+	class RpcServer {
+	public:
+		RpcServer(uint16_t port, const RpcServerOptions& options = RpcServerOptions());
+		~RpcServer();
+
+		/// <summary>
+		/// Adds or replaces the handler of 'method'. Handlers run on the listener thread, or on the workers
+		/// after EnableWorkerPool(). Don't register from inside a handler.
+		/// </summary>
+		void Register(uint16_t method, RpcHandler handler);
+		void Unregister(uint16_t method);
+
+		/// <summary>
+		/// Runs the handlers on a pool of threads (see UDPServerAsync::EnableWorkerPool()).
+		/// </summary>
+		bool EnableWorkerPool(const WorkerPoolOptions& options = WorkerPoolOptions());
+
+		uint16_t GetLocalPort();
+		RpcServerStatistics GetStatistics();
+
+		RpcServer(const RpcServer&) = delete;
+		RpcServer& operator=(const RpcServer&) = delete;
+
+	private:
+		IncompleteTypeWrapper<RpcServerMembers> members;
+	};
+
+}
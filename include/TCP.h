@@ -0,0 +1,165 @@
+#pragma once
+
+#include "NetLib.h"
+
+#include <vector>
+#include <initializer_list>
+
+#define NETLIB_DEFAULT_TCP_BUFFER_SIZE 4096
+#define NETLIB_MAX_TCP_MESSAGE_SIZE (16 * 1024 * 1024)
+#define NETLIB_TCP_SEND_QUEUE_LIMIT (16 * 1024 * 1024)		// Bytes queued per connection before sends are refused
+#define NETLIB_TCP_ACCEPT_RETRY_MS 100						// Pause after a failed accept, e.g. out of descriptors
+
+namespace NetLib {
+
+	// ==============================
+	// ===      TCP Framing       ===
+	// ==============================
+	//
+	// TCP is a byte stream, so every message is framed before it is sent. LENGTH_PREFIXED puts a 4 byte
+	// big-endian length in front of every message, DELIMITER terminates every message with a single byte.
+	// Both sides of a connection must use the same framing.
+	//
+	struct TCPFraming {
+		enum Mode {
+			LENGTH_PREFIXED,
+			DELIMITER
+		};
+
+		Mode mode = LENGTH_PREFIXED;
+		uint8_t delimiter = '\n';
+		size_t maxMessageSize = NETLIB_MAX_TCP_MESSAGE_SIZE;	// Connections sending larger messages are dropped
+	};
+
+	using TCPConnectionId = uint64_t;
+
+
+
+
+
+	// ==================================
+	// ===      TCPClient Class       ===
+	// ==================================
+	//
+	// This class connects to a TCP server and keeps the connection open for the lifetime of the object.
+	// If the connection breaks, the next send reconnects once before giving up. The read buffer is kept
+	// across messages, so steady-state receiving does not allocate.
+	//
+
+	struct TCPClientMembers;
+
+	class TCPClient {
+	public:
+		TCPClient(const std::string& ipAddress, uint16_t port, TCPFraming framing = TCPFraming());
+		~TCPClient();
+
+		size_t send(uint8_t* data, size_t length);
+		size_t send(const char* data);
+		size_t send(const std::string& data);
+
+		/// <summary>
+		/// Send all buffers as a single framed message. The frame header and the buffers are handed to the
+		/// kernel in one vectored write, nothing is concatenated in user space.
+		/// </summary>
+		size_t send(const ConstBuffer* buffers, size_t count);
+		size_t send(std::initializer_list<ConstBuffer> buffers);
+
+		/// <summary>
+		/// Block until a complete message arrived. The message is written into the given vector, whose capacity
+		/// is reused. Returns false if the connection was closed or the framing was violated. May run on another
+		/// thread than send(), a reconnect of send() ends a receive that is blocked on the old connection.
+		/// </summary>
+		bool ReceiveMessage(std::vector<uint8_t>& message);
+		std::optional<std::vector<uint8_t>> ReceiveMessage();
+
+		/// <summary>
+		/// Disable Nagle's algorithm. Small messages are sent immediately instead of being coalesced.
+		/// </summary>
+		void SetNoDelay(bool enable);
+
+		/// <summary>
+		/// Hold back partial segments until the cork is removed (TCP_CORK on Linux, TCP_NOPUSH on BSD/macOS).
+		/// Removing the cork flushes everything queued so far. Returns false if the platform does not support it.
+		/// </summary>
+		bool SetCork(bool enable);
+
+		bool IsConnected();
+
+	private:
+		void Connect();
+		size_t sendFramed(const ConstBuffer* buffers, size_t count);
+
+		IncompleteTypeWrapper<TCPClientMembers> members;
+	};
+
+
+
+
+
+
+	// =======================================
+	// ===      TCPServerAsync Class       ===
+	// =======================================
+	//
+	// All connections of a server share one acceptor and one listener thread, which scales to thousands of
+	// open connections. Every connection owns a read buffer that is reused across messages; the callback
+	// receives a pointer into that buffer, which is only valid during the call.
+	//
+
+	struct TCPServerAsyncMembers;
+
+	class TCPServerAsync {
+	public:
+		TCPServerAsync(
+			std::function<void(TCPConnectionId connection, uint8_t* message, size_t messageSize)> callback,
+			uint16_t port,
+			TCPFraming framing = TCPFraming(),
+			size_t bufferSize = NETLIB_DEFAULT_TCP_BUFFER_SIZE
+		);
+
+		TCPServerAsync(
+			std::function<void(TCPConnectionId connection, uint8_t* message, size_t messageSize, const std::string& remoteHost, uint16_t remotePort)> callback,
+			uint16_t port,
+			TCPFraming framing = TCPFraming(),
+			size_t bufferSize = NETLIB_DEFAULT_TCP_BUFFER_SIZE
+		);
+
+		~TCPServerAsync();
+
+		/// <summary>
+		/// Called on the listener thread when a connection was accepted or closed.
+		/// Set them before the first client connects.
+		/// </summary>
+		void SetConnectCallback(std::function<void(TCPConnectionId connection)> callback);
+		void SetDisconnectCallback(std::function<void(TCPConnectionId connection)> callback);
+
+		/// <summary>
+		/// Send a framed message to a connected client. Safe to call from any thread, including the callback,
+		/// and never blocks: What the socket does not take right away is queued and written by the listener
+		/// thread. Returns the number of payload bytes sent or queued, 0 if the connection does not exist
+		/// anymore or more than NETLIB_TCP_SEND_QUEUE_LIMIT bytes are queued for it.
+		/// </summary>
+		size_t send(TCPConnectionId connection, uint8_t* data, size_t length);
+		size_t send(TCPConnectionId connection, const std::string& data);
+		size_t send(TCPConnectionId connection, const ConstBuffer* buffers, size_t count);
+		size_t send(TCPConnectionId connection, std::initializer_list<ConstBuffer> buffers);
+
+		void Disconnect(TCPConnectionId connection);
+		size_t GetConnectionCount();
+
+		void SetNoDelay(TCPConnectionId connection, bool enable);
+		bool SetCork(TCPConnectionId connection, bool enable);
+
+		std::string GetLocalIP();
+		uint16_t GetLocalPort();
+
+	private:
+		void Initialize(uint16_t port, TCPFraming framing, size_t bufferSize);
+		void StartAccept();
+		void ListenerThread();
+
+		IncompleteTypeWrapper<TCPServerAsyncMembers> members;
+
+	};
+
+}
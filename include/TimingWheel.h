@@ -0,0 +1,259 @@
+#pragma once
+
+#include <cinttypes>    // uint64_t, ...
+#include <vector>       // std::vector
+#include <functional>   // std::function
+#include <utility>      // std::move
+#include <algorithm>    // std::max
+
+namespace NetLib {
+
+	// ==================================
+	// ===      TimingWheel Class     ===
+	// ==================================
+	//
+	// Hierarchical timing wheel on an explicit nanosecond clock: 4 levels of 256 slots each cover 2^32 ticks,
+	// timers further away are clamped and re-sorted when they come closer. Schedule and Cancel are O(1), timers
+	// expiring in the same tick fire together when Advance() passes that tick. Timer nodes are pooled and
+	// reused, callbacks that fit the small buffer of std::function (a few pointers) don't allocate either.
+	// Not thread-safe, the wheel belongs to one event loop.
+	//
+
+	using TimerId = uint64_t;
+	static constexpr TimerId INVALID_TIMER = 0;
+
+	class TimingWheel {
+	public:
+		static constexpr int LEVELS = 4;
+		static constexpr int SLOT_BITS = 8;
+		static constexpr uint32_t SLOTS = 1u << SLOT_BITS;
+
+		explicit TimingWheel(int64_t tickNs = 1000000, int64_t nowNs = 0) : tickNs(tickNs > 0 ? tickNs : 1) {
+			currentTick = (uint64_t)(nowNs > 0 ? nowNs : 0) / (uint64_t)this->tickNs;
+			heads.assign(LEVELS * SLOTS + 1, NONE);
+		}
+
+		/// <summary>
+		/// Pre-allocates nodes for 'timers' concurrent timers.
+		/// </summary>
+		void Reserve(size_t timers) {
+			nodes.reserve(timers);
+		}
+
+		/// <summary>
+		/// The callback fires 'delayNs' after the time of the last Advance() call, rounded up to whole ticks.
+		/// </summary>
+		TimerId Schedule(int64_t delayNs, std::function<void()> callback) {
+			uint64_t ticks = delayNs <= 0 ? 1 : ((uint64_t)delayNs + (uint64_t)tickNs - 1) / (uint64_t)tickNs;
+			return Add(currentTick + ticks, std::move(callback));
+		}
+
+		/// <summary>
+		/// The callback fires in the first Advance() call at or after 'deadlineNs'. Use this when the wheel is
+		/// not advanced continuously.
+		/// </summary>
+		TimerId ScheduleAt(int64_t deadlineNs, std::function<void()> callback) {
+			uint64_t tick = deadlineNs <= 0 ? 0 : ((uint64_t)deadlineNs + (uint64_t)tickNs - 1) / (uint64_t)tickNs;
+			return Add(std::max(tick, currentTick + 1), std::move(callback));
+		}
+
+		/// <summary>
+		/// Returns false if the timer already fired or was cancelled.
+		/// </summary>
+		bool Cancel(TimerId id) {
+			uint32_t index = (uint32_t)(id & 0xFFFFFFFF);
+			if (id == INVALID_TIMER || index >= nodes.size())
+				return false;
+
+			Node& node = nodes[index];
+			if (node.generation != (uint32_t)(id >> 32) || node.list == NONE)
+				return false;
+
+			Unlink(index);
+			ReleaseNode(index);
+			count--;
+			return true;
+		}
+
+		/// <summary>
+		/// Moves the wheel forward to 'nowNs' and fires every timer that expired on the way.
+		/// Callbacks may schedule and cancel timers. Returns the number of fired timers.
+		/// </summary>
+		size_t Advance(int64_t nowNs) {
+			uint64_t target = (uint64_t)(nowNs > 0 ? nowNs : 0) / (uint64_t)tickNs;
+			size_t fired = 0;
+
+			while (currentTick < target) {
+				if (count == 0) {
+					currentTick = target;		// Nothing to cascade or fire, jump ahead
+					break;
+				}
+
+				currentTick++;
+				Cascade();
+
+				// Detach the due slot first, callbacks may modify the wheel
+				uint32_t slot = (uint32_t)(currentTick & (SLOTS - 1));
+				MoveList(slot, FIRING_LIST);
+
+				while (heads[FIRING_LIST] != NONE) {
+					uint32_t index = heads[FIRING_LIST];
+					Unlink(index);
+					std::function<void()> callback = std::move(nodes[index].callback);
+					ReleaseNode(index);
+					count--;
+					fired++;
+					callback();
+				}
+			}
+
+			return fired;
+		}
+
+		/// <summary>
+		/// Point in time at which Advance() should be called next, or -1 if no timer is scheduled.
+		/// May be earlier than the next expiry when timers of the upper levels have to be re-sorted.
+		/// </summary>
+		int64_t NextDeadline() const {
+			if (count == 0)
+				return -1;
+
+			for (uint32_t i = 1; i <= SLOTS; i++) {
+				uint64_t tick = currentTick + i;
+				if (heads[tick & (SLOTS - 1)] != NONE)
+					return (int64_t)(tick * (uint64_t)tickNs);
+				if ((tick & (SLOTS - 1)) == 0)
+					return (int64_t)(tick * (uint64_t)tickNs);		// Next cascade
+			}
+			return (int64_t)((currentTick + 1) * (uint64_t)tickNs);
+		}
+
+		size_t Size() const { return count; }
+		int64_t TickNs() const { return tickNs; }
+
+	private:
+		static constexpr uint32_t NONE = 0xFFFFFFFF;
+		static constexpr uint32_t FIRING_LIST = LEVELS * SLOTS;
+
+		struct Node {
+			std::function<void()> callback;
+			uint64_t expiry = 0;
+			uint32_t prev = NONE;
+			uint32_t next = NONE;
+			uint32_t list = NONE;			// Slot the node is linked into, NONE if free
+			uint32_t generation = 1;		// Makes ids of reused nodes distinct
+		};
+
+		TimerId Add(uint64_t expiry, std::function<void()> callback) {
+			uint32_t index = AllocateNode();
+			Node& node = nodes[index];
+			node.callback = std::move(callback);
+			node.expiry = expiry;
+			Insert(index);
+			count++;
+			return MakeId(index, node.generation);
+		}
+
+		static TimerId MakeId(uint32_t index, uint32_t generation) {
+			return ((uint64_t)generation << 32) | index;
+		}
+
+		uint32_t AllocateNode() {
+			if (freeList != NONE) {
+				uint32_t index = freeList;
+				freeList = nodes[index].next;
+				nodes[index].next = NONE;
+				return index;
+			}
+			nodes.emplace_back();
+			return (uint32_t)(nodes.size() - 1);
+		}
+
+		void ReleaseNode(uint32_t index) {
+			Node& node = nodes[index];
+			node.callback = nullptr;
+			node.list = NONE;
+			node.prev = NONE;
+			node.generation = node.generation == 0xFFFFFFFF ? 1 : node.generation + 1;
+			node.next = freeList;
+			freeList = index;
+		}
+
+		void Insert(uint32_t index) {
+			Node& node = nodes[index];
+			uint64_t delta = node.expiry > currentTick ? node.expiry - currentTick : 0;
+
+			// The maximum reach of the wheel, further timers are placed at the edge and re-sorted on the way
+			uint64_t maxDelta = (1ull << (LEVELS * SLOT_BITS)) - 1;
+			uint64_t expiry = delta > maxDelta ? currentTick + maxDelta : node.expiry;
+
+			int level = 0;
+			while (level < LEVELS - 1 && delta >= (1ull << ((level + 1) * SLOT_BITS))) {
+				level++;
+			}
+			uint32_t slot = (uint32_t)((expiry >> (level * SLOT_BITS)) & (SLOTS - 1));
+			Link(index, level * SLOTS + slot);
+		}
+
+		// When a level wraps, the timers of the next upper slot are spread over the levels below. The highest
+		// level goes first, so timers it moves down are cascaded again in the same tick if needed.
+		void Cascade() {
+			int top = 0;
+			while (top < LEVELS - 1 && (currentTick & ((1ull << ((top + 1) * SLOT_BITS)) - 1)) == 0) {
+				top++;
+			}
+
+			for (int level = top; level >= 1; level--) {
+				uint32_t slot = (uint32_t)((currentTick >> (level * SLOT_BITS)) & (SLOTS - 1));
+				uint32_t list = level * SLOTS + slot;
+				while (heads[list] != NONE) {
+					uint32_t index = heads[list];
+					Unlink(index);
+					Insert(index);
+				}
+			}
+		}
+
+		void MoveList(uint32_t from, uint32_t to) {
+			while (heads[from] != NONE) {
+				uint32_t index = heads[from];
+				Unlink(index);
+				Link(index, to);
+			}
+		}
+
+		void Link(uint32_t index, uint32_t list) {
+			Node& node = nodes[index];
+			node.list = list;
+			node.prev = NONE;
+			node.next = heads[list];
+			if (node.next != NONE) {
+				nodes[node.next].prev = index;
+			}
+			heads[list] = index;
+		}
+
+		void Unlink(uint32_t index) {
+			Node& node = nodes[index];
+			if (node.prev != NONE) {
+				nodes[node.prev].next = node.next;
+			}
+			else {
+				heads[node.list] = node.next;
+			}
+			if (node.next != NONE) {
+				nodes[node.next].prev = node.prev;
+			}
+			node.prev = NONE;
+			node.next = NONE;
+		}
+
+		int64_t tickNs;
+		uint64_t currentTick = 0;
+		size_t count = 0;
+		std::vector<Node> nodes;
+		std::vector<uint32_t> heads;
+		uint32_t freeList = NONE;
+	};
+
+}
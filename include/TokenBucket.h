@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cinttypes>    // int64_t, ...
+#include <algorithm>    // std::min
+
+namespace NetLib {
+
+	// ==================================
+	// ===      TokenBucket Class     ===
+	// ==================================
+	//
+	// Classic token bucket on an explicit nanosecond clock, so it can be driven by any time source and costs
+	// no syscall. Not thread-safe, every bucket belongs to one owner.
+	//
+
+	class TokenBucket {
+	public:
+		TokenBucket() = default;
+		TokenBucket(double ratePerSecond, double capacity, int64_t nowNs = 0) {
+			Configure(ratePerSecond, capacity, nowNs);
+		}
+
+		/// <summary>
+		/// Changes rate and capacity, the bucket starts full.
+		/// </summary>
+		void Configure(double ratePerSecond, double capacity, int64_t nowNs) {
+			rate = ratePerSecond;
+			this->capacity = capacity;
+			tokens = capacity;
+			last = nowNs;
+		}
+
+		/// <summary>
+		/// Admission control: Takes 'cost' tokens if they are available, otherwise nothing is taken.
+		/// </summary>
+		bool TryConsume(double cost, int64_t nowNs) {
+			Refill(nowNs);
+			if (tokens < cost)
+				return false;
+
+			tokens -= cost;
+			return true;
+		}
+
+		/// <summary>
+		/// Pacing: Always takes 'cost' tokens, the bucket may go into debt. Returns the point in time at which
+		/// the debt is paid off, which is the earliest moment the caller may act.
+		/// </summary>
+		int64_t Schedule(double cost, int64_t nowNs) {
+			Refill(nowNs);
+			tokens -= cost;
+			if (tokens >= 0 || rate <= 0)
+				return nowNs;
+
+			return nowNs + (int64_t)(-tokens / rate * 1e9);
+		}
+
+		double Tokens(int64_t nowNs) {
+			Refill(nowNs);
+			return tokens;
+		}
+
+		double Rate() const { return rate; }
+		double Capacity() const { return capacity; }
+
+	private:
+		void Refill(int64_t nowNs) {
+			if (nowNs > last) {
+				tokens = std::min(capacity, tokens + (double)(nowNs - last) * rate / 1e9);
+				last = nowNs;
+			}
+		}
+
+		double rate = 0;
+		double capacity = 0;
+		double tokens = 0;
+		int64_t last = 0;
+	};
+
+}
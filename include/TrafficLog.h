@@ -0,0 +1,103 @@
+#pragma once
+
+#include "NetLib.h"
+
+#define NETLIB_TRAFFIC_LOG_GROW_SIZE (16 * 1024 * 1024)
+
+namespace NetLib {
+
+	// ===========================================
+	// ===      Traffic recording / replay     ===
+	// ===========================================
+	//
+	// A traffic log is a memory-mapped binary file of received datagrams: One fixed-size record header
+	// (timestamp, source address, source port, length) followed by the payload, padded to 8 bytes.
+	// Integers are stored in host byte order, logs are meant to be replayed on the same architecture.
+	// Attach a recorder to a UDPServerAsync with StartRecording() and feed the log into a handler or a
+	// UDPClient with the TrafficReplayer.
+	//
+
+	struct TrafficRecorderMembers;
+
+	class TrafficRecorder {
+	public:
+		/// <summary>
+		/// Creates or truncates the log file. 'maxFileSize' limits the log, records that don't fit anymore
+		/// are dropped and counted. 0 means no limit. Throws std::runtime_error if the file can't be mapped.
+		/// </summary>
+		TrafficRecorder(const std::string& filename, uint64_t maxFileSize = 0);
+		~TrafficRecorder();
+
+		/// <summary>
+		/// Append one datagram, the timestamp is taken from a monotonic clock. Thread-safe.
+		/// Returns false if the record was dropped.
+		/// </summary>
+		bool Record(const uint8_t* data, size_t length, IPv4Address source, uint16_t sourcePort);
+		bool Record(const uint8_t* data, size_t length, const IPv6Address& source, uint16_t sourcePort);
+
+		/// <summary>
+		/// Writes the mapped pages back to disk. Not required for correctness, the file is complete
+		/// after the recorder is destroyed.
+		/// </summary>
+		void Flush();
+
+		uint64_t GetRecordCount();
+		uint64_t GetDroppedCount();
+
+	private:
+		IncompleteTypeWrapper<TrafficRecorderMembers> members;
+	};
+
+
+
+	struct RecordedPacket {
+		uint64_t timestampNs = 0;			// Relative to the start of the recording
+		const uint8_t* data = nullptr;		// Points into the mapped file, valid while the replayer is alive
+		size_t length = 0;
+		IPv6Address source;					// IPv4 sources are stored in the IPv4-mapped form
+		uint16_t sourcePort = 0;
+	};
+
+	struct ReplayOptions {
+		double speed = 1.0;					// 1 = original timing, 2 = twice as fast, 0 = as fast as possible
+	};
+
+	struct TrafficReplayerMembers;
+
+	class TrafficReplayer {
+	public:
+		/// <summary>
+		/// Maps an existing log read-only. Throws std::runtime_error if the file is not a traffic log.
+		/// </summary>
+		TrafficReplayer(const std::string& filename);
+		~TrafficReplayer();
+
+		uint64_t GetPacketCount();
+		uint64_t GetDurationNs();
+
+		/// <summary>
+		/// Iterate the records without any timing. Returns false at the end of the log.
+		/// </summary>
+		bool Next(RecordedPacket& packet);
+		void Rewind();
+
+		/// <summary>
+		/// Calls the handler for every record, with the same signature as the binary UDPServerAsync callback, so
+		/// the server handler can be benchmarked without a socket. Nothing is formatted or allocated per packet:
+		/// The payload is copied into a scratch buffer the handler may modify. Sources that are not IPv4 arrive
+		/// as 0.0.0.0, Next() has them. Returns the number of packets replayed.
+		/// </summary>
+		uint64_t Replay(std::function<void(uint8_t* packet, size_t packetSize, IPv4Address source, uint16_t sourcePort)> callback,
+			const ReplayOptions& options = ReplayOptions());
+
+		/// <summary>
+		/// Re-sends every record through the client, e.g. to a server on loopback. The source addresses
+		/// are lost. Returns the number of packets sent.
+		/// </summary>
+		uint64_t ReplayTo(UDPClient& client, const ReplayOptions& options = ReplayOptions());
+
+	private:
+		IncompleteTypeWrapper<TrafficReplayerMembers> members;
+	};
+
+}
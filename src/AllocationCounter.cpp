@@ -0,0 +1,90 @@
+
+#include "AllocationCounter.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace NetLib {
+
+#ifdef NETLIB_COUNT_ALLOCATIONS
+
+	static std::atomic<uint64_t> allocationCount = 0;
+
+	bool IsAllocationCountingEnabled() {
+		return true;
+	}
+
+	uint64_t GetAllocationCount() {
+		return allocationCount.load(std::memory_order_relaxed);
+	}
+
+	static void* CountedAllocate(size_t size) {
+		allocationCount.fetch_add(1, std::memory_order_relaxed);
+		void* pointer = std::malloc(size > 0 ? size : 1);
+		if (pointer == nullptr)
+			throw std::bad_alloc();
+		return pointer;
+	}
+
+	static void* CountedAllocateAligned(size_t size, std::align_val_t alignment) {
+		allocationCount.fetch_add(1, std::memory_order_relaxed);
+		size_t align = std::max(static_cast<size_t>(alignment), sizeof(void*));
+		size = (std::max<size_t>(size, 1) + align - 1) / align * align;
+#ifdef _WIN32
+		void* pointer = _aligned_malloc(size, align);
+#else
+		void* pointer = std::aligned_alloc(align, size);
+#endif
+		if (pointer == nullptr)
+			throw std::bad_alloc();
+		return pointer;
+	}
+
+	static void FreeAligned(void* pointer) {
+#ifdef _WIN32
+		_aligned_free(pointer);
+#else
+		std::free(pointer);
+#endif
+	}
+
+#else
+
+	bool IsAllocationCountingEnabled() {
+		return false;
+	}
+
+	uint64_t GetAllocationCount() {
+		return 0;
+	}
+
+#endif
+
+}
+
+#ifdef NETLIB_COUNT_ALLOCATIONS
+
+void* operator new(size_t size) { return NetLib::CountedAllocate(size); }
+void* operator new[](size_t size) { return NetLib::CountedAllocate(size); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+	try { return NetLib::CountedAllocate(size); } catch (...) { return nullptr; }
+}
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+	try { return NetLib::CountedAllocate(size); } catch (...) { return nullptr; }
+}
+void* operator new(size_t size, std::align_val_t alignment) { return NetLib::CountedAllocateAligned(size, alignment); }
+void* operator new[](size_t size, std::align_val_t alignment) { return NetLib::CountedAllocateAligned(size, alignment); }
+
+void operator delete(void* pointer) noexcept { std::free(pointer); }
+void operator delete[](void* pointer) noexcept { std::free(pointer); }
+void operator delete(void* pointer, size_t) noexcept { std::free(pointer); }
+void operator delete[](void* pointer, size_t) noexcept { std::free(pointer); }
+void operator delete(void* pointer, const std::nothrow_t&) noexcept { std::free(pointer); }
+void operator delete[](void* pointer, const std::nothrow_t&) noexcept { std::free(pointer); }
+void operator delete(void* pointer, std::align_val_t) noexcept { NetLib::FreeAligned(pointer); }
+void operator delete[](void* pointer, std::align_val_t) noexcept { NetLib::FreeAligned(pointer); }
+void operator delete(void* pointer, size_t, std::align_val_t) noexcept { NetLib::FreeAligned(pointer); }
+void operator delete[](void* pointer, size_t, std::align_val_t) noexcept { NetLib::FreeAligned(pointer); }
+
+#endif
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <asio.hpp>
+
+#include <chrono>
+#include <mutex>
+#include <thread>
+
+#include "TimingWheel.h"
+#include "HandlerAllocator.h"
+
+// Private header: Drives a TimingWheel from an asio event loop with a single steady_timer.
+
+namespace NetLib {
+
+	class EventLoopTimers {
+	public:
+		EventLoopTimers(asio::io_service& ioService) : ioService(ioService), timer(ioService), wheel(NETLIB_TIMER_TICK_NS, Now()) {}
+
+		static int64_t Now() {
+			return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+		}
+
+		// Any thread. Callbacks fire on the loop thread, a schedule from another thread wakes the loop only if
+		// the new timer is due before the armed one.
+		TimerId Schedule(std::chrono::nanoseconds delay, std::function<void()> callback) {
+			std::lock_guard<std::recursive_mutex> lock(mutex);
+			TimerId id = wheel.ScheduleAt(Now() + delay.count(), std::move(callback));
+
+			if (std::this_thread::get_id() != loopThread) {
+				int64_t deadline = wheel.NextDeadline();
+				if (armedDeadline < 0 || deadline < armedDeadline) {
+					asio::post(ioService, [] {});
+				}
+			}
+			return id;
+		}
+
+		bool Cancel(TimerId id) {
+			std::lock_guard<std::recursive_mutex> lock(mutex);
+			return wheel.Cancel(id);
+		}
+
+		// Loop thread, before blocking: Arms the steady_timer for the next deadline of the wheel
+		void Arm() {
+			std::lock_guard<std::recursive_mutex> lock(mutex);
+			loopThread = std::this_thread::get_id();
+
+			int64_t deadline = wheel.NextDeadline();
+			if (deadline < 0 || (armedDeadline >= 0 && deadline >= armedDeadline))
+				return;
+
+			armedDeadline = deadline;
+			uint64_t generation = ++armGeneration;
+			timer.expires_at(std::chrono::steady_clock::time_point(std::chrono::nanoseconds(deadline)));
+			timer.async_wait(AllocatingHandler(handlerMemory, [this, generation](const std::error_code&) {
+				std::lock_guard<std::recursive_mutex> lock(mutex);
+				if (generation == armGeneration) {
+					armedDeadline = -1;
+				}
+			}));
+		}
+
+		// Loop thread, after waking up: Fires the expired timers
+		void Fire() {
+			std::lock_guard<std::recursive_mutex> lock(mutex);
+			wheel.Advance(Now());
+		}
+
+		// Loop thread: Cancels the armed timer, the loop must run once more to release the handler
+		void Stop() {
+			timer.cancel();
+		}
+
+	private:
+		asio::io_service& ioService;
+		asio::steady_timer timer;
+		HandlerMemory handlerMemory;
+
+		std::recursive_mutex mutex;			// Callbacks run locked and may schedule or cancel timers
+		TimingWheel wheel;
+		int64_t armedDeadline = -1;
+		uint64_t armGeneration = 0;
+		std::thread::id loopThread;
+	};
+
+}
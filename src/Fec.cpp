@@ -0,0 +1,866 @@
+#include "Fec.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define NETLIB_FEC_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// GCC and Clang compile single functions for a newer instruction set, MSVC allows the intrinsics anywhere
+#if defined(__GNUC__) || defined(__clang__)
+#define NETLIB_TARGET(features) __attribute__((target(features)))
+#else
+#define NETLIB_TARGET(features)
+#endif
+
+#include <cstring>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <string>
+
+#include "Logging.h"
+
+namespace NetLib {
+
+	// ==============================
+	// ===      GF(2^8) tables    ===
+	// ==============================
+
+	// Polynomial x^8 + x^4 + x^3 + x^2 + 1 (0x11D) with generator 2, like most Reed-Solomon implementations
+	struct GaloisTables {
+		uint8_t exp[512];
+		uint8_t log[256];
+		uint8_t inverse[256];
+		uint8_t mul[256][256];					// Scalar kernel and the small matrices
+		alignas(16) uint8_t low[256][16];		// c * x for x = 0..15, the shuffle kernels look up both nibbles
+		alignas(16) uint8_t high[256][16];		// c * (x << 4)
+
+		GaloisTables() {
+			int x = 1;
+			for (int i = 0; i < 255; i++) {
+				exp[i] = (uint8_t)x;
+				log[x] = (uint8_t)i;
+				x <<= 1;
+				if (x & 0x100) {
+					x ^= 0x11D;
+				}
+			}
+			for (int i = 255; i < 512; i++) {
+				exp[i] = exp[i - 255];
+			}
+			log[0] = 0;
+
+			for (int a = 0; a < 256; a++) {
+				for (int b = 0; b < 256; b++) {
+					mul[a][b] = (a && b) ? exp[log[a] + log[b]] : 0;
+				}
+				inverse[a] = a ? exp[255 - log[a]] : 0;
+				for (int n = 0; n < 16; n++) {
+					low[a][n] = mul[a][n];
+					high[a][n] = mul[a][n << 4];
+				}
+			}
+		}
+	};
+
+	static const GaloisTables gf;
+
+	// Cauchy matrix 1 / (x_r + y_i) with x_r = 255 - r and y_i = i. Both sets are disjoint while
+	// dataCount + repairCount <= 255, then every square submatrix is invertible.
+	static uint8_t Coefficient(size_t repairIndex, size_t dataIndex) {
+		return gf.inverse[(255 - repairIndex) ^ dataIndex];
+	}
+
+
+
+
+
+
+
+	// ========================
+	// ===      Kernels     ===
+	// ========================
+	//
+	// All kernels compute dst ^= c * src over a region, the heart of encoding and decoding.
+	//
+
+	static void XorScalar(uint8_t* dst, const uint8_t* src, size_t length) {
+		size_t i = 0;
+		for (; i + 8 <= length; i += 8) {
+			uint64_t a, b;
+			memcpy(&a, dst + i, 8);
+			memcpy(&b, src + i, 8);
+			a ^= b;
+			memcpy(dst + i, &a, 8);
+		}
+		for (; i < length; i++) {
+			dst[i] ^= src[i];
+		}
+	}
+
+	static void MulAddScalar(uint8_t* dst, const uint8_t* src, uint8_t c, size_t length) {
+		if (c == 0)
+			return;
+		if (c == 1) {
+			XorScalar(dst, src, length);
+			return;
+		}
+
+		const uint8_t* row = gf.mul[c];
+		for (size_t i = 0; i < length; i++) {
+			dst[i] ^= row[src[i]];
+		}
+	}
+
+#ifdef NETLIB_FEC_X86
+	// The product of each byte is low[c][byte & 15] ^ high[c][byte >> 4], PSHUFB does 16 lookups at once
+	NETLIB_TARGET("ssse3")
+	static void MulAddSsse3(uint8_t* dst, const uint8_t* src, uint8_t c, size_t length) {
+		if (c == 0)
+			return;
+
+		size_t i = 0;
+		if (c == 1) {
+			for (; i + 16 <= length; i += 16) {
+				__m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+				__m128i s = _mm_loadu_si128((const __m128i*)(src + i));
+				_mm_storeu_si128((__m128i*)(dst + i), _mm_xor_si128(d, s));
+			}
+			XorScalar(dst + i, src + i, length - i);
+			return;
+		}
+
+		const __m128i low = _mm_load_si128((const __m128i*)gf.low[c]);
+		const __m128i high = _mm_load_si128((const __m128i*)gf.high[c]);
+		const __m128i mask = _mm_set1_epi8(0x0F);
+		for (; i + 16 <= length; i += 16) {
+			__m128i s = _mm_loadu_si128((const __m128i*)(src + i));
+			__m128i product = _mm_xor_si128(
+				_mm_shuffle_epi8(low, _mm_and_si128(s, mask)),
+				_mm_shuffle_epi8(high, _mm_and_si128(_mm_srli_epi64(s, 4), mask)));
+			__m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+			_mm_storeu_si128((__m128i*)(dst + i), _mm_xor_si128(d, product));
+		}
+		MulAddScalar(dst + i, src + i, c, length - i);
+	}
+
+	NETLIB_TARGET("avx2")
+	static void MulAddAvx2(uint8_t* dst, const uint8_t* src, uint8_t c, size_t length) {
+		if (c == 0)
+			return;
+
+		size_t i = 0;
+		if (c == 1) {
+			for (; i + 32 <= length; i += 32) {
+				__m256i d = _mm256_loadu_si256((const __m256i*)(dst + i));
+				__m256i s = _mm256_loadu_si256((const __m256i*)(src + i));
+				_mm256_storeu_si256((__m256i*)(dst + i), _mm256_xor_si256(d, s));
+			}
+			XorScalar(dst + i, src + i, length - i);
+			return;
+		}
+
+		// VPSHUFB looks up within each 128-bit lane, so both lanes get the same table
+		const __m256i low = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i*)gf.low[c]));
+		const __m256i high = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i*)gf.high[c]));
+		const __m256i mask = _mm256_set1_epi8(0x0F);
+		for (; i + 32 <= length; i += 32) {
+			__m256i s = _mm256_loadu_si256((const __m256i*)(src + i));
+			__m256i product = _mm256_xor_si256(
+				_mm256_shuffle_epi8(low, _mm256_and_si256(s, mask)),
+				_mm256_shuffle_epi8(high, _mm256_and_si256(_mm256_srli_epi64(s, 4), mask)));
+			__m256i d = _mm256_loadu_si256((const __m256i*)(dst + i));
+			_mm256_storeu_si256((__m256i*)(dst + i), _mm256_xor_si256(d, product));
+		}
+
+		// The tail with the VEX-encoded 128-bit forms, calling the SSSE3 kernel would mix in legacy SSE code
+		for (; i + 16 <= length; i += 16) {
+			__m128i s = _mm_loadu_si128((const __m128i*)(src + i));
+			__m128i product = _mm_xor_si128(
+				_mm_shuffle_epi8(_mm256_castsi256_si128(low), _mm_and_si128(s, _mm256_castsi256_si128(mask))),
+				_mm_shuffle_epi8(_mm256_castsi256_si128(high), _mm_and_si128(_mm_srli_epi64(s, 4), _mm256_castsi256_si128(mask))));
+			__m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+			_mm_storeu_si128((__m128i*)(dst + i), _mm_xor_si128(d, product));
+		}
+		MulAddScalar(dst + i, src + i, c, length - i);
+	}
+#endif
+
+	static bool CpuSupports(FecKernel kernel) {
+		switch (kernel) {
+		case FEC_KERNEL_AUTO:
+		case FEC_KERNEL_SCALAR:
+			return true;
+#ifdef NETLIB_FEC_X86
+#ifdef _MSC_VER
+		case FEC_KERNEL_SSSE3: {
+			int info[4];
+			__cpuid(info, 1);
+			return (info[2] & (1 << 9)) != 0;
+		}
+		case FEC_KERNEL_AVX2: {
+			int info[4];
+			__cpuid(info, 1);
+			bool osSavesAvx = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && (_xgetbv(0) & 6) == 6;
+			if (!osSavesAvx)
+				return false;
+			__cpuidex(info, 7, 0);
+			return (info[1] & (1 << 5)) != 0;
+		}
+#else
+		case FEC_KERNEL_SSSE3:
+			return __builtin_cpu_supports("ssse3");
+		case FEC_KERNEL_AVX2:
+			return __builtin_cpu_supports("avx2");
+#endif
+#endif
+		default:
+			return false;
+		}
+	}
+
+	using MulAddFunction = void (*)(uint8_t* dst, const uint8_t* src, uint8_t c, size_t length);
+
+	static MulAddFunction KernelFunction(FecKernel kernel) {
+		switch (kernel) {
+#ifdef NETLIB_FEC_X86
+		case FEC_KERNEL_SSSE3: return MulAddSsse3;
+		case FEC_KERNEL_AVX2: return MulAddAvx2;
+#endif
+		default: return MulAddScalar;
+		}
+	}
+
+	static FecKernel BestKernel() {
+		for (FecKernel kernel : { FEC_KERNEL_AVX2, FEC_KERNEL_SSSE3 }) {
+			if (CpuSupports(kernel))
+				return kernel;
+		}
+		return FEC_KERNEL_SCALAR;
+	}
+
+	struct FecKernelSelection {
+		std::atomic<FecKernel> kernel;
+		std::atomic<MulAddFunction> mulAdd;
+
+		FecKernelSelection() : kernel(BestKernel()), mulAdd(KernelFunction(kernel)) {}
+	};
+
+	static FecKernelSelection selection;
+
+	static void MulAdd(uint8_t* dst, const uint8_t* src, uint8_t c, size_t length) {
+		selection.mulAdd.load(std::memory_order_relaxed)(dst, src, c, length);
+	}
+
+	bool SetFecKernel(FecKernel kernel) {
+		if (kernel == FEC_KERNEL_AUTO) {
+			kernel = BestKernel();
+		}
+		if (!CpuSupports(kernel))
+			return false;
+
+		selection.kernel = kernel;
+		selection.mulAdd = KernelFunction(kernel);
+		LOG_DEBUG("[FEC]: Using the {} kernel", GetFecKernelName(kernel));
+		return true;
+	}
+
+	FecKernel GetFecKernel() {
+		return selection.kernel;
+	}
+
+	const char* GetFecKernelName(FecKernel kernel) {
+		switch (kernel) {
+		case FEC_KERNEL_AUTO: return "auto";
+		case FEC_KERNEL_SCALAR: return "scalar";
+		case FEC_KERNEL_SSSE3: return "ssse3";
+		case FEC_KERNEL_AVX2: return "avx2";
+		default: return "unknown";
+		}
+	}
+
+
+
+
+
+
+
+	// ===============================
+	// ===      FecCodec Class     ===
+	// ===============================
+
+	struct FecCodecMembers {
+		FecScheme scheme = FEC_REED_SOLOMON;
+
+		// Reused between calls, so decoding does not allocate once warmed up
+		std::vector<uint8_t> scratch;
+		std::vector<uint8_t> matrix;
+		std::vector<size_t> missing;
+		std::vector<size_t> rows;
+	};
+
+	FecCodec::FecCodec(FecScheme scheme) : members(new FecCodecMembers()) {
+		members->scheme = scheme;
+	}
+
+	FecCodec::~FecCodec() {
+	}
+
+	void FecCodec::Encode(const uint8_t* const* data, size_t dataCount, uint8_t* const* repair, size_t repairCount, size_t length) {
+		if (repairCount == 0)
+			return;
+
+		for (size_t r = 0; r < repairCount; r++) {
+			memset(repair[r], 0, length);
+		}
+
+		// Data symbol by data symbol, so each one is read from memory once
+		for (size_t i = 0; i < dataCount; i++) {
+			if (members->scheme == FEC_XOR) {
+				MulAdd(repair[i % repairCount], data[i], 1, length);
+				continue;
+			}
+			for (size_t r = 0; r < repairCount; r++) {
+				MulAdd(repair[r], data[i], Coefficient(r, i), length);
+			}
+		}
+	}
+
+	// Gauss-Jordan elimination of the n x n matrix in the left half of 'matrix' (n x 2n, right half identity)
+	static bool InvertMatrix(uint8_t* matrix, size_t n) {
+		size_t width = 2 * n;
+		for (size_t column = 0; column < n; column++) {
+			size_t pivot = column;
+			while (pivot < n && matrix[pivot * width + column] == 0) {
+				pivot++;
+			}
+			if (pivot == n)
+				return false;
+
+			if (pivot != column) {
+				std::swap_ranges(matrix + pivot * width, matrix + (pivot + 1) * width, matrix + column * width);
+			}
+
+			uint8_t* row = matrix + column * width;
+			const uint8_t* scale = gf.mul[gf.inverse[row[column]]];
+			for (size_t j = 0; j < width; j++) {
+				row[j] = scale[row[j]];
+			}
+
+			for (size_t other = 0; other < n; other++) {
+				uint8_t factor = matrix[other * width + column];
+				if (other == column || factor == 0)
+					continue;
+
+				uint8_t* target = matrix + other * width;
+				const uint8_t* product = gf.mul[factor];
+				for (size_t j = 0; j < width; j++) {
+					target[j] ^= product[row[j]];
+				}
+			}
+		}
+		return true;
+	}
+
+	bool FecCodec::Decode(uint8_t* const* data, bool* present, size_t dataCount,
+		const uint8_t* const* repair, const bool* repairPresent, size_t repairCount, size_t length)
+	{
+		FecCodecMembers& m = *members.get();
+
+		m.missing.clear();
+		for (size_t i = 0; i < dataCount; i++) {
+			if (!present[i]) {
+				m.missing.push_back(i);
+			}
+		}
+		if (m.missing.empty())
+			return true;
+		if (repairCount == 0)
+			return false;
+
+		if (m.scheme == FEC_XOR) {
+			// Every group with a single loss and its parity is recovered, independent of the other groups
+			bool complete = true;
+			for (size_t group = 0; group < repairCount; group++) {
+				size_t lost = dataCount;
+				size_t lostCount = 0;
+				for (size_t i = group; i < dataCount; i += repairCount) {
+					if (!present[i]) {
+						lost = i;
+						lostCount++;
+					}
+				}
+				if (lostCount == 0)
+					continue;
+				if (lostCount > 1 || !repairPresent[group]) {
+					complete = false;
+					continue;
+				}
+
+				memcpy(data[lost], repair[group], length);
+				for (size_t i = group; i < dataCount; i += repairCount) {
+					if (i != lost) {
+						MulAdd(data[lost], data[i], 1, length);
+					}
+				}
+				present[lost] = true;
+			}
+			return complete;
+		}
+
+		// Reed-Solomon: One present repair symbol per lost data symbol
+		size_t lostCount = m.missing.size();
+		m.rows.clear();
+		for (size_t r = 0; r < repairCount && m.rows.size() < lostCount; r++) {
+			if (repairPresent[r]) {
+				m.rows.push_back(r);
+			}
+		}
+		if (m.rows.size() < lostCount)
+			return false;
+
+		// Remove the contribution of the present data symbols from the repair symbols
+		m.scratch.resize(lostCount * length);
+		for (size_t j = 0; j < lostCount; j++) {
+			uint8_t* syndrome = m.scratch.data() + j * length;
+			memcpy(syndrome, repair[m.rows[j]], length);
+			for (size_t i = 0; i < dataCount; i++) {
+				if (present[i]) {
+					MulAdd(syndrome, data[i], Coefficient(m.rows[j], i), length);
+				}
+			}
+		}
+
+		// What remains is (Cauchy submatrix of the lost symbols) * lost = syndromes
+		size_t width = 2 * lostCount;
+		m.matrix.assign(lostCount * width, 0);
+		for (size_t j = 0; j < lostCount; j++) {
+			for (size_t t = 0; t < lostCount; t++) {
+				m.matrix[j * width + t] = Coefficient(m.rows[j], m.missing[t]);
+			}
+			m.matrix[j * width + lostCount + j] = 1;
+		}
+		if (!InvertMatrix(m.matrix.data(), lostCount))
+			return false;
+
+		for (size_t t = 0; t < lostCount; t++) {
+			uint8_t* out = data[m.missing[t]];
+			memset(out, 0, length);
+			for (size_t j = 0; j < lostCount; j++) {
+				MulAdd(out, m.scratch.data() + j * length, m.matrix[t * width + lostCount + j], length);
+			}
+			present[m.missing[t]] = true;
+		}
+		return true;
+	}
+
+
+
+
+
+
+
+	// ==========================
+	// ===      Wire format   ===
+	// ==========================
+	//
+	// Every datagram starts with an 8-byte block header: Version and scheme, position in the block, number of
+	// data and repair datagrams, block number (big endian). The symbol follows. A data symbol is the 2-byte
+	// payload length and the payload, a repair symbol is as long as the longest data symbol of its block.
+	// Repair datagrams carry the final number of data datagrams, which is smaller after a Flush().
+	//
+
+	static constexpr uint8_t FEC_VERSION = 0x50;			// Upper nibble, the lower one is the scheme
+	static constexpr size_t BLOCK_HEADER_SIZE = 8;
+	static constexpr size_t LENGTH_SIZE = NETLIB_FEC_HEADER_SIZE - BLOCK_HEADER_SIZE;
+
+	struct BlockHeader {
+		FecScheme scheme;
+		uint8_t index;
+		uint8_t dataCount;
+		uint8_t repairCount;
+		uint32_t block;
+	};
+
+	static void WriteBlockHeader(uint8_t* out, const BlockHeader& header) {
+		out[0] = FEC_VERSION | header.scheme;
+		out[1] = header.index;
+		out[2] = header.dataCount;
+		out[3] = header.repairCount;
+		out[4] = (uint8_t)(header.block >> 24);
+		out[5] = (uint8_t)(header.block >> 16);
+		out[6] = (uint8_t)(header.block >> 8);
+		out[7] = (uint8_t)header.block;
+	}
+
+	static bool ReadBlockHeader(const uint8_t* in, size_t size, BlockHeader& header) {
+		if (size < BLOCK_HEADER_SIZE || (in[0] & 0xF0) != FEC_VERSION || (in[0] & 0x0F) > FEC_REED_SOLOMON)
+			return false;
+
+		header.scheme = (FecScheme)(in[0] & 0x0F);
+		header.index = in[1];
+		header.dataCount = in[2];
+		header.repairCount = in[3];
+		header.block = ((uint32_t)in[4] << 24) | ((uint32_t)in[5] << 16) | ((uint32_t)in[6] << 8) | in[7];
+		return header.dataCount > 0 && header.repairCount > 0 && header.dataCount + header.repairCount <= 255 &&
+			header.index < header.dataCount + header.repairCount;
+	}
+
+	static void ValidateOptions(const FecOptions& options) {
+		if (options.dataPackets == 0 || options.repairPackets == 0 || options.dataPackets + options.repairPackets > 255)
+			throw std::runtime_error("FEC: dataPackets and repairPackets must be at least 1 and at most 255 together");
+		if (options.maxPacketSize == 0 || options.maxPacketSize > 0xFFFF)
+			throw std::runtime_error("FEC: maxPacketSize must be between 1 and 65535");
+	}
+
+
+
+
+
+
+
+	// ================================
+	// ===      FecSender Class     ===
+	// ================================
+
+	struct FecSenderMembers {
+		UDPClient& client;
+		FecOptions options;
+		FecCodec codec;
+		std::mutex mutex;
+
+		// One slot per data and repair datagram of the block: Block header, then the symbol
+		size_t slotSize = 0;
+		std::vector<uint8_t> slots;
+		std::vector<size_t> symbolSizes;
+		std::vector<const uint8_t*> dataSymbols;
+		std::vector<uint8_t*> repairSymbols;
+
+		size_t count = 0;					// Data datagrams in the current block
+		size_t symbolLength = 0;			// Longest data symbol of the current block
+		uint32_t block = 0;
+		FecStatistics statistics;
+
+		FecSenderMembers(UDPClient& client, const FecOptions& options) : client(client), options(options), codec(options.scheme) {}
+
+		uint8_t* Slot(size_t index) { return slots.data() + index * slotSize; }
+	};
+
+	// Sends the repair datagrams of the current block and starts the next one
+	static void FinishBlock(FecSenderMembers& m) {
+		if (m.count == 0)
+			return;
+
+		// Shorter symbols are padded with zeros, the receiver does the same
+		for (size_t i = 0; i < m.count; i++) {
+			uint8_t* symbol = m.Slot(i) + BLOCK_HEADER_SIZE;
+			memset(symbol + m.symbolSizes[i], 0, m.symbolLength - m.symbolSizes[i]);
+			m.dataSymbols[i] = symbol;
+		}
+
+		size_t repairCount = m.options.repairPackets;
+		m.codec.Encode(m.dataSymbols.data(), m.count, m.repairSymbols.data(), repairCount, m.symbolLength);
+
+		BlockHeader header = { m.options.scheme, 0, (uint8_t)m.count, (uint8_t)repairCount, m.block };
+		size_t datagramSize = BLOCK_HEADER_SIZE + m.symbolLength;
+
+		m.block++;
+		m.count = 0;
+		m.symbolLength = 0;
+		m.statistics.blocks++;
+
+		for (size_t r = 0; r < repairCount; r++) {
+			header.index = (uint8_t)(header.dataCount + r);
+			uint8_t* slot = m.Slot(m.options.dataPackets + r);
+			WriteBlockHeader(slot, header);
+			m.client.send(slot, datagramSize);
+			m.statistics.repairPackets++;
+		}
+	}
+
+	FecSender::FecSender(UDPClient& client, const FecOptions& options) : members(new FecSenderMembers(client, options)) {
+		ValidateOptions(options);
+
+		size_t slots = (size_t)options.dataPackets + options.repairPackets;
+		members->slotSize = NETLIB_FEC_HEADER_SIZE + options.maxPacketSize;
+		members->slots.resize(slots * members->slotSize);
+		members->symbolSizes.resize(options.dataPackets);
+		members->dataSymbols.resize(options.dataPackets);
+		for (size_t r = 0; r < options.repairPackets; r++) {
+			members->repairSymbols.push_back(members->Slot(options.dataPackets + r) + BLOCK_HEADER_SIZE);
+		}
+
+		LOG_DEBUG("[FecSender]: Blocks of {} data and {} repair datagrams, {} kernel", options.dataPackets, options.repairPackets,
+			GetFecKernelName(GetFecKernel()));
+	}
+
+	FecSender::~FecSender() {
+	}
+
+	size_t FecSender::send(uint8_t* data, size_t length) {
+		FecSenderMembers& m = *members.get();
+		if (length > m.options.maxPacketSize)
+			throw std::runtime_error("FEC: Datagram of " + std::to_string(length) + " bytes exceeds maxPacketSize");
+
+		std::lock_guard<std::mutex> lock(m.mutex);
+		uint8_t* slot = m.Slot(m.count);
+		WriteBlockHeader(slot, { m.options.scheme, (uint8_t)m.count, m.options.dataPackets, m.options.repairPackets, m.block });
+		slot[BLOCK_HEADER_SIZE] = (uint8_t)(length >> 8);
+		slot[BLOCK_HEADER_SIZE + 1] = (uint8_t)length;
+		memcpy(slot + NETLIB_FEC_HEADER_SIZE, data, length);
+
+		size_t bytes = m.client.send(slot, NETLIB_FEC_HEADER_SIZE + length);
+
+		m.symbolSizes[m.count] = LENGTH_SIZE + length;
+		m.symbolLength = std::max(m.symbolLength, LENGTH_SIZE + length);
+		m.count++;
+		m.statistics.dataPackets++;
+
+		if (m.count == m.options.dataPackets) {
+			FinishBlock(m);
+		}
+		return bytes;
+	}
+
+	void FecSender::Flush() {
+		std::lock_guard<std::mutex> lock(members->mutex);
+		FinishBlock(*members.get());
+	}
+
+	FecStatistics FecSender::GetStatistics() {
+		std::lock_guard<std::mutex> lock(members->mutex);
+		return members->statistics;
+	}
+
+
+
+
+
+
+
+	// ==================================
+	// ===      FecReceiver Class     ===
+	// ==================================
+
+	struct FecBlock {
+		bool used = false;
+		bool complete = false;
+		uint32_t id = 0;
+		FecScheme scheme = FEC_REED_SOLOMON;
+		size_t dataCount = 0;				// Known from the first repair datagram, 0 until then
+		size_t repairCount = 0;
+		size_t dataSlots = 0;				// Data datagrams announced by the data headers
+		size_t highestData = 0;				// Highest data position seen + 1
+		size_t symbolLength = 0;			// Length of the repair symbols
+
+		std::array<bool, 255> dataPresent = {};
+		std::array<bool, 255> repairPresent = {};
+		std::array<uint16_t, 255> symbolSizes = {};
+		std::vector<uint8_t> dataSymbols;		// Grown once, reused by the later blocks of this slot
+		std::vector<uint8_t> repairSymbols;
+	};
+
+	struct FecReceiverMembers {
+		std::function<void(uint8_t* packet, size_t packetSize)> deliver;
+		size_t symbolCapacity = 0;
+		std::vector<FecBlock> blocks;		// Indexed by block number % window
+		FecCodec xorCodec{ FEC_XOR };
+		FecCodec reedSolomonCodec{ FEC_REED_SOLOMON };
+
+		std::vector<uint8_t*> dataPointers = std::vector<uint8_t*>(255);
+		std::vector<const uint8_t*> repairPointers = std::vector<const uint8_t*>(255);
+		std::array<bool, 255> before = {};
+
+		// Readable from any thread
+		std::atomic<uint64_t> dataPackets = 0;
+		std::atomic<uint64_t> repairPackets = 0;
+		std::atomic<uint64_t> blocksDone = 0;
+		std::atomic<uint64_t> recovered = 0;
+		std::atomic<uint64_t> unrecoverable = 0;
+		std::atomic<uint64_t> invalid = 0;
+	};
+
+	static void FinalizeBlock(FecReceiverMembers& m, FecBlock& block) {
+		if (!block.used || block.complete)
+			return;
+
+		size_t expected = block.dataCount ? block.dataCount : block.highestData;
+		uint64_t lost = 0;
+		for (size_t i = 0; i < expected; i++) {
+			lost += !block.dataPresent[i];
+		}
+		m.unrecoverable.fetch_add(lost, std::memory_order_relaxed);
+	}
+
+	static void ResetBlock(FecBlock& block, const BlockHeader& header, size_t symbolCapacity) {
+		block.used = true;
+		block.complete = false;
+		block.id = header.block;
+		block.scheme = header.scheme;
+		block.dataCount = 0;
+		block.repairCount = 0;
+		block.highestData = 0;
+		block.symbolLength = 0;
+		block.dataPresent.fill(false);
+		block.repairPresent.fill(false);
+
+		// Data headers announce the configured block size, repair headers the final one which is not larger
+		block.dataSlots = header.index < header.dataCount ? header.dataCount : header.dataCount + header.repairCount;
+		if (block.dataSymbols.size() < block.dataSlots * symbolCapacity) {
+			block.dataSymbols.resize(block.dataSlots * symbolCapacity);
+		}
+		if (block.repairSymbols.size() < (size_t)header.repairCount * symbolCapacity) {
+			block.repairSymbols.resize((size_t)header.repairCount * symbolCapacity);
+		}
+	}
+
+	static void DeliverSymbol(FecReceiverMembers& m, uint8_t* symbol, size_t symbolSize) {
+		size_t length = ((size_t)symbol[0] << 8) | symbol[1];
+		if (LENGTH_SIZE + length > symbolSize) {
+			m.invalid.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+		m.deliver(symbol + LENGTH_SIZE, length);
+	}
+
+	static void TryRecover(FecReceiverMembers& m, FecBlock& block) {
+		if (block.complete || block.dataCount == 0)
+			return;
+
+		size_t dataReceived = 0;
+		size_t repairReceived = 0;
+		for (size_t i = 0; i < block.dataCount; i++) {
+			dataReceived += block.dataPresent[i];
+		}
+		for (size_t r = 0; r < block.repairCount; r++) {
+			repairReceived += block.repairPresent[r];
+		}
+
+		if (dataReceived == block.dataCount) {
+			block.complete = true;
+			m.blocksDone.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+		if (block.scheme == FEC_REED_SOLOMON && dataReceived + repairReceived < block.dataCount)
+			return;
+		if (repairReceived == 0)
+			return;
+
+		for (size_t i = 0; i < block.dataCount; i++) {
+			uint8_t* symbol = block.dataSymbols.data() + i * m.symbolCapacity;
+			if (block.dataPresent[i] && block.symbolSizes[i] < block.symbolLength) {
+				memset(symbol + block.symbolSizes[i], 0, block.symbolLength - block.symbolSizes[i]);
+			}
+			m.dataPointers[i] = symbol;
+			m.before[i] = block.dataPresent[i];
+		}
+		for (size_t r = 0; r < block.repairCount; r++) {
+			m.repairPointers[r] = block.repairSymbols.data() + r * m.symbolCapacity;
+		}
+
+		FecCodec& codec = block.scheme == FEC_XOR ? m.xorCodec : m.reedSolomonCodec;
+		bool complete = codec.Decode(m.dataPointers.data(), block.dataPresent.data(), block.dataCount,
+			m.repairPointers.data(), block.repairPresent.data(), block.repairCount, block.symbolLength);
+
+		for (size_t i = 0; i < block.dataCount; i++) {
+			if (!m.before[i] && block.dataPresent[i]) {
+				block.symbolSizes[i] = (uint16_t)block.symbolLength;
+				m.recovered.fetch_add(1, std::memory_order_relaxed);
+				DeliverSymbol(m, m.dataPointers[i], block.symbolLength);
+			}
+		}
+
+		if (complete) {
+			block.complete = true;
+			m.blocksDone.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+
+	FecReceiver::FecReceiver(std::function<void(uint8_t* packet, size_t packetSize)> deliver, const FecOptions& options, size_t window)
+		: members(new FecReceiverMembers())
+	{
+		ValidateOptions(options);
+		members->deliver = std::move(deliver);
+		members->symbolCapacity = LENGTH_SIZE + options.maxPacketSize;
+		members->blocks.resize(std::max<size_t>(window, 1));
+	}
+
+	FecReceiver::~FecReceiver() {
+	}
+
+	void FecReceiver::OnPacket(uint8_t* packet, size_t packetSize) {
+		FecReceiverMembers& m = *members.get();
+
+		BlockHeader header;
+		size_t symbolSize = packetSize - BLOCK_HEADER_SIZE;
+		if (!ReadBlockHeader(packet, packetSize, header) || symbolSize < LENGTH_SIZE || symbolSize > m.symbolCapacity) {
+			m.invalid.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+
+		FecBlock& block = m.blocks[header.block % m.blocks.size()];
+		if (!block.used || block.id != header.block) {
+			if (block.used && (int32_t)(header.block - block.id) < 0) {
+				m.invalid.fetch_add(1, std::memory_order_relaxed);		// Its block already left the window
+				return;
+			}
+			FinalizeBlock(m, block);
+			ResetBlock(block, header, m.symbolCapacity);
+		}
+
+		uint8_t* symbol = packet + BLOCK_HEADER_SIZE;
+		if (header.index < header.dataCount && header.index < block.dataSlots) {
+			if (block.dataPresent[header.index])
+				return;		// Duplicate, or recovered before it arrived
+
+			m.dataPackets.fetch_add(1, std::memory_order_relaxed);
+			memcpy(block.dataSymbols.data() + header.index * m.symbolCapacity, symbol, symbolSize);
+			block.symbolSizes[header.index] = (uint16_t)symbolSize;
+			block.dataPresent[header.index] = true;
+			block.highestData = std::max<size_t>(block.highestData, header.index + 1);
+
+			// Right away, recovery only ever adds the lost ones
+			DeliverSymbol(m, symbol, symbolSize);
+		}
+		else if (header.index >= header.dataCount) {
+			size_t repairIndex = header.index - header.dataCount;
+			bool consistent = header.dataCount <= block.dataSlots && (block.dataCount == 0 ||
+				(block.dataCount == header.dataCount && block.repairCount == header.repairCount && block.symbolLength == symbolSize));
+			if (!consistent || repairIndex * m.symbolCapacity >= block.repairSymbols.size()) {
+				m.invalid.fetch_add(1, std::memory_order_relaxed);
+				return;
+			}
+			if (block.repairPresent[repairIndex])
+				return;
+
+			m.repairPackets.fetch_add(1, std::memory_order_relaxed);
+			block.dataCount = header.dataCount;
+			block.repairCount = header.repairCount;
+			block.symbolLength = symbolSize;
+			memcpy(block.repairSymbols.data() + repairIndex * m.symbolCapacity, symbol, symbolSize);
+			block.repairPresent[repairIndex] = true;
+		}
+		else {
+			m.invalid.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+
+		TryRecover(m, block);
+	}
+
+	FecStatistics FecReceiver::GetStatistics() {
+		FecStatistics statistics;
+		statistics.dataPackets = members->dataPackets.load(std::memory_order_relaxed);
+		statistics.repairPackets = members->repairPackets.load(std::memory_order_relaxed);
+		statistics.blocks = members->blocksDone.load(std::memory_order_relaxed);
+		statistics.recovered = members->recovered.load(std::memory_order_relaxed);
+		statistics.unrecoverable = members->unrecoverable.load(std::memory_order_relaxed);
+		statistics.invalid = members->invalid.load(std::memory_order_relaxed);
+		return statistics;
+	}
+
+}
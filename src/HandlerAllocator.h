@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <utility>
+
+// Private header: Recycled memory for asio completion handlers, so re-arming an operation does not allocate.
+
+namespace NetLib {
+
+	// Storage for the outstanding operations of one socket or timer. Re-arming reuses the same blocks, so the
+	// event loop does not touch the heap once it runs. Two blocks cover an operation that is cancelled and
+	// re-armed before its handler ran, requests that don't fit go to the heap.
+	class HandlerMemory {
+	public:
+		HandlerMemory() = default;
+		HandlerMemory(const HandlerMemory&) = delete;
+		HandlerMemory& operator=(const HandlerMemory&) = delete;
+
+		void* Allocate(size_t size) {
+			for (Block& block : blocks) {
+				if (!block.inUse && size <= sizeof(block.storage)) {
+					block.inUse = true;
+					return &block.storage;
+				}
+			}
+			return ::operator new(size);
+		}
+
+		void Deallocate(void* pointer) {
+			for (Block& block : blocks) {
+				if (pointer == &block.storage) {
+					block.inUse = false;
+					return;
+				}
+			}
+			::operator delete(pointer);
+		}
+
+	private:
+		struct Block {
+			alignas(std::max_align_t) unsigned char storage[256];
+			bool inUse = false;
+		};
+
+		Block blocks[2];
+	};
+
+	template<typename T>
+	class HandlerAllocator {
+	public:
+		using value_type = T;
+
+		explicit HandlerAllocator(HandlerMemory& memory) : memory(&memory) {}
+
+		template<typename U>
+		HandlerAllocator(const HandlerAllocator<U>& other) noexcept : memory(other.memory) {}
+
+		T* allocate(size_t n) const { return static_cast<T*>(memory->Allocate(sizeof(T) * n)); }
+		void deallocate(T* pointer, size_t) const { memory->Deallocate(pointer); }
+
+		bool operator==(const HandlerAllocator& other) const noexcept { return memory == other.memory; }
+		bool operator!=(const HandlerAllocator& other) const noexcept { return memory != other.memory; }
+
+	private:
+		template<typename> friend class HandlerAllocator;
+		HandlerMemory* memory;
+	};
+
+	// Completion handler that carries its HandlerMemory as the associated allocator
+	template<typename Handler>
+	class AllocatingHandler {
+	public:
+		using allocator_type = HandlerAllocator<Handler>;
+
+		AllocatingHandler(HandlerMemory& memory, Handler handler) : memory(memory), handler(handler) {}
+
+		allocator_type get_allocator() const noexcept { return allocator_type(memory); }
+
+		template<typename... Args>
+		void operator()(Args&&... args) { handler(std::forward<Args>(args)...); }
+
+	private:
+		HandlerMemory& memory;
+		Handler handler;
+	};
+
+}
@@ -0,0 +1,834 @@
+
+#include "Http.h"
+
+#ifdef _WIN32
+#define _WIN32_WINNT _WIN32_WINNT_WIN10		// This sets the asio winsock library to Windows 10
+#define _WINSOCK_DEPRECATED_NO_WARNINGS
+#endif
+
+#include <asio.hpp>
+using asio::ip::tcp;
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include <unordered_map>
+#include <vector>
+#include <thread>
+#include <filesystem>
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+
+#include "Logging.h"
+
+namespace NetLib {
+
+	// ==========================
+	// ===      Helpers       ===
+	// ==========================
+
+	struct HttpUrl {
+		std::string host;
+		uint16_t port = 80;
+		std::string target = "/";
+		bool valid = false;
+
+		std::string Key() const {
+			return host + ":" + std::to_string(port);
+		}
+
+		std::string ToString() const {
+			return "http://" + host + (port != 80 ? ":" + std::to_string(port) : "") + target;
+		}
+	};
+
+	static HttpUrl ParseUrl(const std::string& url) {
+		HttpUrl result;
+
+		const std::string scheme = "http://";
+		if (url.compare(0, scheme.size(), scheme) != 0) {
+			LOG_WARN("[HttpClient]: Only plain http:// urls are supported: '{}'", url);
+			return result;
+		}
+
+		size_t hostBegin = scheme.size();
+		size_t targetBegin = url.find_first_of("/?#", hostBegin);
+		std::string authority = url.substr(hostBegin, targetBegin == std::string::npos ? std::string::npos : targetBegin - hostBegin);
+		if (authority.empty())
+			return result;
+
+		size_t colon = authority.rfind(':');
+		if (colon != std::string::npos && authority.find(']') == std::string::npos) {
+			int port = atoi(authority.c_str() + colon + 1);
+			if (port <= 0 || port > 65535)
+				return result;
+
+			result.port = (uint16_t)port;
+			authority.resize(colon);
+		}
+
+		result.host = authority;
+		if (targetBegin != std::string::npos) {
+			result.target = url.substr(targetBegin);
+			if (result.target[0] != '/') {
+				result.target = "/" + result.target;
+			}
+			result.target = result.target.substr(0, result.target.find('#'));
+		}
+
+		result.valid = true;
+		return result;
+	}
+
+	static HttpUrl ResolveLocation(const HttpUrl& base, const std::string& location) {
+		if (location.compare(0, 2, "//") == 0)
+			return ParseUrl("http:" + location);
+
+		if (location.find("://") != std::string::npos)
+			return ParseUrl(location);
+
+		HttpUrl result = base;
+		if (!location.empty() && location[0] == '/') {
+			result.target = location;
+		}
+		else {
+			result.target = base.target.substr(0, base.target.rfind('/') + 1) + location;
+		}
+		return result;
+	}
+
+	static bool IsRedirect(size_t status) {
+		return status == 301 || status == 302 || status == 303 || status == 307 || status == 308;
+	}
+
+	static bool EqualsIgnoreCase(const std::string& a, const char* b) {
+		size_t length = strlen(b);
+		if (a.size() != length)
+			return false;
+
+		for (size_t i = 0; i < length; i++) {
+			if (tolower((unsigned char)a[i]) != tolower((unsigned char)b[i]))
+				return false;
+		}
+		return true;
+	}
+
+	static bool ContainsIgnoreCase(std::string haystack, std::string needle) {
+		std::transform(haystack.begin(), haystack.end(), haystack.begin(), [](unsigned char c) { return (char)tolower(c); });
+		std::transform(needle.begin(), needle.end(), needle.begin(), [](unsigned char c) { return (char)tolower(c); });
+		return haystack.find(needle) != std::string::npos;
+	}
+
+	// Positional writes, so parallel range downloads can write into the same file without seeking
+	class HttpFile {
+	public:
+		HttpFile() = default;
+		~HttpFile() { Close(); }
+
+		bool Open(const std::string& path) {
+			std::error_code fileError;
+			std::filesystem::path parent = std::filesystem::path(path).parent_path();
+			if (!parent.empty()) {
+				std::filesystem::create_directories(parent, fileError);
+			}
+
+#ifdef _WIN32
+			handle = CreateFileA(path.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+			return handle != INVALID_HANDLE_VALUE;
+#else
+			fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+			return fd >= 0;
+#endif
+		}
+
+		bool Truncate(uint64_t size) {
+#ifdef _WIN32
+			LARGE_INTEGER position;
+			position.QuadPart = (LONGLONG)size;
+			return SetFilePointerEx(handle, position, nullptr, FILE_BEGIN) && SetEndOfFile(handle);
+#else
+			return ftruncate(fd, (off_t)size) == 0;
+#endif
+		}
+
+		bool WriteAt(const uint8_t* data, size_t length, uint64_t offset) {
+			while (length > 0) {
+#ifdef _WIN32
+				OVERLAPPED overlapped = {};
+				overlapped.Offset = (DWORD)(offset & 0xFFFFFFFF);
+				overlapped.OffsetHigh = (DWORD)(offset >> 32);
+				DWORD written = 0;
+				DWORD chunk = (DWORD)std::min(length, (size_t)0x40000000);
+				if (!WriteFile(handle, data, chunk, &written, &overlapped))
+					return false;
+#else
+				ssize_t written = pwrite(fd, data, length, (off_t)offset);
+				if (written < 0) {
+					if (errno == EINTR)
+						continue;
+					return false;
+				}
+#endif
+				data += written;
+				length -= (size_t)written;
+				offset += (uint64_t)written;
+			}
+			return true;
+		}
+
+		void Close() {
+#ifdef _WIN32
+			if (handle != INVALID_HANDLE_VALUE) {
+				CloseHandle(handle);
+				handle = INVALID_HANDLE_VALUE;
+			}
+#else
+			if (fd >= 0) {
+				::close(fd);
+				fd = -1;
+			}
+#endif
+		}
+
+	private:
+#ifdef _WIN32
+		HANDLE handle = INVALID_HANDLE_VALUE;
+#else
+		int fd = -1;
+#endif
+	};
+
+
+
+
+
+
+	// ===================================
+	// ===      Connection handling    ===
+	// ===================================
+
+	struct HttpConnection {
+		tcp::socket socket;
+		std::string key;
+		bool reused = false;
+
+		// Receive buffer, the body is handed to the caller straight from here
+		std::vector<uint8_t> buffer;
+		size_t begin = 0;
+		size_t end = 0;
+
+		HttpConnection(asio::io_service& ioService) : socket(ioService) {
+			buffer.resize(16 * 1024);
+		}
+
+		size_t Available() const {
+			return end - begin;
+		}
+
+		// Receives more data, returns false on EOF or error
+		bool Fill() {
+			if (begin == end) {
+				begin = end = 0;
+			}
+			else if (end == buffer.size()) {
+				if (begin == 0) {
+					if (buffer.size() >= 64 * 1024)		// A single header line does not fit
+						return false;
+					buffer.resize(buffer.size() * 2);
+				}
+				else {
+					memmove(&buffer[0], &buffer[begin], end - begin);
+					end -= begin;
+					begin = 0;
+				}
+			}
+
+			std::error_code error;
+			size_t bytes = socket.read_some(asio::buffer(&buffer[end], buffer.size() - end), error);
+			if (error || bytes == 0)
+				return false;
+
+			end += bytes;
+			return true;
+		}
+
+		bool ReadLine(std::string& line) {
+			size_t scanned = 0;
+			while (true) {
+				const uint8_t* start = &buffer[0] + begin;
+				for (size_t i = scanned; i + 1 < Available(); i++) {
+					if (start[i] == '\r' && start[i + 1] == '\n') {
+						line.assign((const char*)start, i);
+						begin += i + 2;
+						return true;
+					}
+				}
+				scanned = Available() > 0 ? Available() - 1 : 0;
+				if (!Fill())
+					return false;
+			}
+		}
+	};
+
+	struct HttpResponseHead {
+		size_t status = 0;
+		std::string reason;
+		int64_t contentLength = -1;
+		bool chunked = false;
+		bool keepAlive = true;
+		bool acceptRanges = false;
+		std::string location;
+
+		// Content-Range of a 206 reply, -1 if missing or malformed
+		int64_t rangeFirst = -1;
+		int64_t rangeLast = -1;
+		int64_t rangeSize = -1;		// -1 also for an unknown size ("bytes 0-99/*")
+	};
+
+	// "bytes first-last/size"
+	static void ParseContentRange(const std::string& value, HttpResponseHead& head) {
+		unsigned long long first = 0, last = 0;
+		char size[24] = {};
+		if (sscanf(value.c_str(), "bytes %llu-%llu/%23s", &first, &last, size) != 3 || last < first)
+			return;
+
+		head.rangeFirst = (int64_t)first;
+		head.rangeLast = (int64_t)last;
+		head.rangeSize = size[0] == '*' ? -1 : (int64_t)strtoll(size, nullptr, 10);
+	}
+
+	using HttpBodyCallback = std::function<bool(const uint8_t* data, size_t length)>;
+
+	// Sees the head of the final response before its body. Returning false skips the body, the connection
+	// is closed instead of being pooled.
+	using HttpHeadCallback = std::function<bool(const HttpResponseHead& head)>;
+
+	struct HttpClientMembers {
+		asio::io_service ioService;
+		size_t maxIdlePerHost = 0;
+
+		std::mutex poolMutex;
+		std::unordered_map<std::string, std::vector<std::unique_ptr<HttpConnection>>> idleConnections;
+
+		std::unique_ptr<HttpConnection> Acquire(const HttpUrl& url, bool allowReuse) {
+			if (allowReuse) {
+				std::lock_guard<std::mutex> guard(poolMutex);
+				auto it = idleConnections.find(url.Key());
+				if (it != idleConnections.end() && !it->second.empty()) {
+					auto connection = std::move(it->second.back());
+					it->second.pop_back();
+					connection->reused = true;
+					return connection;
+				}
+			}
+
+			auto connection = std::make_unique<HttpConnection>(ioService);
+			connection->key = url.Key();
+
+			std::error_code error;
+			tcp::resolver resolver(ioService);
+			auto endpoints = resolver.resolve(url.host, std::to_string(url.port), error);
+			if (error) {
+				LOG_WARN("[HttpClient]: Failed to resolve '{}': {}", url.host, error.message());
+				return nullptr;
+			}
+
+			asio::connect(connection->socket, endpoints, error);
+			if (error) {
+				LOG_WARN("[HttpClient]: Failed to connect to {}: {}", url.Key(), error.message());
+				return nullptr;
+			}
+
+			connection->socket.set_option(tcp::no_delay(true), error);
+			LOG_DEBUG("[HttpClient]: Opened connection to {}", url.Key());
+			return connection;
+		}
+
+		void Release(std::unique_ptr<HttpConnection> connection) {
+			std::lock_guard<std::mutex> guard(poolMutex);
+			auto& idle = idleConnections[connection->key];
+			if (idle.size() < maxIdlePerHost) {
+				idle.push_back(std::move(connection));
+			}
+		}
+
+		bool ReadHead(HttpConnection& connection, HttpResponseHead& head) {
+			std::string line;
+			if (!connection.ReadLine(line))
+				return false;
+
+			// Status line: HTTP/1.1 200 OK
+			size_t first = line.find(' ');
+			if (first == std::string::npos || line.compare(0, 5, "HTTP/") != 0)
+				return false;
+
+			head.status = (size_t)atoi(line.c_str() + first + 1);
+			size_t second = line.find(' ', first + 1);
+			head.reason = second != std::string::npos ? line.substr(second + 1) : "";
+			head.keepAlive = line.compare(0, 8, "HTTP/1.0") != 0;
+
+			while (true) {
+				if (!connection.ReadLine(line))
+					return false;
+
+				if (line.empty())
+					return true;
+
+				size_t colon = line.find(':');
+				if (colon == std::string::npos)
+					continue;
+
+				std::string name = line.substr(0, colon);
+				size_t valueBegin = line.find_first_not_of(" \t", colon + 1);
+				std::string value = valueBegin != std::string::npos ? line.substr(valueBegin) : "";
+
+				if (EqualsIgnoreCase(name, "Content-Length")) {
+					head.contentLength = (int64_t)strtoll(value.c_str(), nullptr, 10);
+				}
+				else if (EqualsIgnoreCase(name, "Transfer-Encoding")) {
+					head.chunked = ContainsIgnoreCase(value, "chunked");
+				}
+				else if (EqualsIgnoreCase(name, "Connection")) {
+					if (ContainsIgnoreCase(value, "close"))
+						head.keepAlive = false;
+					else if (ContainsIgnoreCase(value, "keep-alive"))
+						head.keepAlive = true;
+				}
+				else if (EqualsIgnoreCase(name, "Accept-Ranges")) {
+					head.acceptRanges = ContainsIgnoreCase(value, "bytes");
+				}
+				else if (EqualsIgnoreCase(name, "Location")) {
+					head.location = value;
+				}
+				else if (EqualsIgnoreCase(name, "Content-Range")) {
+					ParseContentRange(value, head);
+				}
+			}
+		}
+
+		// Hands exactly 'length' bytes to the callback, straight from the receive buffer
+		bool ForwardBody(HttpConnection& connection, uint64_t length, const HttpBodyCallback& onData, bool& cancelled) {
+			while (length > 0) {
+				if (connection.Available() == 0 && !connection.Fill())
+					return false;
+
+				size_t chunk = (size_t)std::min<uint64_t>(length, connection.Available());
+				if (!cancelled && onData && !onData(&connection.buffer[connection.begin], chunk)) {
+					cancelled = true;
+				}
+				connection.begin += chunk;
+				length -= chunk;
+
+				if (cancelled)
+					return false;
+			}
+			return true;
+		}
+
+		bool ReadBody(HttpConnection& connection, HttpResponseHead& head, bool noBody, const HttpBodyCallback& onData, bool& cancelled) {
+			if (noBody || head.status / 100 == 1 || head.status == 204 || head.status == 304)
+				return true;
+
+			if (head.chunked) {
+				std::string line;
+				while (true) {
+					if (!connection.ReadLine(line))
+						return false;
+
+					uint64_t size = strtoull(line.c_str(), nullptr, 16);
+					if (size == 0)
+						break;
+
+					if (!ForwardBody(connection, size, onData, cancelled))
+						return false;
+
+					if (!connection.ReadLine(line))		// CRLF after every chunk
+						return false;
+				}
+
+				do {	// Skip trailers
+					if (!connection.ReadLine(line))
+						return false;
+				} while (!line.empty());
+
+				return true;
+			}
+
+			if (head.contentLength >= 0)
+				return ForwardBody(connection, (uint64_t)head.contentLength, onData, cancelled);
+
+			// Neither length nor chunked: The body ends when the server closes the connection
+			head.keepAlive = false;
+			while (!cancelled) {
+				if (connection.Available() == 0 && !connection.Fill())
+					return true;
+
+				if (onData && !onData(&connection.buffer[connection.begin], connection.Available())) {
+					cancelled = true;
+				}
+				connection.begin = connection.end;
+			}
+			return false;
+		}
+
+		// Sends a single request over a pooled connection. Redirect bodies are discarded, every other body
+		// is streamed into 'onData'. A stale keep-alive connection is replaced once transparently.
+		std::optional<HttpResponseHead> Request(const HttpUrl& url, const char* method, const std::string& range,
+			const HttpBodyCallback& onData, bool& cancelled, const HttpHeadCallback& onHead = nullptr)
+		{
+			std::string request = std::string(method) + " " + url.target + " HTTP/1.1\r\n"
+				"Host: " + url.host + (url.port != 80 ? ":" + std::to_string(url.port) : "") + "\r\n"
+				"User-Agent: NetLib\r\n"
+				"Accept-Encoding: identity\r\n"
+				"Connection: keep-alive\r\n";
+			if (!range.empty()) {
+				request += "Range: bytes=" + range + "\r\n";
+			}
+			request += "\r\n";
+
+			bool noBody = strcmp(method, "HEAD") == 0;
+
+			for (int attempt = 0; attempt < 2; attempt++) {
+				auto connection = Acquire(url, attempt == 0);
+				if (!connection)
+					return std::nullopt;
+
+				std::error_code error;
+				asio::write(connection->socket, asio::buffer(request), error);
+
+				HttpResponseHead head;
+				if (error || !ReadHead(*connection, head)) {
+					if (connection->reused) {
+						LOG_DEBUG("[HttpClient]: Pooled connection to {} went stale, reconnecting", url.Key());
+						continue;
+					}
+					LOG_WARN("[HttpClient]: No valid response from {}", url.Key());
+					return std::nullopt;
+				}
+
+				bool redirect = IsRedirect(head.status) && !head.location.empty();
+				if (!redirect && onHead && !onHead(head))
+					return head;
+
+				if (!ReadBody(*connection, head, noBody, redirect ? HttpBodyCallback() : onData, cancelled)) {
+					if (!cancelled) {
+						LOG_WARN("[HttpClient]: Connection to {} broke while receiving the body", url.Key());
+					}
+					return cancelled ? std::make_optional(head) : std::nullopt;
+				}
+
+				if (head.keepAlive) {
+					Release(std::move(connection));
+				}
+				return head;
+			}
+
+			return std::nullopt;
+		}
+
+		// Follows up to 'maxRedirects' redirects, 'url' is updated to the final location
+		std::optional<HttpResponseHead> RequestFollow(HttpUrl& url, const char* method, size_t maxRedirects,
+			const HttpBodyCallback& onData, bool& cancelled, const HttpHeadCallback& onHead = nullptr)
+		{
+			for (size_t redirects = 0; ; redirects++) {
+				LOG_DEBUG("[HttpClient]: {} {}", method, url.ToString());
+				auto head = Request(url, method, "", onData, cancelled, onHead);
+				if (!head.has_value() || cancelled)
+					return head;
+
+				if (!IsRedirect(head->status) || head->location.empty())
+					return head;
+
+				if (redirects >= maxRedirects) {
+					LOG_WARN("[HttpClient]: Giving up after {} redirects", redirects);
+					return head;
+				}
+
+				url = ResolveLocation(url, head->location);
+				if (!url.valid)
+					return std::nullopt;
+
+				LOG_DEBUG("[HttpClient]: Following redirect to {}", url.ToString());
+			}
+		}
+
+		bool DownloadRanges(const HttpUrl& url, HttpFile& file, uint64_t size, const HttpDownloadOptions& options, bool& rangeUnsupported) {
+			size_t parts = std::max<size_t>(options.parallelConnections, 1);
+			uint64_t partSize = (size + parts - 1) / parts;
+
+			std::atomic<bool> failed = false;
+			std::atomic<bool> cancelled = false;
+			std::atomic<bool> unsupported = false;
+			std::atomic<uint64_t> progress = 0;
+			std::mutex progressMutex;
+
+			auto downloadPart = [&](uint64_t first, uint64_t last) {
+				uint64_t offset = first;
+				bool partCancelled = false;
+				bool mismatch = false;
+
+				// A server that ignores ranges answers 200 with the whole file. A 206 for any other range than the
+				// requested one would put its bytes at the wrong offset, both fall back to a single request.
+				auto checkRange = [&](const HttpResponseHead& head) {
+					if (head.status == 206 && head.rangeFirst == (int64_t)first && head.rangeLast == (int64_t)last &&
+						head.rangeSize == (int64_t)size)
+						return true;
+
+					if (head.status == 206) {
+						LOG_WARN("[HttpClient]: Asked {} for bytes {}-{}/{}, got {}-{}/{}", url.Key(), first, last, size,
+							head.rangeFirst, head.rangeLast, head.rangeSize);
+					}
+					mismatch = true;
+					return false;
+				};
+
+				auto head = Request(url, "GET", std::to_string(first) + "-" + std::to_string(last),
+					[&](const uint8_t* data, size_t length) {
+						if (failed || cancelled)
+							return false;
+
+						if (offset + length > last + 1 || !file.WriteAt(data, length, offset)) {
+							failed = true;
+							return false;
+						}
+						offset += length;
+
+						uint64_t current = progress += length;
+						if (options.onProgress) {
+							std::lock_guard<std::mutex> guard(progressMutex);
+							if (!options.onProgress(current, size)) {
+								cancelled = true;
+								return false;
+							}
+						}
+						return true;
+					}, partCancelled, checkRange);
+
+				if (mismatch) {
+					unsupported = true;
+					failed = true;
+				}
+				else if (!head.has_value() || offset != last + 1) {
+					failed = true;
+				}
+			};
+
+			std::vector<std::thread> threads;
+			for (size_t i = 1; i < parts; i++) {
+				uint64_t first = i * partSize;
+				if (first >= size)
+					break;
+				threads.emplace_back(downloadPart, first, std::min(first + partSize, size) - 1);
+			}
+			downloadPart(0, std::min(partSize, size) - 1);
+
+			for (auto& thread : threads) {
+				thread.join();
+			}
+
+			rangeUnsupported = unsupported && !cancelled;
+			return !failed && !cancelled;
+		}
+	};
+
+
+
+
+
+
+	// ================================
+	// ===      HttpClient Class    ===
+	// ================================
+
+	HttpClient::HttpClient(size_t maxIdleConnectionsPerHost) : members(new HttpClientMembers()) {
+		members->maxIdlePerHost = maxIdleConnectionsPerHost;
+		LOG_DEBUG("[HttpClient]: Instance constructed");
+	}
+
+	HttpClient::~HttpClient() {
+		ClearConnectionPool();
+		LOG_DEBUG("[HttpClient]: Instance destructed");
+	}
+
+	void HttpClient::ClearConnectionPool() {
+		std::lock_guard<std::mutex> guard(members->poolMutex);
+		members->idleConnections.clear();
+	}
+
+	std::optional<HttpResponse> HttpClient::Get(const std::string& url, size_t maxRedirects) {
+		std::string body;
+		auto response = GetChunked(url, [&](const char* data, size_t length) {
+			body.append(data, length);
+			return true;
+		}, nullptr, maxRedirects);
+
+		if (!response.has_value())
+			return std::nullopt;
+
+		response->body = std::move(body);
+		return response;
+	}
+
+	std::optional<HttpResponse> HttpClient::GetChunked(const std::string& url,
+		std::function<bool(const char* data, size_t length)> onReceiveCallback,
+		HttpProgressCallback onProgressCallback, size_t maxRedirects)
+	{
+		HttpUrl parsed = ParseUrl(url);
+		if (!parsed.valid) {
+			LOG_WARN("[HttpClient]: Invalid url '{}'", url);
+			return std::nullopt;
+		}
+
+		uint64_t progress = 0;
+		uint64_t total = 0;
+		bool cancelled = false;
+
+		auto head = members->RequestFollow(parsed, "GET", maxRedirects, [&](const uint8_t* data, size_t length) {
+			progress += length;
+			if (onReceiveCallback && !onReceiveCallback((const char*)data, length))
+				return false;
+			if (onProgressCallback && !onProgressCallback(progress, total))
+				return false;
+			return true;
+		}, cancelled, [&](const HttpResponseHead& head) {
+			total = head.contentLength > 0 ? (uint64_t)head.contentLength : 0;
+			return true;
+		});
+
+		if (!head.has_value() || cancelled)
+			return std::nullopt;
+
+		return std::make_optional(HttpResponse("", head->status, head->reason));
+	}
+
+	std::string HttpClient::DownloadToBuffer(const std::string& url, HttpProgressCallback onProgressCallback, size_t maxRedirects) {
+		std::string buffer;
+
+		auto response = GetChunked(url, [&](const char* data, size_t length) {
+			buffer.append(data, length);
+			return true;
+		}, onProgressCallback, maxRedirects);
+
+		if (!response.has_value() || response->status / 100 != 2)
+			return "";
+
+		return buffer;
+	}
+
+	bool HttpClient::DownloadToFile(const std::string& url, const std::string& targetFile, const HttpDownloadOptions& options) {
+		HttpUrl parsed = ParseUrl(url);
+		if (!parsed.valid) {
+			LOG_WARN("[HttpClient]: Invalid url '{}'", url);
+			return false;
+		}
+
+		HttpFile file;
+		if (!file.Open(targetFile)) {
+			LOG_WARN("[HttpClient]: Failed to open '{}' for writing", targetFile);
+			return false;
+		}
+
+		auto failed = [&]() {
+			LOG_DEBUG("[HttpClient]: Download failed, removing file from disk");
+			file.Close();
+			std::error_code fileError;
+			std::filesystem::remove(targetFile, fileError);
+			return false;
+		};
+
+		// Ask for the size first, large files that support ranges are downloaded in parallel
+		bool cancelled = false;
+		if (options.parallelConnections > 1) {
+			HttpUrl resolved = parsed;
+			auto head = members->RequestFollow(resolved, "HEAD", options.maxRedirects, nullptr, cancelled);
+			if (head.has_value() && head->status == 200 && head->acceptRanges &&
+				head->contentLength > 0 && (uint64_t)head->contentLength >= options.parallelThreshold)
+			{
+				uint64_t size = (uint64_t)head->contentLength;
+				bool rangeUnsupported = false;
+				LOG_DEBUG("[HttpClient]: Downloading {} bytes in {} parallel ranges", size, options.parallelConnections);
+
+				if (file.Truncate(size) && members->DownloadRanges(resolved, file, size, options, rangeUnsupported))
+					return true;
+
+				if (!rangeUnsupported)
+					return failed();
+
+				LOG_DEBUG("[HttpClient]: Server ignored the range requests, falling back to a single request");
+				file.Truncate(0);
+			}
+		}
+
+		uint64_t offset = 0;
+		uint64_t total = 0;
+		bool writeFailed = false;
+		auto head = members->RequestFollow(parsed, "GET", options.maxRedirects, [&](const uint8_t* data, size_t length) {
+			if (!file.WriteAt(data, length, offset)) {
+				writeFailed = true;
+				return false;
+			}
+			offset += length;
+
+			if (options.onProgress && !options.onProgress(offset, total))
+				return false;
+			return true;
+		}, cancelled, [&](const HttpResponseHead& head) {
+			total = head.contentLength > 0 ? (uint64_t)head.contentLength : 0;
+			return true;
+		});
+
+		if (!head.has_value() || cancelled || writeFailed || head->status / 100 != 2)
+			return failed();
+
+		return true;
+	}
+
+
+
+
+
+
+	// =====================================
+	// ===      Free HTTP functions      ===
+	// =====================================
+
+	static HttpClient& DefaultHttpClient() {
+		static HttpClient client;
+		return client;
+	}
+
+	std::pair<std::string, std::string> SplitUrl(const std::string& url) {
+		HttpUrl parsed = ParseUrl(url);
+		if (!parsed.valid)
+			return std::make_pair("", "");
+
+		std::string hostname = "http://" + parsed.host + (parsed.port != 80 ? ":" + std::to_string(parsed.port) : "");
+		return std::make_pair(hostname, parsed.target);
+	}
+
+	std::optional<HttpResponse> GetHttpRequest(const std::string& url, bool followRedirect) {
+		return DefaultHttpClient().Get(url, followRedirect ? NETLIB_HTTP_MAX_REDIRECTS : 0);
+	}
+
+	std::optional<HttpResponse> GetHttpRequestChunked(const std::string& url,
+		std::function<bool(const char* data, size_t length)> onReceiveCallback,
+		HttpProgressCallback onProgressCallback, bool followRedirect)
+	{
+		return DefaultHttpClient().GetChunked(url, onReceiveCallback, onProgressCallback, followRedirect ? NETLIB_HTTP_MAX_REDIRECTS : 0);
+	}
+
+	std::string DownloadUrlToBuffer(const std::string& url, HttpProgressCallback onProgressCallback, bool followRedirect) {
+		return DefaultHttpClient().DownloadToBuffer(url, onProgressCallback, followRedirect ? NETLIB_HTTP_MAX_REDIRECTS : 0);
+	}
+
+	bool DownloadUrlToFile(const std::string& url, const std::string& targetFile, HttpProgressCallback onProgressCallback, bool followRedirect) {
+		HttpDownloadOptions options;
+		options.onProgress = onProgressCallback;
+		options.maxRedirects = followRedirect ? NETLIB_HTTP_MAX_REDIRECTS : 0;
+		return DefaultHttpClient().DownloadToFile(url, targetFile, options);
+	}
+
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "spdlog/spdlog.h"
+#include "spdlog/sinks/stdout_color_sinks.h"
+#include "spdlog/sinks/basic_file_sink.h"
+#include "spdlog/sinks/rotating_file_sink.h"
+
+// Private header: Shared by all NetLib source files, never include it from the public headers.
+
+// TODO: Make logging more fool-proof (and check if name already exists, prevent crashes)
+
+#ifndef DEPLOY
+
+#define LOG_SET_LOGLEVEL(...)			NetLib::logger->set_level(__VA_ARGS__)
+#define INIT_LOGGER()			        {	if (!NetLib::logger) {	\
+												spdlog::set_pattern("%^[%T] %n: %v%$"); \
+												NetLib::logger = spdlog::stdout_color_mt("NetLib"); \
+												LOG_SET_LOGLEVEL(spdlog::level::trace); \
+											} \
+										}
+
+#define LOG_TRACE(...)					{ INIT_LOGGER(); NetLib::logger->trace(__VA_ARGS__);			 }
+#define LOG_WARN(...)					{ INIT_LOGGER(); NetLib::logger->warn(__VA_ARGS__);				 }
+#define LOG_DEBUG(...)					{ INIT_LOGGER(); NetLib::logger->debug(__VA_ARGS__);			 }
+#define LOG_INFO(...)					{ INIT_LOGGER(); NetLib::logger->info(__VA_ARGS__);				 }
+#define LOG_ERROR(...)					{ INIT_LOGGER(); NetLib::logger->error(__VA_ARGS__);			 }
+#define LOG_CRITICAL(...)				{ INIT_LOGGER(); NetLib::logger->critical(__VA_ARGS__);			 }
+
+// For hot paths: Skip building the log arguments entirely if they would be discarded
+#define LOG_ENABLED(level)				(NetLib::logger && NetLib::logger->should_log(level))
+
+#else
+
+#define LOG_SET_LOGLEVEL(...)			{ ; }
+
+#define LOG_TRACE(...)					{ ; }
+#define LOG_WARN(...)					{ ; }
+#define LOG_DEBUG(...)					{ ; }
+#define LOG_INFO(...)					{ ; }
+#define LOG_ERROR(...)					{ ; }
+#define LOG_CRITICAL(...)				{ ; }
+
+#define LOG_ENABLED(level)				(false)
+
+#endif
+
+namespace NetLib {
+
+	extern std::shared_ptr<spdlog::logger> logger;
+
+}
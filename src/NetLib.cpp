@@ -9,44 +9,36 @@
 #include <asio.hpp>
 using asio::ip::udp;
 
-#include "spdlog/spdlog.h"
-#include "spdlog/sinks/stdout_color_sinks.h"
-#include "spdlog/sinks/basic_file_sink.h"
-#include "spdlog/sinks/rotating_file_sink.h"
-
-using namespace std::placeholders;
-
-// TODO: Make logging more fool-proof (and check if name already exists, prevent crashes)
-
-#ifndef DEPLOY
-
-#define LOG_SET_LOGLEVEL(...)			NetLib::logger->set_level(__VA_ARGS__)
-#define INIT_LOGGER()			        {	if (!NetLib::logger) {	\
-												spdlog::set_pattern("%^[%T] %n: %v%$"); \
-												NetLib::logger = spdlog::stdout_color_mt("NetLib"); \
-												LOG_SET_LOGLEVEL(spdlog::level::trace); \
-											} \
-										}
-
-#define LOG_TRACE(...)					{ INIT_LOGGER(); NetLib::logger->trace(__VA_ARGS__);			 }
-#define LOG_WARN(...)					{ INIT_LOGGER(); NetLib::logger->warn(__VA_ARGS__);				 }
-#define LOG_DEBUG(...)					{ INIT_LOGGER(); NetLib::logger->debug(__VA_ARGS__);			 }
-#define LOG_INFO(...)					{ INIT_LOGGER(); NetLib::logger->info(__VA_ARGS__);				 }
-#define LOG_ERROR(...)					{ INIT_LOGGER(); NetLib::logger->error(__VA_ARGS__);			 }
-#define LOG_CRITICAL(...)				{ INIT_LOGGER(); NetLib::logger->critical(__VA_ARGS__);			 }
+#ifdef __linux__
+#include <sys/socket.h>
+#include <linux/net_tstamp.h>
+#include <linux/errqueue.h>
+#include <linux/rtnetlink.h>
+#include <linux/pkt_sched.h>
+#include <ifaddrs.h>
+#include <net/if.h>
+#include <unistd.h>
+#include <sched.h>
+#endif
 
-#else
+#include <chrono>
+#include <thread>
+#include <deque>
+#include <span>
 
-#define LOG_SET_LOGLEVEL(...)			{ ; }
+#include "TokenBucket.h"
+#include "SocketFilter.h"
+#include "TrafficLog.h"
+#include "BasicUDPServer.h"
+#include "HandlerAllocator.h"
+#include "EventLoopTimers.h"
+#include "SharedMemory.h"
+#include "Tracing.h"
+#include "Resolver.h"
 
-#define LOG_TRACE(...)					{ ; }
-#define LOG_WARN(...)					{ ; }
-#define LOG_DEBUG(...)					{ ; }
-#define LOG_INFO(...)					{ ; }
-#define LOG_ERROR(...)					{ ; }
-#define LOG_CRITICAL(...)				{ ; }
+#include "Logging.h"
 
-#endif
+using namespace std::placeholders;
 
 namespace NetLib {
 
@@ -80,15 +72,150 @@ namespace NetLib {
 	// ===      NetLib::SendUDP       ===
 	// ==================================
 
-	bool SendUDP(const asio::ip::address& ipAddress, uint16_t port, uint8_t* data, size_t length, bool broadcastPermissions) {
+	// "1, 2, 3" for the trace log
+	static std::string BytesToString(const uint8_t* data, size_t length) {
+		std::string str;
+		for (size_t i = 0; i < length; i++) {
+			if (i > 0) {
+				str += ", ";
+			}
+			str += std::to_string(data[i]);
+		}
+		return str;
+	}
+
+	// A datagram gathered from several buffers, as an asio buffer sequence on the stack. Asio passes at most
+	// 64 buffers to the kernel and silently drops the rest, so more are refused here.
+	struct GatherBuffers {
+		std::array<asio::const_buffer, NETLIB_MAX_DATAGRAM_BUFFERS> buffers;
+		size_t count = 0;
+		size_t length = 0;
+
+		GatherBuffers(const ConstBuffer* data, size_t count) : count(count) {
+			if (count > NETLIB_MAX_DATAGRAM_BUFFERS)
+				throw std::runtime_error("A datagram can be gathered from at most " + std::to_string(NETLIB_MAX_DATAGRAM_BUFFERS) + " buffers");
+			for (size_t i = 0; i < count; i++) {
+				buffers[i] = asio::const_buffer(data[i].data, data[i].size);
+				length += data[i].size;
+			}
+		}
+
+		std::span<const asio::const_buffer> Sequence() const {
+			return { buffers.data(), count };
+		}
+	};
+
+	// The counterpart for receives, a datagram scattered over several buffers
+	struct ScatterBuffers {
+		std::array<asio::mutable_buffer, NETLIB_MAX_DATAGRAM_BUFFERS> buffers;
+		size_t count = 0;
+		size_t capacity = 0;
+
+		ScatterBuffers(const MutableBuffer* data, size_t count) : count(count) {
+			if (count > NETLIB_MAX_DATAGRAM_BUFFERS)
+				throw std::runtime_error("A datagram can be scattered over at most " + std::to_string(NETLIB_MAX_DATAGRAM_BUFFERS) + " buffers");
+			for (size_t i = 0; i < count; i++) {
+				buffers[i] = asio::mutable_buffer(data[i].data, data[i].size);
+				capacity += data[i].size;
+			}
+		}
+
+		std::span<const asio::mutable_buffer> Sequence() const {
+			return { buffers.data(), count };
+		}
+	};
+
+	// The datagram in one piece, only for the trace log
+	static std::vector<uint8_t> JoinBuffers(const ConstBuffer* buffers, size_t count) {
+		std::vector<uint8_t> joined;
+		for (size_t i = 0; i < count; i++) {
+			const uint8_t* data = (const uint8_t*)buffers[i].data;
+			joined.insert(joined.end(), data, data + buffers[i].size);
+		}
+		return joined;
+	}
+
+	static asio::ip::address ToAsioAddress(IPv4Address address) {
+		return asio::ip::address_v4(address.ToUint());
+	}
+
+	static asio::ip::address ToAsioAddress(const IPv6Address& address) {
+		return asio::ip::address_v6(address.ToBytes());
+	}
+
+	// Dotted IPv4 strings are parsed without a detour through the socket API. Anything that is not an address is
+	// a hostname for the default resolver, IPv4 addresses are preferred. Without 'waitForLookup' only the cache
+	// answers, so a send path never blocks on DNS: An expired result is used while it is refreshed, a name that
+	// was never resolved starts the lookup in the background and throws.
+	static asio::ip::address ParseAddress(const std::string& ipAddress, bool waitForLookup) {
+		auto v4 = IPv4Address::Parse(ipAddress);
+		if (v4.has_value())
+			return ToAsioAddress(v4.value());
+
+		std::error_code error;
+		asio::ip::address address = asio::ip::make_address(ipAddress, error);
+		if (!error)
+			return address;
+
+		ResolveResult result;
+		if (waitForLookup) {
+			result = GetDefaultResolver().Resolve(ipAddress);
+		}
+		else {
+			auto cached = GetDefaultResolver().TryResolveCached(ipAddress, true);
+			if (!cached.has_value()) {
+				throw std::runtime_error("'" + ipAddress + "' is not resolved yet, the lookup was started");
+			}
+			result = std::move(cached.value());
+		}
+
+		if (!result.ipv4.empty())
+			return ToAsioAddress(result.ipv4.front());
+		if (!result.ipv6.empty())
+			return ToAsioAddress(result.ipv6.front());
+		throw std::runtime_error("Could not resolve '" + ipAddress + "': " + GetResolveStatusName(result.status));
+	}
+
+	// DSCP into the TOS byte (IPv4) or the traffic class (IPv6), the priority into SO_PRIORITY
+	static bool ApplyTrafficClass(udp::socket& socket, const TrafficClass& trafficClass) {
+		std::error_code error;
+		int tos = (trafficClass.dscp & 0x3F) << 2;
+		bool success = true;
+
+		if (socket.local_endpoint(error).address().is_v6()) {
+#ifdef IPV6_TCLASS
+			socket.set_option(asio::detail::socket_option::integer<IPPROTO_IPV6, IPV6_TCLASS>(tos), error);
+			success = !error;
+#else
+			success = false;
+#endif
+		}
+		else {
+			socket.set_option(asio::detail::socket_option::integer<IPPROTO_IP, IP_TOS>(tos), error);
+			success = !error;
+		}
+
+#ifdef SO_PRIORITY
+		if (trafficClass.priority >= 0) {
+			socket.set_option(asio::detail::socket_option::integer<SOL_SOCKET, SO_PRIORITY>(trafficClass.priority), error);
+			success = success && !error;
+		}
+#endif
+		return success;
+	}
+
+	static bool SendUDP(const asio::ip::address& ipAddress, uint16_t port, const ConstBuffer* buffers, size_t count, bool broadcastPermissions, const TrafficClass* trafficClass = nullptr) {
 		try {
-			LOG_DEBUG("[SendUDP()]: Connecting to {}:{}", ipAddress.to_string(), port);
+			GatherBuffers gather(buffers, count);
+			if (LOG_ENABLED(spdlog::level::debug)) {
+				LOG_DEBUG("[SendUDP()]: Connecting to {}:{}", ipAddress.to_string(), port);
+			}
 
 			// Create the socket
 			asio::io_service ioService;
 			udp::socket socket(ioService);
 			udp::endpoint remote_endpoint(udp::endpoint(ipAddress, port));
-			socket.open(udp::v4());
+			socket.open(remote_endpoint.protocol());
 
 			if (broadcastPermissions) {
 				LOG_INFO("[SendUDP]: Connected with broadcast permissions");
@@ -96,19 +223,22 @@ namespace NetLib {
         		socket.set_option(asio::socket_base::broadcast(true));
 			}
 
+			if (trafficClass && !ApplyTrafficClass(socket, *trafficClass)) {
+				LOG_WARN("[SendUDP()]: Traffic class was not accepted, sending unmarked");
+			}
+
 			// Send the data
-			size_t bytes = socket.send_to(asio::buffer(data, length), remote_endpoint);
+			socket.send_to(gather.Sequence(), remote_endpoint);
+			TRACE_PROBE(send, socket.native_handle(), gather.length, remote_endpoint.data(), remote_endpoint.size());
 
 #ifndef DEPLOY
-			std::string str = "";
-			for (size_t i = 0; i < length; i++) {
-				str += std::to_string(data[i]);
-				str += ", ";
+			if (LOG_ENABLED(spdlog::level::info)) {
+				LOG_INFO("[SendUDP()]: Packet sent to {}:{}", ipAddress.to_string(), port);
+			}
+			if (LOG_ENABLED(spdlog::level::trace)) {
+				std::vector<uint8_t> data = JoinBuffers(buffers, count);
+				LOG_TRACE("[SendUDP()]: Packet sent to {}:{} -> [{}] -> \"{}\"", ipAddress.to_string(), port, BytesToString(data.data(), data.size()), std::string((const char*)data.data(), data.size()));
 			}
-			str.pop_back();
-			str.pop_back();
-			LOG_INFO("[SendUDP()]: Packet sent to {}:{}", ipAddress.to_string(), port);
-			LOG_TRACE("[SendUDP()]: Packet sent to {}:{} -> [{}] -> \"{}\"", ipAddress.to_string(), port, str, std::string((const char*)data, length));
 #endif
 
 			// Close the socket
@@ -124,6 +254,29 @@ namespace NetLib {
 		return false;
 	}
 
+	bool SendUDP(const asio::ip::address& ipAddress, uint16_t port, uint8_t* data, size_t length, bool broadcastPermissions, const TrafficClass* trafficClass = nullptr) {
+		ConstBuffer buffer = { data, length };
+		return SendUDP(ipAddress, port, &buffer, 1, broadcastPermissions, trafficClass);
+	}
+
+	// A hostname that can't be resolved, or is not cached yet, fails like the send itself
+	static bool SendUDPToHost(const std::string& host, uint16_t port, const ConstBuffer* buffers, size_t count, bool broadcastPermissions, const TrafficClass* trafficClass = nullptr) {
+		asio::ip::address address;
+		try {
+			address = ParseAddress(host, false);
+		}
+		catch (std::exception& e) {
+			LOG_WARN("[SendUDP()]: {}", e.what());
+			return false;
+		}
+		return SendUDP(address, port, buffers, count, broadcastPermissions, trafficClass);
+	}
+
+	static bool SendUDPToHost(const std::string& host, uint16_t port, uint8_t* data, size_t length, bool broadcastPermissions, const TrafficClass* trafficClass = nullptr) {
+		ConstBuffer buffer = { data, length };
+		return SendUDPToHost(host, port, &buffer, 1, broadcastPermissions, trafficClass);
+	}
+
 	bool SendUDP(uint32_t ipAddress, uint16_t port, uint8_t* data, size_t length, bool broadcastPermissions) {
 		return SendUDP(asio::ip::address_v4(ipAddress), port, data, length, broadcastPermissions);
 	}
@@ -137,388 +290,1961 @@ namespace NetLib {
 	}
 
 	bool SendUDP(const std::string& ipAddress, uint16_t port, uint8_t* data, size_t length, bool broadcastPermissions) {
-		return SendUDP(asio::ip::address::from_string(ipAddress), port, data, length, broadcastPermissions);
+		return SendUDPToHost(ipAddress, port, data, length, broadcastPermissions);
 	}
 
 	bool SendUDP(const std::string& ipAddress, uint16_t port, const char* data, bool broadcastPermissions) {
-		return SendUDP(asio::ip::address::from_string(ipAddress), port, (uint8_t*)data, strlen(data), broadcastPermissions);
+		return SendUDPToHost(ipAddress, port, (uint8_t*)data, strlen(data), broadcastPermissions);
 	}
 
 	bool SendUDP(const std::string& ipAddress, uint16_t port, const std::string& data, bool broadcastPermissions) {
-		return SendUDP(asio::ip::address::from_string(ipAddress), port, (uint8_t*)data.c_str(), data.length(), broadcastPermissions);
+		return SendUDPToHost(ipAddress, port, (uint8_t*)data.c_str(), data.length(), broadcastPermissions);
 	}
 
+	bool SendUDP(IPv4Address ipAddress, uint16_t port, uint8_t* data, size_t length, bool broadcastPermissions) {
+		return SendUDP(ToAsioAddress(ipAddress), port, data, length, broadcastPermissions);
+	}
 
+	bool SendUDP(IPv4Address ipAddress, uint16_t port, const char* data, bool broadcastPermissions) {
+		return SendUDP(ToAsioAddress(ipAddress), port, (uint8_t*)data, strlen(data), broadcastPermissions);
+	}
 
+	bool SendUDP(IPv4Address ipAddress, uint16_t port, const std::string& data, bool broadcastPermissions) {
+		return SendUDP(ToAsioAddress(ipAddress), port, (uint8_t*)data.c_str(), data.length(), broadcastPermissions);
+	}
 
+	bool SendUDP(const IPv6Address& ipAddress, uint16_t port, uint8_t* data, size_t length) {
+		return SendUDP(ToAsioAddress(ipAddress), port, data, length, false);
+	}
 
+	bool SendUDP(const IPv6Address& ipAddress, uint16_t port, const char* data) {
+		return SendUDP(ToAsioAddress(ipAddress), port, (uint8_t*)data, strlen(data), false);
+	}
 
-	// ==================================
-	// ===      UDPClient Class       ===
-	// ==================================
+	bool SendUDP(const IPv6Address& ipAddress, uint16_t port, const std::string& data) {
+		return SendUDP(ToAsioAddress(ipAddress), port, (uint8_t*)data.c_str(), data.length(), false);
+	}
 
-	struct UDPClientMembers {
-		asio::io_service ioService;
-		udp::socket socket;
-		udp::endpoint remote_endpoint;
+	bool SendUDP(const std::string& ipAddress, uint16_t port, uint8_t* data, size_t length, const TrafficClass& trafficClass) {
+		return SendUDPToHost(ipAddress, port, data, length, false, &trafficClass);
+	}
 
-		UDPClientMembers() : socket(ioService) {}
-		~UDPClientMembers() = default;
-	};
+	bool SendUDP(IPv4Address ipAddress, uint16_t port, uint8_t* data, size_t length, const TrafficClass& trafficClass) {
+		return SendUDP(ToAsioAddress(ipAddress), port, data, length, false, &trafficClass);
+	}
 
-	UDPClient::UDPClient(const std::string& ipAddress, uint16_t port, bool broadcastPermission) : members(new UDPClientMembers()) {
-		try {
-			members->remote_endpoint = udp::endpoint(asio::ip::address::from_string(ipAddress), port);
-			members->socket.open(udp::v4());
+	bool SendUDP(const std::string& ipAddress, uint16_t port, const ConstBuffer* buffers, size_t count, bool broadcastPermissions) {
+		return SendUDPToHost(ipAddress, port, buffers, count, broadcastPermissions);
+	}
 
-			if (broadcastPermission) {
-				LOG_INFO("[UDPClient]: Constructing instance with broadcast permissions");
-				members->socket.set_option(asio::ip::udp::socket::reuse_address(true));
-        		members->socket.set_option(asio::socket_base::broadcast(true));
-			}
-			LOG_DEBUG("[UDPClient]: Instance constructed, pointing to {}:{}", ipAddress, port);
-		}
-		catch (std::exception& e) {
-			throw std::runtime_error(std::string("ASIO Exception: ") + e.what());
-		}
+	bool SendUDP(IPv4Address ipAddress, uint16_t port, const ConstBuffer* buffers, size_t count, bool broadcastPermissions) {
+		return SendUDP(ToAsioAddress(ipAddress), port, buffers, count, broadcastPermissions);
 	}
 
-	UDPClient::~UDPClient() {
-		members->socket.close();
-		LOG_DEBUG("[UDPClient]: Instance destructed");
+	bool SendUDP(const IPv6Address& ipAddress, uint16_t port, const ConstBuffer* buffers, size_t count) {
+		return SendUDP(ToAsioAddress(ipAddress), port, buffers, count, false);
 	}
 
-	size_t UDPClient::send(uint8_t* data, size_t length) {
 
-		try {
-			size_t bytes = members->socket.send_to(asio::buffer(data, length), members->remote_endpoint);
 
-#ifndef DEPLOY
-			logPacket(data, length, members->remote_endpoint.address().to_string().c_str(), members->remote_endpoint.port());
-#endif
 
-			return bytes;
+
+
+	// ==================================
+	// ===      UDPClient Class       ===
+	// ==================================
+
+	// Decides when each packet of a paced UDPClient may leave, one token bucket per configured limit
+	struct UDPPacer {
+		PacingOptions options;
+		TokenBucket bytes;
+		TokenBucket packets;
+		bool enabled = false;
+		bool kernelPacing = false;
+
+		std::mutex mutex;
+		PacingStatistics statistics;
+
+		// steady_clock is CLOCK_MONOTONIC on Linux, the same clock SO_TXTIME is configured with
+		static int64_t Now() {
+			return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
 		}
-		catch (std::exception& e) {
-			throw std::runtime_error(std::string("ASIO Exception: ") + e.what());
+
+		// Sleeping is only precise to roughly 50-100us, the rest of the wait is spent spinning
+		static void WaitUntil(int64_t deadline) {
+			constexpr int64_t spinThreshold = 100000;
+			int64_t now = Now();
+			if (deadline - now > spinThreshold) {
+				std::this_thread::sleep_for(std::chrono::nanoseconds(deadline - now - spinThreshold));
+			}
+			while (Now() < deadline) {
+				std::this_thread::yield();
+			}
 		}
-	}
 
-	size_t UDPClient::send(const char* data) {
-		return send((uint8_t*)data, strlen(data));
-	}
+		// Returns the departure time of a packet of the given size
+		int64_t Schedule(size_t length, int64_t now) {
+			int64_t departure = now;
+			if (options.bytesPerSecond > 0) {
+				departure = std::max(departure, bytes.Schedule((double)length, now));
+			}
+			if (options.packetsPerSecond > 0) {
+				departure = std::max(departure, packets.Schedule(1.0, now));
+			}
 
-	size_t UDPClient::send(const std::string& data) {
-		return send(data.c_str());
-	}
+			statistics.packets++;
+			if (departure > now) {
+				statistics.delayedPackets++;
+				statistics.totalDelayNs += (uint64_t)(departure - now);
+			}
+			return departure;
+		}
 
-    void UDPClient::logPacket(uint8_t* data, size_t length, const std::string& ipAddress, uint16_t port) {
-        std::string str = "";
-        for (size_t i = 0; i < length; i++) {
-            str += std::to_string(data[i]);
-            str += ", ";
-        }
-        str.pop_back();
-        str.pop_back();
-		LOG_INFO("[UDPClient]: Packet sent to {}:{}", ipAddress, port);
-		LOG_TRACE("[UDPClient]: Packet sent to {}:{} -> [{}] -> \"{}\"", ipAddress, port, str, std::string((const char*)data, length));
-    }
+		void RecordLag(int64_t departure, int64_t actual) {
+			uint64_t lag = actual > departure ? (uint64_t)(actual - departure) : 0;
+			statistics.totalLagNs += lag;
+			statistics.maxLagNs = std::max(statistics.maxLagNs, lag);
+		}
+	};
 
+	// Buffers of MSG_ZEROCOPY sends until the kernel reports them as released
+	struct ZeroCopySender {
+		struct Buffer {
+			std::function<void()> onRelease;
+			bool released = false;
+		};
 
+		size_t threshold = 0;
 
+		std::mutex mutex;						// Keeps the notification ids in the order of the sends
+		std::deque<Buffer> buffers;				// The buffer of notification id 'firstId + index'
+		uint32_t firstId = 0;
+		bool preferCopy = false;				// The kernel copied anyway, zero-copy only adds overhead
+		ZeroCopyStatistics statistics;
 
+		HandlerMemory handlerMemory;
+		std::vector<std::function<void()>> releasing;		// I/O thread only
+	};
 
+#if defined(__linux__) && defined(MSG_ZEROCOPY) && defined(SO_ZEROCOPY)
+	static constexpr int ZEROCOPY_FLAG = MSG_ZEROCOPY;
+#else
+	static constexpr int ZEROCOPY_FLAG = 0;
+#endif
 
+	// A socket per producer thread or CPU, see EnableMultiProducer(). Not connected, so like the main socket
+	// they don't report ICMP errors of earlier datagrams. Each on its own cache line, so the counters of
+	// different threads don't share one.
+	struct alignas(64) ProducerShard {
+		udp::socket socket;
+		std::atomic<uint64_t> datagrams = 0;
+		std::atomic<uint64_t> bytes = 0;
+		std::atomic<uint64_t> errors = 0;
 
-	// =======================================
-	// ===      UDPServerAsync Class       ===
-	// =======================================
+		ProducerShard(asio::io_service& ioService) : socket(ioService) {}
+	};
 
-	struct UDPServerAsyncMembers {
+	struct ProducerShards {
+		uint64_t id = 0;					// Identifies the client in the shard cache of the threads
+		bool perCpu = false;
+		std::vector<std::unique_ptr<ProducerShard>> shards;
+		std::atomic<size_t> nextShard = 0;
+	};
+
+	static std::atomic<uint64_t> nextProducerShardsId = 1;
 
+	struct UDPClientMembers {
 		asio::io_service ioService;
 		udp::socket socket;
-		udp::endpoint remoteEndpoint;
+		udp::endpoint remote_endpoint;
 
+		// Created by the first SetPacing() and kept until the client is destroyed, so a send never sees it go away.
+		// 'paced' is only set once the pacer exists.
+		std::mutex pacingMutex;
+		std::unique_ptr<UDPPacer> pacer;
+		std::atomic<bool> paced = false;
+
+		std::unique_ptr<SharedMemorySender> sharedMemory;
+		std::unique_ptr<ZeroCopySender> zeroCopy;
+		std::unique_ptr<ProducerShards> producers;
+		std::optional<TrafficClass> trafficClass;		// Also applied to the producer shards
+
+		// Event loop for timers, started with the first timer
+		EventLoopTimers timers;
+		std::mutex loopMutex;
+		std::atomic<bool> loopStarted = false;
+		std::thread loopThread;
 		bool terminate = false;
-		std::thread listenerThread;
-		std::function<void(uint8_t* packet, size_t packetSize)> callback;
-		std::function<void(uint8_t* packet, size_t packetSize, const std::string& remoteHost, uint16_t remotePort)> callbackWithHost;
-
-		std::vector<uint8_t> buffer;
-		size_t bufferSize = 0;
 
-		UDPServerAsyncMembers(const udp::endpoint& endpoint) : socket(ioService, endpoint) {}
-		~UDPServerAsyncMembers() = default;
+		UDPClientMembers() : socket(ioService), timers(ioService) {}
+		~UDPClientMembers() = default;
 	};
 
-	UDPServerAsync::UDPServerAsync(std::function<void(uint8_t* packet, size_t packetSize)> callback, uint16_t port, size_t bufferSize)
-		: members(new UDPServerAsyncMembers(udp::endpoint(udp::v4(), port)))
-	{
-		members->callback = callback;
-		Initialize(port, bufferSize);
-	}
+	// Runs the io_service of a UDPClient on its own thread until the client is destroyed
+	static void StartClientLoop(UDPClientMembers& members) {
+		std::lock_guard<std::mutex> lock(members.loopMutex);
+		if (members.loopStarted)
+			return;
 
-	UDPServerAsync::UDPServerAsync(std::function<void(uint8_t* packet, size_t packetSize, const std::string& remoteHost, uint16_t remotePort)> callback, uint16_t port, size_t bufferSize)
-		: members(new UDPServerAsyncMembers(udp::endpoint(udp::v4(), port)))
-	{
-		members->callbackWithHost = callback;
-		Initialize(port, bufferSize);
+		members.loopStarted = true;
+		members.loopThread = std::thread([&members] {
+			auto work = asio::make_work_guard(members.ioService);
+			try {
+				while (!members.terminate) {
+					members.timers.Arm();
+					members.ioService.restart();
+					members.ioService.run_one();
+					members.timers.Fire();
+				}
+			}
+			catch (std::exception& e) {
+				LOG_CRITICAL("[UDPClient]: Exception from the event loop: {}", e.what());
+			}
+			members.timers.Stop();
+			work.reset();
+			members.ioService.restart();
+			members.ioService.poll();
+		});
 	}
 
-	UDPServerAsync::~UDPServerAsync() {
-		LOG_DEBUG("[UDPServerAsync]: Terminating UDP listener");
-
-		// Set the terminate flag and wait until the listener thread returns
-		members->terminate = true;
-		members->socket.close();
-		members->listenerThread.join();
-
-		LOG_DEBUG("[UDPServerAsync]: Instance destructed");
-	}
+	static void StopClientLoop(UDPClientMembers& members) {
+		std::lock_guard<std::mutex> lock(members.loopMutex);
+		if (!members.loopThread.joinable())
+			return;
 
-	std::string UDPServerAsync::GetLocalIP() {
-		return members->socket.local_endpoint().address().to_string();
+		// Cancelling the socket completes the wait for zero-copy notifications
+		asio::post(members.ioService, [&members] {
+			members.terminate = true;
+			members.socket.cancel();
+		});
+		members.loopThread.join();
 	}
 
-	void UDPServerAsync::Initialize(uint16_t port, size_t bufferSize) {
-		try {
-			LOG_DEBUG("[UDPServerAsync]: Creating UDP listener ...");
+	// Sends one datagram with ancillary data: The SCM_TXTIME departure time, the qdisc holds it back until then,
+	// and the TOS byte for this datagram only. Negative values are left out.
+	static size_t SendMessage(UDPClientMembers& members, const ConstBuffer* buffers, size_t count, int64_t departure, int tos, int flags) {
+#ifdef __linux__
+		std::array<iovec, NETLIB_MAX_DATAGRAM_BUFFERS> iov;
+		for (size_t i = 0; i < count; i++) {
+			iov[i] = { const_cast<void*>(buffers[i].data), buffers[i].size };
+		}
 
-			// Initialize the buffer
-			members->bufferSize = bufferSize;
-			members->buffer.clear();
-			members->buffer.reserve(bufferSize);
-			for (size_t i = 0; i < bufferSize; i++) {
-				members->buffer.push_back(0);
-			}
-			memset(&members->buffer[0], 0, bufferSize);
+		alignas(cmsghdr) char control[CMSG_SPACE(sizeof(uint64_t)) + CMSG_SPACE(sizeof(int))] = {};
+		msghdr message = {};
+		message.msg_name = members.remote_endpoint.data();
+		message.msg_namelen = (socklen_t)members.remote_endpoint.size();
+		message.msg_iov = iov.data();
+		message.msg_iovlen = count;
+		message.msg_control = control;
+		message.msg_controllen = sizeof(control);
+
+		size_t controlLength = 0;
+		cmsghdr* cmsg = CMSG_FIRSTHDR(&message);
+#ifdef SO_TXTIME
+		if (departure >= 0) {
+			cmsg->cmsg_level = SOL_SOCKET;
+			cmsg->cmsg_type = SCM_TXTIME;
+			cmsg->cmsg_len = CMSG_LEN(sizeof(uint64_t));
+			uint64_t txtime = (uint64_t)departure;
+			memcpy(CMSG_DATA(cmsg), &txtime, sizeof(txtime));
+			controlLength += CMSG_SPACE(sizeof(uint64_t));
+			cmsg = CMSG_NXTHDR(&message, cmsg);
+		}
+#endif
+		if (tos >= 0) {
+			bool v6 = members.remote_endpoint.address().is_v6();
+			cmsg->cmsg_level = v6 ? IPPROTO_IPV6 : IPPROTO_IP;
+			cmsg->cmsg_type = v6 ? IPV6_TCLASS : IP_TOS;
+			cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+			memcpy(CMSG_DATA(cmsg), &tos, sizeof(tos));
+			controlLength += CMSG_SPACE(sizeof(int));
+		}
+		message.msg_controllen = controlLength;
+		if (controlLength == 0) {
+			message.msg_control = nullptr;
+		}
 
-			// Start the listener thread
-			members->listenerThread = std::thread(std::bind(&UDPServerAsync::ListenerThread, this));
+		ssize_t bytes = sendmsg(members.socket.native_handle(), &message, flags);
+		if (bytes < 0) {
+			throw std::system_error(errno, std::generic_category(), "sendmsg");
+		}
+		return (size_t)bytes;
+#else
+		(void)departure;
+		(void)tos;
+		(void)flags;
+		return members.socket.send_to(GatherBuffers(buffers, count).Sequence(), members.remote_endpoint);
+#endif
+	}
 
-			LOG_DEBUG("[UDPServerAsync]: Instance constructed");
+#if defined(__linux__) && defined(SO_TXTIME)
+	// The interface the kernel routes the remote endpoint through, 0 if unknown
+	static unsigned int EgressInterface(const udp::endpoint& remote) {
+		asio::io_service ioService;
+		udp::socket probe(ioService);
+		std::error_code error;
+		probe.open(remote.protocol(), error);
+		if (!error) {
+			probe.connect(remote, error);
 		}
-		catch (std::exception& e) {
-			throw std::runtime_error(std::string("ASIO Exception: ") + e.what());
+		asio::ip::address local = error ? asio::ip::address() : probe.local_endpoint(error).address();
+		if (error)
+			return 0;
+
+		ifaddrs* interfaces = nullptr;
+		if (getifaddrs(&interfaces) != 0)
+			return 0;
+
+		unsigned int index = 0;
+		for (ifaddrs* entry = interfaces; entry && index == 0; entry = entry->ifa_next) {
+			if (!entry->ifa_addr)
+				continue;
+
+			if (entry->ifa_addr->sa_family == AF_INET && local.is_v4()) {
+				uint32_t address = ntohl(((sockaddr_in*)entry->ifa_addr)->sin_addr.s_addr);
+				if (address == local.to_v4().to_uint())
+					index = if_nametoindex(entry->ifa_name);
+			}
+			else if (entry->ifa_addr->sa_family == AF_INET6 && local.is_v6()) {
+				auto bytes = local.to_v6().to_bytes();
+				if (memcmp(&((sockaddr_in6*)entry->ifa_addr)->sin6_addr, bytes.data(), bytes.size()) == 0)
+					index = if_nametoindex(entry->ifa_name);
+			}
 		}
+		freeifaddrs(interfaces);
+		return index;
 	}
 
-	void UDPServerAsync::OnReceive(const std::error_code& error, size_t bytes) {
-		if (!error) {
+	// SO_TXTIME is accepted on every qdisc, but only fq holds packets back until their CLOCK_MONOTONIC departure
+	// time, the others send them right away. The interface qualifies with fq as its root qdisc, or with mq and
+	// fq on every transmit queue.
+	static bool InterfaceHasFq(unsigned int index) {
+		int fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+		if (fd < 0)
+			return false;
 
-			LOG_DEBUG("[UDPServerAsync]: Packet received, calling client callback");
-			std::string remoteHost = members->remoteEndpoint.address().to_string();
+		struct {
+			nlmsghdr header;
+			tcmsg message;
+		} request = {};
+		request.header.nlmsg_len = NLMSG_LENGTH(sizeof(tcmsg));
+		request.header.nlmsg_type = RTM_GETQDISC;
+		request.header.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+		request.message.tcm_family = AF_UNSPEC;
+		if (send(fd, &request, request.header.nlmsg_len, 0) < 0) {
+			close(fd);
+			return false;
+		}
 
-#ifndef DEPLOY
-			logPacket(&members->buffer[0], bytes, remoteHost.c_str(), members->remoteEndpoint.port());
-#endif
+		std::string rootKind;
+		uint32_t rootHandle = 0;
+		std::vector<std::pair<uint32_t, std::string>> children;
+		std::vector<char> buffer(32 * 1024);
+		bool done = false;
+		while (!done) {
+			int length = (int)recv(fd, buffer.data(), buffer.size(), 0);
+			if (length <= 0)
+				break;
+
+			for (nlmsghdr* header = (nlmsghdr*)buffer.data(); NLMSG_OK(header, length); header = NLMSG_NEXT(header, length)) {
+				if (header->nlmsg_type == NLMSG_DONE || header->nlmsg_type == NLMSG_ERROR) {
+					done = true;
+					break;
+				}
 
-			if (members->callback) {
-				members->callback(&members->buffer[0], bytes);
-			}
-			if (members->callbackWithHost) {
-				members->callbackWithHost(&members->buffer[0], bytes, remoteHost, members->remoteEndpoint.port());
+				tcmsg* message = (tcmsg*)NLMSG_DATA(header);
+				if (header->nlmsg_type != RTM_NEWQDISC || message->tcm_ifindex != (int)index)
+					continue;
+
+				std::string kind;
+				int attributesLength = (int)TCA_PAYLOAD(header);
+				for (rtattr* attribute = TCA_RTA(message); RTA_OK(attribute, attributesLength); attribute = RTA_NEXT(attribute, attributesLength)) {
+					if (attribute->rta_type == TCA_KIND) {
+						kind = (const char*)RTA_DATA(attribute);
+					}
+				}
+
+				if (message->tcm_parent == TC_H_ROOT) {
+					rootKind = kind;
+					rootHandle = message->tcm_handle;
+				}
+				else {
+					children.emplace_back(message->tcm_parent, kind);
+				}
 			}
+		}
+		close(fd);
 
+		if (rootKind == "fq")
+			return true;
+		if (rootKind != "mq")
+			return false;
+
+		size_t queues = 0;
+		for (auto& [parent, kind] : children) {
+			if (TC_H_MAJ(parent) != TC_H_MAJ(rootHandle))
+				continue;
+			if (kind != "fq")
+				return false;
+			queues++;
 		}
-		else {
+		return queues > 0;
+	}
+#endif
 
-			if (members->terminate)		// Errors are ignored if thread is being terminated
-				return;
+	static bool EnableKernelPacing(UDPClientMembers& members, const PacingOptions& options) {
+#if defined(__linux__) && defined(SO_TXTIME)
+		unsigned int egress = EgressInterface(members.remote_endpoint);
+		if (egress == 0 || !InterfaceHasFq(egress)) {
+			char name[IF_NAMESIZE] = "?";
+			LOG_DEBUG("[UDPClient]: Egress interface {} has no fq qdisc, SO_TXTIME would be ignored", egress ? if_indextoname(egress, name) : name);
+			return false;
+		}
+
+		sock_txtime config = {};
+		config.clockid = CLOCK_MONOTONIC;
+		config.flags = 0;
+		if (setsockopt(members.socket.native_handle(), SOL_SOCKET, SO_TXTIME, &config, sizeof(config)) != 0)
+			return false;
 
-			LOG_WARN("[UDPServerAsync]: Error " + std::to_string(error.value()) + ": " + error.message());
+		// fq additionally caps the rate on its own, which also bounds the bursts of a sender that lags behind
+		if (options.bytesPerSecond > 0) {
+			unsigned int rate = (unsigned int)std::min<uint64_t>(options.bytesPerSecond, 0xFFFFFFFE);
+			setsockopt(members.socket.native_handle(), SOL_SOCKET, SO_MAX_PACING_RATE, &rate, sizeof(rate));
 		}
+		return true;
+#else
+		(void)members;
+		(void)options;
+		return false;
+#endif
+	}
 
-		// Start listening for the next packet
-		StartAsyncListener();
+	static void DisableKernelPacing(UDPClientMembers& members) {
+#if defined(__linux__) && defined(SO_MAX_PACING_RATE)
+		unsigned int unlimited = ~0U;
+		setsockopt(members.socket.native_handle(), SOL_SOCKET, SO_MAX_PACING_RATE, &unlimited, sizeof(unlimited));
+#else
+		(void)members;
+#endif
 	}
 
-	void UDPServerAsync::StartAsyncListener() {
+	UDPClient::UDPClient(const std::string& ipAddress, uint16_t port, bool broadcastPermission) : members(new UDPClientMembers()) {
 		try {
-			members->socket.async_receive_from(asio::buffer(&members->buffer[0], members->bufferSize), members->remoteEndpoint,
-				std::bind(&UDPServerAsync::OnReceive, this, _1, _2));
-			LOG_DEBUG("[UDPServerAsync]: Async listener started");
+			members->remote_endpoint = udp::endpoint(ParseAddress(ipAddress, true), port);
 		}
 		catch (std::exception& e) {
 			throw std::runtime_error(std::string("ASIO Exception: ") + e.what());
 		}
+		Initialize(broadcastPermission);
 	}
 
-	void UDPServerAsync::ListenerThread() {
+	UDPClient::UDPClient(IPv4Address ipAddress, uint16_t port, bool broadcastPermission) : members(new UDPClientMembers()) {
+		members->remote_endpoint = udp::endpoint(ToAsioAddress(ipAddress), port);
+		Initialize(broadcastPermission);
+	}
 
-		LOG_DEBUG("[UDPServerAsync]: Listener thread started");
+	UDPClient::UDPClient(const IPv6Address& ipAddress, uint16_t port) : members(new UDPClientMembers()) {
+		members->remote_endpoint = udp::endpoint(ToAsioAddress(ipAddress), port);
+		Initialize(false);
+	}
 
+	void UDPClient::Initialize(bool broadcastPermission) {
 		try {
+			members->socket.open(members->remote_endpoint.protocol());
+			TRACE_PROBE(socket_open, members->socket.native_handle(), members->remote_endpoint.port());
 
-			// Start listener once
-			StartAsyncListener();
-
-			// Main loop in the listener thread
-			while (!members->terminate) {
-				members->ioService.run_one();
+			if (broadcastPermission) {
+				LOG_INFO("[UDPClient]: Constructing instance with broadcast permissions");
+				members->socket.set_option(asio::ip::udp::socket::reuse_address(true));
+        		members->socket.set_option(asio::socket_base::broadcast(true));
 			}
-
+			LOG_DEBUG("[UDPClient]: Instance constructed, pointing to {}:{}", members->remote_endpoint.address().to_string(), members->remote_endpoint.port());
 		}
 		catch (std::exception& e) {
-			LOG_CRITICAL(std::string("ASIO UDP Exception from listener thread: ") + e.what());
+			throw std::runtime_error(std::string("ASIO Exception: ") + e.what());
 		}
-		catch (...) {
-			LOG_CRITICAL("[UDPServerAsync]: Unknown exception from listener thread!");
+	}
+
+	UDPClient::~UDPClient() {
+		StopClientLoop(*members.get());
+		TRACE_PROBE(socket_close, members->socket.native_handle(), members->remote_endpoint.port());
+		members->socket.close();
+
+		if (members->zeroCopy) {
+			for (auto& buffer : members->zeroCopy->buffers) {
+				if (!buffer.released && buffer.onRelease) {
+					buffer.onRelease();
+				}
+			}
 		}
 
-		LOG_DEBUG("[UDPServerAsync]: Listener thread terminated");
+		LOG_DEBUG("[UDPClient]: Instance destructed");
 	}
 
-	void UDPServerAsync::logPacket(uint8_t* data, size_t length, const std::string& ipAddress, uint16_t port) {
-		std::string str = "";
-		for (size_t i = 0; i < length; i++) {
-			str += std::to_string(data[i]);
-			str += ", ";
+	static ProducerShard& SelectShard(ProducerShards& producers) {
+		size_t count = producers.shards.size();
+#ifdef __linux__
+		if (producers.perCpu) {
+			int cpu = sched_getcpu();
+			if (cpu >= 0)
+				return *producers.shards[(size_t)cpu % count];
 		}
-		str.pop_back();
-		str.pop_back();
-		LOG_INFO("[UDPServerAsync]: Packet received from {}:{}", ipAddress, port);
-		LOG_TRACE("[UDPServerAsync]: Packet received from {}:{} -> [{}] -> \"{}\"", ipAddress, port, str, std::string((const char*)data, length));
-	}
+#endif
 
+		// Threads take the shards in turn and keep theirs. A thread remembers its shard for the last few clients
+		// it sent through, so alternating between clients doesn't advance their round robin on every send.
+		struct CachedShard {
+			uint64_t client = 0;
+			size_t shard = 0;
+		};
+		thread_local CachedShard cache[NETLIB_PRODUCER_SHARD_CACHE];
+		thread_local size_t nextReplaced = 0;
+
+		for (const CachedShard& entry : cache) {
+			if (entry.client == producers.id)
+				return *producers.shards[entry.shard];
+		}
 
+		CachedShard& entry = cache[nextReplaced];
+		nextReplaced = (nextReplaced + 1) % NETLIB_PRODUCER_SHARD_CACHE;
+		entry.client = producers.id;
+		entry.shard = producers.nextShard.fetch_add(1, std::memory_order_relaxed) % count;
+		return *producers.shards[entry.shard];
+	}
 
+	static size_t SendOnShard(ProducerShards& producers, const udp::endpoint& endpoint, const GatherBuffers& gather) {
+		ProducerShard& shard = SelectShard(producers);
+		std::error_code error;
+		size_t bytes = shard.socket.send_to(gather.Sequence(), endpoint, 0, error);
+		if (error) {
+			shard.errors.fetch_add(1, std::memory_order_relaxed);
+			throw std::system_error(error);
+		}
 
+		shard.datagrams.fetch_add(1, std::memory_order_relaxed);
+		shard.bytes.fetch_add(bytes, std::memory_order_relaxed);
+		return bytes;
+	}
 
+	// 'tos' >= 0 replaces the TOS byte of the socket for this datagram. A TOS and 'flags' bypass the shared memory.
+	static size_t SendDatagram(UDPClientMembers& members, const ConstBuffer* buffers, size_t count, int tos, int flags = 0) {
+		GatherBuffers gather(buffers, count);
+		size_t length = gather.length;
+		TRACE_PROBE(send, members.socket.native_handle(), length, members.remote_endpoint.data(), members.remote_endpoint.size());
+
+		bool paced = false;
+		if (members.paced.load(std::memory_order_acquire)) {
+			// The tokens are taken under the lock, the wait happens outside of it, so the other sending threads
+			// only queue up behind their own departure times
+			UDPPacer& pacer = *members.pacer;
+			int64_t departure = 0;
+			bool kernelPacing = false;
+			{
+				std::lock_guard<std::mutex> guard(pacer.mutex);
+				if (pacer.enabled) {
+					paced = true;
+					departure = pacer.Schedule(length, UDPPacer::Now());
+					kernelPacing = pacer.kernelPacing;
+				}
+			}
 
+			if (paced && kernelPacing)
+				return SendMessage(members, buffers, count, departure, tos, flags);
 
+			if (paced) {
+				UDPPacer::WaitUntil(departure);
+				std::lock_guard<std::mutex> guard(pacer.mutex);
+				pacer.RecordLag(departure, UDPPacer::Now());
+			}
+		}
 
-	// ==================================
-	// ===      UDPServer Class       ===
-	// ==================================
+		if (!paced && tos < 0 && flags == 0 && members.sharedMemory && members.sharedMemory->Send(buffers, count) != SharedMemorySender::CLOSED) {
+			return length;		// Also when the ring was full, like a datagram dropped by the receiver
+		}
 
-	UDPServer::UDPServer(uint16_t port, size_t bufferSize)
-		: server(std::function<void(uint8_t* packet, size_t packetSize, const std::string& remoteIP, uint16_t remotePort)>(
-			std::bind(&UDPServer::OnReceive, this, _1, _2, _3, _4)), port, bufferSize
-	) {
-		LOG_DEBUG("[UDPServer]: Instance constructed");
+		if (tos >= 0 || flags != 0)
+			return SendMessage(members, buffers, count, -1, tos, flags);
+
+		if (members.producers && !paced)
+			return SendOnShard(*members.producers, members.remote_endpoint, gather);
+
+		return members.socket.send_to(gather.Sequence(), members.remote_endpoint);
 	}
 
-	UDPServer::~UDPServer() {
-		LOG_DEBUG("[UDPServer]: Instance destructed");
+	static size_t SendDatagram(UDPClientMembers& members, uint8_t* data, size_t length, int tos, int flags = 0) {
+		ConstBuffer buffer = { data, length };
+		return SendDatagram(members, &buffer, 1, tos, flags);
 	}
 
-	std::optional<Packet> UDPServer::ReceivePacket() {
-		std::lock_guard<std::mutex> guard(bufferMutex);
+	size_t UDPClient::send(uint8_t* data, size_t length) {
 
-		if (packetBuffer.size() == 0)
-			return std::nullopt;
+		try {
+			size_t bytes = SendDatagram(*members.get(), data, length, -1);
+
+#ifndef DEPLOY
+			if (LOG_ENABLED(spdlog::level::info)) {
+				logPacket(data, length, members->remote_endpoint.address().to_string(), members->remote_endpoint.port());
+			}
+#endif
+
+			return bytes;
+		}
+		catch (std::exception& e) {
+			throw std::runtime_error(std::string("ASIO Exception: ") + e.what());
+		}
+	}
+
+	size_t UDPClient::send(uint8_t* data, size_t length, uint8_t dscp) {
+
+		try {
+			size_t bytes = SendDatagram(*members.get(), data, length, (dscp & 0x3F) << 2);
+
+#ifndef DEPLOY
+			if (LOG_ENABLED(spdlog::level::info)) {
+				logPacket(data, length, members->remote_endpoint.address().to_string(), members->remote_endpoint.port());
+			}
+#endif
+
+			return bytes;
+		}
+		catch (std::exception& e) {
+			throw std::runtime_error(std::string("ASIO Exception: ") + e.what());
+		}
+	}
 
-		auto first = packetBuffer.front();
-		packetBuffer.pop();
-		return std::make_optional(first);
+	size_t UDPClient::send(const char* data) {
+		return send((uint8_t*)data, strlen(data));
 	}
 
-	std::string UDPServer::GetLocalIP() {
-		return server.GetLocalIP();
+	size_t UDPClient::send(const std::string& data) {
+		return send((uint8_t*)data.data(), data.size());
 	}
 
-	void UDPServer::OnReceive(uint8_t* packet, size_t packetSize, const std::string& remoteIP, uint16_t remotePort) {
-		std::lock_guard<std::mutex> guard(bufferMutex);
+	size_t UDPClient::send(std::initializer_list<ConstBuffer> buffers) {
+		return send(buffers.begin(), buffers.size());
+	}
 
-		if (packetBuffer.size() >= NETLIB_MAX_PACKET_COUNT)
-			return;
+	size_t UDPClient::send(const ConstBuffer* buffers, size_t count) {
+
+		try {
+			size_t bytes = SendDatagram(*members.get(), buffers, count, -1);
+
+#ifndef DEPLOY
+			// The buffers are only joined for the trace output
+			if (LOG_ENABLED(spdlog::level::info)) {
+				LOG_INFO("[UDPClient]: Packet sent to {}:{}", members->remote_endpoint.address().to_string(), members->remote_endpoint.port());
+			}
+			if (LOG_ENABLED(spdlog::level::trace)) {
+				std::vector<uint8_t> data = JoinBuffers(buffers, count);
+				LOG_TRACE("[UDPClient]: Packet sent to {}:{} -> [{}] -> \"{}\"", members->remote_endpoint.address().to_string(), members->remote_endpoint.port(),
+					BytesToString(data.data(), data.size()), std::string((const char*)data.data(), data.size()));
+			}
+#endif
 
-		Packet p;
-		p.data.reserve(packetSize);
-		for (size_t i = 0; i < packetSize; i++) {
-			p.data.push_back(packet[i]);
+			return bytes;
+		}
+		catch (std::exception& e) {
+			throw std::runtime_error(std::string("ASIO Exception: ") + e.what());
 		}
+	}
 
-		packetBuffer.push(std::move(p));
+	TimerId UDPClient::ScheduleTimer(std::chrono::nanoseconds delay, std::function<void()> callback) {
+		if (!members->loopStarted) {
+			StartClientLoop(*members.get());
+		}
+		return members->timers.Schedule(delay, std::move(callback));
 	}
 
+	bool UDPClient::CancelTimer(TimerId id) {
+		return members->timers.Cancel(id);
+	}
 
+	static void ReleaseZeroCopyBuffers(ZeroCopySender& zeroCopy, uint32_t first, uint32_t last, bool copied) {
+		{
+			std::lock_guard<std::mutex> lock(zeroCopy.mutex);
+			for (uint32_t id = first;; id++) {
+				uint32_t index = id - zeroCopy.firstId;
+				if (index < zeroCopy.buffers.size() && !zeroCopy.buffers[index].released) {
+					zeroCopy.buffers[index].released = true;
+					zeroCopy.releasing.push_back(std::move(zeroCopy.buffers[index].onRelease));
+					zeroCopy.statistics.pending--;
+				}
+				if (id == last)
+					break;
+			}
 
+			// Notifications may arrive out of order, the queue only shrinks from the front
+			while (!zeroCopy.buffers.empty() && zeroCopy.buffers.front().released) {
+				zeroCopy.buffers.pop_front();
+				zeroCopy.firstId++;
+			}
 
+			if (copied) {
+				zeroCopy.statistics.kernelCopies += last - first + 1;
+				if (!zeroCopy.preferCopy) {
+					LOG_DEBUG("[UDPClient]: The kernel copies zero-copy datagrams, copying from now on");
+				}
+				zeroCopy.preferCopy = true;
+			}
+		}
 
+		// Unlocked, the callbacks may send again
+		for (auto& onRelease : zeroCopy.releasing) {
+			if (onRelease) {
+				onRelease();
+			}
+		}
+		zeroCopy.releasing.clear();
+	}
 
+	// Drains the notifications of the socket error queue, on the I/O thread
+	static void ReadZeroCopyNotifications(UDPClientMembers& members) {
+#if defined(__linux__) && defined(SO_EE_ORIGIN_ZEROCOPY)
+		while (true) {
+			alignas(cmsghdr) char control[CMSG_SPACE(sizeof(sock_extended_err) + sizeof(sockaddr_in6))] = {};
+			msghdr message = {};
+			message.msg_control = control;
+			message.msg_controllen = sizeof(control);
 
+			if (recvmsg(members.socket.native_handle(), &message, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+				return;
 
-	// ==========================================
-	// ===      UDPServerBlocking Class       ===
-	// ==========================================
+			for (cmsghdr* cmsg = CMSG_FIRSTHDR(&message); cmsg; cmsg = CMSG_NXTHDR(&message, cmsg)) {
+				bool recvErr = (cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) ||
+					(cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR);
+				if (!recvErr)
+					continue;
 
-	struct UDPServerBlockingMembers {
+				sock_extended_err error;
+				memcpy(&error, CMSG_DATA(cmsg), sizeof(error));
+				if (error.ee_origin != SO_EE_ORIGIN_ZEROCOPY || error.ee_errno != 0)
+					continue;
 
-		asio::io_service ioService;
-		udp::socket socket;
+				// [ee_info, ee_data] is the range of completed sends
+				ReleaseZeroCopyBuffers(*members.zeroCopy, error.ee_info, error.ee_data, (error.ee_code & SO_EE_CODE_ZEROCOPY_COPIED) != 0);
+			}
+		}
+#else
+		(void)members;
+#endif
+	}
 
-		std::vector<uint8_t> buffer;
+	static void ArmZeroCopyNotifications(UDPClientMembers& members) {
+		UDPClientMembers* m = &members;
+		members.socket.async_wait(udp::socket::wait_error, AllocatingHandler(members.zeroCopy->handlerMemory, [m](const std::error_code& error) {
+			if (error || m->terminate)
+				return;
 
-		UDPServerBlockingMembers(const udp::endpoint& endpoint) : socket(ioService, endpoint) {}
-		~UDPServerBlockingMembers() = default;
-	};
+			ReadZeroCopyNotifications(*m);
+			ArmZeroCopyNotifications(*m);
+
+			// Notifications that arrived before the wait was armed raise no new event
+			ReadZeroCopyNotifications(*m);
+		}));
+	}
+
+	bool UDPClient::EnableZeroCopy(size_t threshold) {
+#if defined(__linux__) && defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+		if (members->zeroCopy)
+			return true;
+
+		int enable = 1;
+		if (setsockopt(members->socket.native_handle(), SOL_SOCKET, SO_ZEROCOPY, &enable, sizeof(enable)) != 0) {
+			LOG_WARN("[UDPClient]: SO_ZEROCOPY is not supported: {}", strerror(errno));
+			return false;
+		}
+
+		members->zeroCopy = std::make_unique<ZeroCopySender>();
+		members->zeroCopy->threshold = threshold;
+
+		// The notifications are read on the I/O thread
+		StartClientLoop(*members.get());
+		UDPClientMembers* m = members.get();
+		asio::post(m->ioService, [m] { ArmZeroCopyNotifications(*m); });
+
+		LOG_DEBUG("[UDPClient]: Zero-copy enabled for datagrams of {} bytes and more", threshold);
+		return true;
+#else
+		(void)threshold;
+		return false;
+#endif
+	}
+
+	size_t UDPClient::send(uint8_t* data, size_t length, std::function<void()> onRelease) {
+		ZeroCopySender* zeroCopy = members->zeroCopy.get();
+
+		// The shared memory copies into its ring anyway
+		if (zeroCopy && length >= zeroCopy->threshold && !members->sharedMemory) {
+			std::lock_guard<std::mutex> lock(zeroCopy->mutex);
+			if (!zeroCopy->preferCopy) {
+				try {
+					size_t bytes = SendDatagram(*members.get(), data, length, -1, ZEROCOPY_FLAG);
+					zeroCopy->buffers.push_back({ std::move(onRelease) });
+					zeroCopy->statistics.zeroCopySends++;
+					zeroCopy->statistics.pending++;
+
+#ifndef DEPLOY
+					if (LOG_ENABLED(spdlog::level::info)) {
+						logPacket(data, length, members->remote_endpoint.address().to_string(), members->remote_endpoint.port());
+					}
+#endif
+					return bytes;
+				}
+				catch (std::system_error& e) {
+					// ENOBUFS: The pinned pages exceed the socket's optmem limit, this datagram is copied
+					if (e.code().value() != ENOBUFS)
+						throw std::runtime_error(std::string("ASIO Exception: ") + e.what());
+				}
+			}
+		}
+
+		size_t bytes = send(data, length);
+		if (zeroCopy) {
+			std::lock_guard<std::mutex> lock(zeroCopy->mutex);
+			zeroCopy->statistics.copiedSends++;
+		}
+		if (onRelease) {
+			onRelease();
+		}
+		return bytes;
+	}
+
+	ZeroCopyStatistics UDPClient::GetZeroCopyStatistics() {
+		if (!members->zeroCopy)
+			return ZeroCopyStatistics();
+
+		std::lock_guard<std::mutex> lock(members->zeroCopy->mutex);
+		return members->zeroCopy->statistics;
+	}
+
+	bool UDPClient::SetTrafficClass(const TrafficClass& trafficClass) {
+		bool applied = ApplyTrafficClass(members->socket, trafficClass);
+		if (members->producers) {
+			for (auto& shard : members->producers->shards) {
+				applied &= ApplyTrafficClass(shard->socket, trafficClass);
+			}
+		}
+		members->trafficClass = trafficClass;
+		return applied;
+	}
+
+	bool UDPClient::EnableMultiProducer(const MultiProducerOptions& options) {
+		if (members->producers)
+			return true;
+
+		auto producers = std::make_unique<ProducerShards>();
+		producers->id = nextProducerShardsId++;
+		producers->perCpu = options.perCpu;
+		size_t count = options.shards ? options.shards : std::max<size_t>(std::thread::hardware_concurrency(), 1);
 
-	UDPServerBlocking::UDPServerBlocking(uint16_t port, size_t bufferSize)
-		: members(new UDPServerBlockingMembers(udp::endpoint(udp::v4(), port)))
-	{
 		try {
-			LOG_DEBUG("[UDPServerBlocking]: Creating UDP listener ...");
+			udp::endpoint local;
+			bool sharePort = false;
+#ifdef __linux__
+			// The main socket must allow the reuse before it is bound, which otherwise happens with the first datagram
+			std::error_code error;
+			if (options.shareSourcePort && members->socket.local_endpoint(error).port() == 0 && !error) {
+				int one = 1;
+				if (setsockopt(members->socket.native_handle(), SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) == 0) {
+					members->socket.bind(udp::endpoint(members->remote_endpoint.protocol(), 0));
+					local = members->socket.local_endpoint();
+					sharePort = true;
+				}
+			}
+			if (options.shareSourcePort && !sharePort) {
+				LOG_WARN("[UDPClient]: The producer shards send from their own ports, the client was already bound");
+			}
+#endif
 
-			// Initialize the buffer
-			members->buffer.clear();
-			members->buffer.reserve(bufferSize);
-			for (size_t i = 0; i < bufferSize; i++) {
-				members->buffer.push_back(0);
+			asio::socket_base::broadcast broadcast;
+			members->socket.get_option(broadcast);
+
+			for (size_t i = 0; i < count; i++) {
+				auto shard = std::make_unique<ProducerShard>(members->ioService);
+				shard->socket.open(members->remote_endpoint.protocol());
+				shard->socket.set_option(broadcast);
+				if (members->trafficClass) {
+					ApplyTrafficClass(shard->socket, *members->trafficClass);
+				}
+#ifdef __linux__
+				if (sharePort) {
+					int one = 1;
+					setsockopt(shard->socket.native_handle(), SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+					shard->socket.bind(local);
+				}
+#endif
+				TRACE_PROBE(socket_open, shard->socket.native_handle(), members->remote_endpoint.port());
+				producers->shards.push_back(std::move(shard));
 			}
+		}
+		catch (std::exception& e) {
+			LOG_WARN("[UDPClient]: Could not create the producer shards: {}", e.what());
+			return false;
+		}
 
-			LOG_DEBUG("[UDPServerBlocking]: Instance constructed");
+		LOG_DEBUG("[UDPClient]: {} producer shards, {}", count, options.perCpu ? "per CPU" : "per thread");
+		members->producers = std::move(producers);
+		return true;
+	}
+
+	MultiProducerStatistics UDPClient::GetMultiProducerStatistics() {
+		MultiProducerStatistics statistics;
+		if (!members->producers)
+			return statistics;
+
+		statistics.shards = members->producers->shards.size();
+		for (auto& shard : members->producers->shards) {
+			uint64_t datagrams = shard->datagrams.load(std::memory_order_relaxed);
+			statistics.datagrams += datagrams;
+			statistics.bytes += shard->bytes.load(std::memory_order_relaxed);
+			statistics.errors += shard->errors.load(std::memory_order_relaxed);
+			statistics.busiestShard = std::max(statistics.busiestShard, datagrams);
+		}
+		return statistics;
+	}
+
+	bool UDPClient::EnableSharedMemory() {
+		if (members->sharedMemory)
+			return true;
+
+		asio::ip::address address = members->remote_endpoint.address();
+		if (!address.is_v4() || !address.is_loopback())
+			return false;
+
+		try {
+			// The receiver sees the local port of this socket as source, like for UDP datagrams
+			if (members->socket.local_endpoint().port() == 0) {
+				members->socket.bind(udp::endpoint(udp::v4(), 0));
+			}
+
+			members->sharedMemory = SharedMemorySender::Connect(members->remote_endpoint.port(), members->socket.local_endpoint().port());
 		}
 		catch (std::exception& e) {
 			throw std::runtime_error(std::string("ASIO Exception: ") + e.what());
 		}
+
+		if (members->sharedMemory) {
+			LOG_DEBUG("[UDPClient]: Sending to port {} through shared memory", members->remote_endpoint.port());
+		}
+		return members->sharedMemory != nullptr;
 	}
 
-	UDPServerBlocking::~UDPServerBlocking() {
+	void UDPClient::SetPacing(const PacingOptions& options) {
+		std::lock_guard<std::mutex> setter(members->pacingMutex);
+		bool enable = options.bytesPerSecond > 0 || options.packetsPerSecond > 0;
+		if (!enable && !members->pacer)
+			return;
 
-		members->socket.close();
+		// The kernel is asked before the pacer lock is taken, every paced send needs that lock briefly
+		bool kernelPacing = false;
+		if (enable && options.mode == PACING_KERNEL) {
+			kernelPacing = EnableKernelPacing(*members.get(), options);
+			if (!kernelPacing) {
+				LOG_WARN("[UDPClient]: Kernel pacing (SO_TXTIME with the fq qdisc) is not available, pacing in user space");
+			}
+		}
 
-		LOG_DEBUG("[UDPServerBlocking]: Instance destructed");
+		if (!members->pacer) {
+			members->pacer = std::make_unique<UDPPacer>();
+		}
+		UDPPacer& pacer = *members->pacer;
+		{
+			std::lock_guard<std::mutex> guard(pacer.mutex);
+			if (pacer.kernelPacing && !kernelPacing) {
+				DisableKernelPacing(*members.get());
+			}
+
+			pacer.options = options;
+			pacer.enabled = enable;
+			pacer.kernelPacing = kernelPacing;
+			pacer.statistics = PacingStatistics();
+			pacer.statistics.kernelPacing = kernelPacing;
+
+			size_t burstPackets = std::max<size_t>(options.burstPackets, 1);
+			size_t burstBytes = options.burstBytes > 0 ? options.burstBytes : burstPackets * 1500;
+			int64_t now = UDPPacer::Now();
+			pacer.bytes.Configure((double)options.bytesPerSecond, (double)burstBytes, now);
+			pacer.packets.Configure((double)options.packetsPerSecond, (double)burstPackets, now);
+		}
+		members->paced.store(enable, std::memory_order_release);
+
+		if (enable) {
+			LOG_DEBUG("[UDPClient]: Pacing enabled: {} bytes/s, {} packets/s", options.bytesPerSecond, options.packetsPerSecond);
+		}
+		else {
+			LOG_DEBUG("[UDPClient]: Pacing disabled");
+		}
 	}
 
-	std::optional<std::vector<uint8_t>> UDPServerBlocking::ReceivePacket() {
+	PacingStatistics UDPClient::GetPacingStatistics() {
+		if (!members->paced.load(std::memory_order_acquire))
+			return PacingStatistics();
 
-		udp::endpoint remote_endpoint;
+		std::lock_guard<std::mutex> guard(members->pacer->mutex);
+		return members->pacer->statistics;
+	}
+
+	void UDPClient::logPacket(uint8_t* data, size_t length, const std::string& ipAddress, uint16_t port) {
+		LOG_INFO("[UDPClient]: Packet sent to {}:{}", ipAddress, port);
+		if (LOG_ENABLED(spdlog::level::trace)) {
+			LOG_TRACE("[UDPClient]: Packet sent to {}:{} -> [{}] -> \"{}\"", ipAddress, port, BytesToString(data, length), std::string((const char*)data, length));
+		}
+	}
+
+
+
+
+
+
+
+	// =======================================
+	// ===      BroadcastSender Class      ===
+	// =======================================
+
+	struct BroadcastInterface {
+		Interface info;
+		Cidr subnet;
+		udp::socket socket;
+		udp::endpoint broadcast;
+
+		BroadcastInterface(asio::io_service& ioService, const Interface& info)
+			: info(info), subnet(GetInterfaceSubnet(info)), socket(ioService), broadcast(ToAsioAddress(info.broadcast), 0) {}
+	};
+
+	struct BroadcastSenderMembers {
+		asio::io_service ioService;
+		std::mutex mutex;
+		bool includeLoopback = false;
+
+		InterfaceSnapshot snapshot;
+		std::vector<std::unique_ptr<BroadcastInterface>> interfaces;
+		udp::socket routed;				// Unbound, for destinations outside of all subnets
+
+		BroadcastSenderMembers() : routed(ioService) {}
+	};
+
+	static std::unique_ptr<BroadcastInterface> OpenInterfaceSocket(BroadcastSenderMembers& members, const Interface& ifc) {
+		try {
+			auto entry = std::make_unique<BroadcastInterface>(members.ioService, ifc);
+			entry->socket.open(udp::v4());
+			entry->socket.set_option(asio::socket_base::broadcast(true));
+
+#ifdef __linux__
+			// Without it, a subnet broadcast leaves through whatever interface the routing table picks for it.
+			// Needs CAP_NET_RAW before Linux 5.7, the bound address alone still selects the source then.
+			if (!ifc.name.empty() && setsockopt(entry->socket.native_handle(), SOL_SOCKET, SO_BINDTODEVICE,
+				ifc.name.c_str(), (socklen_t)ifc.name.size()) != 0) {
+				LOG_DEBUG("[BroadcastSender]: Could not bind to device {}: {}", ifc.name, strerror(errno));
+			}
+#endif
+
+			entry->socket.bind(udp::endpoint(ToAsioAddress(ifc.address), 0));
+			TRACE_PROBE(socket_open, entry->socket.native_handle(), entry->socket.local_endpoint().port());
+			LOG_DEBUG("[BroadcastSender]: Socket for {} ({}), broadcast {}", ifc.name, ifc.address.ToString(), ifc.broadcast.ToString());
+			return entry;
+		}
+		catch (std::exception& e) {
+			LOG_WARN("[BroadcastSender]: ASIO Exception for interface {} ({}): {}", ifc.name, ifc.address.ToString(), e.what());
+		}
+		return nullptr;
+	}
+
+	// Follows the interface cache, the common case is a single atomic load and a pointer comparison
+	static void UpdateBroadcastInterfaces(BroadcastSenderMembers& members) {
+		InterfaceSnapshot current = GetCachedNetworkInterfaces();
+		if (current == members.snapshot)
+			return;
+		members.snapshot = current;
+
+		std::vector<std::unique_ptr<BroadcastInterface>> updated;
+		for (const Interface& ifc : *current) {
+			if (ifc.address.IsUnspecified() || (!members.includeLoopback && ifc.address.IsLoopback()))
+				continue;
+
+			// Unchanged interfaces keep their socket
+			auto existing = std::find_if(members.interfaces.begin(), members.interfaces.end(), [&](auto& entry) {
+				return entry && entry->info.name == ifc.name && entry->info.address == ifc.address && entry->info.subnet == ifc.subnet;
+			});
+			if (existing != members.interfaces.end()) {
+				updated.push_back(std::move(*existing));
+				continue;
+			}
+
+			auto entry = OpenInterfaceSocket(members, ifc);
+			if (entry) {
+				updated.push_back(std::move(entry));
+			}
+		}
+
+		for (auto& entry : members.interfaces) {
+			if (entry) {
+				TRACE_PROBE(socket_close, entry->socket.native_handle(), 0);
+				LOG_DEBUG("[BroadcastSender]: Interface {} ({}) is gone", entry->info.name, entry->info.address.ToString());
+			}
+		}
+		members.interfaces = std::move(updated);
+	}
+
+	static bool SendFromSocket(udp::socket& socket, const udp::endpoint& destination, uint8_t* data, size_t length) {
 		std::error_code error;
-		members->socket.receive_from(asio::buffer(members->buffer), remote_endpoint, 0, error);
+		socket.send_to(asio::buffer(data, length), destination, 0, error);
+		if (error) {
+			LOG_WARN("[BroadcastSender]: Sending to {}:{} failed: {}", destination.address().to_string(), destination.port(), error.message());
+			return false;
+		}
+		TRACE_PROBE(send, socket.native_handle(), length, destination.data(), destination.size());
+		return true;
+	}
 
-		logPacket(
-			&members->buffer[0],
-			members->buffer.size(),
-			members->socket.remote_endpoint().address().to_string(),
-			members->socket.remote_endpoint().port()
-		);
+	static size_t SendBroadcasts(BroadcastSenderMembers& members, uint8_t* data, size_t length, uint16_t port, const std::vector<std::string>* selection) {
+		std::lock_guard<std::mutex> lock(members.mutex);
+		UpdateBroadcastInterfaces(members);
 
-		if (error && error != asio::error::message_size) {
-			return std::nullopt;
+		size_t sent = 0;
+		for (auto& entry : members.interfaces) {
+			if (selection && std::none_of(selection->begin(), selection->end(), [&](const std::string& name) {
+				return name == entry->info.name || name == entry->info.address.ToString();
+			}))
+				continue;
+
+			entry->broadcast.port(port);
+			sent += SendFromSocket(entry->socket, entry->broadcast, data, length);
+		}
+
+#ifndef DEPLOY
+		LOG_INFO("[BroadcastSender]: Packet broadcast on {} interfaces to port {}", sent, port);
+#endif
+		return sent;
+	}
+
+	static BroadcastInterface* LongestPrefixMatch(BroadcastSenderMembers& members, IPv4Address destination) {
+		BroadcastInterface* best = nullptr;
+		for (auto& entry : members.interfaces) {
+			if (entry->subnet.Contains(destination) && (!best || entry->subnet.PrefixLength() > best->subnet.PrefixLength())) {
+				best = entry.get();
+			}
 		}
+		return best;
+	}
 
-		return std::make_optional(members->buffer);
+	BroadcastSender::BroadcastSender(bool includeLoopback) : members(new BroadcastSenderMembers()) {
+		members->includeLoopback = includeLoopback;
+
+		std::lock_guard<std::mutex> lock(members->mutex);
+		UpdateBroadcastInterfaces(*members.get());
+		LOG_DEBUG("[BroadcastSender]: Created with {} interfaces", members->interfaces.size());
 	}
 
-	void UDPServerBlocking::logPacket(uint8_t* data, size_t length, const std::string& ipAddress, uint16_t port) {
-		std::string str = "";
-		for (size_t i = 0; i < length; i++) {
-			str += std::to_string(data[i]);
-			str += ", ";
+	BroadcastSender::~BroadcastSender() {
+		for (auto& entry : members->interfaces) {
+			TRACE_PROBE(socket_close, entry->socket.native_handle(), 0);
 		}
-		str.pop_back();
-		str.pop_back();
-		LOG_INFO("[UDPServerBlocking]: Packet received from {}:{}", ipAddress, port);
-		LOG_TRACE("[UDPServerBlocking]: Packet received from {}:{} -> [{}] -> \"{}\"", ipAddress, port, str, std::string((const char*)data, length));
 	}
 
-}
+	size_t BroadcastSender::Send(uint8_t* data, size_t length, uint16_t port) {
+		return SendBroadcasts(*members.get(), data, length, port, nullptr);
+	}
+
+	size_t BroadcastSender::Send(uint8_t* data, size_t length, uint16_t port, const std::vector<std::string>& interfaces) {
+		return SendBroadcasts(*members.get(), data, length, port, &interfaces);
+	}
+
+	bool BroadcastSender::SendTo(IPv4Address destination, uint16_t port, uint8_t* data, size_t length) {
+		std::lock_guard<std::mutex> lock(members->mutex);
+		UpdateBroadcastInterfaces(*members.get());
+
+		udp::endpoint endpoint(ToAsioAddress(destination), port);
+		BroadcastInterface* entry = LongestPrefixMatch(*members.get(), destination);
+		if (entry)
+			return SendFromSocket(entry->socket, endpoint, data, length);
+
+		std::error_code error;
+		if (!members->routed.is_open()) {
+			members->routed.open(udp::v4(), error);
+			if (error) {
+				LOG_WARN("[BroadcastSender]: ASIO Exception: {}", error.message());
+				return false;
+			}
+		}
+		return SendFromSocket(members->routed, endpoint, data, length);
+	}
+
+	std::optional<Interface> BroadcastSender::SelectInterface(IPv4Address destination) {
+		std::lock_guard<std::mutex> lock(members->mutex);
+		UpdateBroadcastInterfaces(*members.get());
+
+		BroadcastInterface* entry = LongestPrefixMatch(*members.get(), destination);
+		if (!entry)
+			return std::nullopt;
+		return entry->info;
+	}
+
+	std::vector<Interface> BroadcastSender::GetInterfaces() {
+		std::lock_guard<std::mutex> lock(members->mutex);
+		UpdateBroadcastInterfaces(*members.get());
+
+		std::vector<Interface> interfaces;
+		for (auto& entry : members->interfaces) {
+			interfaces.push_back(entry->info);
+		}
+		return interfaces;
+	}
+
+
+
+
+
+
+
+	// =======================================
+	// ===      UDPServerAsync Class       ===
+	// =======================================
+
+	// Writes the address into a reused string. IPv4 addresses fit the small string buffer, so this does not allocate.
+	static void AddressToString(const asio::ip::address& address, std::string& out) {
+		if (address.is_v4()) {
+			char text[IPv4Address::MAX_STRING_LENGTH];
+			size_t length = IPv4Address(address.to_v4().to_uint()).ToChars(text);
+			out.assign(text, length);
+		}
+		else {
+			out = address.to_string();
+		}
+	}
+
+	// =========================================
+	// ===      UDPReceiveSocket Class       ===
+	// =========================================
+
+	// Process-wide free lists of large receive buffers in power-of-two size classes, shared by the adaptive
+	// sockets. Only a few buffers per class are kept, the rest goes back to the heap.
+	class ReceiveBufferPool {
+	public:
+		static constexpr size_t MIN_SIZE = 2048;
+		static constexpr size_t MAX_SIZE = 65536;
+
+		static ReceiveBufferPool& Instance() {
+			static ReceiveBufferPool* pool = new ReceiveBufferPool();		// Never destroyed, like the logger
+			return *pool;
+		}
+
+		static size_t ClassSize(size_t size) {
+			size_t classSize = MIN_SIZE;
+			while (classSize < size && classSize < MAX_SIZE) {
+				classSize *= 2;
+			}
+			return classSize;
+		}
+
+		std::unique_ptr<uint8_t[]> Acquire(size_t classSize) {
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				auto& freeList = freeLists[ClassIndex(classSize)];
+				if (!freeList.empty()) {
+					std::unique_ptr<uint8_t[]> buffer = std::move(freeList.back());
+					freeList.pop_back();
+					return buffer;
+				}
+			}
+			return std::unique_ptr<uint8_t[]>(new uint8_t[classSize]);
+		}
+
+		void Release(std::unique_ptr<uint8_t[]> buffer, size_t classSize) {
+			std::lock_guard<std::mutex> lock(mutex);
+			auto& freeList = freeLists[ClassIndex(classSize)];
+			if (freeList.size() < freeList.capacity()) {
+				freeList.push_back(std::move(buffer));
+			}
+		}
+
+	private:
+		static constexpr size_t CLASSES = 6;			// 2 KiB to 64 KiB
+		static constexpr size_t KEPT_PER_CLASS = 8;
+
+		ReceiveBufferPool() {
+			for (auto& freeList : freeLists) {
+				freeList.reserve(KEPT_PER_CLASS);
+			}
+		}
+
+		static size_t ClassIndex(size_t classSize) {
+			size_t index = 0;
+			while ((MIN_SIZE << index) < classSize) {
+				index++;
+			}
+			return index;
+		}
+
+		std::mutex mutex;
+		std::array<std::vector<std::unique_ptr<uint8_t[]>>, CLASSES> freeLists;
+	};
+
+	// With MSG_TRUNC, Linux returns the full length of a datagram that did not fit
+#ifdef __linux__
+	static constexpr int RECEIVE_FLAGS = MSG_TRUNC;
+#else
+	static constexpr int RECEIVE_FLAGS = 0;
+#endif
+
+	struct UDPReceiveSocketMembers {
+
+		asio::io_service ioService;
+		udp::socket socket;
+		udp::endpoint remoteEndpoint;
+		HandlerMemory handlerMemory;
+		EventLoopTimers timers;
+
+		bool waitPending = false;
+		bool socketReadable = false;	// Until a receive would block
+		bool readable = false;
+		bool terminate = false;		// Only touched on the waiting thread
+
+		std::atomic<bool> receiveTos = false;
+		uint8_t lastTos = 0;
+
+		// Truncated datagrams and the adaptive buffer, which is only touched on the waiting thread
+		std::atomic<uint64_t> truncated = 0;
+		std::atomic<uint64_t> grown = 0;
+		std::atomic<uint64_t> shrunk = 0;
+		std::atomic<size_t> adaptiveSize = 0;
+		std::optional<AdaptiveBufferOptions> adaptive;
+		std::unique_ptr<uint8_t[]> adaptiveBuffer;
+		int64_t lastLargeNs = 0;
+		bool shrinkScheduled = false;
+
+		// Shared-memory rings of local senders, installed on the waiting thread
+		std::atomic<bool> sharedMemoryEnabled = false;
+		std::unique_ptr<SharedMemoryReceiver> sharedMemory;
+		std::chrono::nanoseconds sharedMemorySpin{ 0 };
+		bool ringTurn = false;
+
+		// Ring datagrams bypass the socket filter, they are checked against a copy of it
+		std::mutex ringFilterMutex;
+		std::optional<PacketFilter> ringFilter;
+		std::atomic<bool> ringFiltered = false;
+#ifdef __linux__
+		std::optional<asio::posix::stream_descriptor> sharedMemoryHandle;
+		HandlerMemory sharedMemoryHandlerMemory;
+		bool sharedMemoryWaitPending = false;
+#endif
+
+		std::vector<uint8_t> scatterBuffer;		// Scattered receives that can't read into the caller's buffers
+
+		UDPReceiveSocketMembers(const udp::endpoint& endpoint) : socket(ioService, endpoint), timers(ioService) {}
+		~UDPReceiveSocketMembers() = default;
+	};
+
+	static UDPReceiveSocketMembers* CreateReceiveSocket(uint16_t port) {
+		try {
+			auto members = new UDPReceiveSocketMembers(udp::endpoint(udp::v4(), port));
+			members->socket.non_blocking(true);
+			TRACE_PROBE(socket_open, members->socket.native_handle(), port);
+			return members;
+		}
+		catch (std::exception& e) {
+			throw std::runtime_error(std::string("ASIO Exception: ") + e.what());
+		}
+	}
+
+	UDPReceiveSocket::UDPReceiveSocket(uint16_t port) : members(CreateReceiveSocket(port)) {
+	}
+
+	UDPReceiveSocket::~UDPReceiveSocket() {
+		std::error_code error;
+		TRACE_PROBE(socket_close, members->socket.native_handle(), members->socket.local_endpoint(error).port());
+		members->socket.close();
+#ifdef __linux__
+		if (members->sharedMemoryHandle) {
+			members->sharedMemoryHandle->cancel();
+		}
+#endif
+		members->timers.Stop();
+
+		// Let the cancelled handlers return their memory
+		members->ioService.restart();
+		members->ioService.poll();
+
+		if (members->adaptiveBuffer) {
+			ReceiveBufferPool::Instance().Release(std::move(members->adaptiveBuffer), members->adaptiveSize);
+		}
+
+#ifdef __linux__
+		if (members->sharedMemoryHandle) {
+			members->sharedMemoryHandle->release();		// The descriptor belongs to the receiver
+		}
+#endif
+	}
+
+	static void ArmReceiveWaits(UDPReceiveSocketMembers& m) {
+		UDPReceiveSocketMembers* pm = &m;
+		if (!m.waitPending && !m.socketReadable) {
+			m.waitPending = true;
+			m.socket.async_wait(udp::socket::wait_read, AllocatingHandler(m.handlerMemory, [pm](const std::error_code& error) {
+				if (error && error != asio::error::operation_aborted) {
+					LOG_WARN("[UDPReceiveSocket]: Error " + std::to_string(error.value()) + ": " + error.message());
+				}
+				pm->waitPending = false;
+				pm->socketReadable = !error;
+				pm->readable = true;
+			}));
+		}
+
+#ifdef __linux__
+		if (m.sharedMemoryHandle && !m.sharedMemoryWaitPending) {
+			m.sharedMemoryWaitPending = true;
+			m.sharedMemoryHandle->async_wait(asio::posix::stream_descriptor::wait_read, AllocatingHandler(m.sharedMemoryHandlerMemory, [pm](const std::error_code& error) {
+				pm->sharedMemoryWaitPending = false;
+				if (!error) {
+					pm->sharedMemory->Poll();
+				}
+				pm->readable = true;
+			}));
+		}
+#endif
+	}
+
+	// Busy polling of the rings before the listener goes to sleep. The event loop is polled as well, so UDP
+	// datagrams, new senders and Shutdown() are not delayed by the spinning.
+	static bool SpinForSharedMemory(UDPReceiveSocketMembers& m) {
+		if (m.sharedMemory->HasData())
+			return true;
+		if (m.sharedMemorySpin.count() <= 0)
+			return false;
+
+		auto deadline = std::chrono::steady_clock::now() + m.sharedMemorySpin;
+		for (uint32_t i = 1;; i++) {
+			if (m.sharedMemory->HasData())
+				return true;
+
+			if (i % 64 == 0) {
+				m.ioService.restart();
+				m.ioService.poll();
+				if (m.readable || m.terminate)
+					return true;
+				if (std::chrono::steady_clock::now() >= deadline)
+					return false;
+			}
+		}
+	}
+
+	bool UDPReceiveSocket::Wait() {
+		UDPReceiveSocketMembers* m = members.get();
+
+		// Timers also fire here when the socket never runs dry
+		m->timers.Fire();
+		if (m->terminate)
+			return false;
+
+		// Data is left from the last batch: Only run the handlers that are ready, e.g. a shutdown
+		if (m->socketReadable || (m->sharedMemory && m->sharedMemory->HasData())) {
+			m->ioService.restart();
+			m->ioService.poll();
+			return !m->terminate;
+		}
+
+		m->readable = false;
+		ArmReceiveWaits(*m);
+
+		if (m->sharedMemory) {
+			if (SpinForSharedMemory(*m) || !m->sharedMemory->PrepareToWait())
+				return !m->terminate;
+		}
+
+		// Runs a wait handler, a timer, or a handler posted from another thread
+		while (!m->readable && !m->terminate) {
+			m->timers.Arm();
+			m->ioService.restart();
+			if (m->ioService.run_one() == 0)
+				break;
+			m->timers.Fire();
+			ArmReceiveWaits(*m);
+		}
+		TRACE_PROBE(listener_wakeup, m->socket.native_handle(), m->readable);
+
+		if (m->sharedMemory) {
+			m->sharedMemory->StopWaiting();
+		}
+		return !m->terminate;
+	}
+
+	static void ReportTruncation(UDPReceiveSocketMembers& m, size_t length, size_t capacity) {
+		uint64_t count = m.truncated.fetch_add(1, std::memory_order_relaxed) + 1;
+		if ((count & (count - 1)) == 0) {		// Powers of two, so a flood of large datagrams can't flood the log
+			LOG_WARN("[UDPReceiveSocket]: Datagram of {} bytes truncated to {} bytes ({} so far). Raise the buffer size or enable the adaptive buffer",
+				length, capacity, count);
+		}
+	}
+
+	static bool PassesRingFilter(UDPReceiveSocketMembers& m, const uint8_t* data, size_t capacity, size_t bytes, uint16_t sourcePort) {
+		if (!m.ringFiltered.load(std::memory_order_relaxed))
+			return true;
+
+		std::lock_guard<std::mutex> lock(m.ringFilterMutex);
+		return !m.ringFilter || MatchesPacketFilter(*m.ringFilter, IPv4Address::Loopback(), sourcePort, data, std::min(bytes, capacity), bytes);
+	}
+
+	// With a length, the full datagram length is stored there and reporting truncation is left to the caller
+	static bool TryReceiveShared(UDPReceiveSocketMembers& m, uint8_t* data, size_t capacity, size_t& bytes, IPv4Address& source, uint16_t& sourcePort, size_t* length) {
+		while (m.sharedMemory && m.sharedMemory->TryReceive(data, capacity, bytes, sourcePort)) {
+			if (!PassesRingFilter(m, data, capacity, bytes, sourcePort))
+				continue;		// Dropped like the socket filter would
+
+			if (length) {
+				*length = bytes;
+			}
+			if (bytes > capacity) {
+				if (!length) {
+					ReportTruncation(m, bytes, capacity);
+				}
+				bytes = capacity;
+			}
+
+			source = IPv4Address::Loopback();
+			m.lastTos = 0;
+			TRACE_PROBE(receive, -1, bytes, source.ToUint(), sourcePort);
+			return true;
+		}
+		return false;
+	}
+
+	// receive_from() that also picks up the TOS byte of the datagram
+	static size_t ReceiveWithTos(UDPReceiveSocketMembers& m, uint8_t* data, size_t capacity, std::error_code& error) {
+#ifdef __linux__
+		iovec iov = { data, capacity };
+		alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+		msghdr message = {};
+		message.msg_name = m.remoteEndpoint.data();
+		message.msg_namelen = (socklen_t)m.remoteEndpoint.capacity();
+		message.msg_iov = &iov;
+		message.msg_iovlen = 1;
+		message.msg_control = control;
+		message.msg_controllen = sizeof(control);
+
+		ssize_t bytes = recvmsg(m.socket.native_handle(), &message, MSG_DONTWAIT | MSG_TRUNC);
+		if (bytes < 0) {
+			error.assign(errno, asio::error::get_system_category());
+			return 0;
+		}
+		m.remoteEndpoint.resize(message.msg_namelen);
+
+		m.lastTos = 0;
+		for (cmsghdr* cmsg = CMSG_FIRSTHDR(&message); cmsg; cmsg = CMSG_NXTHDR(&message, cmsg)) {
+			if (cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_TOS) {
+				m.lastTos = *(uint8_t*)CMSG_DATA(cmsg);
+			}
+		}
+		return (size_t)bytes;
+#else
+		return m.socket.receive_from(asio::buffer(data, capacity), m.remoteEndpoint, 0, error);
+#endif
+	}
+
+	// Size of the next datagram, without dequeuing it
+	static size_t PendingDatagramSize(UDPReceiveSocketMembers& m, std::error_code& error) {
+#ifdef __linux__
+		ssize_t size = recv(m.socket.native_handle(), nullptr, 0, MSG_PEEK | MSG_TRUNC | MSG_DONTWAIT);
+		if (size < 0) {
+			error.assign(errno, asio::error::get_system_category());
+			return 0;
+		}
+		return (size_t)size;
+#else
+		return m.socket.available(error);		// FIONREAD: At least the next datagram, on some platforms all queued ones
+#endif
+	}
+
+	static void ReleaseAdaptiveBuffer(UDPReceiveSocketMembers& m) {
+		ReceiveBufferPool::Instance().Release(std::move(m.adaptiveBuffer), m.adaptiveSize);
+		m.adaptiveSize.store(0, std::memory_order_relaxed);
+	}
+
+	// The grown buffer goes back to the pool once no large datagram arrived for the quiet period
+	static void ScheduleShrink(UDPReceiveSocketMembers& m, std::chrono::nanoseconds delay) {
+		UDPReceiveSocketMembers* pm = &m;
+		m.shrinkScheduled = true;
+		m.timers.Schedule(delay, [pm] {
+			pm->shrinkScheduled = false;
+			if (!pm->adaptiveBuffer)
+				return;
+
+			int64_t quietUntil = pm->lastLargeNs + pm->adaptive->quietPeriod.count();
+			int64_t now = EventLoopTimers::Now();
+			if (now < quietUntil) {
+				ScheduleShrink(*pm, std::chrono::nanoseconds(quietUntil - now));
+				return;
+			}
+
+			LOG_DEBUG("[UDPReceiveSocket]: No large datagrams for a while, returning the buffer of {} bytes", pm->adaptiveSize.load());
+			ReleaseAdaptiveBuffer(*pm);
+			pm->shrunk.fetch_add(1, std::memory_order_relaxed);
+		});
+	}
+
+	static uint8_t* AdaptiveBufferFor(UDPReceiveSocketMembers& m, size_t length, size_t& capacity) {
+		size_t classSize = ReceiveBufferPool::ClassSize(std::min(length, m.adaptive->maxSize));
+		if (classSize > m.adaptiveSize) {
+			if (m.adaptiveBuffer) {
+				ReleaseAdaptiveBuffer(m);
+			}
+			m.adaptiveBuffer = ReceiveBufferPool::Instance().Acquire(classSize);
+			m.adaptiveSize.store(classSize, std::memory_order_relaxed);
+			m.grown.fetch_add(1, std::memory_order_relaxed);
+			LOG_DEBUG("[UDPReceiveSocket]: Receive buffer grown to {} bytes for a datagram of {} bytes", classSize, length);
+		}
+
+		m.lastLargeNs = EventLoopTimers::Now();
+		if (!m.shrinkScheduled) {
+			ScheduleShrink(m, m.adaptive->quietPeriod);
+		}
+
+		capacity = m.adaptiveSize;
+		return m.adaptiveBuffer.get();
+	}
+
+	static bool ReceiveFromSocket(UDPReceiveSocketMembers& m, uint8_t*& data, size_t capacity, size_t& bytes, IPv4Address& source, uint16_t& sourcePort, size_t* length) {
+		std::error_code error;
+		uint8_t* target = data;
+		bytes = 0;
+		if (m.adaptive) {
+			size_t length = PendingDatagramSize(m, error);
+			if (!error && length > capacity) {
+				target = AdaptiveBufferFor(m, length, capacity);
+			}
+		}
+
+		if (!error) {
+			if (m.receiveTos.load(std::memory_order_relaxed)) {
+				bytes = ReceiveWithTos(m, target, capacity, error);
+			}
+			else {
+				bytes = m.socket.receive_from(asio::buffer(target, capacity), m.remoteEndpoint, RECEIVE_FLAGS, error);
+			}
+		}
+
+		// Windows reports truncation as an error
+		bool truncated = bytes > capacity;
+		if (error == asio::error::message_size) {
+			error.clear();
+			truncated = true;
+		}
+
+		if (!error) {
+			if (length) {
+				*length = truncated ? std::max(bytes, capacity + 1) : bytes;		// Windows doesn't tell how much was cut off
+			}
+			if (truncated) {
+				if (!length) {
+					ReportTruncation(m, bytes, capacity);
+				}
+				bytes = capacity;
+			}
+			data = target;
+			source = IPv4Address(m.remoteEndpoint.address().to_v4().to_uint());
+			sourcePort = m.remoteEndpoint.port();
+			TRACE_PROBE(receive, m.socket.native_handle(), bytes, source.ToUint(), sourcePort);
+			return true;
+		}
+
+		if (error != asio::error::would_block && error != asio::error::try_again && !m.terminate) {
+			LOG_WARN("[UDPReceiveSocket]: Error " + std::to_string(error.value()) + ": " + error.message());
+		}
+		m.socketReadable = false;
+		return false;
+	}
+
+	static bool ReceiveDatagram(UDPReceiveSocketMembers& m, uint8_t*& data, size_t capacity, size_t& bytes, IPv4Address& source, uint16_t& sourcePort, size_t* length = nullptr) {
+		// Rings and socket take turns, so neither can starve the other
+		m.ringTurn = !m.ringTurn;
+		if (m.ringTurn && TryReceiveShared(m, data, capacity, bytes, source, sourcePort, length))
+			return true;
+
+		if (m.socketReadable && ReceiveFromSocket(m, data, capacity, bytes, source, sourcePort, length))
+			return true;
+
+		return !m.ringTurn && TryReceiveShared(m, data, capacity, bytes, source, sourcePort, length);
+	}
+
+	bool UDPReceiveSocket::TryReceive(uint8_t* data, size_t capacity, size_t& bytes, IPv4Address& source, uint16_t& sourcePort) {
+		UDPReceiveSocketMembers* m = members.get();
+		if (!m->adaptive)
+			return ReceiveDatagram(*m, data, capacity, bytes, source, sourcePort);
+
+		// The caller can't take a different buffer, so truncation is against its capacity and reported once here
+		uint8_t* target = data;
+		size_t length = 0;
+		if (!ReceiveDatagram(*m, target, capacity, bytes, source, sourcePort, &length))
+			return false;
+
+		if (length > capacity) {
+			ReportTruncation(*m, length, capacity);
+		}
+		if (target != data) {
+			bytes = std::min(bytes, capacity);
+			memcpy(data, target, bytes);
+		}
+		return true;
+	}
+
+	bool UDPReceiveSocket::TryReceive(const MutableBuffer* buffers, size_t count, size_t& bytes, IPv4Address& source, uint16_t& sourcePort) {
+		UDPReceiveSocketMembers* m = members.get();
+		ScatterBuffers scatter(buffers, count);
+
+		// The rings, the TOS and the adaptive buffer need one contiguous buffer, the datagram is copied out of it
+		if (m->sharedMemory || m->adaptive || m->receiveTos.load(std::memory_order_relaxed)) {
+			m->scatterBuffer.resize(std::max<size_t>(scatter.capacity, 1));
+			if (!TryReceive(m->scatterBuffer.data(), scatter.capacity, bytes, source, sourcePort))
+				return false;
+			asio::buffer_copy(scatter.Sequence(), asio::buffer(m->scatterBuffer.data(), bytes));
+			return true;
+		}
+
+		if (!m->socketReadable)
+			return false;
+
+		std::error_code error;
+		bytes = m->socket.receive_from(scatter.Sequence(), m->remoteEndpoint, RECEIVE_FLAGS, error);
+
+		// Windows reports truncation as an error
+		bool truncated = bytes > scatter.capacity;
+		if (error == asio::error::message_size) {
+			error.clear();
+			truncated = true;
+		}
+
+		if (error) {
+			if (error != asio::error::would_block && error != asio::error::try_again && !m->terminate) {
+				LOG_WARN("[UDPReceiveSocket]: Error " + std::to_string(error.value()) + ": " + error.message());
+			}
+			m->socketReadable = false;
+			return false;
+		}
+
+		if (truncated) {
+			ReportTruncation(*m, bytes, scatter.capacity);
+			bytes = scatter.capacity;
+		}
+		source = IPv4Address(m->remoteEndpoint.address().to_v4().to_uint());
+		sourcePort = m->remoteEndpoint.port();
+		TRACE_PROBE(receive, m->socket.native_handle(), bytes, source.ToUint(), sourcePort);
+		return true;
+	}
+
+	bool UDPReceiveSocket::TryReceiveAdaptive(uint8_t*& data, size_t capacity, size_t& bytes, IPv4Address& source, uint16_t& sourcePort) {
+		return ReceiveDatagram(*members.get(), data, capacity, bytes, source, sourcePort);
+	}
+
+	size_t UDPReceiveSocket::TryReceiveBatch(uint8_t* const* buffers, size_t capacity, size_t count, size_t* bytes, IPv4Address* sources, uint16_t* sourcePorts) {
+		UDPReceiveSocketMembers* m = members.get();
+		size_t received = 0;
+
+#ifdef __linux__
+		if (!m->adaptive && !m->sharedMemory && !m->receiveTos.load(std::memory_order_relaxed)) {
+			constexpr size_t CHUNK = 64;
+			mmsghdr messages[CHUNK];
+			iovec vectors[CHUNK];
+			sockaddr_in addresses[CHUNK];
+
+			while (received < count && m->socketReadable) {
+				size_t chunk = std::min(count - received, CHUNK);
+				for (size_t i = 0; i < chunk; i++) {
+					vectors[i] = { buffers[received + i], capacity };
+					messages[i] = {};
+					messages[i].msg_hdr.msg_name = &addresses[i];
+					messages[i].msg_hdr.msg_namelen = sizeof(addresses[i]);
+					messages[i].msg_hdr.msg_iov = &vectors[i];
+					messages[i].msg_hdr.msg_iovlen = 1;
+				}
+
+				int result = recvmmsg(m->socket.native_handle(), messages, (unsigned int)chunk, MSG_DONTWAIT | RECEIVE_FLAGS, nullptr);
+				if (result <= 0) {
+					if (result < 0 && errno != EAGAIN && errno != EWOULDBLOCK && !m->terminate) {
+						LOG_WARN("[UDPReceiveSocket]: recvmmsg failed: {}", strerror(errno));
+					}
+					m->socketReadable = false;
+					break;
+				}
+
+				for (int i = 0; i < result; i++) {
+					size_t length = messages[i].msg_len;
+					if (length > capacity || (messages[i].msg_hdr.msg_flags & MSG_TRUNC)) {
+						ReportTruncation(*m, length, capacity);
+						length = capacity;
+					}
+					bytes[received] = length;
+					sources[received] = IPv4Address::FromNetworkOrder(addresses[i].sin_addr.s_addr);
+					sourcePorts[received] = ntohs(addresses[i].sin_port);
+					TRACE_PROBE(receive, m->socket.native_handle(), length, sources[received].ToUint(), sourcePorts[received]);
+					received++;
+				}
+
+				// A short read emptied the queue, the next Wait() finds out about new datagrams
+				if ((size_t)result < chunk) {
+					m->socketReadable = false;
+				}
+			}
+			return received;
+		}
+#endif
+
+		while (received < count && TryReceive(buffers[received], capacity, bytes[received], sources[received], sourcePorts[received])) {
+			received++;
+		}
+		return received;
+	}
+
+	void UDPReceiveSocket::Shutdown() {
+		UDPReceiveSocketMembers* m = members.get();
+		asio::post(m->ioService, [m] {
+			m->terminate = true;
+			m->socket.cancel();
+#ifdef __linux__
+			if (m->sharedMemoryHandle) {
+				m->sharedMemoryHandle->cancel();
+			}
+#endif
+			m->timers.Stop();
+		});
+	}
+
+	bool UDPReceiveSocket::EnableTrafficClass() {
+#ifdef __linux__
+		int enable = 1;
+		if (setsockopt(members->socket.native_handle(), IPPROTO_IP, IP_RECVTOS, &enable, sizeof(enable)) != 0)
+			return false;
+
+		members->receiveTos = true;
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	bool UDPReceiveSocket::EnableAdaptiveBuffer(const AdaptiveBufferOptions& options) {
+		AdaptiveBufferOptions adaptive = options;
+		adaptive.maxSize = std::min(std::max<size_t>(adaptive.maxSize, 1), ReceiveBufferPool::MAX_SIZE);
+
+		// The buffer belongs to the waiting thread
+		UDPReceiveSocketMembers* m = members.get();
+		asio::post(m->ioService, [m, adaptive] { m->adaptive = adaptive; });
+		return true;
+	}
+
+	ReceiveBufferStatistics UDPReceiveSocket::GetReceiveBufferStatistics() {
+		ReceiveBufferStatistics statistics;
+		statistics.truncated = members->truncated.load(std::memory_order_relaxed);
+		statistics.grown = members->grown.load(std::memory_order_relaxed);
+		statistics.shrunk = members->shrunk.load(std::memory_order_relaxed);
+		statistics.adaptiveBufferSize = members->adaptiveSize.load(std::memory_order_relaxed);
+		return statistics;
+	}
+
+	uint8_t UDPReceiveSocket::ReceivedTos() {
+		return members->lastTos;
+	}
+
+	bool UDPReceiveSocket::EnableSharedMemory(const SharedMemoryOptions& options) {
+#ifdef __linux__
+		UDPReceiveSocketMembers* m = members.get();
+		if (m->sharedMemoryEnabled.exchange(true))
+			return true;
+
+		auto receiver = SharedMemoryReceiver::Create(m->socket.local_endpoint().port(), options.ringSize, options.allowOtherUsers);
+		if (!receiver) {
+			m->sharedMemoryEnabled = false;
+			return false;
+		}
+
+		// Installed by the waiting thread, which owns everything the event loop touches. The handler owns the
+		// receiver until then, so it is freed if the handler never runs.
+		// Spinning on the only core keeps the sender from running
+		std::chrono::nanoseconds spin = std::thread::hardware_concurrency() > 1 ? options.spin : std::chrono::nanoseconds(0);
+		asio::post(m->ioService, [m, receiver = std::move(receiver), spin]() mutable {
+			m->sharedMemory = std::move(receiver);
+			m->sharedMemorySpin = spin;
+			m->sharedMemoryHandle.emplace(m->ioService, m->sharedMemory->WaitHandle());
+		});
+		return true;
+#else
+		(void)options;
+		return false;
+#endif
+	}
+
+	TimerId UDPReceiveSocket::ScheduleTimer(std::chrono::nanoseconds delay, std::function<void()> callback) {
+		return members->timers.Schedule(delay, std::move(callback));
+	}
+
+	bool UDPReceiveSocket::CancelTimer(TimerId id) {
+		return members->timers.Cancel(id);
+	}
+
+	std::string UDPReceiveSocket::GetLocalIP() {
+		return members->socket.local_endpoint().address().to_string();
+	}
+
+	uint16_t UDPReceiveSocket::GetLocalPort() {
+		return members->socket.local_endpoint().port();
+	}
+
+	bool UDPReceiveSocket::SendTo(IPv4Address destination, uint16_t port, const uint8_t* data, size_t length) {
+		udp::endpoint endpoint(ToAsioAddress(destination), port);
+		udp::socket& socket = members->socket;
+
+		// The socket is non-blocking for the receive loop, a full send buffer is waited out here
+		std::error_code error;
+		while (true) {
+			socket.send_to(asio::buffer(data, length), endpoint, 0, error);
+			if (error != asio::error::would_block && error != asio::error::try_again)
+				break;
+			socket.wait(udp::socket::wait_write, error);
+			if (error)
+				break;
+		}
+
+		if (error) {
+			LOG_WARN("[UDPReceiveSocket]: Sending to {}:{} failed: {}", endpoint.address().to_string(), port, error.message());
+			return false;
+		}
+		TRACE_PROBE(send, socket.native_handle(), length, endpoint.data(), endpoint.size());
+		return true;
+	}
+
+	bool UDPReceiveSocket::SetFilter(const PacketFilter& filter) {
+		if (!AttachPacketFilter((intptr_t)members->socket.native_handle(), filter))
+			return false;
+
+		std::lock_guard<std::mutex> lock(members->ringFilterMutex);
+		members->ringFilter = filter;
+		members->ringFiltered.store(true, std::memory_order_relaxed);
+		return true;
+	}
+
+	void UDPReceiveSocket::ClearFilter() {
+		DetachPacketFilter((intptr_t)members->socket.native_handle());
+
+		std::lock_guard<std::mutex> lock(members->ringFilterMutex);
+		members->ringFilter.reset();
+		members->ringFiltered.store(false, std::memory_order_relaxed);
+	}
 
+	void LogReceivedPacket(const char* component, const uint8_t* data, size_t length, IPv4Address source, uint16_t sourcePort) {
+#ifndef DEPLOY
+		if (!LOG_ENABLED(spdlog::level::info))
+			return;
 
+		char host[IPv4Address::MAX_STRING_LENGTH + 1] = {};
+		source.ToChars(host);
+		LOG_INFO("[{}]: Packet received from {}:{}", component, host, sourcePort);
+		if (LOG_ENABLED(spdlog::level::trace)) {
+			LOG_TRACE("[{}]: Packet received from {}:{} -> [{}] -> \"{}\"", component, host, sourcePort, BytesToString(data, length), std::string((const char*)data, length));
+		}
+#endif
+	}
 
+	void LogListenerError(const char* component, const char* message) {
+		LOG_CRITICAL("[{}]: Exception from listener thread: {}", component, message);
+	}
 
 
 
@@ -527,201 +2253,408 @@ namespace NetLib {
 
 
 
+	// =======================================
+	// ===      UDPServerAsync Class       ===
+	// =======================================
 
+	// UDPServerAsync is a BasicUDPServer with std::function callbacks and recording
+	struct UDPServerAsyncDispatch {
+		UDPServerAsyncMembers* members;
+		void operator()(uint8_t* packet, size_t packetSize, IPv4Address source, uint16_t sourcePort) const;
+	};
 
+	struct UDPServerAsyncLog {
+		static constexpr bool enabled = true;
 
+		static void Received(const uint8_t* data, size_t length, IPv4Address source, uint16_t sourcePort) {
+			LogReceivedPacket("UDPServerAsync", data, length, source, sourcePort);
+		}
 
+		static void Error(const char* message) {
+			LogListenerError("UDPServerAsync", message);
+		}
+	};
 
+	// One worker of the dispatch pool: A single-producer single-consumer ring of datagram copies, filled by the
+	// listener thread. The indices only grow, the slot is (index & mask).
+	struct DispatchWorker {
+		struct Slot {
+			uint32_t length = 0;
+			IPv4Address source;
+			uint16_t sourcePort = 0;
+			uint8_t tos = 0;
+		};
 
+		static constexpr uint32_t STOP = 0xFFFFFFFF;		// Length of the slot that ends the worker
 
+		std::vector<Slot> slots;
+		std::vector<uint8_t> buffers;
+		size_t bufferSize = 0;
+		uint32_t mask = 0;
+		std::string remoteHost;
+		std::thread thread;
+
+		alignas(64) std::atomic<uint32_t> head = 0;			// Written by the worker
+		alignas(64) std::atomic<uint32_t> tail = 0;			// Written by the listener, the worker waits on it
+
+		// Watchdog: Start of the running callback in steady clock nanoseconds, 0 while idle
+		alignas(64) std::atomic<int64_t> callbackStart = 0;
+		std::atomic<uint32_t> callbackSource = 0;
+		std::atomic<uint16_t> callbackSourcePort = 0;
+		int64_t reportedStart = 0;							// Listener thread only
+	};
 
+	struct DispatchPool {
+		WorkerPoolOptions options;
+		std::vector<std::unique_ptr<DispatchWorker>> workers;
+		std::atomic<uint64_t> dispatched = 0;
+		std::atomic<uint64_t> dropped = 0;
+		std::atomic<uint64_t> overruns = 0;
+	};
 
+	// The TOS byte of the datagram a worker thread is handling, for ReceivedTos()
+	static thread_local int workerTos = -1;
 
+	struct UDPServerAsyncMembers {
 
+		std::function<void(uint8_t* packet, size_t packetSize)> callback;
+		std::function<void(uint8_t* packet, size_t packetSize, const std::string& remoteHost, uint16_t remotePort)> callbackWithHost;
+		std::function<void(uint8_t* packet, size_t packetSize, IPv4Address source, uint16_t sourcePort)> callbackWithAddress;
+		std::string remoteHost;
+		size_t bufferSize = 0;
 
+		// 'recording' lets the dispatch skip the mutex while no recorder is attached
+		std::mutex recorderMutex;
+		std::shared_ptr<TrafficRecorder> recorder;
+		std::atomic<bool> recording = false;
 
+		// Destroyed after the listener thread stopped: The workers finish the queued datagrams, then exit
+		std::unique_ptr<DispatchPool> pool;
+		std::atomic<DispatchPool*> activePool = nullptr;
 
+		// Last member: The listener thread is stopped before anything else is destroyed
+		std::optional<BasicUDPServer<UDPServerAsyncDispatch, DynamicBuffer, UDPServerAsyncLog>> server;
 
+		~UDPServerAsyncMembers();
+	};
 
+	static void InvokeCallbacks(UDPServerAsyncMembers& members, std::string& remoteHost, uint8_t* packet, size_t packetSize, IPv4Address source, uint16_t sourcePort) {
+		TRACE_PROBE(callback_entry, packet, packetSize, source.ToUint(), sourcePort);
+		if (members.callback) {
+			members.callback(packet, packetSize);
+		}
+		if (members.callbackWithHost) {
+			char host[IPv4Address::MAX_STRING_LENGTH];
+			remoteHost.assign(host, source.ToChars(host));		// Fits the small string buffer, no allocation
+			members.callbackWithHost(packet, packetSize, remoteHost, sourcePort);
+		}
+		if (members.callbackWithAddress) {
+			members.callbackWithAddress(packet, packetSize, source, sourcePort);
+		}
+		TRACE_PROBE(callback_exit, packet, packetSize);
+	}
 
-/*
+	static int64_t SteadyNowNs() {
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
 
-#include "Battery/pch.h"
-#include "Battery/Core/Exception.h"
-#include "Battery/Log/Log.h"
-#include "Battery/Utils/NetUtils.h"
-#include "Battery/StringUtils.h"
-#include "Battery/Utils/TimeUtils.h"
-#include "Battery/Utils/FileUtils.h"
+	static void RunDispatchWorker(UDPServerAsyncMembers& members, DispatchPool& pool, DispatchWorker& worker) {
+		int64_t budget = pool.options.callbackBudget.count();
+		uint32_t head = worker.head.load(std::memory_order_relaxed);
 
-#define CPPHTTPLIB_OPENSSL_SUPPORT
-#include "Battery/Extern/httplib.h"
-#include "Battery/Extern/magic_enum.hpp"
+		while (true) {
+			uint32_t tail = worker.tail.load(std::memory_order_acquire);
+			if (head == tail) {
+				worker.tail.wait(tail, std::memory_order_acquire);
+				continue;
+			}
 
-#pragma warning( disable : 4101 )		// Suppress warning about unused variable 'e' (Only in this .cpp file)
+			DispatchWorker::Slot& slot = worker.slots[head & worker.mask];
+			if (slot.length == DispatchWorker::STOP)
+				return;
 
-namespace Battery {
+			uint8_t* packet = worker.buffers.data() + (head & worker.mask) * worker.bufferSize;
+			workerTos = slot.tos;
 
-	// TODO: Fix UDPServer and Client with the IncompleteTypeWrapper, also for RobotinoLib
+			int64_t start = 0;
+			if (budget > 0) {
+				start = SteadyNowNs();
+				worker.callbackSource.store(slot.source.ToUint(), std::memory_order_relaxed);
+				worker.callbackSourcePort.store(slot.sourcePort, std::memory_order_relaxed);
+				worker.callbackStart.store(start, std::memory_order_release);
+			}
 
-	// UDPServer
+			// A throwing callback must not end the worker, its queue would fill up and never drain
+			try {
+				InvokeCallbacks(members, worker.remoteHost, packet, slot.length, slot.source, slot.sourcePort);
+			}
+			catch (std::exception& e) {
+				LogListenerError("UDPServerAsync", e.what());
+			}
+			catch (...) {
+				LogListenerError("UDPServerAsync", "Unknown exception");
+			}
 
-	struct UDPServerData {
+			if (budget > 0) {
+				worker.callbackStart.store(0, std::memory_order_release);
+				if (SteadyNowNs() - start > budget) {
+					pool.overruns.fetch_add(1, std::memory_order_relaxed);
+				}
+			}
 
-		asio::io_service ioService;
-		std::unique_ptr<udp::socket> socket;
-		udp::endpoint remoteEndpoint;
+			worker.head.store(++head, std::memory_order_release);
+		}
+	}
 
-		bool terminate = false;
-		std::unique_ptr<std::thread> listenerThread;
-		std::function<void(uint8_t* packet, size_t packetSize)> callback;
+	// Listener thread: Copies the datagram into the queue of the worker that owns the sender
+	static void EnqueueForWorker(UDPServerAsyncMembers& members, DispatchPool& pool, uint8_t* packet, size_t packetSize, IPv4Address source, uint16_t sourcePort) {
+		uint64_t hash = (((uint64_t)source.ToUint() << 16) | sourcePort) * 0x9E3779B97F4A7C15ull;
+		DispatchWorker& worker = *pool.workers[(hash >> 32) % pool.workers.size()];
 
-		std::unique_ptr<uint8_t[]> buffer;
-		size_t bufferSize;
+		// The slots have the size of the server buffer, datagrams of an adaptive buffer may not fit
+		uint32_t tail = worker.tail.load(std::memory_order_relaxed);
+		if (tail - worker.head.load(std::memory_order_acquire) > worker.mask || packetSize > worker.bufferSize) {
+			pool.dropped.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
 
-		UDPServerData() = default;
-		~UDPServerData() = default;
-	};
+		DispatchWorker::Slot& slot = worker.slots[tail & worker.mask];
+		memcpy(worker.buffers.data() + (tail & worker.mask) * worker.bufferSize, packet, packetSize);
+		slot.length = (uint32_t)packetSize;
+		slot.source = source;
+		slot.sourcePort = sourcePort;
+		slot.tos = members.server->ReceivedTos();
 
-	// -> UDPServerDataWrapper Child class vvvvvv
-	UDPServer::UDPServerDataWrapper::UDPServerDataWrapper() {
-		data = new UDPServerData();
+		worker.tail.store(tail + 1, std::memory_order_release);
+		worker.tail.notify_one();
+		pool.dispatched.fetch_add(1, std::memory_order_relaxed);
 	}
 
-	UDPServer::UDPServerDataWrapper::~UDPServerDataWrapper() {
-		delete data;
+	// Listener thread: Reports the callbacks that are still running over their budget, once each
+	static void ScheduleWatchdog(UDPServerAsyncMembers& members, DispatchPool& pool) {
+		UDPServerAsyncMembers* m = &members;
+		DispatchPool* p = &pool;
+		auto interval = std::max<std::chrono::nanoseconds>(pool.options.callbackBudget / 2, std::chrono::nanoseconds(NETLIB_TIMER_TICK_NS));
+
+		members.server->ScheduleTimer(interval, [m, p] {
+			int64_t now = SteadyNowNs();
+			for (auto& worker : p->workers) {
+				int64_t start = worker->callbackStart.load(std::memory_order_acquire);
+				if (start == 0 || start == worker->reportedStart || now - start <= p->options.callbackBudget.count())
+					continue;
+
+				worker->reportedStart = start;
+				std::chrono::nanoseconds elapsed(now - start);
+				IPv4Address source(worker->callbackSource.load(std::memory_order_relaxed));
+				uint16_t sourcePort = worker->callbackSourcePort.load(std::memory_order_relaxed);
+
+				if (p->options.onOverrun) {
+					p->options.onOverrun(elapsed, source, sourcePort);
+				}
+				else {
+					LOG_WARN("[UDPServerAsync]: Callback for {}:{} is running for {} us, over its budget of {} us", source.ToString(), sourcePort,
+						elapsed.count() / 1000, p->options.callbackBudget.count() / 1000);
+				}
+			}
+			ScheduleWatchdog(*m, *p);
+		});
 	}
 
-	UDPServerData* UDPServer::UDPServerDataWrapper::get() {
-		return data;
-	}
-	// -> UDPServerDataWrapper Child class ^^^^^^
+	UDPServerAsyncMembers::~UDPServerAsyncMembers() {
+		server.reset();		// No more datagrams are queued
 
-	UDPServer::UDPServer() {
-		try {
-			data = std::make_unique<UDPServerDataWrapper>();
-			LOG_TRACE("UDPServer Instance constructed");
-		}
-		catch (std::exception& e) {
-			throw Battery::Exception(std::string("ASIO Exception: ") + e.what());
+		if (pool) {
+			for (auto& worker : pool->workers) {
+				// The queue might be full, the worker frees slots until the stop marker fits
+				uint32_t tail = worker->tail.load(std::memory_order_relaxed);
+				while (tail - worker->head.load(std::memory_order_acquire) > worker->mask) {
+					std::this_thread::yield();
+				}
+				worker->slots[tail & worker->mask].length = DispatchWorker::STOP;
+				worker->tail.store(tail + 1, std::memory_order_release);
+				worker->tail.notify_one();
+			}
+			for (auto& worker : pool->workers) {
+				worker->thread.join();
+			}
 		}
 	}
 
-	UDPServer::UDPServer(std::function<void(uint8_t* packet, size_t packetSize)> callback, uint16_t port, size_t bufferSize) {
-		try {
-			data = std::make_unique<UDPServerDataWrapper>();
-			LOG_TRACE("UDPServer Instance constructed");
-		}
-		catch (std::exception& e) {
-			throw Battery::Exception(std::string("ASIO Exception: ") + e.what());
+	void UDPServerAsyncDispatch::operator()(uint8_t* packet, size_t packetSize, IPv4Address source, uint16_t sourcePort) const {
+		if (members->recording.load(std::memory_order_relaxed)) {
+			std::lock_guard<std::mutex> lock(members->recorderMutex);
+			if (members->recorder) {
+				members->recorder->Record(packet, packetSize, source, sourcePort);
+			}
 		}
-		Listen(callback, port, bufferSize);
-	}
 
-	UDPServer::~UDPServer() {
-		LOG_TRACE("Terminating UDP listener");
+		if (DispatchPool* pool = members->activePool.load(std::memory_order_acquire)) {
+			EnqueueForWorker(*members, *pool, packet, packetSize, source, sourcePort);
+			return;
+		}
 
-		// Set the terminate flag and wait until the listener thread returns
-		data->get()->terminate = true;
-		data->get()->socket->close();
-		data->get()->listenerThread->join();
-		data->get()->listenerThread.reset();
+		InvokeCallbacks(*members, members->remoteHost, packet, packetSize, source, sourcePort);
+	}
 
-		LOG_TRACE("UDPServer Instance destructed");
+	UDPServerAsync::UDPServerAsync(std::function<void(uint8_t* packet, size_t packetSize)> callback, uint16_t port, size_t bufferSize)
+		: members(new UDPServerAsyncMembers())
+	{
+		members->callback = callback;
+		Initialize(port, bufferSize);
 	}
 
-	void UDPServer::Listen(std::function<void(uint8_t* packet, size_t packetSize)> callback, uint16_t port, size_t bufferSize) {
-		try {
-			LOG_TRACE("Creating UDP listener");
+	UDPServerAsync::UDPServerAsync(std::function<void(uint8_t* packet, size_t packetSize, const std::string& remoteHost, uint16_t remotePort)> callback, uint16_t port, size_t bufferSize)
+		: members(new UDPServerAsyncMembers())
+	{
+		members->callbackWithHost = callback;
+		Initialize(port, bufferSize);
+	}
 
-			// Setting all data members
-			data->get()->socket = std::make_unique<udp::socket>(data->get()->ioService, udp::endpoint(udp::v4(), port));
-			data->get()->bufferSize = bufferSize;
-			data->get()->callback = callback;
+	UDPServerAsync::UDPServerAsync(std::function<void(uint8_t* packet, size_t packetSize, IPv4Address source, uint16_t sourcePort)> callback, uint16_t port, size_t bufferSize)
+		: members(new UDPServerAsyncMembers())
+	{
+		members->callbackWithAddress = callback;
+		Initialize(port, bufferSize);
+	}
 
-			// Initialize the buffer
-			data->get()->buffer.reset(new uint8_t[bufferSize]);
-			for (size_t i = 0; i < bufferSize; i++) {
-				data->get()->buffer[i] = 0;
-			}
+	UDPServerAsync::~UDPServerAsync() {
+		LOG_DEBUG("[UDPServerAsync]: Terminating UDP listener");
+		members->server.reset();
+		LOG_DEBUG("[UDPServerAsync]: Instance destructed");
+	}
 
-			// Start the listener thread
-			data->get()->listenerThread = std::make_unique<std::thread>(std::bind(&UDPServer::ListenerThread, this));
+	std::string UDPServerAsync::GetLocalIP() {
+		return members->server->GetLocalIP();
+	}
 
-			LOG_TRACE("UDPServer Instance constructed");
-		}
-		catch (std::exception& e) {
-			throw Battery::Exception(std::string("ASIO Exception: ") + e.what());
-		}
+	uint16_t UDPServerAsync::GetLocalPort() {
+		return members->server->GetLocalPort();
 	}
 
-	void UDPServer::OnReceive(const std::error_code& error, size_t bytes) {
-		if (!error) {
+	bool UDPServerAsync::SendTo(IPv4Address destination, uint16_t port, const uint8_t* data, size_t length) {
+		return members->server->SendTo(destination, port, data, length);
+	}
 
-			LOG_TRACE("UDP Packet received, calling client callback");
-			data->get()->callback(data->get()->buffer.get(), bytes);
+	bool UDPServerAsync::SetFilter(const PacketFilter& filter) {
+		return members->server->SetFilter(filter);
+	}
 
-		}
-		else {
+	void UDPServerAsync::ClearFilter() {
+		members->server->ClearFilter();
+	}
 
-			if (data->get()->terminate)	// Errors are ignored if thread is being terminated
-				return;
+	void UDPServerAsync::StartRecording(std::shared_ptr<TrafficRecorder> recorder) {
+		std::lock_guard<std::mutex> lock(members->recorderMutex);
+		members->recorder = std::move(recorder);
+		members->recording.store(members->recorder != nullptr, std::memory_order_relaxed);
+	}
 
-			LOG_WARN("UDP Error " + std::to_string(error.value()) + ": " + error.message());
-		}
+	void UDPServerAsync::StopRecording() {
+		std::lock_guard<std::mutex> lock(members->recorderMutex);
+		members->recorder.reset();
+		members->recording.store(false, std::memory_order_relaxed);
+	}
 
-		// Start listening for the next packet
-		StartAsyncListener();
+	bool UDPServerAsync::EnableTrafficClass() {
+		return members->server->EnableTrafficClass();
 	}
 
-	void UDPServer::StartAsyncListener() {
-		try {
-			data->get()->socket->async_receive_from(asio::buffer(data->get()->buffer.get(), data->get()->bufferSize), data->get()->remoteEndpoint,
-				std::bind(&UDPServer::OnReceive, this, std::placeholders::_1, std::placeholders::_2));
-			LOG_TRACE("UDP async listener started");
-		}
-		catch (std::exception& e) {
-			throw Battery::Exception(std::string("ASIO Exception: ") + e.what());
-		}
+	uint8_t UDPServerAsync::ReceivedTos() {
+		if (workerTos >= 0)
+			return (uint8_t)workerTos;
+
+		return members->server->ReceivedTos();
 	}
 
-	void UDPServer::ListenerThread() {
+	bool UDPServerAsync::EnableWorkerPool(const WorkerPoolOptions& options) {
+		if (members->pool)
+			return false;
 
-		LOG_TRACE("UDP listener thread started");
+		auto pool = std::make_unique<DispatchPool>();
+		pool->options = options;
 
-		try {
+		size_t workers = options.workers;
+		if (workers == 0) {
+			workers = std::max<unsigned>(std::thread::hardware_concurrency(), 1);
+		}
 
-			// Start listener once
-			StartAsyncListener();
+		uint32_t queueSize = 2;
+		while (queueSize < options.queueSize && queueSize < (1u << 30)) {
+			queueSize *= 2;
+		}
 
-			// Main loop in the listener thread
-			while (!data->get()->terminate) {
-				data->get()->ioService.run_one();
+		try {
+			for (size_t i = 0; i < workers; i++) {
+				auto worker = std::make_unique<DispatchWorker>();
+				worker->slots.resize(queueSize);
+				worker->bufferSize = members->bufferSize;
+				worker->buffers.resize((size_t)queueSize * members->bufferSize);
+				worker->mask = queueSize - 1;
+				worker->remoteHost.reserve(IPv4Address::MAX_STRING_LENGTH);
+				pool->workers.push_back(std::move(worker));
 			}
-
 		}
-		catch (Battery::Exception& e) {
-			LOG_CRITICAL(std::string("Battery::Exception from listener thread: ") + e.what());
+		catch (std::bad_alloc&) {
+			LOG_ERROR("[UDPServerAsync]: Not enough memory for {} workers with {} datagrams of {} bytes", workers, queueSize, members->bufferSize);
+			return false;
 		}
-		catch (std::exception& e) {
-			LOG_CRITICAL(std::string("ASIO UDP Exception from listener thread: ") + e.what());
+
+		UDPServerAsyncMembers* m = members.get();
+		DispatchPool* p = pool.get();
+		for (auto& worker : pool->workers) {
+			DispatchWorker* w = worker.get();
+			w->thread = std::thread([m, p, w] { RunDispatchWorker(*m, *p, *w); });
 		}
-		catch (...) {
-			LOG_CRITICAL("Unknown exception from listener thread!");
+
+		members->pool = std::move(pool);
+		if (options.callbackBudget.count() > 0) {
+			ScheduleWatchdog(*m, *p);
 		}
+		members->activePool.store(p, std::memory_order_release);
 
-		LOG_TRACE("UDP listener thread returned");
+		LOG_DEBUG("[UDPServerAsync]: Callbacks run on {} workers with queues of {} datagrams", workers, queueSize);
+		return true;
 	}
 
+	bool UDPServerAsync::EnableAdaptiveBuffer(const AdaptiveBufferOptions& options) {
+		return members->server->EnableAdaptiveBuffer(options);
+	}
 
+	ReceiveBufferStatistics UDPServerAsync::GetReceiveBufferStatistics() {
+		return members->server->GetReceiveBufferStatistics();
+	}
 
+	WorkerPoolStatistics UDPServerAsync::GetWorkerPoolStatistics() {
+		WorkerPoolStatistics statistics;
+		if (DispatchPool* pool = members->activePool.load(std::memory_order_acquire)) {
+			statistics.dispatched = pool->dispatched.load(std::memory_order_relaxed);
+			statistics.dropped = pool->dropped.load(std::memory_order_relaxed);
+			statistics.overruns = pool->overruns.load(std::memory_order_relaxed);
+		}
+		return statistics;
+	}
 
+	bool UDPServerAsync::EnableSharedMemory(const SharedMemoryOptions& options) {
+		return members->server->EnableSharedMemory(options);
+	}
 
+	TimerId UDPServerAsync::ScheduleTimer(std::chrono::nanoseconds delay, std::function<void()> callback) {
+		return members->server->ScheduleTimer(delay, std::move(callback));
+	}
 
+	bool UDPServerAsync::CancelTimer(TimerId id) {
+		return members->server->CancelTimer(id);
+	}
 
+	void UDPServerAsync::Initialize(uint16_t port, size_t bufferSize) {
+		LOG_DEBUG("[UDPServerAsync]: Creating UDP listener ...");
 
+		members->remoteHost.reserve(IPv4Address::MAX_STRING_LENGTH);
+		members->bufferSize = bufferSize;
+		members->server.emplace(UDPServerAsyncDispatch{ members.get() }, port, DynamicBuffer(bufferSize));
 
-	
+		LOG_DEBUG("[UDPServerAsync]: Instance constructed");
+	}
 
 
 
@@ -730,214 +2663,257 @@ namespace Battery {
 
 
 
+	// ==================================
+	// ===      UDPServer Class       ===
+	// ==================================
 
+	UDPServer::UDPServer(uint16_t port, size_t bufferSize)
+		: server(std::function<void(uint8_t* packet, size_t packetSize, const std::string& remoteIP, uint16_t remotePort)>(
+			std::bind(&UDPServer::OnReceive, this, _1, _2, _3, _4)), port, bufferSize
+	) {
+		LOG_DEBUG("[UDPServer]: Instance constructed");
+	}
 
+	UDPServer::~UDPServer() {
+		LOG_DEBUG("[UDPServer]: Instance destructed");
+	}
 
-	// =================================================
-	// ===      File download / HTTP Utilities       ===
-	// =================================================
+	std::optional<Packet> UDPServer::ReceivePacket() {
+		Packet packet;
+		if (!ReceivePacket(packet))
+			return std::nullopt;
 
-	std::pair<std::string, std::string> SplitUrl(const std::string& url) {
-		std::vector<std::string> urlFragments = Battery::StringUtils::SplitString(url, '/');
+		return std::make_optional(std::move(packet));
+	}
 
-		if (urlFragments.size() < 3)
-			return std::make_pair("", "");
+	bool UDPServer::ReceivePacket(Packet& packet) {
+		std::lock_guard<std::mutex> guard(bufferMutex);
 
-		std::string hostname = urlFragments[0] + "//" + urlFragments[1];
-		std::string pathname = "/";
+		for (PacketQueue& queue : queues) {
+			if (queue.count == 0)
+				continue;
 
-		for (size_t i = 2; i < urlFragments.size(); i++) {
-			pathname += urlFragments[i] + "/";
+			// Swapping hands the previous buffers of 'packet' back to the ring, where they are reused
+			std::swap(packet, queue.packets[queue.head]);
+			queue.head = (queue.head + 1) % queue.packets.size();
+			queue.count--;
+			TRACE_PROBE(queue_dequeue, &queue - queues.data(), queue.count, packet.data.size());
+			return true;
 		}
-		pathname.pop_back();
+		return false;
+	}
+
+	std::string UDPServer::GetLocalIP() {
+		return server.GetLocalIP();
+	}
 
-		return std::make_pair(hostname, pathname);
+	bool UDPServer::SetFilter(const PacketFilter& filter) {
+		return server.SetFilter(filter);
 	}
 
-	std::optional<httplib::Response> GetHttpRequestRaw(const std::string& url, bool followRedirect = true) {
+	void UDPServer::ClearFilter() {
+		server.ClearFilter();
+	}
 
-		LOG_TRACE(__FUNCTION__"(): Accessing {}", url);
-		std::pair<std::string, std::string> urlP = SplitUrl(url);
+	bool UDPServer::EnableSharedMemory(const SharedMemoryOptions& options) {
+		return server.EnableSharedMemory(options);
+	}
 
-		if (urlP.first.empty() || urlP.second.empty()) {
-			LOG_TRACE(__FUNCTION__"(): Error: Invalid url: server='{}', path='{}'", urlP.first, urlP.second);
-			return std::nullopt;
-		}
+	bool UDPServer::EnableAdaptiveBuffer(const AdaptiveBufferOptions& options) {
+		return server.EnableAdaptiveBuffer(options);
+	}
 
-		httplib::Client cli(urlP.first);
-		httplib::Result res = cli.Get(urlP.second.c_str());
+	ReceiveBufferStatistics UDPServer::GetReceiveBufferStatistics() {
+		return server.GetReceiveBufferStatistics();
+	}
 
-		if (&res.value() == nullptr || res.error() != httplib::Error::Success) {
-			LOG_TRACE(__FUNCTION__"(): Network failed");
-			return std::nullopt;
+	bool UDPServer::EnablePriorityQueues(size_t classes, std::function<size_t(uint8_t dscp)> classOf) {
+		if (!server.EnableTrafficClass())
+			return false;
+
+		classes = std::max<size_t>(classes, 1);
+		std::lock_guard<std::mutex> guard(bufferMutex);
+		queues.resize(classes);
+
+		for (uint8_t dscp = 0; dscp < 64; dscp++) {
+			size_t queue = 0;
+			if (classOf) {
+				queue = classOf(dscp);
+			}
+			else if (dscp >= DSCP_CS5) {
+				queue = 0;
+			}
+			else if (dscp == DSCP_CS1 || dscp == DSCP_LE) {
+				queue = classes - 1;
+			}
+			else {
+				queue = 1;
+			}
+			queueOfDscp[dscp] = (uint8_t)std::min(queue, classes - 1);
 		}
-		LOG_TRACE(__FUNCTION__"(): Success");
+		return true;
+	}
+
+	void UDPServer::OnReceive(uint8_t* packet, size_t packetSize, const std::string& remoteIP, uint16_t remotePort) {
+		uint8_t tos = server.ReceivedTos();
+		std::lock_guard<std::mutex> guard(bufferMutex);
 
-		if (res->status == 302 && followRedirect) {
-			std::string follow = res->get_header_value("location");
-			LOG_TRACE(__FUNCTION__"(): Following redirect to {}", follow);
-			return GetHttpRequestRaw(follow);
+		// Each class overflows on its own
+		PacketQueue& queue = queues[queueOfDscp[tos >> 2]];
+		if (queue.count >= queue.packets.size()) {
+			TRACE_PROBE(queue_drop, &queue - queues.data(), packetSize, remoteIP.c_str(), remotePort);
+			return;
 		}
 
-		return std::make_optional(res.value());
+		Packet& p = queue.packets[(queue.head + queue.count) % queue.packets.size()];
+		p.data.assign(packet, packet + packetSize);
+		p.remoteIP = remoteIP;
+		p.remotePort = remotePort;
+		p.tos = tos;
+		queue.count++;
+		TRACE_PROBE(queue_enqueue, &queue - queues.data(), queue.count, packetSize);
 	}
 
-	std::optional<HttpResponse> GetHttpRequest(const std::string& url, bool followRedirect) {
-		std::optional<httplib::Response> res = GetHttpRequestRaw(url, followRedirect);
-		if (!res.has_value())
-			return std::nullopt;
 
-		return std::make_optional(HttpResponse(res->body, (size_t)res->status, res->reason));
-	}
 
-	std::optional<HttpResponse> GetHttpRequestChunkedImpl(const std::string& url,
-		std::function<bool(const char*, size_t)> onReceiveCallback,
-		std::optional<std::function<bool(uint64_t, uint64_t)>> onProgressCallback)
-	{
-		LOG_TRACE(__FUNCTION__"(): Accessing {}", url);
-		std::pair<std::string, std::string> urlP = SplitUrl(url);
 
-		if (urlP.first.empty() || urlP.second.empty()) {
-			LOG_TRACE(__FUNCTION__"(): Error: Invalid url: server='{}', path='{}'", urlP.first, urlP.second);
-			return std::nullopt;
-		}
 
-		httplib::Client cli(urlP.first);
-		std::optional<httplib::Result> res;
 
-		if (onProgressCallback.has_value()) {
-			res = cli.Get(urlP.second.c_str(),
-				[&](const char* data, size_t bytes) {
-				return onReceiveCallback(data, bytes);
-			},
-				[&](uint64_t progress, uint64_t total) {
-				return onProgressCallback.value()(progress, total);
-			}
-			);
-		}
-		else {
-			res = cli.Get(urlP.second.c_str(),
-				[&](const char* data, size_t bytes) {
-				return onReceiveCallback(data, bytes);
-			},
-				[&](uint64_t progress, uint64_t total) {
-				return true;
-			}
-			);
-		}
 
-		if (&res->value() == nullptr || res->error() != httplib::Error::Success) {
-			LOG_TRACE(__FUNCTION__"(): Network failed");
-			return std::nullopt;
-		}
 
-		LOG_TRACE(__FUNCTION__"(): Success");
-		return std::make_optional(HttpResponse(res.value()->body, res.value()->status, res.value()->reason));
-	}
+	// ==========================================
+	// ===      UDPServerBlocking Class       ===
+	// ==========================================
 
-	// TODO: Implement max redirect count
-	std::optional<HttpResponse> GetHttpRequestChunked(
-		const std::string& url,
-		std::function<void()> onClearDataCallback,
-		std::function<bool(const char*, size_t)> onReceiveCallback,
-		std::optional<std::function<bool(uint64_t, uint64_t)>> onProgressCallback,
-		bool followRedirect)
-	{
-		// Download the resource
-		std::optional<HttpResponse> res = GetHttpRequestChunkedImpl(url, onReceiveCallback, onProgressCallback);
-		if (!res.has_value()) {
-			return std::nullopt;
-		}
+	struct UDPServerBlockingMembers {
+
+		asio::io_service ioService;
+		udp::socket socket;
 
-		// Handle redirect
-		if (res->status == 302 && followRedirect) {
-			LOG_TRACE(__FUNCTION__"(): Got redirected, requesting again");
+		std::vector<uint8_t> buffer;
+		std::atomic<uint64_t> truncated = 0;
 
-			// Send the same request again without redirect
-			std::optional<httplib::Response> res = GetHttpRequestRaw(url, false);
-			if (!res.has_value()) {
-				LOG_TRACE(__FUNCTION__"(): Second request failed");
-				return std::nullopt;
-			}
+		UDPServerBlockingMembers(const udp::endpoint& endpoint) : socket(ioService, endpoint) {}
+		~UDPServerBlockingMembers() = default;
+	};
 
-			// Now read the location of the redirect
-			std::string follow = res->get_header_value("location");
-			LOG_TRACE(__FUNCTION__"(): Followed redirect to {}, clearing data and restarting download", follow);
-			onClearDataCallback();
+	UDPServerBlocking::UDPServerBlocking(uint16_t port, size_t bufferSize)
+		: members(new UDPServerBlockingMembers(udp::endpoint(udp::v4(), port)))
+	{
+		try {
+			LOG_DEBUG("[UDPServerBlocking]: Creating UDP listener ...");
 
-			// And download the actual resource recursively (allowing several redirects)
-			return GetHttpRequestChunked(follow, onClearDataCallback, onReceiveCallback, onProgressCallback);
-		}
+			// Initialize the buffer
+			members->buffer.assign(bufferSize, 0);
+			TRACE_PROBE(socket_open, members->socket.native_handle(), port);
 
-		return res;
+			LOG_DEBUG("[UDPServerBlocking]: Instance constructed");
+		}
+		catch (std::exception& e) {
+			throw std::runtime_error(std::string("ASIO Exception: ") + e.what());
+		}
 	}
 
-	std::string DownloadUrlToBuffer(
-		const std::string& url, std::optional<std::function<bool(uint64_t, uint64_t)>> onProgressCallback,
-		bool followRedirect) {
+	UDPServerBlocking::~UDPServerBlocking() {
 
-		std::string buffer = "";
+		std::error_code error;
+		TRACE_PROBE(socket_close, members->socket.native_handle(), members->socket.local_endpoint(error).port());
+		members->socket.close();
 
-		std::optional<HttpResponse> res = GetHttpRequestChunked(url,
-			[&]() {
-			buffer.clear();
-		},
-			[&](const char* data, size_t bytes) {
-			buffer.append(data, bytes);
-			return true;
-		},
-			onProgressCallback,
-			true
-			);
+		LOG_DEBUG("[UDPServerBlocking]: Instance destructed");
+	}
 
-		if (!res.has_value())
-			return "";
+	std::optional<std::vector<uint8_t>> UDPServerBlocking::ReceivePacket() {
+		Packet packet;
+		if (!ReceivePacket(packet))
+			return std::nullopt;
 
-		return buffer;
+		return std::make_optional(std::move(packet.data));
 	}
 
-	bool DownloadUrlToFile(
-		const std::string& url, const std::string& targetFile, bool binary,
-		std::optional<std::function<bool(uint64_t, uint64_t)>> onProgressCallback,
-		bool followRedirect) {
+	bool UDPServerBlocking::ReceivePacket(Packet& packet) {
+
+		udp::endpoint remote_endpoint;
+		std::error_code error;
+		size_t bytes = members->socket.receive_from(asio::buffer(members->buffer), remote_endpoint, RECEIVE_FLAGS, error);
 
-		LOG_TRACE(__FUNCTION__"(): Preparing directory and opening target file");
-		Battery::PrepareDirectory(Battery::GetParentDirectory(targetFile));
-		ALLEGRO_FILE* file = al_fopen(targetFile.c_str(), (binary ? "wb" : "w"));
-		if (file == nullptr) {
-			LOG_TRACE(__FUNCTION__"(): File failed, memory error...");
+		if (error && error != asio::error::message_size) {
 			return false;
 		}
 
-		std::optional<HttpResponse> res = GetHttpRequestChunked(url,
-			[&]() {
-				// Clear the file: Close and open it again
-				al_fclose(file);
-				file = al_fopen(targetFile.c_str(), (binary ? "wb" : "w"));
-				if (file == nullptr) {
-					LOG_TRACE(__FUNCTION__"(): File failed, memory error...");
-					return false;
-				}
-				return true;
-			},
-			[&](const char* data, size_t bytes) {
-				if (file)
-					al_fwrite(file, data, bytes);
+		if (error || bytes > members->buffer.size()) {
+			uint64_t count = members->truncated.fetch_add(1, std::memory_order_relaxed) + 1;
+			if ((count & (count - 1)) == 0) {
+				LOG_WARN("[UDPServerBlocking]: Datagram truncated to {} bytes ({} so far), raise the buffer size", members->buffer.size(), count);
+			}
+			bytes = members->buffer.size();
+		}
 
-				return true;
-			},
-			onProgressCallback,
-			true
-		);
+		packet.data.assign(members->buffer.begin(), members->buffer.begin() + bytes);
+		AddressToString(remote_endpoint.address(), packet.remoteIP);
+		packet.remotePort = remote_endpoint.port();
+		TRACE_PROBE(receive, members->socket.native_handle(), bytes, remote_endpoint.address().to_v4().to_uint(), packet.remotePort);
 
-		al_fclose(file);
+#ifndef DEPLOY
+		if (LOG_ENABLED(spdlog::level::info)) {
+			logPacket(packet.data.data(), bytes, packet.remoteIP, packet.remotePort);
+		}
+#endif
+
+		return true;
+	}
+
+	bool UDPServerBlocking::ReceivePacket(const MutableBuffer* buffers, size_t count, size_t& bytes, IPv4Address& source, uint16_t& sourcePort) {
+		ScatterBuffers scatter(buffers, count);
+
+		udp::endpoint remote_endpoint;
+		std::error_code error;
+		bytes = members->socket.receive_from(scatter.Sequence(), remote_endpoint, RECEIVE_FLAGS, error);
 
-		if (!res.has_value()) {
-			LOG_TRACE(__FUNCTION__"(): Download failed, removing file from disk");
-			Battery::RemoveFile(targetFile);
+		if (error && error != asio::error::message_size) {
 			return false;
 		}
 
+		if (error || bytes > scatter.capacity) {
+			uint64_t truncated = members->truncated.fetch_add(1, std::memory_order_relaxed) + 1;
+			if ((truncated & (truncated - 1)) == 0) {
+				LOG_WARN("[UDPServerBlocking]: Datagram truncated to {} bytes ({} so far), raise the buffer size", scatter.capacity, truncated);
+			}
+			bytes = scatter.capacity;
+		}
+
+		source = IPv4Address(remote_endpoint.address().to_v4().to_uint());
+		sourcePort = remote_endpoint.port();
+		TRACE_PROBE(receive, members->socket.native_handle(), bytes, source.ToUint(), sourcePort);
+
+#ifndef DEPLOY
+		if (LOG_ENABLED(spdlog::level::info)) {
+			LOG_INFO("[UDPServerBlocking]: Packet received from {}:{}", source.ToString(), sourcePort);
+		}
+#endif
+
 		return true;
 	}
-}*/
\ No newline at end of file
+
+	ReceiveBufferStatistics UDPServerBlocking::GetReceiveBufferStatistics() {
+		ReceiveBufferStatistics statistics;
+		statistics.truncated = members->truncated.load(std::memory_order_relaxed);
+		return statistics;
+	}
+
+	bool UDPServerBlocking::SetFilter(const PacketFilter& filter) {
+		return AttachPacketFilter((intptr_t)members->socket.native_handle(), filter);
+	}
+
+	void UDPServerBlocking::ClearFilter() {
+		DetachPacketFilter((intptr_t)members->socket.native_handle());
+	}
+
+	void UDPServerBlocking::logPacket(uint8_t* data, size_t length, const std::string& ipAddress, uint16_t port) {
+		LOG_INFO("[UDPServerBlocking]: Packet received from {}:{}", ipAddress, port);
+		if (LOG_ENABLED(spdlog::level::trace)) {
+			LOG_TRACE("[UDPServerBlocking]: Packet received from {}:{} -> [{}] -> \"{}\"", ipAddress, port, BytesToString(data, length), std::string((const char*)data, length));
+		}
+	}
+
+}
@@ -12,39 +12,23 @@
 #include <netdb.h>
 #include <ifaddrs.h>
 #include <arpa/inet.h>
+#include <poll.h>
+#include <unistd.h>
 #endif  // END _WIN32
 
+#ifdef __linux__
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#endif
+
 #include <iostream>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <map>
 
 namespace NetLib {
 
-    std::vector<std::string> SplitString(std::string str, char delimeter) {
-        std::string::size_type b = 0;
-        std::vector<std::string> result;
-
-        while ((b = str.find_first_not_of(delimeter, b)) != std::string::npos) {
-            auto e = str.find_first_of(delimeter, b);
-            result.push_back(str.substr(b, e - b));
-            b = e;
-        }
-
-        return result;
-    }
-
-    std::string JoinStrings(std::vector<std::string> strings, std::string spacer) {
-        std::string str = "";
-
-        for (size_t i = 0; i < strings.size(); i++) {
-            str += strings[i];
-
-            if (i < strings.size() - 1 && spacer != "") {
-                str += spacer;
-            }
-        }
-
-        return str;
-    }
-
 	std::vector<Interface> GetNetworkInterfaces() {
         std::vector<Interface> interfaces;
 
@@ -72,19 +56,12 @@ namespace NetLib {
         // Construct the address table
         for (size_t i = 0; i < (size_t)table[0].dwNumEntries; i++) {
 
-            IN_ADDR IPAddr;
             Interface ifc;
             
             ifc.index = table[0].table[i].dwIndex;
-
-            IPAddr.S_un.S_addr = (u_long)table[0].table[i].dwAddr;
-            ifc.address = inet_ntoa(IPAddr);
-
-            IPAddr.S_un.S_addr = (u_long)table[0].table[i].dwMask;
-            ifc.subnet = inet_ntoa(IPAddr);
-
-            IPAddr.S_un.S_addr = (u_long)table[0].table[i].dwBCastAddr;
-            ifc.broadcast = inet_ntoa(IPAddr);
+            ifc.address = IPv4Address::FromNetworkOrder((uint32_t)table[0].table[i].dwAddr);
+            ifc.subnet = IPv4Address::FromNetworkOrder((uint32_t)table[0].table[i].dwMask);
+            ifc.broadcast = CreateBroadcastAddress(ifc);     // dwBCastAddr only holds the host bits
 
             ifc.reassemblySize = table[0].table[i].dwReasmSize;
 
@@ -117,21 +94,16 @@ namespace NetLib {
 
             if (ifa->ifa_addr->sa_family == AF_INET) {  // Only accept IPv4 addresses
                 
-                std::string address(INET_ADDRSTRLEN, '\0');
-                std::string subnet(INET_ADDRSTRLEN, '\0');
-
-                void* tmpAddrPtr = &((struct sockaddr_in *)(ifa->ifa_addr))->sin_addr;
-                inet_ntop(AF_INET, tmpAddrPtr, &address[0], INET_ADDRSTRLEN);
-                tmpAddrPtr = &((struct sockaddr_in *)(ifa->ifa_netmask))->sin_addr;
-                inet_ntop(AF_INET, tmpAddrPtr, &subnet[0], INET_ADDRSTRLEN);
-
                 Interface interface;
                 interface.index = 0;
-                interface.address = std::string(address);
+                interface.address = IPv4Address::FromNetworkOrder(((struct sockaddr_in *)(ifa->ifa_addr))->sin_addr.s_addr);
                 interface.name = std::string(ifa->ifa_name);
-                interface.subnet = std::string(subnet);
+                if (ifa->ifa_netmask != NULL) {
+                    interface.subnet = IPv4Address::FromNetworkOrder(((struct sockaddr_in *)(ifa->ifa_netmask))->sin_addr.s_addr);
+                }
                 interface.reassemblySize = 0;
                 interface.state = InterfaceState::NONE;
+                interface.broadcast = CreateBroadcastAddress(interface);
 
                 interfaces.push_back(interface);
             }
@@ -144,24 +116,247 @@ namespace NetLib {
         return interfaces;
 	}
 
-    std::string CreateBroadcastAddress(const Interface& ifc) {
-        auto ipParts = SplitString(ifc.address, '.');
-        auto subParts = SplitString(ifc.subnet, '.');
+    IPv4Address CreateBroadcastAddress(const Interface& ifc) {
+        return IPv4Address(ifc.address.ToUint() | ~ifc.subnet.ToUint());
+    }
+
+    Cidr GetInterfaceSubnet(const Interface& ifc) {
+        auto subnet = Cidr::FromNetmask(ifc.address, ifc.subnet);
+        return subnet.has_value() ? subnet.value() : Cidr(ifc.address, 32);
+    }
+
+    uint32_t ipToBytes(const std::string& ip) {
+        auto address = IPv4Address::Parse(ip);
+        return address.has_value() ? address->ToNetworkOrder() : 0xFFFFFFFF;
+    }
+
+
+
+
+    // ==================================
+    // ===      Interface cache       ===
+    // ==================================
+
+    static bool SameInterfaces(const std::vector<Interface>& a, const std::vector<Interface>& b) {
+        if (a.size() != b.size())
+            return false;
+
+        for (size_t i = 0; i < a.size(); i++) {
+            if (a[i].index != b[i].index || a[i].address != b[i].address || a[i].name != b[i].name ||
+                a[i].subnet != b[i].subnet || a[i].broadcast != b[i].broadcast || a[i].state != b[i].state)
+                return false;
+        }
+        return true;
+    }
+
+    class InterfaceCache {
+    public:
+        InterfaceCache() {
+            snapshot = std::make_shared<const std::vector<Interface>>(GetNetworkInterfaces());
+            StartMonitor();
+        }
+
+        ~InterfaceCache() {
+            StopMonitor();
+        }
+
+        InterfaceSnapshot Get() {
+
+            // Every thread keeps its own reference and only touches the shared pointer again after a change.
+            // In the common case this is a single atomic load.
+            thread_local uint64_t localVersion = 0;
+            thread_local InterfaceSnapshot localSnapshot;
+
+            uint64_t current = version.load(std::memory_order_acquire);
+            if (current != localVersion || !localSnapshot) {
+                std::lock_guard<std::mutex> guard(snapshotMutex);
+                localSnapshot = snapshot;
+                localVersion = version.load(std::memory_order_relaxed);
+            }
+            return localSnapshot;
+        }
+
+        // Refreshes run one at a time, so the snapshot and the notifications follow the order of the enumerations
+        // and a slower, older enumeration can't overwrite a newer one
+        void Refresh() {
+            std::lock_guard<std::mutex> refreshGuard(refreshMutex);
+            auto interfaces = std::make_shared<const std::vector<Interface>>(GetNetworkInterfaces());
+
+            {
+                std::lock_guard<std::mutex> guard(snapshotMutex);
+                if (SameInterfaces(*snapshot, *interfaces))
+                    return;
+
+                snapshot = interfaces;
+                version.fetch_add(1, std::memory_order_release);
+            }
+
+            std::lock_guard<std::mutex> guard(subscriberMutex);
+            for (auto& [id, callback] : subscribers) {
+                callback(interfaces);
+            }
+        }
+
+        size_t Subscribe(InterfaceChangeCallback callback) {
+            std::lock_guard<std::mutex> guard(subscriberMutex);
+            size_t id = nextSubscription++;
+            subscribers.emplace(id, std::move(callback));
+            return id;
+        }
+
+        void Unsubscribe(size_t id) {
+            std::lock_guard<std::mutex> guard(subscriberMutex);
+            subscribers.erase(id);
+        }
+
+    private:
+        void StartMonitor() {
+#if defined(__linux__)
+            netlinkSocket = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+            if (netlinkSocket < 0)
+                return;
+
+            sockaddr_nl address = {};
+            address.nl_family = AF_NETLINK;
+            address.nl_groups = RTMGRP_LINK | RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR;
+            if (bind(netlinkSocket, (sockaddr*)&address, sizeof(address)) != 0 || pipe(wakeupPipe) != 0) {
+                close(netlinkSocket);
+                netlinkSocket = -1;
+                return;
+            }
+
+            monitorThread = std::thread(&InterfaceCache::NetlinkThread, this);
+#elif defined(_WIN32)
+            stopEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+            if (stopEvent != nullptr) {
+                monitorThread = std::thread(&InterfaceCache::NotifyThread, this);
+            }
+#endif
+        }
 
-        if (subParts.size() != 4 || ipParts.size() != 4) {  // Weird
-            return "";
+        void StopMonitor() {
+            if (!monitorThread.joinable())
+                return;
+
+#if defined(__linux__)
+            char wakeup = 0;
+            (void)!write(wakeupPipe[1], &wakeup, 1);
+            monitorThread.join();
+            close(netlinkSocket);
+            close(wakeupPipe[0]);
+            close(wakeupPipe[1]);
+#elif defined(_WIN32)
+            SetEvent(stopEvent);
+            monitorThread.join();
+            CloseHandle(stopEvent);
+#endif
         }
 
-        for (int i = 0; i < 4; i++) {
-            if (subParts[i] != "255") {
-                ipParts[i] = "255";
+#if defined(__linux__)
+        void NetlinkThread() {
+            std::vector<char> buffer(16 * 1024);
+
+            while (true) {
+                pollfd fds[2] = { { netlinkSocket, POLLIN, 0 }, { wakeupPipe[0], POLLIN, 0 } };
+                if (poll(fds, 2, -1) < 0) {
+                    if (errno == EINTR)
+                        continue;
+                    return;
+                }
+
+                if (fds[1].revents != 0)
+                    return;
+
+                // Drain everything that is queued, a burst of events only causes a single rebuild
+                bool changed = false;
+                while (true) {
+                    ssize_t length = recv(netlinkSocket, &buffer[0], buffer.size(), MSG_DONTWAIT);
+                    if (length < 0) {
+                        if (errno == ENOBUFS)       // Events were lost, the table must be rebuilt
+                            changed = true;
+                        if (errno == EINTR || errno == ENOBUFS)
+                            continue;
+                        break;
+                    }
+
+                    int remaining = (int)length;
+                    for (nlmsghdr* header = (nlmsghdr*)&buffer[0]; NLMSG_OK(header, remaining); header = NLMSG_NEXT(header, remaining)) {
+                        switch (header->nlmsg_type) {
+                            case RTM_NEWADDR:
+                            case RTM_DELADDR:
+                            case RTM_NEWLINK:
+                            case RTM_DELLINK:
+                                changed = true;
+                                break;
+                        }
+                    }
+                }
+
+                if (changed) {
+                    Refresh();
+                }
             }
         }
 
-        return JoinStrings(ipParts, ".");
+        int netlinkSocket = -1;
+        int wakeupPipe[2] = { -1, -1 };
+#elif defined(_WIN32)
+        void NotifyThread() {
+            OVERLAPPED overlapped = {};
+            overlapped.hEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+
+            while (true) {
+                HANDLE handle = nullptr;
+                ResetEvent(overlapped.hEvent);
+                if (NotifyAddrChange(&handle, &overlapped) != ERROR_IO_PENDING)
+                    break;
+
+                HANDLE events[2] = { overlapped.hEvent, stopEvent };
+                DWORD result = WaitForMultipleObjects(2, events, FALSE, INFINITE);
+                if (result != WAIT_OBJECT_0) {
+                    CancelIPChangeNotify(&overlapped);
+                    break;
+                }
+
+                Refresh();
+            }
+
+            CloseHandle(overlapped.hEvent);
+        }
+
+        HANDLE stopEvent = nullptr;
+#endif
+
+        std::mutex refreshMutex;
+        std::mutex snapshotMutex;
+        InterfaceSnapshot snapshot;
+        std::atomic<uint64_t> version = 1;
+
+        std::mutex subscriberMutex;
+        std::map<size_t, InterfaceChangeCallback> subscribers;
+        size_t nextSubscription = 1;
+
+        std::thread monitorThread;
+    };
+
+    static InterfaceCache& GetInterfaceCache() {
+        static InterfaceCache cache;
+        return cache;
     }
 
-    uint32_t ipToBytes(const std::string& ip) {
-        return inet_addr(ip.c_str());
+    InterfaceSnapshot GetCachedNetworkInterfaces() {
+        return GetInterfaceCache().Get();
+    }
+
+    void RefreshNetworkInterfaces() {
+        GetInterfaceCache().Refresh();
+    }
+
+    size_t SubscribeInterfaceChanges(InterfaceChangeCallback callback) {
+        return GetInterfaceCache().Subscribe(std::move(callback));
+    }
+
+    void UnsubscribeInterfaceChanges(size_t subscription) {
+        GetInterfaceCache().Unsubscribe(subscription);
     }
 }
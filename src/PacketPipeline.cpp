@@ -0,0 +1,287 @@
+#include "PacketPipeline.h"
+#include "BasicUDPServer.h"
+
+#include <cstring>
+#include <thread>
+
+#include "Logging.h"
+
+namespace NetLib {
+
+	// ======================================
+	// ===      PacketPipeline Class      ===
+	// ======================================
+
+	struct PipelineStage {
+		std::string name;
+		std::function<void(PacketBatch& batch)> function;
+		PacketBatch batch;				// The datagrams waiting for this stage
+
+		std::atomic<uint64_t> batches = 0;
+		std::atomic<uint64_t> packets = 0;
+		std::atomic<uint64_t> dropped = 0;
+		std::atomic<uint64_t> redirected = 0;
+		std::atomic<uint64_t> invalidRedirects = 0;
+	};
+
+	struct PacketPipelineMembers {
+
+		PipelineOptions options;
+		std::vector<std::unique_ptr<PipelineStage>> stages;
+
+		// The pending batch of Push()
+		std::vector<uint8_t> slab;
+		std::vector<uint8_t*> pushPackets;
+		std::vector<size_t> pushLengths;
+		std::vector<IPv4Address> pushSources;
+		std::vector<uint16_t> pushPorts;
+		size_t pushed = 0;
+
+		PacketPipelineMembers(const PipelineOptions& options) : options(options) {}
+
+		void RunStages();
+		void RunStagesOnce();
+	};
+
+	PacketPipeline::PacketPipeline(const PipelineOptions& options) : members(new PacketPipelineMembers(options)) {
+		PipelineOptions& o = members->options;
+		o.batchSize = std::clamp<size_t>(o.batchSize, 1, NETLIB_PIPELINE_MAX_BATCH);
+		o.bufferSize = std::max<size_t>(o.bufferSize, 1);
+	}
+
+	PacketPipeline::~PacketPipeline() {
+	}
+
+	size_t PacketPipeline::AddStage(const std::string& name, std::function<void(PacketBatch& batch)> stage) {
+		auto& stages = members->stages;
+		if (stages.size() >= PacketBatch::DROP)
+			throw std::runtime_error("PacketPipeline: Too many stages");
+
+		auto entry = std::make_unique<PipelineStage>();
+		entry->name = name;
+		entry->function = std::move(stage);
+		entry->batch.current = (uint16_t)stages.size();
+		stages.push_back(std::move(entry));
+
+		for (auto& other : stages) {
+			other->batch.stages = (uint16_t)stages.size();
+		}
+		return stages.size() - 1;
+	}
+
+	// Runs the stages in order, each one over everything that reached it. Redirects only go forward, so one
+	// pass delivers every datagram and the batches can't overflow. A stage that throws loses the datagrams
+	// still in the pipeline, the batches are emptied so the next call starts clean.
+	void PacketPipelineMembers::RunStages() {
+		try {
+			RunStagesOnce();
+		}
+		catch (...) {
+			for (auto& stage : stages) {
+				stage->batch.count = 0;
+				stage->batch.invalidRedirects = 0;
+			}
+			throw;
+		}
+	}
+
+	void PacketPipelineMembers::RunStagesOnce() {
+		size_t stageCount = stages.size();
+		for (size_t s = 0; s < stageCount; s++) {
+			PipelineStage& stage = *stages[s];
+			PacketBatch& batch = stage.batch;
+			if (batch.count == 0)
+				continue;
+
+			std::fill_n(batch.targets.begin(), batch.count, (uint16_t)(s + 1));
+			batch.invalidRedirects = 0;
+			stage.function(batch);
+
+			uint64_t dropped = 0;
+			uint64_t redirected = 0;
+			for (size_t i = 0; i < batch.count; i++) {
+				uint16_t target = batch.targets[i];
+				if (target == PacketBatch::DROP) {
+					dropped++;
+				}
+				else if (target < stageCount) {
+					redirected += target != s + 1;
+					stages[target]->batch.Append(batch.packets[i], batch.lengths[i], batch.sources[i], batch.sourcePorts[i], batch.tags[i]);
+				}
+			}
+
+			stage.batches.fetch_add(1, std::memory_order_relaxed);
+			stage.packets.fetch_add(batch.count, std::memory_order_relaxed);
+			stage.dropped.fetch_add(dropped, std::memory_order_relaxed);
+			stage.redirected.fetch_add(redirected, std::memory_order_relaxed);
+			stage.invalidRedirects.fetch_add(batch.invalidRedirects, std::memory_order_relaxed);
+			batch.count = 0;
+		}
+	}
+
+	void PacketPipeline::Process(uint8_t* const* packets, const size_t* lengths, const IPv4Address* sources, const uint16_t* sourcePorts, size_t count) {
+		PacketPipelineMembers& m = *members.get();
+		if (m.stages.empty())
+			return;
+
+		PacketBatch& input = m.stages.front()->batch;
+		for (size_t i = 0; i < count; i++) {
+			input.Append(packets[i], (uint32_t)std::min<size_t>(lengths[i], UINT32_MAX), sources[i], sourcePorts[i], 0);
+			if (input.count == NETLIB_PIPELINE_MAX_BATCH) {
+				m.RunStages();
+			}
+		}
+		m.RunStages();
+	}
+
+	void PacketPipeline::Push(const uint8_t* packet, size_t length, IPv4Address source, uint16_t sourcePort) {
+		PacketPipelineMembers& m = *members.get();
+		if (m.slab.empty()) {
+			m.slab.resize(m.options.batchSize * m.options.bufferSize);
+			m.pushPackets.resize(m.options.batchSize);
+			m.pushLengths.resize(m.options.batchSize);
+			m.pushSources.resize(m.options.batchSize);
+			m.pushPorts.resize(m.options.batchSize);
+			for (size_t i = 0; i < m.options.batchSize; i++) {
+				m.pushPackets[i] = m.slab.data() + i * m.options.bufferSize;
+			}
+		}
+
+		length = std::min(length, m.options.bufferSize);
+		memcpy(m.pushPackets[m.pushed], packet, length);
+		m.pushLengths[m.pushed] = length;
+		m.pushSources[m.pushed] = source;
+		m.pushPorts[m.pushed] = sourcePort;
+		if (++m.pushed == m.options.batchSize) {
+			Flush();
+		}
+	}
+
+	void PacketPipeline::Flush() {
+		PacketPipelineMembers& m = *members.get();
+		size_t count = m.pushed;
+		m.pushed = 0;
+		if (count > 0) {
+			Process(m.pushPackets.data(), m.pushLengths.data(), m.pushSources.data(), m.pushPorts.data(), count);
+		}
+	}
+
+	std::vector<PipelineStageStatistics> PacketPipeline::GetStatistics() {
+		std::vector<PipelineStageStatistics> result;
+		for (auto& stage : members->stages) {
+			PipelineStageStatistics statistics;
+			statistics.name = stage->name;
+			statistics.batches = stage->batches.load(std::memory_order_relaxed);
+			statistics.packets = stage->packets.load(std::memory_order_relaxed);
+			statistics.dropped = stage->dropped.load(std::memory_order_relaxed);
+			statistics.redirected = stage->redirected.load(std::memory_order_relaxed);
+			statistics.invalidRedirects = stage->invalidRedirects.load(std::memory_order_relaxed);
+			result.push_back(std::move(statistics));
+		}
+		return result;
+	}
+
+
+
+
+
+
+
+	// =========================================
+	// ===      UDPPipelineServer Class      ===
+	// =========================================
+
+	struct UDPPipelineServerMembers {
+
+		PacketPipeline& pipeline;
+		PipelineOptions options;
+
+		std::vector<uint8_t> slab;
+		std::vector<uint8_t*> packets;
+		std::vector<size_t> lengths;
+		std::vector<IPv4Address> sources;
+		std::vector<uint16_t> sourcePorts;
+
+		UDPReceiveSocket socket;
+		std::thread listenerThread;
+
+		UDPPipelineServerMembers(PacketPipeline& pipeline, uint16_t port, const PipelineOptions& options)
+			: pipeline(pipeline), options(options), socket(port) {}
+	};
+
+	// A stage that throws costs the batch, not the server. Exceptions from timers still stop the listener.
+	static void PipelineListenerThread(UDPPipelineServerMembers& m) {
+		try {
+			while (m.socket.Wait()) {
+				size_t count = m.socket.TryReceiveBatch(m.packets.data(), m.options.bufferSize, m.options.batchSize,
+					m.lengths.data(), m.sources.data(), m.sourcePorts.data());
+				if (count == 0)
+					continue;
+
+				try {
+					m.pipeline.Process(m.packets.data(), m.lengths.data(), m.sources.data(), m.sourcePorts.data(), count);
+				}
+				catch (std::exception& e) {
+					LOG_ERROR("[UDPPipelineServer]: Batch of {} datagrams lost, exception from a stage: {}", count, e.what());
+				}
+			}
+		}
+		catch (std::exception& e) {
+			LOG_ERROR("[UDPPipelineServer]: Listener stopped: {}", e.what());
+		}
+	}
+
+	UDPPipelineServer::UDPPipelineServer(PacketPipeline& pipeline, uint16_t port, const PipelineOptions& options)
+		: members(new UDPPipelineServerMembers(pipeline, port, options))
+	{
+		UDPPipelineServerMembers* m = members.get();
+		m->options.batchSize = std::clamp<size_t>(options.batchSize, 1, NETLIB_PIPELINE_MAX_BATCH);
+		m->options.bufferSize = std::max<size_t>(options.bufferSize, 1);
+
+		m->slab.resize(m->options.batchSize * m->options.bufferSize);
+		m->packets.resize(m->options.batchSize);
+		m->lengths.resize(m->options.batchSize);
+		m->sources.resize(m->options.batchSize);
+		m->sourcePorts.resize(m->options.batchSize);
+		for (size_t i = 0; i < m->options.batchSize; i++) {
+			m->packets[i] = m->slab.data() + i * m->options.bufferSize;
+		}
+
+		m->listenerThread = std::thread([m] { PipelineListenerThread(*m); });
+		LOG_DEBUG("[UDPPipelineServer]: Batches of {} datagrams on port {}", m->options.batchSize, m->socket.GetLocalPort());
+	}
+
+	UDPPipelineServer::~UDPPipelineServer() {
+		members->socket.Shutdown();
+		members->listenerThread.join();
+	}
+
+	uint16_t UDPPipelineServer::GetLocalPort() {
+		return members->socket.GetLocalPort();
+	}
+
+	bool UDPPipelineServer::SendTo(IPv4Address destination, uint16_t port, const uint8_t* data, size_t length) {
+		return members->socket.SendTo(destination, port, data, length);
+	}
+
+	bool UDPPipelineServer::SetFilter(const PacketFilter& filter) {
+		return members->socket.SetFilter(filter);
+	}
+
+	void UDPPipelineServer::ClearFilter() {
+		members->socket.ClearFilter();
+	}
+
+	bool UDPPipelineServer::EnableSharedMemory(const SharedMemoryOptions& options) {
+		return members->socket.EnableSharedMemory(options);
+	}
+
+	TimerId UDPPipelineServer::ScheduleTimer(std::chrono::nanoseconds delay, std::function<void()> callback) {
+		return members->socket.ScheduleTimer(delay, std::move(callback));
+	}
+
+	bool UDPPipelineServer::CancelTimer(TimerId id) {
+		return members->socket.CancelTimer(id);
+	}
+
+}
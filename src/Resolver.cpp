@@ -0,0 +1,686 @@
+#include "Resolver.h"
+
+#ifdef _WIN32
+#define _WIN32_WINNT _WIN32_WINNT_WIN10		// This sets the asio winsock library to Windows 10
+#define _WINSOCK_DEPRECATED_NO_WARNINGS
+#endif
+
+#include <asio.hpp>
+using asio::ip::udp;
+
+#include <fstream>
+#include <sstream>
+#include <unordered_map>
+#include <condition_variable>
+#include <deque>
+#include <thread>
+#include <future>
+#include <random>
+#include <algorithm>
+
+#include "Logging.h"
+
+namespace NetLib {
+
+	const char* GetResolveStatusName(ResolveStatus status) {
+		switch (status) {
+		case RESOLVE_OK: return "ok";
+		case RESOLVE_NOT_FOUND: return "not found";
+		case RESOLVE_TIMEOUT: return "timeout";
+		case RESOLVE_FAILED: return "failed";
+		default: return "unknown";
+		}
+	}
+
+	// Names are case-insensitive, a trailing dot makes no difference
+	static std::string NormalizeHostname(const std::string& host) {
+		std::string name = host;
+		if (!name.empty() && name.back() == '.') {
+			name.pop_back();
+		}
+		std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+		return name;
+	}
+
+	static bool AddAddress(ResolveResult& result, const asio::ip::address& address) {
+		if (address.is_v4()) {
+			IPv4Address v4(address.to_v4().to_uint());
+			if (std::find(result.ipv4.begin(), result.ipv4.end(), v4) == result.ipv4.end()) {
+				result.ipv4.push_back(v4);
+			}
+			return true;
+		}
+		IPv6Address v6(address.to_v6().to_bytes());
+		if (std::find(result.ipv6.begin(), result.ipv6.end(), v6) == result.ipv6.end()) {
+			result.ipv6.push_back(v6);
+		}
+		return true;
+	}
+
+
+
+
+
+
+
+	// ============================
+	// ===      Lookups         ===
+	// ============================
+
+	// getaddrinfo() through asio, it also reads the hosts file. It does not report TTLs.
+	static void LookupSystem(const std::string& name, ResolveResult& result) {
+		asio::io_service ioService;
+		udp::resolver resolver(ioService);
+		std::error_code error;
+		auto endpoints = resolver.resolve(name, "", error);
+		if (error) {
+			bool notFound = error == asio::error::host_not_found || error == asio::error::no_data;
+			result.status = notFound ? RESOLVE_NOT_FOUND : RESOLVE_FAILED;
+			LOG_DEBUG("[Resolver]: Lookup of {} failed: {}", name, error.message());
+			return;
+		}
+
+		for (const auto& entry : endpoints) {
+			AddAddress(result, entry.endpoint().address());
+		}
+		result.status = result.ipv4.empty() && result.ipv6.empty() ? RESOLVE_NOT_FOUND : RESOLVE_OK;
+	}
+
+	static bool LookupHostsFile(const std::string& path, const std::string& name, ResolveResult& result) {
+		std::ifstream file(path);
+		if (!file)
+			return false;
+
+		std::string line;
+		while (std::getline(file, line)) {
+			line = line.substr(0, line.find('#'));
+			std::istringstream tokens(line);
+			std::string addressText;
+			if (!(tokens >> addressText))
+				continue;
+
+			std::error_code error;
+			asio::ip::address address = asio::ip::make_address(addressText, error);
+			if (error)
+				continue;
+
+			std::string alias;
+			while (tokens >> alias) {
+				if (NormalizeHostname(alias) == name) {
+					AddAddress(result, address);
+					break;
+				}
+			}
+		}
+
+		if (result.ipv4.empty() && result.ipv6.empty())
+			return false;
+		result.status = RESOLVE_OK;
+		return true;
+	}
+
+	// "IP" or "IP:port", IPv6 addresses in brackets if they have a port
+	static bool ParseNameServer(const std::string& text, udp::endpoint& endpoint) {
+		std::string host = text;
+		uint16_t port = 53;
+		size_t colon = text.rfind(':');
+		if (!text.empty() && text.front() == '[') {
+			size_t bracket = text.find(']');
+			if (bracket == std::string::npos)
+				return false;
+			host = text.substr(1, bracket - 1);
+			if (bracket + 1 < text.size()) {
+				if (text[bracket + 1] != ':')
+					return false;
+				port = (uint16_t)atoi(text.c_str() + bracket + 2);
+			}
+		}
+		else if (colon != std::string::npos && text.find(':') == colon) {
+			host = text.substr(0, colon);
+			port = (uint16_t)atoi(text.c_str() + colon + 1);
+		}
+
+		std::error_code error;
+		asio::ip::address address = asio::ip::make_address(host, error);
+		if (error || port == 0)
+			return false;
+		endpoint = udp::endpoint(address, port);
+		return true;
+	}
+
+
+
+
+
+
+
+	// =============================
+	// ===      DNS client       ===
+	// =============================
+	//
+	// Just enough of RFC 1035 for A and AAAA queries with recursion desired, over a connected UDP socket so
+	// only the name server can answer. Each query is sent again once half of the timeout passed.
+	//
+
+	static constexpr uint16_t DNS_TYPE_A = 1;
+	static constexpr uint16_t DNS_TYPE_AAAA = 28;
+	static constexpr uint16_t DNS_CLASS_IN = 1;
+	static constexpr size_t DNS_HEADER_SIZE = 12;
+	static constexpr size_t DNS_MAX_MESSAGE = 512;		// Without EDNS, larger answers are truncated
+
+	enum DnsReply {
+		DNS_REPLY_OK,
+		DNS_REPLY_NAME_ERROR,		// NXDOMAIN
+		DNS_REPLY_TIMEOUT,
+		DNS_REPLY_ERROR
+	};
+
+	static uint16_t ReadUint16(const uint8_t* data) {
+		return (uint16_t)((data[0] << 8) | data[1]);
+	}
+
+	static uint32_t ReadUint32(const uint8_t* data) {
+		return ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) | ((uint32_t)data[2] << 8) | data[3];
+	}
+
+	static void WriteUint16(std::vector<uint8_t>& out, uint16_t value) {
+		out.push_back((uint8_t)(value >> 8));
+		out.push_back((uint8_t)value);
+	}
+
+	static bool BuildQuery(std::vector<uint8_t>& query, uint16_t id, const std::string& name, uint16_t type) {
+		query.clear();
+		WriteUint16(query, id);
+		WriteUint16(query, 0x0100);			// Standard query, recursion desired
+		WriteUint16(query, 1);				// One question
+		WriteUint16(query, 0);
+		WriteUint16(query, 0);
+		WriteUint16(query, 0);
+
+		size_t start = 0;
+		while (start < name.size()) {
+			size_t end = name.find('.', start);
+			if (end == std::string::npos) {
+				end = name.size();
+			}
+			size_t length = end - start;
+			if (length == 0 || length > 63)
+				return false;
+
+			query.push_back((uint8_t)length);
+			query.insert(query.end(), name.begin() + start, name.begin() + end);
+			start = end + 1;
+		}
+		query.push_back(0);
+		if (query.size() - DNS_HEADER_SIZE > 255)
+			return false;
+
+		WriteUint16(query, type);
+		WriteUint16(query, DNS_CLASS_IN);
+		return true;
+	}
+
+	// Skips a name, which may end in a compression pointer
+	static bool SkipName(const uint8_t* data, size_t size, size_t& pos) {
+		while (pos < size) {
+			uint8_t length = data[pos];
+			if (length == 0) {
+				pos++;
+				return true;
+			}
+			if ((length & 0xC0) == 0xC0) {
+				pos += 2;
+				return pos <= size;
+			}
+			if (length & 0xC0)
+				return false;
+			pos += 1 + length;
+		}
+		return false;
+	}
+
+	// Returns false if the message is not the response to this query, e.g. a late answer to a previous one
+	static bool ParseResponse(const uint8_t* data, size_t size, const std::vector<uint8_t>& query, uint16_t type,
+		ResolveResult& result, uint32_t& ttl, DnsReply& reply)
+	{
+		if (size < query.size() || ReadUint16(data) != ReadUint16(query.data()) || !(data[2] & 0x80))
+			return false;
+		if (ReadUint16(data + 4) != 1 || memcmp(data + DNS_HEADER_SIZE, query.data() + DNS_HEADER_SIZE, query.size() - DNS_HEADER_SIZE) != 0)
+			return false;
+
+		uint8_t rcode = data[3] & 0x0F;
+		if (rcode != 0) {
+			reply = rcode == 3 ? DNS_REPLY_NAME_ERROR : DNS_REPLY_ERROR;
+			return true;
+		}
+
+		// The answers may start with CNAME records, the addresses of the final name follow them
+		size_t answers = ReadUint16(data + 6);
+		size_t pos = query.size();
+		reply = DNS_REPLY_OK;
+		for (size_t i = 0; i < answers; i++) {
+			if (!SkipName(data, size, pos) || pos + 10 > size) {
+				reply = DNS_REPLY_ERROR;
+				return true;
+			}
+			uint16_t recordType = ReadUint16(data + pos);
+			uint16_t recordClass = ReadUint16(data + pos + 2);
+			uint32_t recordTtl = ReadUint32(data + pos + 4);
+			size_t length = ReadUint16(data + pos + 8);
+			pos += 10;
+			if (pos + length > size) {
+				reply = DNS_REPLY_ERROR;
+				return true;
+			}
+
+			if (recordClass == DNS_CLASS_IN && recordType == type) {
+				if (type == DNS_TYPE_A && length == 4) {
+					AddAddress(result, asio::ip::address_v4({ data[pos], data[pos + 1], data[pos + 2], data[pos + 3] }));
+					ttl = std::min(ttl, recordTtl);
+				}
+				else if (type == DNS_TYPE_AAAA && length == 16) {
+					asio::ip::address_v6::bytes_type bytes;
+					memcpy(bytes.data(), data + pos, 16);
+					AddAddress(result, asio::ip::address_v6(bytes));
+					ttl = std::min(ttl, recordTtl);
+				}
+			}
+			pos += length;
+		}
+		return true;
+	}
+
+	static size_t ReceiveUntil(asio::io_service& ioService, udp::socket& socket, uint8_t* buffer, size_t capacity,
+		std::chrono::steady_clock::time_point deadline, std::error_code& error)
+	{
+		size_t bytes = 0;
+		bool done = false;
+		socket.async_receive(asio::buffer(buffer, capacity), [&](const std::error_code& e, size_t received) {
+			error = e;
+			bytes = received;
+			done = true;
+		});
+
+		ioService.restart();
+		ioService.run_until(deadline);
+		if (!done) {
+			socket.cancel();
+			ioService.restart();
+			ioService.run();
+			error = asio::error::timed_out;
+		}
+		return bytes;
+	}
+
+	static DnsReply QueryNameServer(udp::socket& socket, asio::io_service& ioService, const std::string& name, uint16_t type,
+		std::chrono::milliseconds timeout, ResolveResult& result, uint32_t& ttl, std::atomic<uint64_t>& queries)
+	{
+		static thread_local std::mt19937 random(std::random_device{}());
+		std::vector<uint8_t> query;
+		if (!BuildQuery(query, (uint16_t)random(), name, type))
+			return DNS_REPLY_ERROR;
+
+		uint8_t buffer[DNS_MAX_MESSAGE];
+		auto start = std::chrono::steady_clock::now();
+		for (int attempt = 0; attempt < 2; attempt++) {
+			std::error_code error;
+			socket.send(asio::buffer(query), 0, error);
+			queries++;
+			if (error)
+				return DNS_REPLY_ERROR;
+
+			auto deadline = start + (attempt == 0 ? timeout / 2 : timeout);
+			while (std::chrono::steady_clock::now() < deadline) {
+				size_t bytes = ReceiveUntil(ioService, socket, buffer, sizeof(buffer), deadline, error);
+				if (error == asio::error::timed_out)
+					break;
+				if (error) {
+					LOG_DEBUG("[Resolver]: Query for {} failed: {}", name, error.message());
+					return DNS_REPLY_ERROR;
+				}
+
+				DnsReply reply;
+				if (ParseResponse(buffer, bytes, query, type, result, ttl, reply))
+					return reply;
+			}
+		}
+		return DNS_REPLY_TIMEOUT;
+	}
+
+	static void LookupNameServer(const ResolverOptions& options, const std::string& name, ResolveResult& result,
+		uint32_t& ttl, std::atomic<uint64_t>& queries)
+	{
+		udp::endpoint server;
+		if (!ParseNameServer(options.nameServer, server)) {
+			LOG_WARN("[Resolver]: Invalid name server '{}'", options.nameServer);
+			result.status = RESOLVE_FAILED;
+			return;
+		}
+
+		try {
+			asio::io_service ioService;
+			udp::socket socket(ioService);
+			socket.open(server.protocol());
+			socket.connect(server);
+
+			DnsReply reply = QueryNameServer(socket, ioService, name, DNS_TYPE_A, options.timeout, result, ttl, queries);
+			if (reply == DNS_REPLY_OK) {
+				QueryNameServer(socket, ioService, name, DNS_TYPE_AAAA, options.timeout, result, ttl, queries);		// Optional
+			}
+
+			if (!result.ipv4.empty() || !result.ipv6.empty()) {
+				result.status = RESOLVE_OK;
+			}
+			else if (reply == DNS_REPLY_OK || reply == DNS_REPLY_NAME_ERROR) {
+				result.status = RESOLVE_NOT_FOUND;
+			}
+			else {
+				result.status = reply == DNS_REPLY_TIMEOUT ? RESOLVE_TIMEOUT : RESOLVE_FAILED;
+			}
+		}
+		catch (std::exception& e) {
+			LOG_WARN("[Resolver]: ASIO Exception: {}", e.what());
+			result.status = RESOLVE_FAILED;
+		}
+	}
+
+
+
+
+
+
+
+	// ===============================
+	// ===      Resolver Class     ===
+	// ===============================
+
+	using ResolveCallback = std::function<void(const ResolveResult& result)>;
+
+	struct ResolverEntry {
+		ResolveResult result;
+		std::chrono::steady_clock::time_point expires;		// Default-constructed until the first lookup completed
+		bool resolving = false;
+		std::vector<ResolveCallback> waiters;
+	};
+
+	struct ResolverShard {
+		std::mutex mutex;
+		std::unordered_map<std::string, ResolverEntry> entries;
+		size_t sweepAt = 64;			// Long expired entries are dropped once the shard grows to this size
+	};
+
+	struct ResolverMembers {
+		std::mutex optionsMutex;
+		ResolverOptions options;
+
+		std::vector<std::unique_ptr<ResolverShard>> shards;
+
+		std::mutex queueMutex;
+		std::condition_variable queueCondition;
+		std::deque<std::string> queue;
+		bool stop = false;
+		std::vector<std::thread> threads;
+
+		std::atomic<uint64_t> hits = 0;
+		std::atomic<uint64_t> stale = 0;
+		std::atomic<uint64_t> misses = 0;
+		std::atomic<uint64_t> coalesced = 0;
+		std::atomic<uint64_t> lookups = 0;
+		std::atomic<uint64_t> failures = 0;
+		std::atomic<uint64_t> queries = 0;
+
+		ResolverOptions Options() {
+			std::lock_guard<std::mutex> lock(optionsMutex);
+			return options;
+		}
+
+		ResolverShard& ShardFor(const std::string& name) {
+			return *shards[std::hash<std::string>()(name) % shards.size()];
+		}
+	};
+
+	// Called with the lock held. Sweeping again only after the shard doubled keeps it amortized O(1) per lookup.
+	// Entries stay for another 'keep' after they expired, so names that are still sent to keep their stale result.
+	static void SweepExpired(ResolverShard& shard, std::chrono::seconds keep) {
+		auto now = std::chrono::steady_clock::now();
+		std::erase_if(shard.entries, [now, keep](const auto& item) { return !item.second.resolving && item.second.expires + keep <= now; });
+		shard.sweepAt = std::max<size_t>(64, shard.entries.size() * 2);
+	}
+
+	// Addresses need no lookup, they are neither cached nor counted
+	static bool ParseLiteral(const std::string& host, ResolveResult& result) {
+		std::error_code error;
+		asio::ip::address address = asio::ip::make_address(host, error);
+		if (error)
+			return false;
+		AddAddress(result, address);
+		result.status = RESOLVE_OK;
+		return true;
+	}
+
+	static void CompleteLookup(ResolverMembers& m, const std::string& name, const ResolveResult& result, std::chrono::seconds ttl) {
+		std::vector<ResolveCallback> waiters;
+		{
+			ResolverShard& shard = m.ShardFor(name);
+			std::lock_guard<std::mutex> lock(shard.mutex);
+			ResolverEntry& entry = shard.entries[name];
+			entry.result = result;
+			entry.expires = std::chrono::steady_clock::now() + ttl;
+			entry.resolving = false;
+			waiters.swap(entry.waiters);
+		}
+
+		for (auto& waiter : waiters) {
+			try {
+				waiter(result);
+			}
+			catch (std::exception& e) {
+				LOG_ERROR("[Resolver]: Exception from a callback: {}", e.what());
+			}
+		}
+	}
+
+	static void ResolverThread(ResolverMembers& m) {
+		while (true) {
+			std::string name;
+			{
+				std::unique_lock<std::mutex> lock(m.queueMutex);
+				m.queueCondition.wait(lock, [&] { return m.stop || !m.queue.empty(); });
+				if (m.stop)
+					return;
+				name = std::move(m.queue.front());
+				m.queue.pop_front();
+			}
+
+			ResolverOptions options = m.Options();
+			ResolveResult result;
+			std::chrono::seconds ttl = options.ttl;
+			if (options.nameServer.empty()) {
+				LookupSystem(name, result);
+			}
+			else if (!LookupHostsFile(options.hostsFile, name, result)) {
+				uint32_t recordTtl = UINT32_MAX;
+				LookupNameServer(options, name, result, recordTtl, m.queries);
+				ttl = std::min(ttl, std::chrono::seconds(recordTtl));
+			}
+
+			if (result.status != RESOLVE_OK) {
+				ttl = options.negativeTtl;
+				m.failures++;
+			}
+			m.lookups++;
+			LOG_DEBUG("[Resolver]: {} -> {} IPv4, {} IPv6 addresses ({}), cached for {}s", name, result.ipv4.size(), result.ipv6.size(),
+				GetResolveStatusName(result.status), ttl.count());
+
+			CompleteLookup(m, name, result, ttl);
+		}
+	}
+
+	Resolver::Resolver(const ResolverOptions& options) : members(new ResolverMembers()) {
+		members->options = options;
+
+		size_t shards = std::max<size_t>(options.shards, 1);
+		for (size_t i = 0; i < shards; i++) {
+			members->shards.push_back(std::make_unique<ResolverShard>());
+		}
+
+		ResolverMembers& m = *members.get();
+		for (size_t i = 0; i < std::max<size_t>(options.threads, 1); i++) {
+			members->threads.emplace_back([&m] { ResolverThread(m); });
+		}
+		LOG_DEBUG("[Resolver]: Instance constructed, {}", options.nameServer.empty() ? "system resolver" : "name server " + options.nameServer);
+	}
+
+	Resolver::~Resolver() {
+		{
+			std::lock_guard<std::mutex> lock(members->queueMutex);
+			members->stop = true;
+		}
+		members->queueCondition.notify_all();
+		for (auto& thread : members->threads) {
+			thread.join();
+		}
+
+		// Names still queued never got looked up
+		ResolveResult failed;
+		for (auto& shard : members->shards) {
+			for (auto& [name, entry] : shard->entries) {
+				for (auto& waiter : entry.waiters) {
+					waiter(failed);
+				}
+			}
+		}
+	}
+
+	void Resolver::ResolveAsync(const std::string& host, std::function<void(const ResolveResult& result)> callback) {
+		ResolveResult literal;
+		if (ParseLiteral(host, literal)) {
+			callback(literal);
+			return;
+		}
+
+		std::string name = NormalizeHostname(host);
+		ResolverShard& shard = members->ShardFor(name);
+		std::unique_lock<std::mutex> lock(shard.mutex);
+		if (shard.entries.size() >= shard.sweepAt) {
+			SweepExpired(shard, members->Options().ttl);
+		}
+		ResolverEntry& entry = shard.entries[name];
+
+		if (entry.resolving) {
+			entry.waiters.push_back(std::move(callback));
+			members->coalesced++;
+			return;
+		}
+
+		if (entry.expires > std::chrono::steady_clock::now()) {
+			ResolveResult result = entry.result;
+			lock.unlock();
+			members->hits++;
+			callback(result);
+			return;
+		}
+
+		entry.resolving = true;
+		entry.waiters.push_back(std::move(callback));
+		lock.unlock();
+		members->misses++;
+
+		{
+			std::lock_guard<std::mutex> queueLock(members->queueMutex);
+			members->queue.push_back(std::move(name));
+		}
+		members->queueCondition.notify_one();
+	}
+
+	ResolveResult Resolver::Resolve(const std::string& host) {
+		auto cached = TryResolveCached(host);
+		if (cached.has_value())
+			return cached.value();
+
+		auto promise = std::make_shared<std::promise<ResolveResult>>();
+		auto future = promise->get_future();
+		ResolveAsync(host, [promise](const ResolveResult& result) { promise->set_value(result); });
+
+		if (future.wait_for(members->Options().timeout) != std::future_status::ready) {
+			ResolveResult timeout;
+			timeout.status = RESOLVE_TIMEOUT;
+			return timeout;
+		}
+		return future.get();
+	}
+
+	std::optional<ResolveResult> Resolver::TryResolveCached(const std::string& host, bool allowStale) {
+		ResolveResult literal;
+		if (ParseLiteral(host, literal))
+			return literal;
+
+		std::string name = NormalizeHostname(host);
+		ResolverShard& shard = members->ShardFor(name);
+		std::optional<ResolveResult> result;
+		bool refresh = allowStale;
+		{
+			std::lock_guard<std::mutex> lock(shard.mutex);
+			auto entry = shard.entries.find(name);
+			bool resolved = entry != shard.entries.end() && entry->second.expires != std::chrono::steady_clock::time_point();
+			if (resolved && entry->second.expires > std::chrono::steady_clock::now()) {
+				members->hits++;
+				return entry->second.result;
+			}
+
+			// A refresh keeps the previous result until it completed
+			if (resolved && allowStale) {
+				members->stale++;
+				result = entry->second.result;
+			}
+			if (entry != shard.entries.end() && entry->second.resolving) {
+				refresh = false;
+			}
+		}
+
+		if (refresh) {
+			ResolveAsync(host, [](const ResolveResult&) {});
+		}
+		return result;
+	}
+
+	void Resolver::SetOptions(const ResolverOptions& options) {
+		{
+			std::lock_guard<std::mutex> lock(members->optionsMutex);
+			members->options = options;
+		}
+		ClearCache();
+	}
+
+	void Resolver::ClearCache() {
+		for (auto& shard : members->shards) {
+			std::lock_guard<std::mutex> lock(shard->mutex);
+			for (auto entry = shard->entries.begin(); entry != shard->entries.end();) {
+				if (entry->second.resolving) {
+					++entry;		// Its waiters still get the result
+				}
+				else {
+					entry = shard->entries.erase(entry);
+				}
+			}
+		}
+	}
+
+	ResolverStatistics Resolver::GetStatistics() {
+		ResolverStatistics statistics;
+		statistics.hits = members->hits;
+		statistics.stale = members->stale;
+		statistics.misses = members->misses;
+		statistics.coalesced = members->coalesced;
+		statistics.lookups = members->lookups;
+		statistics.failures = members->failures;
+		statistics.queries = members->queries;
+		return statistics;
+	}
+
+	Resolver& GetDefaultResolver() {
+		static Resolver resolver;
+		return resolver;
+	}
+
+}
@@ -0,0 +1,476 @@
+#include "Rpc.h"
+#include "Resolver.h"
+
+#include <cstring>
+#include <shared_mutex>
+#include <unordered_map>
+
+#include "Logging.h"
+
+namespace NetLib {
+
+	// Every datagram starts with:
+	//   uint8   version (high nibble) and packet type (low nibble)
+	//   uint8   reserved, 0
+	//   uint16  method, big-endian
+	//   uint32  correlation id, big-endian. The client puts the slot of the request into the low bits and
+	//           a generation into the high bits, so a late response never matches a reused slot.
+
+	static constexpr uint8_t RPC_VERSION = 1;
+
+	enum RpcPacketType : uint8_t {
+		RPC_PACKET_REQUEST,
+		RPC_PACKET_RESPONSE,
+		RPC_PACKET_NO_HANDLER,
+		RPC_PACKET_FAILED
+	};
+
+	struct RpcHeader {
+		RpcPacketType type;
+		uint16_t method;
+		uint32_t id;
+	};
+
+	static void WriteHeader(uint8_t* data, const RpcHeader& header) {
+		data[0] = (uint8_t)((RPC_VERSION << 4) | header.type);
+		data[1] = 0;
+		data[2] = (uint8_t)(header.method >> 8);
+		data[3] = (uint8_t)header.method;
+		data[4] = (uint8_t)(header.id >> 24);
+		data[5] = (uint8_t)(header.id >> 16);
+		data[6] = (uint8_t)(header.id >> 8);
+		data[7] = (uint8_t)header.id;
+	}
+
+	static bool ReadHeader(const uint8_t* data, size_t length, RpcHeader& header) {
+		if (length < NETLIB_RPC_HEADER_SIZE || (data[0] >> 4) != RPC_VERSION || (data[0] & 0x0F) > RPC_PACKET_FAILED)
+			return false;
+
+		header.type = (RpcPacketType)(data[0] & 0x0F);
+		header.method = (uint16_t)((data[2] << 8) | data[3]);
+		header.id = ((uint32_t)data[4] << 24) | ((uint32_t)data[5] << 16) | ((uint32_t)data[6] << 8) | data[7];
+		return true;
+	}
+
+	static int64_t RpcNow() {
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	const char* GetRpcStatusName(RpcStatus status) {
+		switch (status) {
+		case RPC_OK: return "ok";
+		case RPC_TIMEOUT: return "timeout";
+		case RPC_NO_HANDLER: return "no handler";
+		case RPC_HANDLER_FAILED: return "handler failed";
+		case RPC_REJECTED: return "rejected";
+		case RPC_CANCELLED: return "cancelled";
+		}
+		return "unknown";
+	}
+
+
+
+
+
+
+
+	// =================================
+	// ===      RpcClient Class      ===
+	// =================================
+
+	struct PendingRequest {
+		std::atomic<uint32_t> id = 0;			// Correlation id while in flight, 0 once completed
+		std::atomic<uint32_t> references = 0;	// The sending thread and the completion, the last one frees the slot
+		uint32_t generation = 0;				// Owned by the thread holding the free slot
+
+		// Written by the caller before 'id' is published, then only touched on the listener thread
+		RpcCallback callback;
+		std::vector<uint8_t> packet;			// Header and request, kept for the retries
+		int64_t deadline = 0;
+		int64_t nextAttempt = 0;
+	};
+
+	struct RpcClientMembers {
+
+		RpcClientOptions options;
+		IPv4Address server;
+		uint16_t port = 0;
+
+		// The pending-request table: A fixed array of slots, the free ones linked into a lock-free stack
+		std::unique_ptr<PendingRequest[]> slots;
+		std::unique_ptr<std::atomic<uint32_t>[]> next;		// Index + 1 of the next free slot, 0 = None
+		std::atomic<uint64_t> freeHead = 0;					// ABA tag << 32 | (index + 1)
+		uint32_t capacity = 0;
+		uint32_t indexBits = 0;
+		std::atomic<uint32_t> highWater = 0;				// The sweep only looks at slots below, the stack reuses the low ones first
+
+		std::atomic<size_t> inFlight = 0;
+		std::atomic<uint64_t> requests = 0;
+		std::atomic<uint64_t> retries = 0;
+		std::atomic<uint64_t> responses = 0;
+		std::atomic<uint64_t> timeouts = 0;
+		std::atomic<uint64_t> rejected = 0;
+		std::atomic<uint64_t> late = 0;
+		std::atomic<uint64_t> invalid = 0;
+
+		// Last, the listener thread uses everything above. An optional keeps it reachable for the callbacks
+		// while its destructor joins the listener thread.
+		std::optional<UDPServerAsync> socket;
+
+		RpcClientMembers(IPv4Address server, uint16_t port, const RpcClientOptions& options) : options(options), server(server), port(port) {}
+	};
+
+	static bool PopFreeSlot(RpcClientMembers& m, uint32_t& index) {
+		uint64_t head = m.freeHead.load(std::memory_order_acquire);
+		while (true) {
+			uint32_t top = (uint32_t)head;
+			if (top == 0)
+				return false;
+
+			uint64_t replacement = ((head >> 32) + 1) << 32 | m.next[top - 1].load(std::memory_order_relaxed);
+			if (m.freeHead.compare_exchange_weak(head, replacement, std::memory_order_acquire, std::memory_order_acquire)) {
+				index = top - 1;
+				return true;
+			}
+		}
+	}
+
+	static void PushFreeSlot(RpcClientMembers& m, uint32_t index) {
+		uint64_t head = m.freeHead.load(std::memory_order_relaxed);
+		while (true) {
+			m.next[index].store((uint32_t)head, std::memory_order_relaxed);
+			uint64_t replacement = ((head >> 32) + 1) << 32 | (index + 1);
+			if (m.freeHead.compare_exchange_weak(head, replacement, std::memory_order_release, std::memory_order_relaxed))
+				return;
+		}
+	}
+
+	static void ReleaseSlot(RpcClientMembers& m, uint32_t index) {
+		if (m.slots[index].references.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+			PushFreeSlot(m, index);
+		}
+	}
+
+	// Listener thread, after the id of the slot was swapped to 0
+	static void CompleteRequest(RpcClientMembers& m, uint32_t index, RpcStatus status, const uint8_t* response, size_t responseSize) {
+		RpcCallback callback = std::move(m.slots[index].callback);
+		m.slots[index].callback = nullptr;
+		m.inFlight.fetch_sub(1, std::memory_order_relaxed);
+		ReleaseSlot(m, index);
+
+		try {
+			callback(status, response, responseSize);
+		}
+		catch (std::exception& e) {
+			LOG_ERROR("[RpcClient]: Exception in callback: {}", e.what());
+		}
+	}
+
+	static void OnResponse(RpcClientMembers& m, uint8_t* packet, size_t packetSize, IPv4Address source, uint16_t sourcePort) {
+		RpcHeader header;
+		if (source != m.server || sourcePort != m.port || !ReadHeader(packet, packetSize, header) || header.type == RPC_PACKET_REQUEST) {
+			m.invalid.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+
+		uint32_t index = header.id & ((1u << m.indexBits) - 1);
+		uint32_t expected = header.id;
+		if (index >= m.capacity || header.id == 0 || !m.slots[index].id.compare_exchange_strong(expected, 0, std::memory_order_acquire)) {
+			m.late.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+
+		m.responses.fetch_add(1, std::memory_order_relaxed);
+		switch (header.type) {
+		case RPC_PACKET_RESPONSE:
+			CompleteRequest(m, index, RPC_OK, packet + NETLIB_RPC_HEADER_SIZE, packetSize - NETLIB_RPC_HEADER_SIZE);
+			break;
+		case RPC_PACKET_NO_HANDLER:
+			CompleteRequest(m, index, RPC_NO_HANDLER, nullptr, 0);
+			break;
+		default:
+			CompleteRequest(m, index, RPC_HANDLER_FAILED, nullptr, 0);
+			break;
+		}
+	}
+
+	// Listener thread, every 'resolution': Times out and repeats the requests in flight
+	static void SweepRequests(RpcClientMembers& m) {
+		if (m.inFlight.load(std::memory_order_relaxed) > 0) {
+			int64_t now = RpcNow();
+			int64_t retryInterval = std::chrono::duration_cast<std::chrono::nanoseconds>(m.options.retryInterval).count();
+			uint32_t limit = m.highWater.load(std::memory_order_acquire);
+
+			for (uint32_t i = 0; i < limit; i++) {
+				PendingRequest& request = m.slots[i];
+				uint32_t id = request.id.load(std::memory_order_acquire);
+				if (id == 0)
+					continue;
+
+				if (now >= request.deadline) {
+					if (request.id.compare_exchange_strong(id, 0, std::memory_order_acquire)) {
+						m.timeouts.fetch_add(1, std::memory_order_relaxed);
+						CompleteRequest(m, i, RPC_TIMEOUT, nullptr, 0);
+					}
+				}
+				else if (retryInterval > 0 && now >= request.nextAttempt) {
+					request.nextAttempt = now + retryInterval;
+					m.retries.fetch_add(1, std::memory_order_relaxed);
+					m.socket->SendTo(m.server, m.port, request.packet.data(), request.packet.size());
+				}
+			}
+		}
+
+		RpcClientMembers* pointer = &m;
+		m.socket->ScheduleTimer(m.options.resolution, [pointer] { SweepRequests(*pointer); });
+	}
+
+	static IPv4Address ResolveRpcServer(const std::string& host) {
+		if (auto address = IPv4Address::Parse(host))
+			return *address;
+
+		ResolveResult result = GetDefaultResolver().Resolve(host);
+		if (result.status != RESOLVE_OK || result.ipv4.empty())
+			throw std::runtime_error("RPC: Can't resolve " + host + ": " + GetResolveStatusName(result.status));
+		return result.ipv4.front();
+	}
+
+	RpcClient::RpcClient(const std::string& host, uint16_t port, const RpcClientOptions& options)
+		: RpcClient(ResolveRpcServer(host), port, options) {
+	}
+
+	RpcClient::RpcClient(IPv4Address server, uint16_t port, const RpcClientOptions& options) : members(new RpcClientMembers(server, port, options)) {
+		RpcClientMembers* m = members.get();
+		m->options.resolution = std::max(m->options.resolution, std::chrono::milliseconds(1));
+
+		m->indexBits = 0;
+		while ((1u << m->indexBits) < std::clamp<size_t>(options.maxInFlight, 1, 1u << 20)) {
+			m->indexBits++;
+		}
+		m->capacity = 1u << m->indexBits;
+		m->slots = std::make_unique<PendingRequest[]>(m->capacity);
+		m->next = std::make_unique<std::atomic<uint32_t>[]>(m->capacity);
+		for (uint32_t i = 0; i < m->capacity; i++) {
+			m->next[i] = (i + 1 < m->capacity) ? i + 2 : 0;
+		}
+		m->freeHead = 1;
+
+		m->socket.emplace([m](uint8_t* packet, size_t packetSize, IPv4Address source, uint16_t sourcePort) {
+			OnResponse(*m, packet, packetSize, source, sourcePort);
+		}, 0, NETLIB_RPC_HEADER_SIZE + options.maxResponseSize);
+		m->socket->ScheduleTimer(m->options.resolution, [m] { SweepRequests(*m); });
+
+		LOG_DEBUG("[RpcClient]: {} requests in flight to {}:{} from port {}", m->capacity, server.ToString(), port, m->socket->GetLocalPort());
+	}
+
+	RpcClient::~RpcClient() {
+		RpcClientMembers* m = members.get();
+		m->socket.reset();
+
+		for (uint32_t i = 0; i < m->capacity; i++) {
+			uint32_t id = m->slots[i].id.load(std::memory_order_acquire);
+			if (id != 0 && m->slots[i].id.compare_exchange_strong(id, 0)) {
+				CompleteRequest(*m, i, RPC_CANCELLED, nullptr, 0);
+			}
+		}
+	}
+
+	bool RpcClient::Call(uint16_t method, const uint8_t* request, size_t requestSize, RpcCallback callback, std::chrono::milliseconds timeout) {
+		RpcClientMembers& m = *members.get();
+		uint32_t index = 0;
+		if (requestSize > m.options.maxRequestSize || !PopFreeSlot(m, index)) {
+			m.rejected.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+
+		// A new generation for every use of the slot, skipping the reserved id 0
+		PendingRequest& pending = m.slots[index];
+		uint32_t id = 0;
+		do {
+			pending.generation = (pending.generation + 1) & ((1ull << (32 - m.indexBits)) - 1);
+			id = (uint32_t)((uint64_t)pending.generation << m.indexBits) | index;
+		} while (id == 0);
+
+		pending.callback = std::move(callback);
+		pending.packet.resize(NETLIB_RPC_HEADER_SIZE + requestSize);
+		WriteHeader(pending.packet.data(), { RPC_PACKET_REQUEST, method, id });
+		if (requestSize > 0) {
+			memcpy(pending.packet.data() + NETLIB_RPC_HEADER_SIZE, request, requestSize);
+		}
+
+		int64_t now = RpcNow();
+		if (timeout.count() <= 0) {
+			timeout = m.options.timeout;
+		}
+		pending.deadline = now + std::chrono::duration_cast<std::chrono::nanoseconds>(timeout).count();
+		pending.nextAttempt = now + std::chrono::duration_cast<std::chrono::nanoseconds>(m.options.retryInterval).count();
+		pending.references.store(2, std::memory_order_relaxed);
+
+		uint32_t highWater = m.highWater.load(std::memory_order_relaxed);
+		while (highWater <= index && !m.highWater.compare_exchange_weak(highWater, index + 1, std::memory_order_release)) {}
+
+		m.inFlight.fetch_add(1, std::memory_order_relaxed);
+		m.requests.fetch_add(1, std::memory_order_relaxed);
+		pending.id.store(id, std::memory_order_release);
+
+		// The slot stays ours until the send returned, even if the request already completed. A failed send
+		// is not reported, the request is repeated or times out like a lost one.
+		m.socket->SendTo(m.server, m.port, pending.packet.data(), pending.packet.size());
+		ReleaseSlot(m, index);
+		return true;
+	}
+
+	std::future<RpcResponse> RpcClient::CallAsync(uint16_t method, const uint8_t* request, size_t requestSize, std::chrono::milliseconds timeout) {
+		auto promise = std::make_shared<std::promise<RpcResponse>>();
+		std::future<RpcResponse> future = promise->get_future();
+
+		bool sent = Call(method, request, requestSize, [promise](RpcStatus status, const uint8_t* response, size_t responseSize) {
+			RpcResponse result;
+			result.status = status;
+			result.data.assign(response, response + responseSize);
+			promise->set_value(std::move(result));
+		}, timeout);
+
+		if (!sent) {
+			RpcResponse result;
+			result.status = RPC_REJECTED;
+			promise->set_value(std::move(result));
+		}
+		return future;
+	}
+
+	uint16_t RpcClient::GetLocalPort() {
+		return members->socket->GetLocalPort();
+	}
+
+	RpcClientStatistics RpcClient::GetStatistics() {
+		RpcClientStatistics statistics;
+		statistics.requests = members->requests.load(std::memory_order_relaxed);
+		statistics.retries = members->retries.load(std::memory_order_relaxed);
+		statistics.responses = members->responses.load(std::memory_order_relaxed);
+		statistics.timeouts = members->timeouts.load(std::memory_order_relaxed);
+		statistics.rejected = members->rejected.load(std::memory_order_relaxed);
+		statistics.late = members->late.load(std::memory_order_relaxed);
+		statistics.invalid = members->invalid.load(std::memory_order_relaxed);
+		statistics.inFlight = members->inFlight.load(std::memory_order_relaxed);
+		return statistics;
+	}
+
+
+
+
+
+
+
+	// =================================
+	// ===      RpcServer Class      ===
+	// =================================
+
+	struct RpcServerMembers {
+
+		RpcServerOptions options;
+
+		std::shared_mutex handlerMutex;
+		std::unordered_map<uint16_t, RpcHandler> handlers;
+
+		std::atomic<uint64_t> requests = 0;
+		std::atomic<uint64_t> noHandler = 0;
+		std::atomic<uint64_t> failures = 0;
+		std::atomic<uint64_t> invalid = 0;
+
+		// Last, the listener thread uses everything above. An optional keeps it reachable for the callbacks
+		// while its destructor joins the listener thread.
+		std::optional<UDPServerAsync> socket;
+
+		RpcServerMembers(const RpcServerOptions& options) : options(options) {}
+	};
+
+	static void OnRequest(RpcServerMembers& m, uint8_t* packet, size_t packetSize, IPv4Address source, uint16_t sourcePort) {
+		RpcHeader header;
+		if (!ReadHeader(packet, packetSize, header) || header.type != RPC_PACKET_REQUEST) {
+			m.invalid.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+		m.requests.fetch_add(1, std::memory_order_relaxed);
+
+		// Per thread, the handlers may run on the workers of the socket
+		thread_local std::vector<uint8_t> response;
+		if (response.size() < NETLIB_RPC_HEADER_SIZE + m.options.maxResponseSize) {
+			response.resize(NETLIB_RPC_HEADER_SIZE + m.options.maxResponseSize);
+		}
+
+		RpcPacketType type = RPC_PACKET_RESPONSE;
+		size_t responseSize = 0;
+		{
+			std::shared_lock<std::shared_mutex> lock(m.handlerMutex);
+			auto handler = m.handlers.find(header.method);
+			if (handler == m.handlers.end()) {
+				m.noHandler.fetch_add(1, std::memory_order_relaxed);
+				type = RPC_PACKET_NO_HANDLER;
+			}
+			else {
+				try {
+					responseSize = handler->second(packet + NETLIB_RPC_HEADER_SIZE, packetSize - NETLIB_RPC_HEADER_SIZE,
+						response.data() + NETLIB_RPC_HEADER_SIZE, m.options.maxResponseSize);
+					if (responseSize > m.options.maxResponseSize) {
+						LOG_WARN("[RpcServer]: Response of method {} with {} bytes exceeds maxResponseSize", header.method, responseSize);
+						type = RPC_PACKET_FAILED;
+					}
+				}
+				catch (std::exception& e) {
+					LOG_WARN("[RpcServer]: Exception in the handler of method {}: {}", header.method, e.what());
+					type = RPC_PACKET_FAILED;
+				}
+			}
+		}
+
+		if (type != RPC_PACKET_RESPONSE) {
+			responseSize = 0;
+			if (type == RPC_PACKET_FAILED) {
+				m.failures.fetch_add(1, std::memory_order_relaxed);
+			}
+		}
+
+		WriteHeader(response.data(), { type, header.method, header.id });
+		m.socket->SendTo(source, sourcePort, response.data(), NETLIB_RPC_HEADER_SIZE + responseSize);
+	}
+
+	RpcServer::RpcServer(uint16_t port, const RpcServerOptions& options) : members(new RpcServerMembers(options)) {
+		RpcServerMembers* m = members.get();
+		m->socket.emplace([m](uint8_t* packet, size_t packetSize, IPv4Address source, uint16_t sourcePort) {
+			OnRequest(*m, packet, packetSize, source, sourcePort);
+		}, port, NETLIB_RPC_HEADER_SIZE + options.maxRequestSize);
+	}
+
+	RpcServer::~RpcServer() {
+		members->socket.reset();
+	}
+
+	void RpcServer::Register(uint16_t method, RpcHandler handler) {
+		std::unique_lock<std::shared_mutex> lock(members->handlerMutex);
+		members->handlers[method] = std::move(handler);
+	}
+
+	void RpcServer::Unregister(uint16_t method) {
+		std::unique_lock<std::shared_mutex> lock(members->handlerMutex);
+		members->handlers.erase(method);
+	}
+
+	bool RpcServer::EnableWorkerPool(const WorkerPoolOptions& options) {
+		return members->socket->EnableWorkerPool(options);
+	}
+
+	uint16_t RpcServer::GetLocalPort() {
+		return members->socket->GetLocalPort();
+	}
+
+	RpcServerStatistics RpcServer::GetStatistics() {
+		RpcServerStatistics statistics;
+		statistics.requests = members->requests.load(std::memory_order_relaxed);
+		statistics.noHandler = members->noHandler.load(std::memory_order_relaxed);
+		statistics.failures = members->failures.load(std::memory_order_relaxed);
+		statistics.invalid = members->invalid.load(std::memory_order_relaxed);
+		return statistics;
+	}
+
+}
@@ -0,0 +1,560 @@
+
+#include "SharedMemory.h"
+
+#ifdef __linux__
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <cstddef>
+#endif
+
+#include <atomic>
+#include <cstring>
+#include <new>
+#include <string>
+
+#include "Logging.h"
+
+namespace NetLib {
+
+#ifdef __linux__
+
+	static constexpr uint32_t RING_MAGIC = 0x4E4C5352;			// "NLSR"
+	static constexpr uint32_t PROTOCOL_VERSION = 1;
+	static constexpr size_t MIN_RING_SIZE = 256 * 1024;			// Holds the largest UDP datagram
+	static constexpr size_t DATA_OFFSET = 4096;
+	static constexpr size_t RECORD_HEADER = 8;					// uint32_t length, padding keeps the payload aligned
+	static constexpr uint32_t WRAP_RECORD = 0xFFFFFFFF;		// The rest of the ring is unused, continue at 0
+	static constexpr std::chrono::seconds REATTACH_INTERVAL{ 1 };	// A closed sender looks for a restarted receiver
+
+	// Lives at the start of the shared mapping, the datagrams follow at DATA_OFFSET
+	struct SharedMemoryRing {
+		uint32_t magic = RING_MAGIC;
+		uint32_t version = PROTOCOL_VERSION;
+		uint64_t capacity = 0;										// Power of two
+
+		alignas(64) std::atomic<uint64_t> head = 0;					// Written by the sender only
+		alignas(64) std::atomic<uint64_t> tail = 0;					// Written by the receiver only
+		alignas(64) std::atomic<uint32_t> consumerWaiting = 1;		// The receiver sleeps, signal the eventfd
+		std::atomic<uint32_t> closed = 0;							// The receiver is gone
+	};
+
+	static_assert(sizeof(SharedMemoryRing) <= DATA_OFFSET, "The ring header must fit in front of the data");
+	static_assert(std::atomic<uint64_t>::is_always_lock_free, "Shared memory atomics must be lock-free");
+
+	struct HelloMessage {
+		uint32_t magic;
+		uint16_t version;
+		uint16_t localPort;			// Reported to the receiver as source port
+	};
+
+	struct WelcomeMessage {
+		uint32_t magic;
+		uint32_t version;
+		uint64_t mappedSize;
+	};
+
+	struct SharedMemoryConnection {
+		int socketFd = -1;
+		SharedMemoryRing* ring = nullptr;
+		size_t mappedSize = 0;
+		uint16_t sourcePort = 0;
+		bool closing = false;		// Removed once the ring is drained
+
+		~SharedMemoryConnection() {
+			if (ring) {
+				ring->closed.store(1, std::memory_order_release);
+				munmap(ring, mappedSize);
+			}
+			if (socketFd >= 0) {
+				close(socketFd);
+			}
+		}
+	};
+
+	static uint8_t* RingData(SharedMemoryRing* ring) {
+		return (uint8_t*)ring + DATA_OFFSET;
+	}
+
+	static uint64_t RecordSize(size_t length) {
+		return (RECORD_HEADER + length + 7) & ~(uint64_t)7;
+	}
+
+	static bool RingWrite(SharedMemoryRing* ring, const ConstBuffer* buffers, size_t count) {
+		size_t length = 0;
+		for (size_t i = 0; i < count; i++) {
+			length += buffers[i].size;
+		}
+
+		uint64_t capacity = ring->capacity;
+		uint64_t need = RecordSize(length);
+		if (need > capacity / 2)
+			return false;
+
+		uint64_t head = ring->head.load(std::memory_order_relaxed);
+		uint64_t tail = ring->tail.load(std::memory_order_acquire);
+		uint64_t offset = head & (capacity - 1);
+		uint64_t contiguous = capacity - offset;
+		uint64_t total = need <= contiguous ? need : contiguous + need;
+		if (head + total - tail > capacity)
+			return false;
+
+		uint8_t* base = RingData(ring);
+		if (need > contiguous) {
+			memcpy(base + offset, &WRAP_RECORD, sizeof(WRAP_RECORD));
+			head += contiguous;
+			offset = 0;
+		}
+
+		uint32_t length32 = (uint32_t)length;
+		memcpy(base + offset, &length32, sizeof(length32));
+		uint8_t* record = base + offset + RECORD_HEADER;
+		for (size_t i = 0; i < count; i++) {
+			if (buffers[i].size > 0) {
+				memcpy(record, buffers[i].data, buffers[i].size);
+				record += buffers[i].size;
+			}
+		}
+		ring->head.store(head + need, std::memory_order_release);
+		return true;
+	}
+
+	static bool RingHasData(SharedMemoryRing* ring) {
+		return ring->head.load(std::memory_order_acquire) != ring->tail.load(std::memory_order_relaxed);
+	}
+
+	// Returns 1 for a datagram, 0 if the ring is empty and -1 if the sender wrote garbage. Datagrams larger
+	// than 'capacity' are truncated like a UDP receive.
+	static int RingRead(SharedMemoryRing* ring, uint8_t* data, size_t capacity, size_t& bytes) {
+		uint64_t ringCapacity = ring->capacity;
+		uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+		uint64_t head = ring->head.load(std::memory_order_acquire);
+		if (tail == head)
+			return 0;
+
+		uint8_t* base = RingData(ring);
+		uint64_t offset = tail & (ringCapacity - 1);
+		uint32_t length = 0;
+		memcpy(&length, base + offset, sizeof(length));
+
+		if (length == WRAP_RECORD) {
+			tail += ringCapacity - offset;
+			offset = 0;
+			if (tail >= head)
+				return -1;
+			memcpy(&length, base, sizeof(length));
+		}
+
+		uint64_t size = RecordSize(length);
+		if (size > ringCapacity - offset || tail + size > head)
+			return -1;
+
+		bytes = length;			// The caller notices truncation
+		memcpy(data, base + offset + RECORD_HEADER, length < capacity ? length : capacity);
+		ring->tail.store(tail + size, std::memory_order_release);
+		return 1;
+	}
+
+	static socklen_t AbstractAddress(uint16_t port, sockaddr_un& address) {
+		std::string name = "netlib-udp-" + std::to_string(port);
+		memset(&address, 0, sizeof(address));
+		address.sun_family = AF_UNIX;
+		memcpy(address.sun_path + 1, name.data(), name.size());		// Leading zero: Abstract namespace
+		return (socklen_t)(offsetof(sockaddr_un, sun_path) + 1 + name.size());
+	}
+
+
+
+	// ==============================
+	// ===      Receiver Side     ===
+	// ==============================
+
+	std::unique_ptr<SharedMemoryReceiver> SharedMemoryReceiver::Create(uint16_t port, size_t ringSize, bool allowOtherUsers) {
+		std::unique_ptr<SharedMemoryReceiver> receiver(new SharedMemoryReceiver());
+		receiver->allowOtherUsers = allowOtherUsers;
+
+		receiver->ringSize = MIN_RING_SIZE;
+		while (receiver->ringSize < ringSize) {
+			receiver->ringSize *= 2;
+		}
+
+		sockaddr_un address;
+		socklen_t addressLength = AbstractAddress(port, address);
+
+		receiver->listenFd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		if (receiver->listenFd < 0 || bind(receiver->listenFd, (sockaddr*)&address, addressLength) != 0 || listen(receiver->listenFd, 64) != 0) {
+			LOG_WARN("[SharedMemory]: Can't advertise port {}: {}", port, strerror(errno));
+			return nullptr;
+		}
+
+		receiver->eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		receiver->epollFd = epoll_create1(EPOLL_CLOEXEC);
+		if (receiver->eventFd < 0 || receiver->epollFd < 0) {
+			LOG_WARN("[SharedMemory]: Can't create the wakeup handles: {}", strerror(errno));
+			return nullptr;
+		}
+
+		// The addresses of the members tag their events
+		epoll_event event = {};
+		event.events = EPOLLIN;
+		event.data.ptr = &receiver->listenFd;
+		epoll_ctl(receiver->epollFd, EPOLL_CTL_ADD, receiver->listenFd, &event);
+		event.data.ptr = &receiver->eventFd;
+		epoll_ctl(receiver->epollFd, EPOLL_CTL_ADD, receiver->eventFd, &event);
+
+		LOG_DEBUG("[SharedMemory]: Advertising port {} with {} byte rings", port, receiver->ringSize);
+		return receiver;
+	}
+
+	SharedMemoryReceiver::~SharedMemoryReceiver() {
+		connections.clear();
+		if (epollFd >= 0) close(epollFd);
+		if (listenFd >= 0) close(listenFd);
+		if (eventFd >= 0) close(eventFd);
+	}
+
+	void SharedMemoryReceiver::Poll() {
+		epoll_event events[64];
+		int count = epoll_wait(epollFd, events, 64, 0);
+
+		for (int i = 0; i < count; i++) {
+			void* tag = events[i].data.ptr;
+			if (tag == &listenFd) {
+				Accept();
+			}
+			else if (tag == &eventFd) {
+				uint64_t value = 0;
+				(void)!read(eventFd, &value, sizeof(value));
+			}
+			else {
+				SharedMemoryConnection& connection = *(SharedMemoryConnection*)tag;
+				if (!connection.ring && (events[i].events & EPOLLIN)) {
+					Handshake(connection);
+				}
+				else {
+					// The sender sends nothing after the handshake, so this is the end of the connection
+					connection.closing = true;
+					epoll_ctl(epollFd, EPOLL_CTL_DEL, connection.socketFd, nullptr);
+				}
+			}
+		}
+
+		RemoveClosed();
+	}
+
+	void SharedMemoryReceiver::Accept() {
+		while (true) {
+			int fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+			if (fd < 0)
+				return;
+
+			// The abstract namespace has no file permissions, anyone on the host can connect
+			ucred credentials = {};
+			socklen_t credentialsLength = sizeof(credentials);
+			if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &credentials, &credentialsLength) != 0) {
+				LOG_WARN("[SharedMemory]: Can't read the credentials of a sender: {}", strerror(errno));
+				close(fd);
+				continue;
+			}
+			if (!allowOtherUsers && credentials.uid != geteuid()) {
+				LOG_WARN("[SharedMemory]: Rejected sender pid {} running as uid {}", credentials.pid, credentials.uid);
+				close(fd);
+				continue;
+			}
+
+			auto connection = std::make_unique<SharedMemoryConnection>();
+			connection->socketFd = fd;
+
+			epoll_event event = {};
+			event.events = EPOLLIN | EPOLLRDHUP;
+			event.data.ptr = connection.get();
+			epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event);
+			connections.push_back(std::move(connection));
+		}
+	}
+
+	void SharedMemoryReceiver::Handshake(SharedMemoryConnection& connection) {
+		HelloMessage hello = {};
+		ssize_t received = recv(connection.socketFd, &hello, sizeof(hello), MSG_DONTWAIT);
+		if (received != (ssize_t)sizeof(hello) || hello.magic != RING_MAGIC || hello.version != PROTOCOL_VERSION) {
+			connection.closing = true;
+			epoll_ctl(epollFd, EPOLL_CTL_DEL, connection.socketFd, nullptr);
+			return;
+		}
+
+		size_t mappedSize = DATA_OFFSET + ringSize;
+		int memoryFd = memfd_create("netlib-udp-ring", MFD_CLOEXEC);
+		void* memory = MAP_FAILED;
+		if (memoryFd >= 0 && ftruncate(memoryFd, (off_t)mappedSize) == 0) {
+			memory = mmap(nullptr, mappedSize, PROT_READ | PROT_WRITE, MAP_SHARED, memoryFd, 0);
+		}
+		if (memory == MAP_FAILED) {
+			LOG_WARN("[SharedMemory]: Can't create a ring: {}", strerror(errno));
+			if (memoryFd >= 0) close(memoryFd);
+			connection.closing = true;
+			epoll_ctl(epollFd, EPOLL_CTL_DEL, connection.socketFd, nullptr);
+			return;
+		}
+
+		connection.ring = new (memory) SharedMemoryRing();
+		connection.ring->capacity = ringSize;
+		connection.mappedSize = mappedSize;
+		connection.sourcePort = hello.localPort;
+
+		// The ring and the shared eventfd go to the sender
+		WelcomeMessage welcome = { RING_MAGIC, PROTOCOL_VERSION, mappedSize };
+		iovec iov = { &welcome, sizeof(welcome) };
+		alignas(cmsghdr) char control[CMSG_SPACE(2 * sizeof(int))] = {};
+		msghdr message = {};
+		message.msg_iov = &iov;
+		message.msg_iovlen = 1;
+		message.msg_control = control;
+		message.msg_controllen = sizeof(control);
+
+		cmsghdr* header = CMSG_FIRSTHDR(&message);
+		header->cmsg_level = SOL_SOCKET;
+		header->cmsg_type = SCM_RIGHTS;
+		header->cmsg_len = CMSG_LEN(2 * sizeof(int));
+		int fds[2] = { memoryFd, eventFd };
+		memcpy(CMSG_DATA(header), fds, sizeof(fds));
+
+		if (sendmsg(connection.socketFd, &message, MSG_NOSIGNAL) != (ssize_t)sizeof(welcome)) {
+			connection.closing = true;
+			epoll_ctl(epollFd, EPOLL_CTL_DEL, connection.socketFd, nullptr);
+		}
+		close(memoryFd);		// The mappings keep the memory alive
+
+		LOG_DEBUG("[SharedMemory]: Sender from local port {} attached", hello.localPort);
+	}
+
+	void SharedMemoryReceiver::RemoveClosed() {
+		for (size_t i = 0; i < connections.size();) {
+			SharedMemoryConnection& connection = *connections[i];
+			if (connection.closing && (!connection.ring || !RingHasData(connection.ring))) {
+				connections[i] = std::move(connections.back());
+				connections.pop_back();
+			}
+			else {
+				i++;
+			}
+		}
+	}
+
+	bool SharedMemoryReceiver::HasData() const {
+		for (auto& connection : connections) {
+			if (connection->ring && RingHasData(connection->ring))
+				return true;
+		}
+		return false;
+	}
+
+	bool SharedMemoryReceiver::TryReceive(uint8_t* data, size_t capacity, size_t& bytes, uint16_t& sourcePort) {
+		size_t count = connections.size();
+		for (size_t i = 0; i < count; i++) {
+			size_t index = (next + i) % count;
+			SharedMemoryConnection& connection = *connections[index];
+			if (!connection.ring)
+				continue;
+
+			int result = RingRead(connection.ring, data, capacity, bytes);
+			if (result > 0) {
+				next = index + 1;
+				sourcePort = connection.sourcePort;
+				return true;
+			}
+			if (result < 0) {
+				LOG_WARN("[SharedMemory]: Corrupted ring of local port {}, detaching", connection.sourcePort);
+				connection.ring->tail.store(connection.ring->head.load());
+				if (!connection.closing) {
+					connection.closing = true;
+					epoll_ctl(epollFd, EPOLL_CTL_DEL, connection.socketFd, nullptr);
+				}
+			}
+		}
+		return false;
+	}
+
+	bool SharedMemoryReceiver::PrepareToWait() {
+		for (auto& connection : connections) {
+			if (connection->ring) {
+				connection->ring->consumerWaiting.store(1, std::memory_order_relaxed);
+			}
+		}
+
+		// Pairs with the fence of the senders: Either they see the flag or we see their data
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (HasData()) {
+			StopWaiting();
+			return false;
+		}
+
+		RemoveClosed();
+		return true;
+	}
+
+	void SharedMemoryReceiver::StopWaiting() {
+		for (auto& connection : connections) {
+			if (connection->ring) {
+				connection->ring->consumerWaiting.store(0, std::memory_order_relaxed);
+			}
+		}
+	}
+
+
+
+	// ============================
+	// ===      Sender Side     ===
+	// ============================
+
+	std::unique_ptr<SharedMemorySender> SharedMemorySender::Connect(uint16_t port, uint16_t localPort) {
+		std::unique_ptr<SharedMemorySender> sender(new SharedMemorySender());
+		sender->port = port;
+		sender->localPort = localPort;
+		if (!sender->Attach())
+			return nullptr;
+
+		return sender;
+	}
+
+	// Handshake with the receiver, on failure the caller detaches what was set up so far
+	bool SharedMemorySender::Attach() {
+		sockaddr_un address;
+		socklen_t addressLength = AbstractAddress(port, address);
+
+		socketFd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+		if (socketFd < 0 || connect(socketFd, (sockaddr*)&address, addressLength) != 0)
+			return false;		// No local server advertises this port
+
+		// The receiver answers from its listener thread
+		timeval timeout = { 1, 0 };
+		setsockopt(socketFd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+		HelloMessage hello = { RING_MAGIC, (uint16_t)PROTOCOL_VERSION, localPort };
+		if (send(socketFd, &hello, sizeof(hello), MSG_NOSIGNAL) != (ssize_t)sizeof(hello))
+			return false;
+
+		WelcomeMessage welcome = {};
+		iovec iov = { &welcome, sizeof(welcome) };
+		alignas(cmsghdr) char control[CMSG_SPACE(2 * sizeof(int))] = {};
+		msghdr message = {};
+		message.msg_iov = &iov;
+		message.msg_iovlen = 1;
+		message.msg_control = control;
+		message.msg_controllen = sizeof(control);
+
+		ssize_t received = recvmsg(socketFd, &message, MSG_CMSG_CLOEXEC);
+		cmsghdr* header = CMSG_FIRSTHDR(&message);
+		if (received != (ssize_t)sizeof(welcome) || !header || header->cmsg_type != SCM_RIGHTS || header->cmsg_len != CMSG_LEN(2 * sizeof(int))) {
+			LOG_WARN("[SharedMemory]: Handshake with local port {} failed", port);
+			return false;
+		}
+
+		int fds[2] = { -1, -1 };
+		memcpy(fds, CMSG_DATA(header), sizeof(fds));
+		eventFd = fds[1];
+
+		void* memory = MAP_FAILED;
+		if (welcome.magic == RING_MAGIC && welcome.version == PROTOCOL_VERSION && welcome.mappedSize > DATA_OFFSET) {
+			memory = mmap(nullptr, welcome.mappedSize, PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+		}
+		close(fds[0]);
+		if (memory == MAP_FAILED) {
+			LOG_WARN("[SharedMemory]: Can't map the ring of local port {}", port);
+			return false;
+		}
+
+		ring = (SharedMemoryRing*)memory;
+		mappedSize = welcome.mappedSize;
+		if (ring->magic != RING_MAGIC || ring->capacity + DATA_OFFSET != welcome.mappedSize)
+			return false;
+
+		LOG_DEBUG("[SharedMemory]: Attached to local port {}", port);
+		return true;
+	}
+
+	void SharedMemorySender::Detach() {
+		if (ring) munmap(ring, mappedSize);
+		if (eventFd >= 0) close(eventFd);
+		if (socketFd >= 0) close(socketFd);
+		ring = nullptr;
+		mappedSize = 0;
+		eventFd = socketFd = -1;
+	}
+
+	SharedMemorySender::~SharedMemorySender() {
+		Detach();
+	}
+
+	// The receiver went away: Releases its ring, the client sends through its socket until a restarted
+	// receiver is attached
+	void SharedMemorySender::Close() {
+		LOG_DEBUG("[SharedMemory]: Local port {} went away", port);
+		Detach();
+		closed = true;
+		nextAttach = std::chrono::steady_clock::now() + REATTACH_INTERVAL;
+	}
+
+	SharedMemorySender::Result SharedMemorySender::Send(const ConstBuffer* buffers, size_t count) {
+		std::lock_guard<std::mutex> lock(mutex);
+		if (closed) {
+			auto now = std::chrono::steady_clock::now();
+			if (now < nextAttach)
+				return CLOSED;
+
+			nextAttach = now + REATTACH_INTERVAL;
+			if (!Attach()) {
+				Detach();
+				return CLOSED;
+			}
+			closed = false;
+		}
+
+		if (ring->closed.load(std::memory_order_acquire)) {
+			Close();
+			return CLOSED;
+		}
+
+		if (!RingWrite(ring, buffers, count)) {
+			// A receiver that crashed never drains its ring, find out on the first full ring
+			char byte;
+			if (recv(socketFd, &byte, 1, MSG_DONTWAIT | MSG_PEEK) == 0) {
+				Close();
+				return CLOSED;
+			}
+			return DROPPED;
+		}
+
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (ring->consumerWaiting.load(std::memory_order_relaxed)) {
+			uint64_t one = 1;
+			(void)!write(eventFd, &one, sizeof(one));
+		}
+		return SENT;
+	}
+
+#else
+
+	struct SharedMemoryConnection {};
+	struct SharedMemoryRing {};
+
+	std::unique_ptr<SharedMemoryReceiver> SharedMemoryReceiver::Create(uint16_t, size_t, bool) { return nullptr; }
+	SharedMemoryReceiver::~SharedMemoryReceiver() {}
+	void SharedMemoryReceiver::Poll() {}
+	bool SharedMemoryReceiver::HasData() const { return false; }
+	bool SharedMemoryReceiver::TryReceive(uint8_t*, size_t, size_t&, uint16_t&) { return false; }
+	bool SharedMemoryReceiver::PrepareToWait() { return true; }
+	void SharedMemoryReceiver::StopWaiting() {}
+
+	std::unique_ptr<SharedMemorySender> SharedMemorySender::Connect(uint16_t, uint16_t) { return nullptr; }
+	SharedMemorySender::~SharedMemorySender() {}
+	bool SharedMemorySender::Attach() { return false; }
+	void SharedMemorySender::Detach() {}
+	void SharedMemorySender::Close() {}
+	SharedMemorySender::Result SharedMemorySender::Send(const ConstBuffer*, size_t) { return CLOSED; }
+
+#endif
+
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "NetLib.h"
+
+// Private header: Same-host datagram transport. A server advertises itself on the abstract unix socket
+// "netlib-udp-<port>", every local sender that connects gets its own memfd-backed single-producer ring.
+// All rings of a server share one eventfd, which the producers only signal while the consumer sleeps.
+// Linux only, on other platforms Create() and Connect() fail and both sides stay on UDP.
+
+namespace NetLib {
+
+	struct SharedMemoryConnection;
+
+	class SharedMemoryReceiver {
+	public:
+		// Without 'allowOtherUsers' only senders with the effective uid of this process may attach
+		static std::unique_ptr<SharedMemoryReceiver> Create(uint16_t port, size_t ringSize, bool allowOtherUsers);
+		~SharedMemoryReceiver();
+
+		SharedMemoryReceiver(const SharedMemoryReceiver&) = delete;
+		SharedMemoryReceiver& operator=(const SharedMemoryReceiver&) = delete;
+
+		// Readable whenever Poll() has something to do, to be watched by the event loop
+		int WaitHandle() const { return epollFd; }
+
+		// Accepts senders, completes handshakes, notices closed senders and resets the eventfd
+		void Poll();
+
+		bool HasData() const;
+
+		// 'bytes' is the full length of the datagram, only 'capacity' bytes of it are copied
+		bool TryReceive(uint8_t* data, size_t capacity, size_t& bytes, uint16_t& sourcePort);
+
+		// Before sleeping: Asks the producers for a wakeup. Returns false if data arrived in the meantime.
+		bool PrepareToWait();
+		void StopWaiting();
+
+	private:
+		SharedMemoryReceiver() = default;
+
+		void Accept();
+		void Handshake(SharedMemoryConnection& connection);
+		void RemoveClosed();
+
+		int epollFd = -1;
+		int listenFd = -1;
+		int eventFd = -1;
+		size_t ringSize = 0;
+		bool allowOtherUsers = false;
+		size_t next = 0;				// Round robin over the senders
+		std::vector<std::unique_ptr<SharedMemoryConnection>> connections;
+	};
+
+	struct SharedMemoryRing;
+
+	class SharedMemorySender {
+	public:
+		enum Result {
+			SENT,
+			DROPPED,		// The ring is full, like a full socket buffer
+			CLOSED			// The receiver is gone, the sender must fall back to UDP until it is attached again
+		};
+
+		// Returns nullptr if no local server advertises a ring on this port
+		static std::unique_ptr<SharedMemorySender> Connect(uint16_t port, uint16_t localPort);
+		~SharedMemorySender();
+
+		SharedMemorySender(const SharedMemorySender&) = delete;
+		SharedMemorySender& operator=(const SharedMemorySender&) = delete;
+
+		// Thread-safe. The buffers are copied into one record, the receiver sees a single datagram. After the
+		// receiver went away, a send tries to attach to a restarted one at most once a second.
+		Result Send(const ConstBuffer* buffers, size_t count);
+
+	private:
+		SharedMemorySender() = default;
+
+		bool Attach();
+		void Detach();
+		void Close();
+
+		std::mutex mutex;
+		uint16_t port = 0;
+		uint16_t localPort = 0;
+		int socketFd = -1;
+		int eventFd = -1;
+		SharedMemoryRing* ring = nullptr;
+		size_t mappedSize = 0;
+		bool closed = false;
+		std::chrono::steady_clock::time_point nextAttach;
+	};
+
+}
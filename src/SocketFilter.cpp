@@ -0,0 +1,185 @@
+
+#include "SocketFilter.h"
+
+#ifdef __linux__
+#include <sys/socket.h>
+#include <linux/filter.h>
+#endif
+
+#include <algorithm>
+#include <vector>
+
+#include "Logging.h"
+
+namespace NetLib {
+
+#ifdef __linux__
+
+	// For UDP sockets the filter sees the packet starting at the UDP header, the IP header is reached
+	// through the SKF_NET_OFF extension.
+	static constexpr uint32_t UDP_HEADER_SIZE = 8;
+	static constexpr uint32_t IPV4_SOURCE_OFFSET = (uint32_t)SKF_NET_OFF + 12;
+
+	class FilterProgram {
+	public:
+		void Load(uint16_t code, uint32_t k) {
+			program.push_back(BPF_STMT(code, k));
+		}
+
+		void Jump(uint16_t code, uint32_t k, uint8_t jt, uint8_t jf) {
+			program.push_back(BPF_JUMP(code, k, jt, jf));
+		}
+
+		void Reject() {
+			program.push_back(BPF_STMT(BPF_RET | BPF_K, 0));
+		}
+
+		void Accept() {
+			program.push_back(BPF_STMT(BPF_RET | BPF_K, 0xFFFFFFFF));
+		}
+
+		// Unconditional jumps have a 32 bit offset, they are patched once the target is known
+		size_t JumpPlaceholder() {
+			program.push_back(BPF_STMT(BPF_JMP | BPF_JA, 0));
+			return program.size() - 1;
+		}
+
+		void PatchJumpsToHere(const std::vector<size_t>& jumps) {
+			for (size_t index : jumps) {
+				program[index].k = (uint32_t)(program.size() - index - 1);
+			}
+		}
+
+		std::vector<sock_filter> program;
+	};
+
+	// Every check is laid out so that conditional jumps only skip a few instructions. Any-of sets exit
+	// through unconditional jumps, so the program stays valid no matter how many entries it has.
+	static std::vector<sock_filter> CompilePacketFilter(const PacketFilter& filter) {
+		FilterProgram p;
+
+		if (filter.minLength > 0) {
+			p.Load(BPF_LD | BPF_W | BPF_LEN, 0);
+			p.Jump(BPF_JMP | BPF_JGE | BPF_K, (uint32_t)(UDP_HEADER_SIZE + filter.minLength), 1, 0);
+			p.Reject();
+		}
+
+		if (filter.maxLength > 0) {
+			p.Load(BPF_LD | BPF_W | BPF_LEN, 0);
+			p.Jump(BPF_JMP | BPF_JGT | BPF_K, (uint32_t)(UDP_HEADER_SIZE + filter.maxLength), 0, 1);
+			p.Reject();
+		}
+
+		// Compare the magic bytes in words, then halfwords and bytes
+		size_t offset = 0;
+		while (offset < filter.magic.size()) {
+			size_t remaining = filter.magic.size() - offset;
+			size_t width = remaining >= 4 ? 4 : (remaining >= 2 ? 2 : 1);
+			uint16_t size = width == 4 ? BPF_W : (width == 2 ? BPF_H : BPF_B);
+
+			uint32_t expected = 0;
+			for (size_t i = 0; i < width; i++) {
+				expected = (expected << 8) | filter.magic[offset + i];
+			}
+
+			p.Load(BPF_LD | size | BPF_ABS, (uint32_t)(UDP_HEADER_SIZE + offset));
+			p.Jump(BPF_JMP | BPF_JEQ | BPF_K, expected, 1, 0);
+			p.Reject();
+			offset += width;
+		}
+
+		if (!filter.allowedSources.empty()) {
+			std::vector<size_t> matched;
+			for (const Cidr& source : filter.allowedSources) {
+				p.Load(BPF_LD | BPF_W | BPF_ABS, IPV4_SOURCE_OFFSET);
+				p.Load(BPF_ALU | BPF_AND | BPF_K, source.Netmask().ToUint());
+				p.Jump(BPF_JMP | BPF_JEQ | BPF_K, source.Network().ToUint(), 0, 1);
+				matched.push_back(p.JumpPlaceholder());
+			}
+			p.Reject();
+			p.PatchJumpsToHere(matched);
+		}
+
+		if (!filter.allowedSourcePorts.empty()) {
+			std::vector<size_t> matched;
+			for (const auto& [first, last] : filter.allowedSourcePorts) {
+				p.Load(BPF_LD | BPF_H | BPF_ABS, 0);							// UDP source port
+				p.Jump(BPF_JMP | BPF_JGE | BPF_K, first, 0, 2);
+				p.Jump(BPF_JMP | BPF_JGT | BPF_K, last, 1, 0);
+				matched.push_back(p.JumpPlaceholder());
+			}
+			p.Reject();
+			p.PatchJumpsToHere(matched);
+		}
+
+		p.Accept();
+		return p.program;
+	}
+
+	bool AttachPacketFilter(intptr_t nativeSocket, const PacketFilter& filter) {
+		std::vector<sock_filter> program = CompilePacketFilter(filter);
+		if (program.size() > BPF_MAXINSNS) {
+			LOG_WARN("[PacketFilter]: Filter needs {} instructions, the kernel allows {}", program.size(), BPF_MAXINSNS);
+			return false;
+		}
+
+		sock_fprog fprog = {};
+		fprog.len = (unsigned short)program.size();
+		fprog.filter = program.data();
+
+		// Attaching again atomically replaces the previous program
+		if (setsockopt((int)nativeSocket, SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof(fprog)) != 0) {
+			LOG_WARN("[PacketFilter]: SO_ATTACH_FILTER failed: {}", strerror(errno));
+			return false;
+		}
+
+		LOG_DEBUG("[PacketFilter]: Attached filter with {} instructions", program.size());
+		return true;
+	}
+
+	bool DetachPacketFilter(intptr_t nativeSocket) {
+		int unused = 0;
+		return setsockopt((int)nativeSocket, SOL_SOCKET, SO_DETACH_FILTER, &unused, sizeof(unused)) == 0;
+	}
+
+#else
+
+	bool AttachPacketFilter(intptr_t nativeSocket, const PacketFilter& filter) {
+		(void)nativeSocket;
+		(void)filter;
+		LOG_WARN("[PacketFilter]: Socket filters are only supported on Linux");
+		return false;
+	}
+
+	bool DetachPacketFilter(intptr_t nativeSocket) {
+		(void)nativeSocket;
+		return false;
+	}
+
+#endif
+
+	bool MatchesPacketFilter(const PacketFilter& filter, IPv4Address source, uint16_t sourcePort, const uint8_t* data, size_t available, size_t length) {
+		if (length < filter.minLength || (filter.maxLength > 0 && length > filter.maxLength))
+			return false;
+
+		if (filter.magic.size() > available || !std::equal(filter.magic.begin(), filter.magic.end(), data))
+			return false;
+
+		if (!filter.allowedSources.empty()) {
+			bool matched = std::any_of(filter.allowedSources.begin(), filter.allowedSources.end(), [&](const Cidr& cidr) { return cidr.Contains(source); });
+			if (!matched)
+				return false;
+		}
+
+		if (!filter.allowedSourcePorts.empty()) {
+			bool matched = std::any_of(filter.allowedSourcePorts.begin(), filter.allowedSourcePorts.end(), [&](const auto& range) {
+				return sourcePort >= range.first && sourcePort <= range.second;
+			});
+			if (!matched)
+				return false;
+		}
+
+		return true;
+	}
+
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstdint>
+
+#include "PacketFilter.h"
+
+// Private header: Compiles a PacketFilter to classic BPF and attaches it to a native socket handle.
+
+namespace NetLib {
+
+	bool AttachPacketFilter(intptr_t nativeSocket, const PacketFilter& filter);
+	bool DetachPacketFilter(intptr_t nativeSocket);
+
+	// The same criteria in software, for datagrams that bypass the socket (shared-memory rings). 'length' is
+	// the full length of the datagram, 'available' the bytes of it in 'data'.
+	bool MatchesPacketFilter(const PacketFilter& filter, IPv4Address source, uint16_t sourcePort, const uint8_t* data, size_t available, size_t length);
+
+}
@@ -0,0 +1,731 @@
+
+#include "TCP.h"
+
+#ifdef _WIN32
+#define _WIN32_WINNT _WIN32_WINNT_WIN10		// This sets the asio winsock library to Windows 10
+#define _WINSOCK_DEPRECATED_NO_WARNINGS
+#endif
+
+#include <asio.hpp>
+using asio::ip::tcp;
+
+#ifndef _WIN32
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#endif
+
+#include <unordered_map>
+#include <cstring>
+
+#include "Logging.h"
+
+namespace NetLib {
+
+	// ==================================
+	// ===      Framing helpers       ===
+	// ==================================
+
+	// Read buffer of a single connection. Messages are parsed in place, the storage only grows when a
+	// message does not fit and is reused for every following message.
+	struct TCPReadBuffer {
+		std::vector<uint8_t> data;
+		size_t begin = 0;		// First byte that was not consumed yet
+		size_t end = 0;			// One past the last received byte
+		size_t scan = 0;		// Delimiter framing: Bytes from begin that are known to contain no delimiter
+
+		void Initialize(size_t size) {
+			data.resize(size);
+			begin = end = scan = 0;
+		}
+
+		// Returns true if a complete message is available. 'violation' is set if the peer broke the framing.
+		bool NextMessage(const TCPFraming& framing, uint8_t*& message, size_t& messageSize, bool& violation) {
+			size_t available = end - begin;
+			violation = false;
+
+			if (framing.mode == TCPFraming::LENGTH_PREFIXED) {
+				if (available < 4)
+					return false;
+
+				uint8_t* header = &data[begin];
+				size_t length = ((size_t)header[0] << 24) | ((size_t)header[1] << 16) | ((size_t)header[2] << 8) | (size_t)header[3];
+				if (length > framing.maxMessageSize) {
+					violation = true;
+					return false;
+				}
+				if (available < length + 4)
+					return false;
+
+				message = header + 4;
+				messageSize = length;
+				begin += length + 4;
+				return true;
+			}
+
+			if (scan == available)
+				return false;
+
+			void* delimiter = memchr(&data[begin + scan], framing.delimiter, available - scan);
+			if (delimiter == nullptr) {
+				scan = available;
+				if (available > framing.maxMessageSize)
+					violation = true;
+				return false;
+			}
+
+			message = &data[begin];
+			messageSize = (size_t)((uint8_t*)delimiter - message);
+			begin += messageSize + 1;
+			scan = 0;
+			return true;
+		}
+
+		// Makes room for the next read and returns the writable region
+		asio::mutable_buffer Prepare(const TCPFraming& framing) {
+			if (begin == end) {
+				begin = end = 0;
+			}
+			else if (begin > 0 && end == data.size()) {
+				memmove(&data[0], &data[begin], end - begin);
+				end -= begin;
+				begin = 0;
+			}
+
+			if (end == data.size()) {		// A single message fills the whole buffer, grow it
+				size_t limit = framing.maxMessageSize + 4;
+				data.resize(std::min(std::max(data.size() * 2, (size_t)64), std::max(limit, data.size() + 1)));
+			}
+
+			return asio::buffer(&data[end], data.size() - end);
+		}
+
+		void Commit(size_t bytes) {
+			end += bytes;
+		}
+	};
+
+	// Builds the buffer sequence for one framed message. 'header' must provide 4 bytes of storage.
+	static size_t BuildFrame(const TCPFraming& framing, std::vector<asio::const_buffer>& gather, uint8_t* header,
+		const ConstBuffer* buffers, size_t count)
+	{
+		size_t length = 0;
+		for (size_t i = 0; i < count; i++) {
+			length += buffers[i].size;
+		}
+
+		gather.clear();
+		if (framing.mode == TCPFraming::LENGTH_PREFIXED) {
+			header[0] = (uint8_t)(length >> 24);
+			header[1] = (uint8_t)(length >> 16);
+			header[2] = (uint8_t)(length >> 8);
+			header[3] = (uint8_t)(length);
+			gather.emplace_back(header, 4);
+		}
+
+		for (size_t i = 0; i < count; i++) {
+			if (buffers[i].size > 0) {
+				gather.emplace_back(buffers[i].data, buffers[i].size);
+			}
+		}
+
+		if (framing.mode == TCPFraming::DELIMITER) {
+			gather.emplace_back(&framing.delimiter, 1);
+		}
+
+		return length;
+	}
+
+	static bool SetSocketCork(tcp::socket& socket, bool enable) {
+#if defined(TCP_CORK)
+		int value = enable ? 1 : 0;
+		return setsockopt(socket.native_handle(), IPPROTO_TCP, TCP_CORK, &value, sizeof(value)) == 0;
+#elif defined(TCP_NOPUSH)
+		int value = enable ? 1 : 0;
+		return setsockopt(socket.native_handle(), IPPROTO_TCP, TCP_NOPUSH, &value, sizeof(value)) == 0;
+#else
+		(void)socket;
+		(void)enable;
+		return false;
+#endif
+	}
+
+
+
+
+
+
+	// ==================================
+	// ===      TCPClient Class       ===
+	// ==================================
+
+	struct TCPClientMembers {
+		asio::io_service ioService;
+		tcp::socket socket;
+		tcp::endpoint remoteEndpoint;
+		TCPFraming framing;
+
+		std::atomic<bool> connected = false;
+		bool noDelay = false;
+
+		// A reconnect takes both locks, the receive side only shuts a broken connection down, never closes it
+		std::mutex sendMutex;
+		std::mutex receiveMutex;
+		std::vector<asio::const_buffer> gather;
+		TCPReadBuffer readBuffer;
+
+		TCPClientMembers() : socket(ioService) {}
+		~TCPClientMembers() = default;
+	};
+
+	TCPClient::TCPClient(const std::string& ipAddress, uint16_t port, TCPFraming framing) : members(new TCPClientMembers()) {
+		try {
+			members->remoteEndpoint = tcp::endpoint(asio::ip::address::from_string(ipAddress), port);
+			members->framing = framing;
+			members->readBuffer.Initialize(NETLIB_DEFAULT_TCP_BUFFER_SIZE);
+			Connect();
+			LOG_DEBUG("[TCPClient]: Instance constructed, connected to {}:{}", ipAddress, port);
+		}
+		catch (std::exception& e) {
+			throw std::runtime_error(std::string("ASIO Exception: ") + e.what());
+		}
+	}
+
+	TCPClient::~TCPClient() {
+		std::error_code error;
+		members->socket.shutdown(tcp::socket::shutdown_both, error);
+		members->socket.close(error);
+		LOG_DEBUG("[TCPClient]: Instance destructed");
+	}
+
+	void TCPClient::Connect() {
+		// Wakes up a ReceiveMessage() blocked on the old connection, so it releases the read side
+		std::error_code error;
+		members->socket.shutdown(tcp::socket::shutdown_both, error);
+
+		std::lock_guard<std::mutex> guard(members->receiveMutex);
+		members->socket.close(error);
+		members->readBuffer.begin = members->readBuffer.end = members->readBuffer.scan = 0;
+
+		members->socket.connect(members->remoteEndpoint);
+		members->socket.set_option(tcp::no_delay(members->noDelay));
+		members->connected = true;
+	}
+
+	size_t TCPClient::send(uint8_t* data, size_t length) {
+		ConstBuffer buffer = { data, length };
+		return send(&buffer, 1);
+	}
+
+	size_t TCPClient::send(const char* data) {
+		return send((uint8_t*)data, strlen(data));
+	}
+
+	size_t TCPClient::send(const std::string& data) {
+		return send((uint8_t*)data.c_str(), data.length());
+	}
+
+	size_t TCPClient::send(std::initializer_list<ConstBuffer> buffers) {
+		return send(buffers.begin(), buffers.size());
+	}
+
+	size_t TCPClient::send(const ConstBuffer* buffers, size_t count) {
+		size_t length = 0;
+		for (size_t i = 0; i < count; i++) {
+			length += buffers[i].size;
+		}
+		if (length > members->framing.maxMessageSize) {
+			throw std::runtime_error("Message exceeds the maximum message size of the framing");
+		}
+
+		std::lock_guard<std::mutex> guard(members->sendMutex);
+
+		try {
+			return sendFramed(buffers, count);
+		}
+		catch (std::exception& e) {
+			LOG_WARN("[TCPClient]: Send failed, reconnecting: {}", e.what());
+		}
+
+		// The connection broke, reuse fails once before the error is reported to the caller
+		try {
+			Connect();
+			return sendFramed(buffers, count);
+		}
+		catch (std::exception& e) {
+			members->connected = false;
+			throw std::runtime_error(std::string("ASIO Exception: ") + e.what());
+		}
+	}
+
+	size_t TCPClient::sendFramed(const ConstBuffer* buffers, size_t count) {
+		if (!members->connected) {
+			Connect();
+		}
+
+		uint8_t header[4];
+		size_t length = BuildFrame(members->framing, members->gather, header, buffers, count);
+		asio::write(members->socket, members->gather);
+		if (LOG_ENABLED(spdlog::level::debug)) {
+			LOG_DEBUG("[TCPClient]: Message of {} bytes sent to {}:{}", length,
+				members->remoteEndpoint.address().to_string(), members->remoteEndpoint.port());
+		}
+
+		return length;
+	}
+
+	bool TCPClient::ReceiveMessage(std::vector<uint8_t>& message) {
+		std::lock_guard<std::mutex> guard(members->receiveMutex);
+		if (!members->connected)
+			return false;
+
+		TCPReadBuffer& buffer = members->readBuffer;
+		while (true) {
+			uint8_t* data = nullptr;
+			size_t size = 0;
+			bool violation = false;
+
+			if (buffer.NextMessage(members->framing, data, size, violation)) {
+				message.assign(data, data + size);
+				return true;
+			}
+
+			if (violation) {
+				LOG_WARN("[TCPClient]: Framing violated by the server, closing the connection");
+				std::error_code error;
+				members->socket.shutdown(tcp::socket::shutdown_both, error);		// Closed by the next Connect()
+				members->connected = false;
+				return false;
+			}
+
+			std::error_code error;
+			size_t bytes = members->socket.read_some(buffer.Prepare(members->framing), error);
+			if (error) {
+				LOG_DEBUG("[TCPClient]: Connection closed: {}", error.message());
+				members->connected = false;
+				return false;
+			}
+			buffer.Commit(bytes);
+		}
+	}
+
+	std::optional<std::vector<uint8_t>> TCPClient::ReceiveMessage() {
+		std::vector<uint8_t> message;
+		if (!ReceiveMessage(message))
+			return std::nullopt;
+
+		return std::make_optional(std::move(message));
+	}
+
+	void TCPClient::SetNoDelay(bool enable) {
+		members->noDelay = enable;
+		if (members->connected) {
+			members->socket.set_option(tcp::no_delay(enable));
+		}
+	}
+
+	bool TCPClient::SetCork(bool enable) {
+		return members->connected && SetSocketCork(members->socket, enable);
+	}
+
+	bool TCPClient::IsConnected() {
+		return members->connected;
+	}
+
+
+
+
+
+
+
+	// =======================================
+	// ===      TCPServerAsync Class       ===
+	// =======================================
+
+	struct TCPSession : public std::enable_shared_from_this<TCPSession> {
+		TCPConnectionId id = 0;
+		tcp::socket socket;
+		std::string remoteHost;
+		uint16_t remotePort = 0;
+
+		TCPReadBuffer readBuffer;
+
+		// Guards the socket against the close and the queue. Bytes the socket did not take right away are
+		// queued and written by the listener thread, in order with everything sent after them.
+		std::mutex sendMutex;
+		std::vector<asio::const_buffer> gather;
+		std::vector<uint8_t> queued;
+		std::vector<uint8_t> writing;		// The queued bytes of the async_write in flight
+		bool writePending = false;
+		bool closed = false;
+
+		TCPSession(asio::io_service& ioService) : socket(ioService) {}
+	};
+
+	struct TCPServerAsyncMembers {
+
+		asio::io_service ioService;
+		tcp::acceptor acceptor;
+		asio::steady_timer acceptTimer;
+
+		std::atomic<bool> terminate = false;
+		std::thread listenerThread;
+		std::function<void(TCPConnectionId connection, uint8_t* message, size_t messageSize)> callback;
+		std::function<void(TCPConnectionId connection, uint8_t* message, size_t messageSize, const std::string& remoteHost, uint16_t remotePort)> callbackWithHost;
+		std::function<void(TCPConnectionId connection)> connectCallback;
+		std::function<void(TCPConnectionId connection)> disconnectCallback;
+
+		TCPFraming framing;
+		size_t bufferSize = 0;
+
+		std::mutex sessionMutex;
+		std::unordered_map<TCPConnectionId, std::shared_ptr<TCPSession>> sessions;
+		TCPConnectionId nextId = 1;
+
+		TCPServerAsyncMembers() : acceptor(ioService), acceptTimer(ioService) {}
+		~TCPServerAsyncMembers() = default;
+
+		std::shared_ptr<TCPSession> FindSession(TCPConnectionId id) {
+			std::lock_guard<std::mutex> guard(sessionMutex);
+			auto it = sessions.find(id);
+			return it != sessions.end() ? it->second : nullptr;
+		}
+
+		void CloseSession(const std::shared_ptr<TCPSession>& session) {
+			{
+				std::lock_guard<std::mutex> guard(sessionMutex);
+				if (sessions.erase(session->id) == 0)
+					return;
+			}
+
+			// A send on another thread may be writing to the socket, the descriptor must not be reused under it
+			{
+				std::lock_guard<std::mutex> guard(session->sendMutex);
+				session->closed = true;
+				std::error_code error;
+				session->socket.close(error);
+			}
+			LOG_DEBUG("[TCPServerAsync]: Connection {} from {}:{} closed", session->id, session->remoteHost, session->remotePort);
+
+			if (disconnectCallback) {
+				disconnectCallback(session->id);
+			}
+		}
+
+		void StartRead(const std::shared_ptr<TCPSession>& session) {
+			session->socket.async_read_some(session->readBuffer.Prepare(framing),
+				[this, session](const std::error_code& error, size_t bytes) {
+					OnRead(session, error, bytes);
+				});
+		}
+
+		void OnRead(const std::shared_ptr<TCPSession>& session, const std::error_code& error, size_t bytes) {
+			if (error) {
+				if (!terminate) {
+					CloseSession(session);
+				}
+				return;
+			}
+
+			session->readBuffer.Commit(bytes);
+
+			uint8_t* message = nullptr;
+			size_t messageSize = 0;
+			bool violation = false;
+			while (session->readBuffer.NextMessage(framing, message, messageSize, violation)) {
+				if (callback) {
+					callback(session->id, message, messageSize);
+				}
+				if (callbackWithHost) {
+					callbackWithHost(session->id, message, messageSize, session->remoteHost, session->remotePort);
+				}
+			}
+
+			if (violation) {
+				LOG_WARN("[TCPServerAsync]: Connection {} violated the framing, closing it", session->id);
+				CloseSession(session);
+				return;
+			}
+
+			StartRead(session);
+		}
+
+		// Writes the queued bytes, on the listener thread with the sendMutex held
+		void StartWrite(const std::shared_ptr<TCPSession>& session) {
+			session->writing.swap(session->queued);
+			session->queued.clear();
+			asio::async_write(session->socket, asio::buffer(session->writing),
+				[this, session](const std::error_code& error, size_t) {
+					OnWrite(session, error);
+				});
+		}
+
+		void OnWrite(const std::shared_ptr<TCPSession>& session, const std::error_code& error) {
+			if (error) {
+				if (!terminate) {
+					LOG_WARN("[TCPServerAsync]: Sending to connection {} failed: {}", session->id, error.message());
+					CloseSession(session);
+				}
+				return;
+			}
+
+			std::lock_guard<std::mutex> guard(session->sendMutex);
+			session->writing.clear();
+			if (session->queued.empty() || session->closed) {
+				session->writePending = false;
+				return;
+			}
+			StartWrite(session);
+		}
+	};
+
+	TCPServerAsync::TCPServerAsync(std::function<void(TCPConnectionId connection, uint8_t* message, size_t messageSize)> callback,
+		uint16_t port, TCPFraming framing, size_t bufferSize)
+		: members(new TCPServerAsyncMembers())
+	{
+		members->callback = callback;
+		Initialize(port, framing, bufferSize);
+	}
+
+	TCPServerAsync::TCPServerAsync(std::function<void(TCPConnectionId connection, uint8_t* message, size_t messageSize, const std::string& remoteHost, uint16_t remotePort)> callback,
+		uint16_t port, TCPFraming framing, size_t bufferSize)
+		: members(new TCPServerAsyncMembers())
+	{
+		members->callbackWithHost = callback;
+		Initialize(port, framing, bufferSize);
+	}
+
+	TCPServerAsync::~TCPServerAsync() {
+		LOG_DEBUG("[TCPServerAsync]: Terminating TCP listener");
+
+		// Stop the event loop first, the sockets are closed once no handler can run anymore
+		members->terminate = true;
+		members->ioService.stop();
+		members->listenerThread.join();
+
+		std::error_code error;
+		members->acceptor.close(error);
+		for (auto& [id, session] : members->sessions) {
+			std::lock_guard<std::mutex> guard(session->sendMutex);
+			session->closed = true;
+			session->socket.close(error);
+		}
+		members->sessions.clear();
+
+		LOG_DEBUG("[TCPServerAsync]: Instance destructed");
+	}
+
+	void TCPServerAsync::Initialize(uint16_t port, TCPFraming framing, size_t bufferSize) {
+		try {
+			LOG_DEBUG("[TCPServerAsync]: Creating TCP listener on port {} ...", port);
+
+			members->framing = framing;
+			members->bufferSize = std::max(bufferSize, (size_t)64);
+
+			tcp::endpoint endpoint(tcp::v4(), port);
+			members->acceptor.open(endpoint.protocol());
+			members->acceptor.set_option(tcp::acceptor::reuse_address(true));
+			members->acceptor.bind(endpoint);
+			members->acceptor.listen(asio::socket_base::max_listen_connections);
+
+			// Start the listener thread
+			members->listenerThread = std::thread(std::bind(&TCPServerAsync::ListenerThread, this));
+
+			LOG_DEBUG("[TCPServerAsync]: Instance constructed");
+		}
+		catch (std::exception& e) {
+			throw std::runtime_error(std::string("ASIO Exception: ") + e.what());
+		}
+	}
+
+	void TCPServerAsync::SetConnectCallback(std::function<void(TCPConnectionId connection)> callback) {
+		members->connectCallback = callback;
+	}
+
+	void TCPServerAsync::SetDisconnectCallback(std::function<void(TCPConnectionId connection)> callback) {
+		members->disconnectCallback = callback;
+	}
+
+	size_t TCPServerAsync::send(TCPConnectionId connection, uint8_t* data, size_t length) {
+		ConstBuffer buffer = { data, length };
+		return send(connection, &buffer, 1);
+	}
+
+	size_t TCPServerAsync::send(TCPConnectionId connection, const std::string& data) {
+		return send(connection, (uint8_t*)data.c_str(), data.length());
+	}
+
+	size_t TCPServerAsync::send(TCPConnectionId connection, std::initializer_list<ConstBuffer> buffers) {
+		return send(connection, buffers.begin(), buffers.size());
+	}
+
+	size_t TCPServerAsync::send(TCPConnectionId connection, const ConstBuffer* buffers, size_t count) {
+		auto session = members->FindSession(connection);
+		if (!session)
+			return 0;
+
+		std::lock_guard<std::mutex> guard(session->sendMutex);
+		if (session->closed)
+			return 0;
+
+		uint8_t header[4];
+		size_t length = BuildFrame(members->framing, session->gather, header, buffers, count);
+		if (length > members->framing.maxMessageSize) {
+			LOG_WARN("[TCPServerAsync]: Message of {} bytes exceeds the maximum message size", length);
+			return 0;
+		}
+
+		size_t frameSize = asio::buffer_size(session->gather);
+		if (session->queued.size() + frameSize > NETLIB_TCP_SEND_QUEUE_LIMIT) {
+			LOG_WARN("[TCPServerAsync]: Connection {} does not keep up, {} bytes queued", connection, session->queued.size());
+			return 0;
+		}
+
+		// The socket is non-blocking, the kernel takes what fits into the socket buffer in one vectored write
+		size_t written = 0;
+		if (!session->writePending) {
+			std::error_code error;
+			written = session->socket.write_some(session->gather, error);
+			if (error == asio::error::would_block || error == asio::error::try_again) {
+				written = 0;
+			}
+			else if (error) {
+				LOG_WARN("[TCPServerAsync]: Sending to connection {} failed: {}", connection, error.message());
+				return 0;
+			}
+		}
+		if (written == frameSize)
+			return length;
+
+		// Queue the rest of the frame
+		size_t skip = written;
+		for (const asio::const_buffer& buffer : session->gather) {
+			size_t size = buffer.size();
+			if (skip >= size) {
+				skip -= size;
+				continue;
+			}
+			const uint8_t* data = (const uint8_t*)buffer.data() + skip;
+			session->queued.insert(session->queued.end(), data, data + size - skip);
+			skip = 0;
+		}
+
+		if (!session->writePending) {
+			session->writePending = true;
+			TCPServerAsyncMembers* m = members.get();
+			asio::post(m->ioService, [m, session] {
+				std::lock_guard<std::mutex> guard(session->sendMutex);
+				if (session->closed) {
+					session->writePending = false;
+					return;
+				}
+				m->StartWrite(session);
+			});
+		}
+		return length;
+	}
+
+	void TCPServerAsync::Disconnect(TCPConnectionId connection) {
+		auto session = members->FindSession(connection);
+		if (!session)
+			return;
+
+		// Only shut the socket down, the pending read fails on the listener thread and removes the session
+		std::error_code error;
+		session->socket.shutdown(tcp::socket::shutdown_both, error);
+	}
+
+	size_t TCPServerAsync::GetConnectionCount() {
+		std::lock_guard<std::mutex> guard(members->sessionMutex);
+		return members->sessions.size();
+	}
+
+	void TCPServerAsync::SetNoDelay(TCPConnectionId connection, bool enable) {
+		auto session = members->FindSession(connection);
+		if (session) {
+			std::error_code error;
+			session->socket.set_option(tcp::no_delay(enable), error);
+		}
+	}
+
+	bool TCPServerAsync::SetCork(TCPConnectionId connection, bool enable) {
+		auto session = members->FindSession(connection);
+		return session && SetSocketCork(session->socket, enable);
+	}
+
+	std::string TCPServerAsync::GetLocalIP() {
+		return members->acceptor.local_endpoint().address().to_string();
+	}
+
+	uint16_t TCPServerAsync::GetLocalPort() {
+		return members->acceptor.local_endpoint().port();
+	}
+
+	void TCPServerAsync::StartAccept() {
+		auto session = std::make_shared<TCPSession>(members->ioService);
+
+		members->acceptor.async_accept(session->socket, [this, session](const std::error_code& error) {
+			if (error) {
+				if (members->terminate)		// Errors are ignored if thread is being terminated
+					return;
+
+				// Out of descriptors (EMFILE, ENFILE) fails every accept right away, wait for connections to close
+				LOG_WARN("[TCPServerAsync]: Accept failed, retrying in {} ms: {}", NETLIB_TCP_ACCEPT_RETRY_MS, error.message());
+				members->acceptTimer.expires_after(std::chrono::milliseconds(NETLIB_TCP_ACCEPT_RETRY_MS));
+				members->acceptTimer.async_wait([this](const std::error_code& timerError) {
+					if (!timerError && !members->terminate) {
+						StartAccept();
+					}
+				});
+				return;
+			}
+
+			std::error_code endpointError;
+			tcp::endpoint remote = session->socket.remote_endpoint(endpointError);
+			session->remoteHost = remote.address().to_string();
+			session->remotePort = remote.port();
+			session->readBuffer.Initialize(members->bufferSize);
+			session->socket.non_blocking(true, endpointError);
+
+			{
+				std::lock_guard<std::mutex> guard(members->sessionMutex);
+				session->id = members->nextId++;
+				members->sessions.emplace(session->id, session);
+			}
+			LOG_DEBUG("[TCPServerAsync]: Connection {} accepted from {}:{}", session->id, session->remoteHost, session->remotePort);
+
+			if (members->connectCallback) {
+				members->connectCallback(session->id);
+			}
+
+			members->StartRead(session);
+			StartAccept();
+		});
+	}
+
+	void TCPServerAsync::ListenerThread() {
+
+		LOG_DEBUG("[TCPServerAsync]: Listener thread started");
+
+		try {
+
+			// Start accepting once, every accepted connection re-arms it
+			StartAccept();
+
+			// Main loop in the listener thread
+			while (!members->terminate) {
+				members->ioService.run_one();
+			}
+
+		}
+		catch (std::exception& e) {
+			LOG_CRITICAL(std::string("ASIO TCP Exception from listener thread: ") + e.what());
+		}
+		catch (...) {
+			LOG_CRITICAL("[TCPServerAsync]: Unknown exception from listener thread!");
+		}
+
+		LOG_DEBUG("[TCPServerAsync]: Listener thread terminated");
+	}
+
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+// Private header: USDT probes of the "netlib" provider for perf, bpftrace and systemtap, e.g.
+//
+//     bpftrace -e 'usdt:./server:netlib:receive { @bytes = hist(arg1); }'
+//     perf probe -x ./server sdt_netlib:queue_drop && perf record -e sdt_netlib:queue_drop -a
+//
+// A probe is a single nop until a tracer attaches, so they stay in release builds. Only pass arguments that
+// are already at hand (lengths, descriptors, pointers): They are evaluated even while nobody traces.
+// Durations are the difference between the timestamps of a pair of probes, e.g. callback_entry and
+// callback_exit, measuring them here would read the clock on every call.
+// Without <sys/sdt.h> (systemtap-sdt-dev) or with NETLIB_NO_TRACEPOINTS, the probes compile to nothing.
+//
+// Probe							Arguments
+// socket_open, socket_close		fd, port (remote port of clients, local port of servers)
+// send								fd, length, sockaddr* of the destination, socklen
+// receive							fd (-1 for shared memory), length, IPv4 source (host order), source port
+// callback_entry					packet, length, IPv4 source (host order), source port
+// callback_exit					packet, length
+// listener_wakeup					fd, readable (0 = timer, shutdown or posted handler)
+// queue_enqueue					queue, depth after enqueue, length
+// queue_dequeue					queue, depth after dequeue, length
+// queue_drop						queue, length, remote ip (char*), remote port
+
+#if defined(__linux__) && !defined(NETLIB_NO_TRACEPOINTS) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define NETLIB_TRACEPOINTS
+#endif
+#endif
+
+#ifdef NETLIB_TRACEPOINTS
+#define TRACE_PROBE(name, ...)			STAP_PROBEV(netlib, name, __VA_ARGS__)
+#else
+#define TRACE_PROBE(name, ...)			{ ; }
+#endif
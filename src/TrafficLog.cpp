@@ -0,0 +1,439 @@
+
+#include "TrafficLog.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include <chrono>
+#include <thread>
+#include <cstring>
+
+#include "Logging.h"
+
+namespace NetLib {
+
+	// ==========================
+	// ===      Helpers       ===
+	// ==========================
+
+	static constexpr char TRAFFIC_LOG_MAGIC[8] = { 'N', 'L', 'T', 'R', 'A', 'F', 'F', 'C' };
+	static constexpr uint32_t TRAFFIC_LOG_VERSION = 1;
+
+	struct TrafficLogHeader {
+		char magic[8];
+		uint32_t version;
+		uint32_t headerSize;
+		uint64_t startTimeNs;			// System clock at the start of the recording, ns since epoch
+		uint64_t dataEnd;				// Offset behind the last complete record
+		uint64_t recordCount;
+		uint8_t reserved[24];
+	};
+
+	struct TrafficRecordHeader {
+		uint64_t timestampNs;
+		uint32_t length;
+		uint16_t sourcePort;
+		uint16_t reserved;
+		uint8_t source[16];
+	};
+
+	static_assert(sizeof(TrafficLogHeader) == 64);
+	static_assert(sizeof(TrafficRecordHeader) == 32);
+
+	static uint64_t RecordSize(size_t payloadLength) {
+		return (sizeof(TrafficRecordHeader) + payloadLength + 7) & ~(uint64_t)7;
+	}
+
+	class MappedFile {
+	public:
+		MappedFile() = default;
+		~MappedFile() { Close(); }
+
+		bool Create(const std::string& path, uint64_t size) {
+#ifdef _WIN32
+			handle = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+			if (handle == INVALID_HANDLE_VALUE)
+				return false;
+#else
+			fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+			if (fd < 0)
+				return false;
+#endif
+			writable = true;
+			return Resize(size);
+		}
+
+		bool Open(const std::string& path) {
+#ifdef _WIN32
+			handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+			if (handle == INVALID_HANDLE_VALUE)
+				return false;
+			LARGE_INTEGER fileSize;
+			if (!GetFileSizeEx(handle, &fileSize))
+				return false;
+			size = (uint64_t)fileSize.QuadPart;
+#else
+			fd = ::open(path.c_str(), O_RDONLY);
+			if (fd < 0)
+				return false;
+			struct stat info;
+			if (fstat(fd, &info) != 0)
+				return false;
+			size = (uint64_t)info.st_size;
+#endif
+			writable = false;
+			return size > 0 && Map();
+		}
+
+		// Grows or shrinks the file and maps it again, previous pointers into the mapping become invalid
+		bool Resize(uint64_t newSize) {
+			Unmap();
+#ifdef _WIN32
+			LARGE_INTEGER position;
+			position.QuadPart = (LONGLONG)newSize;
+			if (!SetFilePointerEx(handle, position, nullptr, FILE_BEGIN) || !SetEndOfFile(handle))
+				return false;
+#else
+			if (ftruncate(fd, (off_t)newSize) != 0)
+				return false;
+#endif
+			size = newSize;
+			return size == 0 || Map();
+		}
+
+		void Sync() {
+			if (data == nullptr)
+				return;
+#ifdef _WIN32
+			FlushViewOfFile(data, 0);
+#else
+			msync(data, size, MS_ASYNC);
+#endif
+		}
+
+		void Close() {
+			Unmap();
+#ifdef _WIN32
+			if (handle != INVALID_HANDLE_VALUE) {
+				CloseHandle(handle);
+				handle = INVALID_HANDLE_VALUE;
+			}
+#else
+			if (fd >= 0) {
+				::close(fd);
+				fd = -1;
+			}
+#endif
+		}
+
+		uint8_t* data = nullptr;
+		uint64_t size = 0;
+
+	private:
+		bool Map() {
+#ifdef _WIN32
+			mapping = CreateFileMappingA(handle, nullptr, writable ? PAGE_READWRITE : PAGE_READONLY, 0, 0, nullptr);
+			if (mapping == nullptr)
+				return false;
+			data = (uint8_t*)MapViewOfFile(mapping, writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, 0);
+#else
+			void* address = mmap(nullptr, size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+			data = address == MAP_FAILED ? nullptr : (uint8_t*)address;
+#endif
+			return data != nullptr;
+		}
+
+		void Unmap() {
+#ifdef _WIN32
+			if (data != nullptr) {
+				UnmapViewOfFile(data);
+			}
+			if (mapping != nullptr) {
+				CloseHandle(mapping);
+				mapping = nullptr;
+			}
+#else
+			if (data != nullptr) {
+				munmap(data, size);
+			}
+#endif
+			data = nullptr;
+		}
+
+#ifdef _WIN32
+		HANDLE handle = INVALID_HANDLE_VALUE;
+		HANDLE mapping = nullptr;
+#else
+		int fd = -1;
+#endif
+		bool writable = false;
+	};
+
+	static int64_t SteadyNowNs() {
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+
+
+
+
+
+
+	// ========================================
+	// ===      TrafficRecorder Class       ===
+	// ========================================
+
+	struct TrafficRecorderMembers {
+		MappedFile file;
+		std::mutex mutex;
+		uint64_t maxFileSize = 0;
+		int64_t startNs = 0;
+		uint64_t dropped = 0;
+
+		TrafficLogHeader* Header() { return (TrafficLogHeader*)file.data; }
+	};
+
+	TrafficRecorder::TrafficRecorder(const std::string& filename, uint64_t maxFileSize) : members(new TrafficRecorderMembers()) {
+		members->maxFileSize = maxFileSize;
+
+		uint64_t initialSize = NETLIB_TRAFFIC_LOG_GROW_SIZE;
+		if (maxFileSize > 0) {
+			initialSize = std::min(initialSize, std::max<uint64_t>(maxFileSize, sizeof(TrafficLogHeader)));
+		}
+
+		if (!members->file.Create(filename, initialSize)) {
+			throw std::runtime_error("Failed to create traffic log '" + filename + "'");
+		}
+
+		TrafficLogHeader* header = members->Header();
+		memset(header, 0, sizeof(TrafficLogHeader));
+		memcpy(header->magic, TRAFFIC_LOG_MAGIC, sizeof(header->magic));
+		header->version = TRAFFIC_LOG_VERSION;
+		header->headerSize = sizeof(TrafficLogHeader);
+		header->startTimeNs = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::system_clock::now().time_since_epoch()).count();
+		header->dataEnd = sizeof(TrafficLogHeader);
+		members->startNs = SteadyNowNs();
+
+		LOG_DEBUG("[TrafficRecorder]: Recording to '{}'", filename);
+	}
+
+	TrafficRecorder::~TrafficRecorder() {
+		std::lock_guard<std::mutex> lock(members->mutex);
+
+		// Cut off the unused part of the last growth step
+		uint64_t dataEnd = members->Header()->dataEnd;
+		uint64_t records = members->Header()->recordCount;
+		members->file.Resize(dataEnd);
+		members->file.Close();
+
+		LOG_DEBUG("[TrafficRecorder]: Recorded {} packets, {} dropped", records, members->dropped);
+	}
+
+	bool TrafficRecorder::Record(const uint8_t* data, size_t length, IPv4Address source, uint16_t sourcePort) {
+		return Record(data, length, IPv6Address::FromV4Mapped(source), sourcePort);
+	}
+
+	bool TrafficRecorder::Record(const uint8_t* data, size_t length, const IPv6Address& source, uint16_t sourcePort) {
+		int64_t now = SteadyNowNs();
+		std::lock_guard<std::mutex> lock(members->mutex);
+
+		if (members->file.data == nullptr || length > UINT32_MAX) {
+			members->dropped++;
+			return false;
+		}
+
+		uint64_t offset = members->Header()->dataEnd;
+		uint64_t end = offset + RecordSize(length);
+
+		if (members->maxFileSize > 0 && end > members->maxFileSize) {
+			members->dropped++;
+			return false;
+		}
+
+		if (end > members->file.size) {
+			uint64_t newSize = members->file.size + std::max<uint64_t>(NETLIB_TRAFFIC_LOG_GROW_SIZE, end - members->file.size);
+			if (members->maxFileSize > 0) {
+				newSize = std::min(newSize, members->maxFileSize);
+			}
+			if (!members->file.Resize(newSize)) {
+				LOG_ERROR("[TrafficRecorder]: Failed to grow the traffic log to {} bytes", newSize);
+				members->dropped++;
+				return false;
+			}
+		}
+
+		TrafficRecordHeader record = {};
+		record.timestampNs = (uint64_t)(now - members->startNs);
+		record.length = (uint32_t)length;
+		record.sourcePort = sourcePort;
+		memcpy(record.source, source.ToBytes().data(), sizeof(record.source));
+
+		memcpy(members->file.data + offset, &record, sizeof(record));
+		if (length > 0) {
+			memcpy(members->file.data + offset + sizeof(record), data, length);
+		}
+
+		// The header is updated last, a log of a crashed process ends at the last complete record
+		members->Header()->recordCount++;
+		members->Header()->dataEnd = end;
+		return true;
+	}
+
+	void TrafficRecorder::Flush() {
+		std::lock_guard<std::mutex> lock(members->mutex);
+		members->file.Sync();
+	}
+
+	uint64_t TrafficRecorder::GetRecordCount() {
+		std::lock_guard<std::mutex> lock(members->mutex);
+		return members->file.data != nullptr ? members->Header()->recordCount : 0;
+	}
+
+	uint64_t TrafficRecorder::GetDroppedCount() {
+		std::lock_guard<std::mutex> lock(members->mutex);
+		return members->dropped;
+	}
+
+
+
+
+
+
+
+	// ========================================
+	// ===      TrafficReplayer Class       ===
+	// ========================================
+
+	struct TrafficReplayerMembers {
+		MappedFile file;
+		uint64_t dataStart = 0;
+		uint64_t dataEnd = 0;
+		uint64_t recordCount = 0;
+		uint64_t durationNs = 0;
+		uint64_t position = 0;
+		std::vector<uint8_t> scratch;
+	};
+
+	TrafficReplayer::TrafficReplayer(const std::string& filename) : members(new TrafficReplayerMembers()) {
+		if (!members->file.Open(filename) || members->file.size < sizeof(TrafficLogHeader)) {
+			throw std::runtime_error("Failed to open traffic log '" + filename + "'");
+		}
+
+		TrafficLogHeader header;
+		memcpy(&header, members->file.data, sizeof(header));
+		if (memcmp(header.magic, TRAFFIC_LOG_MAGIC, sizeof(header.magic)) != 0 || header.version != TRAFFIC_LOG_VERSION) {
+			throw std::runtime_error("'" + filename + "' is not a traffic log");
+		}
+
+		members->dataEnd = std::min<uint64_t>(header.dataEnd, members->file.size);
+		if (header.headerSize < sizeof(TrafficLogHeader) || header.headerSize > members->dataEnd) {
+			throw std::runtime_error("'" + filename + "' is not a traffic log");
+		}
+		members->dataStart = header.headerSize;
+		members->position = members->dataStart;
+
+		// Validate the records once, Next() can then trust the lengths
+		RecordedPacket packet;
+		while (Next(packet)) {
+			members->recordCount++;
+			members->durationNs = packet.timestampNs;
+		}
+		Rewind();
+
+		if (members->recordCount != header.recordCount) {
+			LOG_WARN("[TrafficReplayer]: '{}' announces {} records but contains {}", filename, header.recordCount, members->recordCount);
+		}
+	}
+
+	TrafficReplayer::~TrafficReplayer() {
+		members->file.Close();
+	}
+
+	uint64_t TrafficReplayer::GetPacketCount() {
+		return members->recordCount;
+	}
+
+	uint64_t TrafficReplayer::GetDurationNs() {
+		return members->durationNs;
+	}
+
+	bool TrafficReplayer::Next(RecordedPacket& packet) {
+		uint64_t offset = members->position;
+		if (offset + sizeof(TrafficRecordHeader) > members->dataEnd)
+			return false;
+
+		TrafficRecordHeader record;
+		memcpy(&record, members->file.data + offset, sizeof(record));
+
+		uint64_t end = offset + RecordSize(record.length);
+		if (end > members->dataEnd) {
+			members->dataEnd = offset;		// Truncated record, the log ends here
+			return false;
+		}
+
+		IPv6Address::Bytes source;
+		memcpy(source.data(), record.source, source.size());
+
+		packet.timestampNs = record.timestampNs;
+		packet.data = members->file.data + offset + sizeof(record);
+		packet.length = record.length;
+		packet.source = IPv6Address(source);
+		packet.sourcePort = record.sourcePort;
+
+		members->position = end;
+		return true;
+	}
+
+	void TrafficReplayer::Rewind() {
+		members->position = members->dataStart;
+	}
+
+	// Walks the log from the start and calls 'sendPacket' at the recorded point in time, scaled by the speed
+	template<typename F>
+	static uint64_t ReplayTimed(TrafficReplayer& replayer, const ReplayOptions& options, F&& sendPacket) {
+		replayer.Rewind();
+
+		auto start = std::chrono::steady_clock::now();
+		uint64_t count = 0;
+		RecordedPacket packet;
+
+		while (replayer.Next(packet)) {
+			if (options.speed > 0) {
+				auto offset = std::chrono::nanoseconds((int64_t)((double)packet.timestampNs / options.speed));
+				std::this_thread::sleep_until(start + offset);
+			}
+			sendPacket(packet);
+			count++;
+		}
+
+		replayer.Rewind();
+		return count;
+	}
+
+	uint64_t TrafficReplayer::Replay(std::function<void(uint8_t* packet, size_t packetSize, IPv4Address source, uint16_t sourcePort)> callback,
+		const ReplayOptions& options)
+	{
+		std::vector<uint8_t>& scratch = members->scratch;
+		return ReplayTimed(*this, options, [&](const RecordedPacket& packet) {
+			scratch.assign(packet.data, packet.data + packet.length);
+			IPv4Address source = packet.source.IsV4Mapped() ? packet.source.ToV4() : IPv4Address();
+			callback(scratch.data(), packet.length, source, packet.sourcePort);
+		});
+	}
+
+	uint64_t TrafficReplayer::ReplayTo(UDPClient& client, const ReplayOptions& options) {
+		std::vector<uint8_t>& scratch = members->scratch;
+		return ReplayTimed(*this, options, [&](const RecordedPacket& packet) {
+			scratch.assign(packet.data, packet.data + packet.length);
+			client.send(scratch.data(), packet.length);
+		});
+	}
+
+}
@@ -0,0 +1,1768 @@
+
+// netlib-loadgen: Sends sequenced, timestamped datagrams through NetLib and analyzes what arrives.
+//
+//   netlib-loadgen send     --target 127.0.0.1:9000 [--target ...] [--rate 100000] [--size 64-1400] [--threads 4]
+//                           [--duration 10] [--api client|shared|sharded|sendudp] [--shared-memory on]
+//   netlib-loadgen receive  --port 9000 [--server async|buffered|blocking|pipeline] [--duration 10] [--shared-memory on]
+//   netlib-loadgen loopback --port 9000 [all options of send and receive]
+//   netlib-loadgen alloc-check --port 9000 [--size 512]
+//   netlib-loadgen fec-check   --port 9000
+//   netlib-loadgen fec-bench   [--size 1400] [--duration 1]
+//   netlib-loadgen resolve-check --port 9000
+//   netlib-loadgen rpc-bench   --port 9000 [--size 64] [--duration 5]
+//   netlib-loadgen gather-check --port 9000
+//   netlib-loadgen http-check  --port 9000
+//
+// alloc-check needs a library built with NETLIB_COUNT_ALLOCATIONS. It verifies that every server class receives
+// without heap allocations once warmed up, and exits with 1 otherwise.
+// fec-check decodes every recoverable erasure pattern with each FEC kernel, then drops datagrams between a
+// FecSender and a FecReceiver on loopback and verifies that all of them are recovered. Exits with 1 on failure.
+// resolve-check resolves "localhost" through SendUDP(), then runs a Resolver against a stub name server on the
+// given port (and the next one, which must stay silent), and sends to an expiring name on the port after those.
+// It needs no network access.
+// rpc-bench checks the RpcClient against an RpcServer on the given port and a lossy stub server on the next one,
+// then measures the request rate with 1, 64 and 1024 requests in flight. Exits with 1 if a check fails.
+// gather-check sends datagrams gathered from several buffers to a UDPServerBlocking on the given port and
+// scatters them back into separate buffers, including short, oversized and too many buffers.
+// http-check runs the HttpClient against a stub HTTP server on the given port: keep-alive reuse, redirects and
+// their limit, parallel range downloads, servers that ignore or misanswer ranges and the progress totals.
+//
+// One-way latency uses the system clock of both hosts, across machines it is only as good as their clock sync.
+
+#include "NetLib.h"
+#include "TokenBucket.h"
+#include "AllocationCounter.h"
+#include "Fec.h"
+#include "Resolver.h"
+#include "Rpc.h"
+#include "PacketPipeline.h"
+#include "Http.h"
+
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <unordered_map>
+#include <bitset>
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#endif
+
+using namespace NetLib;
+
+static constexpr uint32_t LOADGEN_MAGIC = 0x4E4C4C47;		// "NLLG"
+
+struct LoadgenHeader {
+	uint32_t magic;
+	uint32_t stream;			// One stream per sender thread
+	uint64_t sequence;
+	int64_t sendTimeNs;			// System clock, ns since epoch
+};
+
+struct Target {
+	std::string host;
+	uint16_t port = 0;
+};
+
+struct SizeBucket {
+	size_t min = 0;
+	size_t max = 0;
+	double weight = 1;
+};
+
+struct Options {
+	std::string mode;
+	std::vector<Target> targets;
+	uint64_t rate = 0;							// Packets per second over all threads, 0 = unlimited
+	std::vector<SizeBucket> sizes = { { 64, 64, 1 } };
+	size_t threads = 1;
+	double duration = 5;
+	std::string api = "client";
+	uint16_t port = 9000;
+	std::string server = "async";
+	bool sharedMemory = false;
+};
+
+static int64_t WallNowNs() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+static int64_t SteadyNowNs() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+
+
+
+
+
+// =================================
+// ===      Argument parsing     ===
+// =================================
+
+static void PrintUsage() {
+	printf(
+		"Usage: netlib-loadgen <send|receive|loopback|alloc-check|fec-check|fec-bench|resolve-check|rpc-bench|gather-check|http-check> [options]\n"
+		"\n"
+		"Sender options:\n"
+		"  --target HOST:PORT     Destination, may be given multiple times (default: 127.0.0.1:<port>)\n"
+		"  --rate PPS             Total packets per second, 0 = as fast as possible (default: 0)\n"
+		"  --size SPEC            N, MIN-MAX (uniform) or N:WEIGHT,N:WEIGHT,... (default: 64)\n"
+		"  --threads N            Sender threads, each thread is one sequenced stream (default: 1)\n"
+		"  --api client|shared|sharded|sendudp\n"
+		"                         A UDPClient per thread, one UDPClient for all threads, one with EnableMultiProducer()\n"
+		"                         or one SendUDP() call per packet (default: client)\n"
+		"\n"
+		"Receiver options:\n"
+		"  --port PORT            Listening port (default: 9000)\n"
+		"  --server async|buffered|blocking|pipeline\n"
+		"                         UDPServerAsync, UDPServer, UDPServerBlocking or a UDPPipelineServer (default: async)\n"
+		"\n"
+		"Common:\n"
+		"  --duration SECONDS     Run time (default: 5)\n"
+		"  --shared-memory on     Same-host fast path between UDPClient and the async or buffered server\n");
+}
+
+static bool ParseSizes(const std::string& spec, std::vector<SizeBucket>& sizes) {
+	sizes.clear();
+	size_t pos = 0;
+	while (pos <= spec.size()) {
+		size_t end = spec.find(',', pos);
+		std::string item = spec.substr(pos, end == std::string::npos ? std::string::npos : end - pos);
+
+		SizeBucket bucket;
+		size_t colon = item.find(':');
+		if (colon != std::string::npos) {
+			bucket.weight = atof(item.c_str() + colon + 1);
+			item = item.substr(0, colon);
+		}
+		size_t dash = item.find('-');
+		bucket.min = (size_t)strtoull(item.c_str(), nullptr, 10);
+		bucket.max = dash != std::string::npos ? (size_t)strtoull(item.c_str() + dash + 1, nullptr, 10) : bucket.min;
+
+		bucket.min = std::max(bucket.min, sizeof(LoadgenHeader));
+		if (bucket.max < bucket.min || bucket.max > 65507 || bucket.weight <= 0)
+			return false;
+		sizes.push_back(bucket);
+
+		if (end == std::string::npos)
+			break;
+		pos = end + 1;
+	}
+	return !sizes.empty();
+}
+
+static bool ParseArguments(int argc, char** argv, Options& options) {
+	if (argc < 2)
+		return false;
+
+	options.mode = argv[1];
+	if (options.mode != "send" && options.mode != "receive" && options.mode != "loopback" && options.mode != "alloc-check" &&
+		options.mode != "fec-check" && options.mode != "fec-bench" && options.mode != "resolve-check" &&
+		options.mode != "rpc-bench" && options.mode != "gather-check" &&
+		options.mode != "http-check")
+		return false;
+
+	for (int i = 2; i < argc; i++) {
+		std::string arg = argv[i];
+		if (i + 1 >= argc)
+			return false;
+		std::string value = argv[++i];
+
+		if (arg == "--target") {
+			size_t colon = value.rfind(':');
+			if (colon == std::string::npos)
+				return false;
+			options.targets.push_back({ value.substr(0, colon), (uint16_t)atoi(value.c_str() + colon + 1) });
+		}
+		else if (arg == "--rate") options.rate = strtoull(value.c_str(), nullptr, 10);
+		else if (arg == "--size") { if (!ParseSizes(value, options.sizes)) return false; }
+		else if (arg == "--threads") options.threads = std::max<size_t>(1, (size_t)atoi(value.c_str()));
+		else if (arg == "--duration") options.duration = atof(value.c_str());
+		else if (arg == "--api") options.api = value;
+		else if (arg == "--port") options.port = (uint16_t)atoi(value.c_str());
+		else if (arg == "--server") options.server = value;
+		else if (arg == "--shared-memory") options.sharedMemory = (value == "on");
+		else return false;
+	}
+
+	if (options.targets.empty()) {
+		options.targets.push_back({ "127.0.0.1", options.port });
+	}
+	return (options.api == "client" || options.api == "shared" || options.api == "sharded" || options.api == "sendudp") &&
+		(options.server == "async" || options.server == "buffered" || options.server == "blocking" || options.server == "pipeline");
+}
+
+
+
+
+
+
+
+// =======================
+// ===      Sender     ===
+// =======================
+
+struct SenderResult {
+	uint64_t packets = 0;
+	uint64_t bytes = 0;
+	uint64_t failures = 0;
+};
+
+// 'sharedClients' are used by all threads with --api shared and sharded, one per target
+static void SenderThread(const Options& options, uint32_t stream, std::atomic<bool>& stop, SenderResult& result,
+	const std::vector<std::unique_ptr<UDPClient>>& sharedClients)
+{
+	std::mt19937_64 random(stream);
+	std::vector<double> weights;
+	for (const SizeBucket& bucket : options.sizes) {
+		weights.push_back(bucket.weight);
+	}
+	std::discrete_distribution<size_t> pickBucket(weights.begin(), weights.end());
+
+	size_t maxSize = 0;
+	for (const SizeBucket& bucket : options.sizes) {
+		maxSize = std::max(maxSize, bucket.max);
+	}
+	std::vector<uint8_t> buffer(maxSize, 0xA5);
+
+	double threadRate = (double)options.rate / (double)options.threads;
+
+	std::vector<std::unique_ptr<UDPClient>> clients;
+	if (options.api == "client") {
+		for (const Target& target : options.targets) {
+			clients.push_back(std::make_unique<UDPClient>(target.host, target.port));
+			if (options.sharedMemory && !clients.back()->EnableSharedMemory()) {
+				fprintf(stderr, "No shared-memory receiver at %s:%u, sending UDP\n", target.host.c_str(), target.port);
+			}
+			if (threadRate > 0) {
+				PacingOptions pacing;
+				pacing.packetsPerSecond = (uint64_t)std::max(1.0, threadRate / (double)options.targets.size());
+				clients.back()->SetPacing(pacing);
+			}
+		}
+	}
+
+	// SendUDP() has no pacing of its own
+	TokenBucket bucket(threadRate, 1, SteadyNowNs());
+
+	for (uint64_t sequence = 0; !stop; sequence++) {
+		const SizeBucket& sizeBucket = options.sizes[pickBucket(random)];
+		size_t size = sizeBucket.min;
+		if (sizeBucket.max > sizeBucket.min) {
+			size += (size_t)(random() % (sizeBucket.max - sizeBucket.min + 1));
+		}
+
+		size_t targetIndex = (size_t)(sequence % options.targets.size());
+		LoadgenHeader header = { LOADGEN_MAGIC, stream, sequence, WallNowNs() };
+		memcpy(buffer.data(), &header, sizeof(header));
+
+		bool sent = false;
+		if (options.api == "client") {
+			sent = clients[targetIndex]->send(buffer.data(), size) == size;
+		}
+		else if (!sharedClients.empty()) {
+			sent = sharedClients[targetIndex]->send(buffer.data(), size) == size;
+		}
+		else {
+			if (threadRate > 0) {
+				int64_t departure = bucket.Schedule(1, SteadyNowNs());
+				int64_t wait = departure - SteadyNowNs();
+				if (wait > 0) {
+					std::this_thread::sleep_for(std::chrono::nanoseconds(wait));
+				}
+			}
+			const Target& target = options.targets[targetIndex];
+			sent = SendUDP(target.host, target.port, buffer.data(), size);
+		}
+
+		if (sent) {
+			result.packets++;
+			result.bytes += size;
+		}
+		else {
+			result.failures++;
+		}
+	}
+}
+
+static void RunSenders(const Options& options, std::vector<SenderResult>& results) {
+	std::atomic<bool> stop = false;
+	std::vector<std::thread> threads;
+	results.assign(options.threads, SenderResult());
+
+	std::vector<std::unique_ptr<UDPClient>> sharedClients;
+	if (options.api == "shared" || options.api == "sharded") {
+		for (const Target& target : options.targets) {
+			sharedClients.push_back(std::make_unique<UDPClient>(target.host, target.port));
+			if (options.api == "sharded") {
+				MultiProducerOptions sharding;
+				sharding.shards = options.threads;
+				sharedClients.back()->EnableMultiProducer(sharding);
+			}
+			if (options.rate > 0) {
+				PacingOptions pacing;
+				pacing.packetsPerSecond = std::max<uint64_t>(1, options.rate / options.targets.size());
+				sharedClients.back()->SetPacing(pacing);
+			}
+		}
+	}
+
+	uint32_t firstStream = std::random_device()();
+	for (size_t i = 0; i < options.threads; i++) {
+		threads.emplace_back(SenderThread, std::cref(options), firstStream + (uint32_t)i, std::ref(stop), std::ref(results[i]),
+			std::cref(sharedClients));
+	}
+
+	std::this_thread::sleep_for(std::chrono::duration<double>(options.duration));
+	stop = true;
+	for (std::thread& thread : threads) {
+		thread.join();
+	}
+
+	for (auto& client : sharedClients) {
+		MultiProducerStatistics statistics = client->GetMultiProducerStatistics();
+		if (statistics.shards > 0) {
+			printf("Shards:      %zu, %llu datagrams, busiest shard %llu, %llu errors\n", statistics.shards,
+				(unsigned long long)statistics.datagrams, (unsigned long long)statistics.busiestShard, (unsigned long long)statistics.errors);
+		}
+	}
+}
+
+static void PrintSenderReport(const Options& options, const std::vector<SenderResult>& results) {
+	SenderResult total;
+	for (const SenderResult& result : results) {
+		total.packets += result.packets;
+		total.bytes += result.bytes;
+		total.failures += result.failures;
+	}
+
+	printf("Sent:        %llu packets, %llu bytes, %llu failed sends\n",
+		(unsigned long long)total.packets, (unsigned long long)total.bytes, (unsigned long long)total.failures);
+	printf("Send rate:   %.0f pps, %.2f Mbit/s\n",
+		(double)total.packets / options.duration, (double)total.bytes * 8 / options.duration / 1e6);
+}
+
+
+
+
+
+
+
+// =========================
+// ===      Receiver     ===
+// =========================
+
+class Analyzer {
+public:
+	void OnPacket(const uint8_t* data, size_t length) {
+		int64_t now = WallNowNs();
+		LoadgenHeader header;
+		if (length < sizeof(header)) {
+			invalid++;
+			return;
+		}
+		memcpy(&header, data, sizeof(header));
+		if (header.magic != LOADGEN_MAGIC) {
+			invalid++;
+			return;
+		}
+
+		packets++;
+		bytes += length;
+
+		Stream& stream = streams[header.stream];
+		if (header.sequence >= MAX_TRACKED_SEQUENCE) {
+			untracked++;
+			return;
+		}
+
+		size_t word = (size_t)(header.sequence / 64);
+		uint64_t bit = 1ull << (header.sequence % 64);
+		if (word >= stream.seen.size()) {
+			stream.seen.resize(std::max(word + 1, stream.seen.size() * 2), 0);
+		}
+		if (stream.seen[word] & bit) {
+			duplicates++;
+			return;
+		}
+		stream.seen[word] |= bit;
+		stream.unique++;
+
+		if (stream.unique > 1 && header.sequence < stream.highest) {
+			reordered++;
+		}
+		stream.highest = std::max(stream.highest, header.sequence);
+
+		latencies.push_back(now - header.sendTimeNs);
+	}
+
+	void PrintReport(double duration) {
+		uint64_t expected = 0;
+		uint64_t unique = 0;
+		for (const auto& [id, stream] : streams) {
+			expected += stream.highest + 1;
+			unique += stream.unique;
+		}
+		uint64_t lost = expected - unique;
+
+		printf("Received:    %llu packets, %llu bytes in %zu streams\n",
+			(unsigned long long)packets.load(), (unsigned long long)bytes.load(), streams.size());
+		printf("Throughput:  %.0f pps, %.2f Mbit/s\n", (double)packets / duration, (double)bytes * 8 / duration / 1e6);
+		printf("Lost:        %llu (%.3f%%)\n", (unsigned long long)lost, expected > 0 ? 100.0 * (double)lost / (double)expected : 0.0);
+		printf("Reordered:   %llu\n", (unsigned long long)reordered);
+		printf("Duplicates:  %llu\n", (unsigned long long)duplicates);
+		if (invalid > 0 || untracked > 0) {
+			printf("Ignored:     %llu foreign, %llu beyond the tracking window\n", (unsigned long long)invalid, (unsigned long long)untracked);
+		}
+
+		if (!latencies.empty()) {
+			std::sort(latencies.begin(), latencies.end());
+			auto percentile = [&](double p) {
+				size_t index = std::min(latencies.size() - 1, (size_t)(p / 100.0 * (double)latencies.size()));
+				return (double)latencies[index] / 1000.0;
+			};
+			printf("Latency us:  p50 %.1f  p90 %.1f  p99 %.1f  p99.9 %.1f  max %.1f\n",
+				percentile(50), percentile(90), percentile(99), percentile(99.9), (double)latencies.back() / 1000.0);
+		}
+	}
+
+	std::atomic<uint64_t> packets = 0;
+	std::atomic<uint64_t> bytes = 0;
+
+private:
+	static constexpr uint64_t MAX_TRACKED_SEQUENCE = 1ull << 32;
+
+	struct Stream {
+		std::vector<uint64_t> seen;			// Bitmap of received sequence numbers
+		uint64_t highest = 0;
+		uint64_t unique = 0;
+	};
+
+	std::unordered_map<uint32_t, Stream> streams;
+	std::vector<int64_t> latencies;
+	uint64_t reordered = 0;
+	uint64_t duplicates = 0;
+	uint64_t invalid = 0;
+	uint64_t untracked = 0;
+};
+
+// Receives until 'stop' is set. Every server class is driven the way an application would use it.
+static void RunReceiver(const Options& options, Analyzer& analyzer, std::atomic<bool>& stop, std::atomic<bool>& ready) {
+	size_t bufferSize = 65536;
+
+	if (options.server == "async") {
+		UDPServerAsync server([&](uint8_t* packet, size_t packetSize) {
+			analyzer.OnPacket(packet, packetSize);
+		}, options.port, bufferSize);
+		if (options.sharedMemory) {
+			server.EnableSharedMemory();
+		}
+		ready = true;
+		while (!stop) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		}
+	}
+	else if (options.server == "pipeline") {
+		// Foreign datagrams are dropped by the first stage, so they don't show up in the report
+		PacketPipeline pipeline;
+		pipeline.AddStage("parse", [](PacketBatch& batch) {
+			for (size_t i = 0; i < batch.Size(); i++) {
+				uint32_t magic = 0;
+				if (batch.Length(i) >= sizeof(LoadgenHeader)) {
+					memcpy(&magic, batch.Data(i), sizeof(magic));
+				}
+				if (magic != LOADGEN_MAGIC) {
+					batch.Drop(i);
+				}
+			}
+		});
+		pipeline.AddStage("analyze", [&](PacketBatch& batch) {
+			for (size_t i = 0; i < batch.Size(); i++) {
+				analyzer.OnPacket(batch.Data(i), batch.Length(i));
+			}
+		});
+
+		PipelineOptions pipelineOptions;
+		pipelineOptions.bufferSize = bufferSize;
+		UDPPipelineServer server(pipeline, options.port, pipelineOptions);
+		if (options.sharedMemory) {
+			server.EnableSharedMemory();
+		}
+		ready = true;
+		while (!stop) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		}
+
+		for (const PipelineStageStatistics& stage : pipeline.GetStatistics()) {
+			printf("Stage %-8s %llu batches, %.1f datagrams per batch, %llu dropped\n", stage.name.c_str(), (unsigned long long)stage.batches,
+				stage.batches > 0 ? (double)stage.packets / (double)stage.batches : 0.0, (unsigned long long)stage.dropped);
+		}
+	}
+	else if (options.server == "buffered") {
+		UDPServer server(options.port, bufferSize);
+		if (options.sharedMemory) {
+			server.EnableSharedMemory();
+		}
+		ready = true;
+		while (!stop) {
+			auto packet = server.ReceivePacket();
+			if (packet) {
+				analyzer.OnPacket(packet->data.data(), packet->data.size());
+			}
+			else {
+				std::this_thread::yield();
+			}
+		}
+	}
+	else {
+		UDPServerBlocking server(options.port, bufferSize);
+		ready = true;
+		while (!stop) {
+			auto packet = server.ReceivePacket();
+			if (packet && !stop) {
+				analyzer.OnPacket(packet->data(), packet->size());
+			}
+		}
+	}
+}
+
+static void WakeBlockingReceiver(const Options& options) {
+	if (options.server == "blocking") {
+		SendUDP("127.0.0.1", options.port, "stop");
+	}
+}
+
+
+
+
+
+
+
+// ===================================
+// ===      Allocation check       ===
+// ===================================
+
+static constexpr uint64_t ALLOC_CHECK_WARMUP_PACKETS = 2000;
+static constexpr uint64_t ALLOC_CHECK_PACKETS = 20000;
+
+// Sends 'count' packets and waits until the receiver has seen them or stopped making progress
+static void SendAndDrain(UDPClient& client, std::vector<uint8_t>& buffer, uint64_t count, std::atomic<uint64_t>& received) {
+	uint64_t target = received + count;
+	for (uint64_t i = 0; i < count; i++) {
+		client.send(buffer.data(), buffer.size());
+		if (i % 64 == 63) {
+			std::this_thread::sleep_for(std::chrono::microseconds(200));		// Stay below the socket buffer
+		}
+	}
+
+	uint64_t last = 0;
+	while (received < target && received != last) {
+		last = received;
+		std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	}
+}
+
+static bool CheckServer(const Options& options, const std::string& server) {
+	std::atomic<uint64_t> received = 0;
+	std::atomic<bool> stop = false;
+	std::thread consumer;
+
+	std::unique_ptr<UDPServerAsync> asyncServer;
+	std::unique_ptr<UDPServer> bufferedServer;
+	std::unique_ptr<UDPServerBlocking> blockingServer;
+
+	if (server == "async") {
+		asyncServer = std::make_unique<UDPServerAsync>([&](uint8_t*, size_t, const std::string&, uint16_t) {
+			received++;
+		}, options.port, 65536);
+	}
+	else if (server == "buffered") {
+		bufferedServer = std::make_unique<UDPServer>(options.port, 65536);
+		consumer = std::thread([&] {
+			Packet packet;
+			while (!stop) {
+				if (bufferedServer->ReceivePacket(packet)) {
+					received++;
+				}
+				else {
+					std::this_thread::yield();
+				}
+			}
+		});
+	}
+	else {
+		blockingServer = std::make_unique<UDPServerBlocking>(options.port, 65536);
+		consumer = std::thread([&] {
+			Packet packet;
+			while (!stop && blockingServer->ReceivePacket(packet)) {
+				received++;
+			}
+		});
+	}
+
+	UDPClient client("127.0.0.1", options.port);
+	std::vector<uint8_t> buffer(options.sizes.front().max, 0xA5);
+
+	SendAndDrain(client, buffer, ALLOC_CHECK_WARMUP_PACKETS, received);
+	uint64_t before = GetAllocationCount();
+	uint64_t receivedBefore = received;
+	SendAndDrain(client, buffer, ALLOC_CHECK_PACKETS, received);
+	uint64_t allocations = GetAllocationCount() - before;
+	uint64_t packets = received - receivedBefore;
+
+	stop = true;
+	if (blockingServer) {
+		client.send(buffer.data(), buffer.size());		// Wake up the blocking receive
+	}
+	if (consumer.joinable()) {
+		consumer.join();
+	}
+
+	bool passed = allocations == 0 && packets > 0;
+	printf("%-10s %s: %llu allocations for %llu packets\n", server.c_str(), passed ? "PASS" : "FAIL",
+		(unsigned long long)allocations, (unsigned long long)packets);
+	return passed;
+}
+
+static int RunAllocationCheck(const Options& options) {
+	if (!IsAllocationCountingEnabled()) {
+		printf("The library was built without NETLIB_COUNT_ALLOCATIONS\n");
+		return 1;
+	}
+
+	bool passed = true;
+	for (const char* server : { "async", "buffered", "blocking" }) {
+		passed &= CheckServer(options, server);
+	}
+	return passed ? 0 : 1;
+}
+
+
+
+
+
+
+
+// ===================================
+// ===      Forward error correction ===
+// ===================================
+
+static constexpr uint8_t FEC_CHECK_DATA = 8;
+static constexpr uint8_t FEC_CHECK_REPAIR = 2;
+static constexpr uint64_t FEC_CHECK_PACKETS = 8003;		// Not a multiple of the block size, the last block is flushed
+
+static std::vector<FecKernel> SupportedKernels() {
+	std::vector<FecKernel> kernels;
+	for (FecKernel kernel : { FEC_KERNEL_SCALAR, FEC_KERNEL_SSSE3, FEC_KERNEL_AVX2 }) {
+		if (SetFecKernel(kernel)) {
+			kernels.push_back(kernel);
+		}
+	}
+	SetFecKernel(FEC_KERNEL_AUTO);
+	return kernels;
+}
+
+// Encodes a random block and decodes it for every erasure pattern the scheme can recover
+static bool CheckErasures(FecScheme scheme, size_t dataCount, size_t repairCount, size_t length) {
+	std::mt19937 random(1234);
+	std::vector<std::vector<uint8_t>> original(dataCount, std::vector<uint8_t>(length));
+	std::vector<std::vector<uint8_t>> repair(repairCount, std::vector<uint8_t>(length));
+	for (auto& symbol : original) {
+		for (auto& byte : symbol) {
+			byte = (uint8_t)random();
+		}
+	}
+
+	std::vector<const uint8_t*> dataPointers;
+	std::vector<uint8_t*> repairPointers;
+	for (auto& symbol : original) dataPointers.push_back(symbol.data());
+	for (auto& symbol : repair) repairPointers.push_back(symbol.data());
+
+	FecCodec codec(scheme);
+	codec.Encode(dataPointers.data(), dataCount, repairPointers.data(), repairCount, length);
+
+	std::vector<std::vector<uint8_t>> received(dataCount, std::vector<uint8_t>(length));
+	std::vector<uint8_t*> receivedPointers;
+	std::vector<const uint8_t*> repairConst(repairPointers.begin(), repairPointers.end());
+	for (auto& symbol : received) receivedPointers.push_back(symbol.data());
+
+	size_t total = dataCount + repairCount;
+	uint64_t patterns = 0;
+	uint64_t failures = 0;
+	for (uint64_t mask = 1; mask < (1ull << total); mask++) {
+		// Reed-Solomon recovers any 'repairCount' losses, XOR one loss per group
+		bool recoverable = true;
+		if (scheme == FEC_REED_SOLOMON) {
+			recoverable = std::bitset<64>(mask).count() <= repairCount;
+		}
+		else {
+			for (size_t group = 0; group < repairCount; group++) {
+				size_t lost = (mask >> (dataCount + group)) & 1;
+				for (size_t i = group; i < dataCount; i += repairCount) {
+					lost += (mask >> i) & 1;
+				}
+				recoverable &= lost <= 1;
+			}
+		}
+		if (!recoverable)
+			continue;
+
+		bool present[255];
+		bool repairPresent[255];
+		for (size_t i = 0; i < dataCount; i++) {
+			present[i] = !((mask >> i) & 1);
+			if (present[i]) {
+				received[i] = original[i];
+			}
+			else {
+				std::fill(received[i].begin(), received[i].end(), 0xEE);
+			}
+		}
+		for (size_t r = 0; r < repairCount; r++) {
+			repairPresent[r] = !((mask >> (dataCount + r)) & 1);
+		}
+
+		bool complete = codec.Decode(receivedPointers.data(), present, dataCount, repairConst.data(), repairPresent, repairCount, length);
+		patterns++;
+		if (!complete || received != original) {
+			failures++;
+		}
+	}
+
+	printf("%-14s %-6s k=%zu m=%zu: %llu erasure patterns, %s\n", scheme == FEC_XOR ? "xor" : "reed-solomon",
+		GetFecKernelName(GetFecKernel()), dataCount, repairCount, (unsigned long long)patterns, failures ? "FAIL" : "PASS");
+	return failures == 0;
+}
+
+static size_t FecPayloadSize(uint64_t sequence, size_t maxSize) {
+	return 16 + (size_t)((sequence * 2654435761u) % (maxSize - 15));
+}
+
+static void FillFecPayload(uint8_t* data, size_t size, uint64_t sequence) {
+	memcpy(data, &sequence, sizeof(sequence));
+	for (size_t i = sizeof(sequence); i < size; i++) {
+		data[i] = (uint8_t)(sequence * 31 + i);
+	}
+}
+
+// Sends through FecSender and UDPServerAsync on loopback and drops datagrams in the server callback.
+// Every block loses as much as the scheme can recover, so every datagram must arrive.
+static bool CheckFecLoopback(const Options& options, FecScheme scheme) {
+	FecOptions fec;
+	fec.scheme = scheme;
+	fec.dataPackets = FEC_CHECK_DATA;
+	fec.repairPackets = FEC_CHECK_REPAIR;
+	fec.maxPacketSize = 1400;
+
+	std::vector<uint8_t> seen(FEC_CHECK_PACKETS, 0);
+	uint64_t corrupt = 0;
+	std::vector<uint8_t> expected(fec.maxPacketSize);
+	FecReceiver receiver([&](uint8_t* packet, size_t size) {
+		uint64_t sequence = 0;
+		if (size >= sizeof(sequence)) {
+			memcpy(&sequence, packet, sizeof(sequence));
+		}
+		if (sequence >= FEC_CHECK_PACKETS || size != FecPayloadSize(sequence, fec.maxPacketSize)) {
+			corrupt++;
+			return;
+		}
+		FillFecPayload(expected.data(), size, sequence);
+		corrupt += memcmp(expected.data(), packet, size) != 0;
+		seen[sequence]++;
+	}, fec);
+
+	// Datagrams arrive in send order on loopback, so the arrival count tells the position in the block
+	std::mt19937 random(42);
+	size_t blockSize = fec.dataPackets + fec.repairPackets;
+	uint64_t fullBlocks = FEC_CHECK_PACKETS / fec.dataPackets;
+	uint64_t arrived = 0;
+	uint64_t dropped = 0;
+	std::vector<bool> drop(blockSize);
+	std::atomic<uint64_t> handled = 0;
+
+	UDPServerAsync server([&](uint8_t* packet, size_t size) {
+		uint64_t block = arrived / blockSize;
+		size_t position = (size_t)(arrived % blockSize);
+		size_t dataCount = block < fullBlocks ? fec.dataPackets : (size_t)(FEC_CHECK_PACKETS % fec.dataPackets);
+		size_t total = dataCount + fec.repairPackets;
+
+		if (position == 0) {
+			// Lose 'repairPackets' random datagrams of the block, for XOR at most one per group
+			std::fill(drop.begin(), drop.end(), false);
+			for (size_t group = 0; group < fec.repairPackets; group++) {
+				std::vector<size_t> members;
+				for (size_t i = group; i < dataCount; i += fec.repairPackets) members.push_back(i);
+				members.push_back(dataCount + group);
+				drop[members[random() % members.size()]] = true;
+			}
+		}
+
+		arrived++;
+		if (drop[position]) {
+			dropped++;
+		}
+		else {
+			receiver.OnPacket(packet, size);
+		}
+		if (position + 1 == total) {
+			handled = arrived;
+		}
+	}, options.port, 2048);
+
+	UDPClient client("127.0.0.1", options.port);
+	FecSender sender(client, fec);
+	std::vector<uint8_t> buffer(fec.maxPacketSize);
+	for (uint64_t sequence = 0; sequence < FEC_CHECK_PACKETS; sequence++) {
+		size_t size = FecPayloadSize(sequence, fec.maxPacketSize);
+		FillFecPayload(buffer.data(), size, sequence);
+		sender.send(buffer.data(), size);
+		if (sequence % 32 == 31) {
+			std::this_thread::sleep_for(std::chrono::microseconds(300));		// Stay below the socket buffer
+		}
+	}
+	sender.Flush();
+
+	uint64_t datagrams = sender.GetStatistics().dataPackets + sender.GetStatistics().repairPackets;
+	uint64_t last = 0;
+	while (handled < datagrams && handled != last) {
+		last = handled;
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+	}
+
+	uint64_t missing = 0;
+	uint64_t duplicates = 0;
+	for (uint8_t count : seen) {
+		missing += count == 0;
+		duplicates += count > 1;
+	}
+
+	FecStatistics statistics = receiver.GetStatistics();
+	bool passed = handled == datagrams && missing == 0 && duplicates == 0 && corrupt == 0 && statistics.recovered > 0;
+	printf("%-14s loopback: %llu datagrams, %llu dropped, %llu recovered, %llu missing, %llu corrupt, %s\n",
+		scheme == FEC_XOR ? "xor" : "reed-solomon", (unsigned long long)datagrams, (unsigned long long)dropped,
+		(unsigned long long)statistics.recovered, (unsigned long long)missing, (unsigned long long)corrupt, passed ? "PASS" : "FAIL");
+	if (handled != datagrams) {
+		printf("  %llu of %llu datagrams arrived, the kernel dropped some\n", (unsigned long long)handled, (unsigned long long)datagrams);
+	}
+	return passed;
+}
+
+static int RunFecCheck(const Options& options) {
+	bool passed = true;
+	for (FecKernel kernel : SupportedKernels()) {
+		SetFecKernel(kernel);
+		passed &= CheckErasures(FEC_REED_SOLOMON, 8, 2, 1402);
+		passed &= CheckErasures(FEC_REED_SOLOMON, 10, 4, 333);
+		passed &= CheckErasures(FEC_XOR, 8, 2, 1402);
+		passed &= CheckErasures(FEC_XOR, 6, 3, 65);
+	}
+	SetFecKernel(FEC_KERNEL_AUTO);
+
+	passed &= CheckFecLoopback(options, FEC_REED_SOLOMON);
+	passed &= CheckFecLoopback(options, FEC_XOR);
+	return passed ? 0 : 1;
+}
+
+// Encode and decode throughput of every kernel the CPU supports
+static int RunFecBenchmark(const Options& options) {
+	size_t length = std::max<size_t>(options.sizes.front().max, 64);
+	size_t dataCount = FEC_CHECK_DATA;
+	size_t repairCount = FEC_CHECK_REPAIR;
+
+	std::vector<std::vector<uint8_t>> data(dataCount, std::vector<uint8_t>(length, 0x5A));
+	std::vector<std::vector<uint8_t>> repair(repairCount, std::vector<uint8_t>(length));
+	std::vector<const uint8_t*> dataPointers;
+	std::vector<uint8_t*> writablePointers;
+	std::vector<uint8_t*> repairPointers;
+	for (auto& symbol : data) { dataPointers.push_back(symbol.data()); writablePointers.push_back(symbol.data()); }
+	for (auto& symbol : repair) repairPointers.push_back(symbol.data());
+	std::vector<const uint8_t*> repairConst(repairPointers.begin(), repairPointers.end());
+
+	printf("Blocks of %zu data and %zu repair symbols of %zu bytes, MB/s of data\n", dataCount, repairCount, length);
+	double seconds = std::min(options.duration, 1.0);
+	for (FecScheme scheme : { FEC_XOR, FEC_REED_SOLOMON }) {
+		FecCodec codec(scheme);
+		for (FecKernel kernel : SupportedKernels()) {
+			SetFecKernel(kernel);
+
+			double rates[2];
+			for (int decode = 0; decode < 2; decode++) {
+				uint64_t blocks = 0;
+				int64_t start = SteadyNowNs();
+				int64_t end = start + (int64_t)(seconds * 1e9);
+				int64_t now = start;
+				while (now < end) {
+					for (int i = 0; i < 64; i++) {
+						if (decode) {
+							// Worst case of the scheme: For XOR one loss per group, for Reed-Solomon 'repairCount' losses
+							bool present[255];
+							bool repairPresent[255];
+							std::fill(present, present + dataCount, true);
+							std::fill(repairPresent, repairPresent + repairCount, true);
+							for (size_t r = 0; r < repairCount; r++) present[r] = false;
+							codec.Decode(writablePointers.data(), present, dataCount, repairConst.data(), repairPresent, repairCount, length);
+						}
+						else {
+							codec.Encode(dataPointers.data(), dataCount, repairPointers.data(), repairCount, length);
+						}
+					}
+					blocks += 64;
+					now = SteadyNowNs();
+				}
+				rates[decode] = blocks * dataCount * length / ((now - start) / 1e9) / 1e6;
+			}
+			printf("%-14s %-6s encode %8.0f  decode %8.0f\n", scheme == FEC_XOR ? "xor" : "reed-solomon",
+				GetFecKernelName(kernel), rates[0], rates[1]);
+		}
+	}
+	SetFecKernel(FEC_KERNEL_AUTO);
+	return 0;
+}
+
+
+
+
+
+
+
+
+// =============================
+// ===      Resolver check   ===
+// =============================
+//
+// A stub name server on loopback answers the resolver without any network access:
+//   svc.test    A 10.1.2.3 with a TTL of 1s, no AAAA records
+//   alias.test  CNAME to svc.test, then its A record
+//   slow.test   A 10.1.2.4 after 200ms, for concurrent lookups
+//   others      NXDOMAIN
+//
+
+#ifndef _WIN32
+class StubNameServer {
+public:
+	explicit StubNameServer(uint16_t port) {
+		fd = socket(AF_INET, SOCK_DGRAM, 0);
+		sockaddr_in address = {};
+		address.sin_family = AF_INET;
+		address.sin_port = htons(port);
+		address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		timeval timeout = { 0, 50000 };
+		setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+		ready = bind(fd, (sockaddr*)&address, sizeof(address)) == 0;
+		thread = std::thread([this] { Run(); });
+	}
+
+	~StubNameServer() {
+		stop = true;
+		thread.join();
+		close(fd);
+	}
+
+	bool Ready() const { return ready; }
+
+	uint64_t Queries(const std::string& name) {
+		std::lock_guard<std::mutex> lock(mutex);
+		return queries[name];
+	}
+
+private:
+	static void Append16(std::vector<uint8_t>& out, uint16_t value) {
+		out.push_back((uint8_t)(value >> 8));
+		out.push_back((uint8_t)value);
+	}
+
+	static void AppendRecord(std::vector<uint8_t>& out, const std::vector<uint8_t>& name, uint16_t type, uint32_t ttl, const std::vector<uint8_t>& data) {
+		out.insert(out.end(), name.begin(), name.end());
+		Append16(out, type);
+		Append16(out, 1);
+		Append16(out, (uint16_t)(ttl >> 16));
+		Append16(out, (uint16_t)ttl);
+		Append16(out, (uint16_t)data.size());
+		out.insert(out.end(), data.begin(), data.end());
+	}
+
+	void Run() {
+		uint8_t buffer[512];
+		while (!stop) {
+			sockaddr_in source = {};
+			socklen_t sourceLength = sizeof(source);
+			ssize_t bytes = recvfrom(fd, buffer, sizeof(buffer), 0, (sockaddr*)&source, &sourceLength);
+			if (bytes < 12)
+				continue;
+
+			// Question name as text, then its type
+			std::string name;
+			size_t pos = 12;
+			while (pos < (size_t)bytes && buffer[pos] != 0) {
+				if (!name.empty()) name += '.';
+				name.append((const char*)buffer + pos + 1, buffer[pos]);
+				pos += 1 + buffer[pos];
+			}
+			pos++;
+			if (pos + 4 > (size_t)bytes)
+				continue;
+			uint16_t type = (uint16_t)((buffer[pos] << 8) | buffer[pos + 1]);
+			pos += 4;
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				queries[name]++;
+			}
+
+			std::vector<uint8_t> response(buffer, buffer + pos);
+			const std::vector<uint8_t> question = { 0xC0, 0x0C };
+			uint16_t answers = 0;
+			bool exists = name == "svc.test" || name == "alias.test" || name == "slow.test";
+			if (name == "slow.test") {
+				std::this_thread::sleep_for(std::chrono::milliseconds(200));
+			}
+			if (type == 1 && name == "svc.test") {
+				AppendRecord(response, question, 1, 1, { 10, 1, 2, 3 });
+				answers = 1;
+			}
+			if (type == 1 && name == "alias.test") {
+				std::vector<uint8_t> target = { 3, 's', 'v', 'c', 4, 't', 'e', 's', 't', 0 };
+				AppendRecord(response, question, 5, 60, target);
+				AppendRecord(response, target, 1, 60, { 10, 1, 2, 3 });
+				answers = 2;
+			}
+			if (type == 1 && name == "slow.test") {
+				AppendRecord(response, question, 1, 60, { 10, 1, 2, 4 });
+				answers = 1;
+			}
+
+			response[2] = 0x81;
+			response[3] = exists ? 0x80 : 0x83;
+			response[6] = (uint8_t)(answers >> 8);
+			response[7] = (uint8_t)answers;
+			sendto(fd, response.data(), response.size(), 0, (sockaddr*)&source, sourceLength);
+		}
+	}
+
+	int fd = -1;
+	bool ready = false;
+	std::atomic<bool> stop = false;
+	std::thread thread;
+	std::mutex mutex;
+	std::unordered_map<std::string, uint64_t> queries;
+};
+#endif
+
+static bool ReportCheck(const char* name, bool passed) {
+	printf("%-44s %s\n", name, passed ? "PASS" : "FAIL");
+	return passed;
+}
+
+static bool HasAddress(const ResolveResult& result, IPv4Address address) {
+	return result.status == RESOLVE_OK && std::find(result.ipv4.begin(), result.ipv4.end(), address) != result.ipv4.end();
+}
+
+static int RunResolverCheck(const Options& options) {
+	bool passed = true;
+
+	// The system resolver with the hosts file, through SendUDP()
+	std::atomic<uint64_t> received = 0;
+	{
+		UDPServerAsync server([&](uint8_t*, size_t) { received++; }, options.port);
+		std::string payload = "resolve-check";
+		passed &= ReportCheck("uncached name fails the send", !SendUDP("localhost", options.port, payload));
+
+		// The failed send started the lookup, Resolve() waits for it
+		uint64_t hitsBefore = GetDefaultResolver().GetStatistics().hits;
+		bool sent = GetDefaultResolver().Resolve("localhost").status == RESOLVE_OK &&
+			SendUDP("localhost", options.port, payload) && SendUDP("localhost", options.port, payload);
+		for (int i = 0; i < 100 && received < 2; i++) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		}
+		passed &= ReportCheck("localhost through SendUDP()", sent && received == 2);
+		passed &= ReportCheck("sends served from the cache", GetDefaultResolver().GetStatistics().hits - hitsBefore >= 2);
+
+		GetDefaultResolver().Resolve("does-not-exist.invalid");
+		passed &= ReportCheck("unresolvable name fails the send", !SendUDP("does-not-exist.invalid", options.port, payload));
+	}
+
+#ifndef _WIN32
+	StubNameServer stub(options.port);
+	if (!stub.Ready()) {
+		printf("Could not bind the stub name server to 127.0.0.1:%u\n", options.port);
+		return 1;
+	}
+
+	std::string hostsFile = "netlib-loadgen-hosts.tmp";
+	FILE* file = fopen(hostsFile.c_str(), "w");
+	if (file) {
+		fprintf(file, "# Written by netlib-loadgen resolve-check\n10.9.9.9   hosts.test  other.test\n127.0.0.1  stale.test\n");
+		fclose(file);
+	}
+
+	ResolverOptions resolverOptions;
+	resolverOptions.nameServer = "127.0.0.1:" + std::to_string(options.port);
+	resolverOptions.hostsFile = hostsFile;
+	resolverOptions.negativeTtl = std::chrono::seconds(1);
+	resolverOptions.timeout = std::chrono::milliseconds(1000);
+	resolverOptions.threads = 4;
+	Resolver resolver(resolverOptions);
+
+	passed &= ReportCheck("A record from the name server", HasAddress(resolver.Resolve("svc.test"), IPv4Address(10, 1, 2, 3)));
+	passed &= ReportCheck("A and AAAA queried once", stub.Queries("svc.test") == 2);
+	passed &= ReportCheck("cached within the TTL", HasAddress(resolver.Resolve("SVC.test."), IPv4Address(10, 1, 2, 3)) &&
+		stub.Queries("svc.test") == 2);
+	std::this_thread::sleep_for(std::chrono::milliseconds(1100));
+	passed &= ReportCheck("queried again after the TTL", !resolver.TryResolveCached("svc.test").has_value() &&
+		HasAddress(resolver.Resolve("svc.test"), IPv4Address(10, 1, 2, 3)) && stub.Queries("svc.test") == 4);
+
+	passed &= ReportCheck("CNAME followed by the A record", HasAddress(resolver.Resolve("alias.test"), IPv4Address(10, 1, 2, 3)));
+
+	passed &= ReportCheck("NXDOMAIN", resolver.Resolve("missing.test").status == RESOLVE_NOT_FOUND && stub.Queries("missing.test") == 1);
+	passed &= ReportCheck("negative entry cached", resolver.Resolve("missing.test").status == RESOLVE_NOT_FOUND &&
+		stub.Queries("missing.test") == 1);
+	std::this_thread::sleep_for(std::chrono::milliseconds(1100));
+	resolver.Resolve("missing.test");
+	passed &= ReportCheck("negative entry expires", stub.Queries("missing.test") == 2);
+
+	passed &= ReportCheck("hosts file before the name server", HasAddress(resolver.Resolve("other.test"), IPv4Address(10, 9, 9, 9)) &&
+		stub.Queries("other.test") == 0);
+
+	// Concurrent lookups of one name wait for the same query
+	std::atomic<int> answers = 0;
+	uint64_t coalescedBefore = resolver.GetStatistics().coalesced;
+	for (int i = 0; i < 8; i++) {
+		resolver.ResolveAsync("slow.test", [&](const ResolveResult& result) {
+			answers += HasAddress(result, IPv4Address(10, 1, 2, 4));
+		});
+	}
+	for (int i = 0; i < 200 && answers < 8; i++) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+	passed &= ReportCheck("concurrent lookups coalesced", answers == 8 && stub.Queries("slow.test") == 2 &&
+		resolver.GetStatistics().coalesced - coalescedBefore == 7);
+
+	// A name server that does not answer
+	ResolverOptions silentOptions = resolverOptions;
+	silentOptions.nameServer = "127.0.0.1:" + std::to_string(options.port + 1);
+	silentOptions.timeout = std::chrono::milliseconds(300);
+	resolver.SetOptions(silentOptions);
+	ResolveStatus status = resolver.Resolve("svc.test").status;
+	passed &= ReportCheck("unreachable name server", status == RESOLVE_FAILED || status == RESOLVE_TIMEOUT);
+
+	// SendUDP() keeps sending to an expired name while the default resolver refreshes it
+	{
+		std::atomic<uint64_t> staleReceived = 0;
+		UDPServerAsync server([&](uint8_t*, size_t) { staleReceived++; }, options.port + 2);
+		ResolverOptions shortTtl = resolverOptions;
+		shortTtl.ttl = std::chrono::seconds(1);
+		GetDefaultResolver().SetOptions(shortTtl);
+		ResolverStatistics before = GetDefaultResolver().GetStatistics();
+
+		bool warmed = GetDefaultResolver().Resolve("stale.test").status == RESOLVE_OK;
+		uint64_t failed = 0;
+		uint64_t sends = 0;
+		auto end = std::chrono::steady_clock::now() + std::chrono::milliseconds(2500);
+		while (std::chrono::steady_clock::now() < end) {
+			failed += !SendUDP("stale.test", options.port + 2, "stale-check");
+			sends++;
+			std::this_thread::sleep_for(std::chrono::milliseconds(5));
+		}
+		for (int i = 0; i < 100 && staleReceived < sends; i++) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		}
+
+		ResolverStatistics after = GetDefaultResolver().GetStatistics();
+		passed &= ReportCheck("no failed sends across the TTL", warmed && failed == 0 && staleReceived == sends);
+		passed &= ReportCheck("expired name refreshed in the background", after.stale > before.stale && after.lookups - before.lookups >= 3);
+		GetDefaultResolver().SetOptions(ResolverOptions());
+	}
+
+	remove(hostsFile.c_str());
+#endif
+
+	ResolverStatistics statistics = GetDefaultResolver().GetStatistics();
+	printf("Default resolver: %llu hits, %llu stale, %llu misses, %llu lookups\n", (unsigned long long)statistics.hits,
+		(unsigned long long)statistics.stale, (unsigned long long)statistics.misses, (unsigned long long)statistics.lookups);
+	return passed ? 0 : 1;
+}
+
+
+
+
+
+
+
+
+// ============================
+// ===      RPC benchmark   ===
+// ============================
+
+static constexpr uint16_t RPC_ECHO = 1;
+static constexpr uint16_t RPC_THROW = 2;
+static constexpr uint16_t RPC_MISSING = 3;
+
+struct RpcBenchState {
+	std::vector<uint8_t> payload;
+	std::atomic<bool> stop = false;
+	std::atomic<uint64_t> completed = 0;
+	std::atomic<uint64_t> failed = 0;
+	std::atomic<size_t> outstanding = 0;
+};
+
+// Closed loop: Every completion sends the next request, so 'outstanding' requests stay in flight
+static void IssueRpc(RpcClient& client, RpcBenchState& state) {
+	bool sent = client.Call(RPC_ECHO, state.payload.data(), state.payload.size(), [&client, &state](RpcStatus status, const uint8_t*, size_t) {
+		if (status == RPC_OK) {
+			state.completed.fetch_add(1, std::memory_order_relaxed);
+		}
+		else {
+			state.failed.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		if (state.stop.load(std::memory_order_relaxed)) {
+			state.outstanding--;
+		}
+		else {
+			IssueRpc(client, state);
+		}
+	});
+
+	if (!sent) {
+		state.failed++;
+		state.outstanding--;
+	}
+}
+
+static int RunRpcBenchmark(const Options& options) {
+	RpcServer server(options.port);
+	server.Register(RPC_ECHO, [](const uint8_t* request, size_t requestSize, uint8_t* response, size_t) {
+		memcpy(response, request, requestSize);
+		return requestSize;
+	});
+	server.Register(RPC_THROW, [](const uint8_t*, size_t, uint8_t*, size_t) -> size_t {
+		throw std::runtime_error("rpc-bench");
+	});
+
+	// Stub on the next port: Answers echo requests only when they are repeated, and never any other method
+	uint16_t lossyPort = options.port + 1;
+	std::unordered_map<uint32_t, int> seen;
+	std::unique_ptr<UDPServerAsync> lossy;
+	lossy = std::make_unique<UDPServerAsync>([&](uint8_t* packet, size_t packetSize, IPv4Address source, uint16_t sourcePort) {
+		if (packetSize < NETLIB_RPC_HEADER_SIZE || ((packet[2] << 8) | packet[3]) != RPC_ECHO)
+			return;
+
+		uint32_t id;
+		memcpy(&id, packet + 4, sizeof(id));
+		if (seen[id]++ == 0)
+			return;
+
+		packet[0] = (uint8_t)((packet[0] & 0xF0) | 1);		// Response
+		lossy->SendTo(source, sourcePort, packet, packetSize);
+	}, lossyPort, 2048);
+
+	bool passed = true;
+	std::vector<uint8_t> request(std::max<size_t>(options.sizes.front().max, 1));
+	for (size_t i = 0; i < request.size(); i++) {
+		request[i] = (uint8_t)(i * 7);
+	}
+
+	{
+		RpcClient client(IPv4Address::Loopback(), options.port);
+		RpcResponse echo = client.CallAsync(RPC_ECHO, request.data(), request.size()).get();
+		passed &= ReportCheck("echo", echo.status == RPC_OK && echo.data == request);
+		passed &= ReportCheck("unknown method", client.CallAsync(RPC_MISSING, nullptr, 0).get().status == RPC_NO_HANDLER);
+		passed &= ReportCheck("throwing handler", client.CallAsync(RPC_THROW, nullptr, 0).get().status == RPC_HANDLER_FAILED);
+
+		std::vector<uint8_t> large(RpcClientOptions().maxRequestSize + 1);
+		passed &= ReportCheck("oversized request", client.CallAsync(RPC_ECHO, large.data(), large.size()).get().status == RPC_REJECTED);
+
+		// Many requests at once, completed in any order
+		std::vector<std::future<RpcResponse>> futures;
+		for (uint32_t i = 0; i < 1000; i++) {
+			futures.push_back(client.CallAsync(RPC_ECHO, (const uint8_t*)&i, sizeof(i)));
+		}
+		bool matched = true;
+		for (uint32_t i = 0; i < futures.size(); i++) {
+			RpcResponse response = futures[i].get();
+			matched &= response.status == RPC_OK && response.data.size() == sizeof(i) && memcmp(response.data.data(), &i, sizeof(i)) == 0;
+		}
+		passed &= ReportCheck("1000 requests in flight", matched);
+	}
+
+	{
+		RpcClientOptions clientOptions;
+		clientOptions.retryInterval = std::chrono::milliseconds(20);
+		clientOptions.timeout = std::chrono::milliseconds(300);
+		RpcClient client(IPv4Address::Loopback(), lossyPort, clientOptions);
+
+		RpcResponse retried = client.CallAsync(RPC_ECHO, request.data(), request.size()).get();
+		passed &= ReportCheck("lost request is repeated", retried.status == RPC_OK && retried.data == request);
+
+		auto start = std::chrono::steady_clock::now();
+		RpcStatus status = client.CallAsync(RPC_MISSING, nullptr, 0, std::chrono::milliseconds(100)).get().status;
+		double waited = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		passed &= ReportCheck("deadline of the call", status == RPC_TIMEOUT && waited >= 100 && waited < 250);
+
+		RpcClientStatistics statistics = client.GetStatistics();
+		passed &= ReportCheck("retries counted", statistics.retries >= 3 && statistics.timeouts == 1);
+	}
+
+	{
+		std::future<RpcResponse> pending;
+		{
+			RpcClient client(IPv4Address::Loopback(), lossyPort);
+			pending = client.CallAsync(RPC_MISSING, nullptr, 0);
+		}
+		passed &= ReportCheck("destroyed client cancels", pending.get().status == RPC_CANCELLED);
+	}
+
+	lossy.reset();
+
+	for (size_t depth : { 1, 64, 1024 }) {
+		RpcClient client(IPv4Address::Loopback(), options.port);
+		RpcBenchState state;
+		state.payload = request;
+		state.outstanding = depth;
+
+		auto start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < depth; i++) {
+			IssueRpc(client, state);
+		}
+		std::this_thread::sleep_for(std::chrono::duration<double>(options.duration / 3));
+		state.stop = true;
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		uint64_t completed = state.completed;
+
+		while (state.outstanding > 0) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+
+		RpcClientStatistics statistics = client.GetStatistics();
+		double rate = completed / seconds;
+		printf("%5zu in flight: %10.0f requests/s, %8.1f us per request, %llu failed, %llu retries\n", depth, rate,
+			rate > 0 ? depth * 1e6 / rate : 0.0, (unsigned long long)state.failed.load(), (unsigned long long)statistics.retries);
+	}
+
+	RpcServerStatistics statistics = server.GetStatistics();
+	printf("Server: %llu requests, %llu without handler, %llu failed\n", (unsigned long long)statistics.requests,
+		(unsigned long long)statistics.noHandler, (unsigned long long)statistics.failures);
+	return passed ? 0 : 1;
+}
+
+
+
+
+
+
+
+
+// ==============================
+// ===      Gather check      ===
+// ==============================
+
+static int RunGatherCheck(const Options& options) {
+	bool passed = true;
+	UDPServerBlocking server(options.port, 2048);
+
+	LoadgenHeader header = {};
+	header.stream = 7;
+	header.sequence = 42;
+	std::vector<uint8_t> payload(1000);
+	for (size_t i = 0; i < payload.size(); i++) {
+		payload[i] = (uint8_t)(i * 13);
+	}
+
+	// Receives one datagram scattered into a header and a payload buffer
+	auto receive = [&](size_t expected, LoadgenHeader& receivedHeader, std::vector<uint8_t>& receivedPayload) {
+		receivedPayload.assign(payload.size(), 0);
+		MutableBuffer buffers[] = { { &receivedHeader, sizeof(receivedHeader) }, { receivedPayload.data(), receivedPayload.size() } };
+		size_t bytes = 0;
+		IPv4Address source;
+		uint16_t sourcePort = 0;
+		return server.ReceivePacket(buffers, 2, bytes, source, sourcePort) && bytes == expected && source == IPv4Address(127, 0, 0, 1);
+	};
+	auto matches = [&](const LoadgenHeader& receivedHeader, const std::vector<uint8_t>& receivedPayload) {
+		return memcmp(&receivedHeader, &header, sizeof(header)) == 0 && receivedPayload == payload;
+	};
+
+	UDPClient client("127.0.0.1", options.port);
+	LoadgenHeader receivedHeader;
+	std::vector<uint8_t> receivedPayload;
+
+	size_t sent = client.send({ { &header, sizeof(header) }, { payload.data(), payload.size() } });
+	passed &= ReportCheck("UDPClient gathers header and payload", sent == sizeof(header) + payload.size() &&
+		receive(sent, receivedHeader, receivedPayload) && matches(receivedHeader, receivedPayload));
+
+	ConstBuffer pieces[] = { { &header, sizeof(header) }, { payload.data(), 100 }, { nullptr, 0 }, { payload.data() + 100, payload.size() - 100 } };
+	passed &= ReportCheck("SendUDP() gathers four buffers", SendUDP(IPv4Address(127, 0, 0, 1), options.port, pieces, 4) &&
+		receive(sizeof(header) + payload.size(), receivedHeader, receivedPayload) && matches(receivedHeader, receivedPayload));
+
+	std::vector<ConstBuffer> tooMany(NETLIB_MAX_DATAGRAM_BUFFERS + 1, ConstBuffer{ payload.data(), 1 });
+	bool refused = false;
+	try {
+		client.send(tooMany.data(), tooMany.size());
+	}
+	catch (std::exception&) {
+		refused = true;
+	}
+	passed &= ReportCheck("more than the maximum buffers refused", refused);
+
+	// A datagram shorter than the header ends in the first buffer
+	client.send((uint8_t*)&header, 8);
+	passed &= ReportCheck("short datagram stays in the first buffer", receive(8, receivedHeader, receivedPayload) &&
+		memcmp(&receivedHeader, &header, 8) == 0 && receivedPayload[0] == 0);
+
+	// std::string with an embedded NUL is sent completely
+	std::string text("before\0after", 12);
+	client.send(text);
+	std::vector<uint8_t> textBuffer(64);
+	MutableBuffer textBuffers[] = { { textBuffer.data(), textBuffer.size() } };
+	size_t bytes = 0;
+	IPv4Address source;
+	uint16_t sourcePort = 0;
+	passed &= ReportCheck("std::string with embedded NUL", server.ReceivePacket(textBuffers, 1, bytes, source, sourcePort) &&
+		bytes == text.size() && memcmp(textBuffer.data(), text.data(), text.size()) == 0);
+
+	// Longer than both buffers together
+	std::vector<uint8_t> large(sizeof(header) + payload.size() + 100, 0x5A);
+	client.send(large.data(), large.size());
+	passed &= ReportCheck("oversized datagram truncated", receive(sizeof(header) + payload.size(), receivedHeader, receivedPayload) &&
+		server.GetReceiveBufferStatistics().truncated == 1);
+
+	return passed ? 0 : 1;
+}
+
+
+
+
+
+
+
+
+// ==========================
+// ===      HTTP check    ===
+// ==========================
+//
+// A stub HTTP/1.1 server on loopback, keep-alive on every connection:
+//   /file          1 MB, honours Range requests
+//   /norange       Like /file, but answers ranges with 200 and the whole file
+//   /badrange      Like /file, but answers ranges with the bytes 100 further on
+//   /chunked       64 kB in chunks, without a Content-Length
+//   /redirect/N    302 to /redirect/N-1, /redirect/0 redirects to /file
+//
+
+#ifndef _WIN32
+class StubHttpServer {
+public:
+	static constexpr size_t FILE_SIZE = 1024 * 1024;
+
+	explicit StubHttpServer(uint16_t port) {
+		fd = socket(AF_INET, SOCK_STREAM, 0);
+		int one = 1;
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+		sockaddr_in address = {};
+		address.sin_family = AF_INET;
+		address.sin_port = htons(port);
+		address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		timeval timeout = { 0, 50000 };
+		setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+		ready = bind(fd, (sockaddr*)&address, sizeof(address)) == 0 && listen(fd, 64) == 0;
+		thread = std::thread([this] { Run(); });
+	}
+
+	~StubHttpServer() {
+		stop = true;
+		thread.join();
+		for (auto& connection : connections) {
+			connection.join();
+		}
+		close(fd);
+	}
+
+	bool Ready() const { return ready; }
+
+	static uint8_t FileByte(size_t i) { return (uint8_t)(i * 31 + 7); }
+
+	uint64_t Connections() const { return accepted; }
+	uint64_t RangeRequests() const { return ranges; }
+
+private:
+	void Run() {
+		while (!stop) {
+			int client = accept(fd, nullptr, nullptr);
+			if (client < 0)
+				continue;
+			accepted++;
+			connections.emplace_back([this, client] { Serve(client); });
+		}
+	}
+
+	static bool SendAll(int client, const std::string& data) {
+		size_t sent = 0;
+		while (sent < data.size()) {
+			ssize_t bytes = send(client, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+			if (bytes <= 0)
+				return false;
+			sent += (size_t)bytes;
+		}
+		return true;
+	}
+
+	static std::string FileBytes(size_t first, size_t last) {
+		std::string body(last - first + 1, '\0');
+		for (size_t i = first; i <= last; i++) {
+			body[i - first] = (char)FileByte(i);
+		}
+		return body;
+	}
+
+	std::string Respond(const std::string& method, const std::string& path, const std::string& range) {
+		if (path.compare(0, 10, "/redirect/") == 0) {
+			int remaining = atoi(path.c_str() + 10);
+			std::string location = remaining > 0 ? "/redirect/" + std::to_string(remaining - 1) : "/file";
+			return "HTTP/1.1 302 Found\r\nLocation: " + location + "\r\nContent-Length: 5\r\n\r\nmoved";
+		}
+
+		if (path == "/chunked") {
+			std::string response = "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n";
+			for (size_t offset = 0; offset < 65536; offset += 4096) {
+				response += "1000\r\n" + FileBytes(offset, offset + 4095) + "\r\n";
+			}
+			return response + "0\r\n\r\n";
+		}
+
+		if (path != "/file" && path != "/norange" && path != "/badrange")
+			return "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n";
+
+		unsigned long long first = 0, last = 0;
+		bool partial = !range.empty() && path != "/norange" && sscanf(range.c_str(), "bytes=%llu-%llu", &first, &last) == 2;
+		if (partial) {
+			ranges++;
+			if (path == "/badrange") {
+				first = std::min<unsigned long long>(first + 100, FILE_SIZE - 1);
+				last = std::min<unsigned long long>(last + 100, FILE_SIZE - 1);
+			}
+		}
+		else {
+			first = 0;
+			last = FILE_SIZE - 1;
+		}
+
+		std::string head = partial ? "HTTP/1.1 206 Partial Content\r\nContent-Range: bytes " + std::to_string(first) + "-" +
+			std::to_string(last) + "/" + std::to_string(FILE_SIZE) + "\r\n" : "HTTP/1.1 200 OK\r\n";
+		head += "Accept-Ranges: bytes\r\nContent-Length: " + std::to_string(last - first + 1) + "\r\n\r\n";
+		return method == "HEAD" ? head : head + FileBytes(first, last);
+	}
+
+	void Serve(int client) {
+		timeval timeout = { 0, 50000 };
+		setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+		std::string pending;
+		char buffer[4096];
+		while (!stop) {
+			size_t end = pending.find("\r\n\r\n");
+			if (end == std::string::npos) {
+				ssize_t bytes = recv(client, buffer, sizeof(buffer), 0);
+				if (bytes == 0 || (bytes < 0 && errno != EAGAIN && errno != EWOULDBLOCK))
+					break;
+				if (bytes > 0)
+					pending.append(buffer, (size_t)bytes);
+				continue;
+			}
+
+			std::string request = pending.substr(0, end);
+			pending.erase(0, end + 4);
+
+			size_t space = request.find(' ');
+			std::string method = request.substr(0, space);
+			std::string path = request.substr(space + 1, request.find(' ', space + 1) - space - 1);
+			std::string range;
+			size_t rangeHeader = request.find("\r\nRange: ");
+			if (rangeHeader != std::string::npos) {
+				range = request.substr(rangeHeader + 9, request.find("\r\n", rangeHeader + 2) - rangeHeader - 9);
+			}
+
+			if (!SendAll(client, Respond(method, path, range)))
+				break;
+		}
+		close(client);
+	}
+
+	int fd = -1;
+	bool ready = false;
+	std::atomic<bool> stop = false;
+	std::atomic<uint64_t> accepted = 0;
+	std::atomic<uint64_t> ranges = 0;
+	std::thread thread;
+	std::vector<std::thread> connections;		// Only touched by the accepting thread until it is joined
+};
+#endif
+
+static bool FileMatches(const std::string& path) {
+	FILE* file = fopen(path.c_str(), "rb");
+	if (!file)
+		return false;
+
+	std::vector<uint8_t> data(StubHttpServer::FILE_SIZE + 1);
+	size_t bytes = fread(data.data(), 1, data.size(), file);
+	fclose(file);
+	if (bytes != StubHttpServer::FILE_SIZE)
+		return false;
+
+	for (size_t i = 0; i < bytes; i++) {
+		if (data[i] != StubHttpServer::FileByte(i))
+			return false;
+	}
+	return true;
+}
+
+static int RunHttpCheck(const Options& options) {
+#ifdef _WIN32
+	(void)options;
+	printf("http-check needs the POSIX stub server\n");
+	return 1;
+#else
+	StubHttpServer stub(options.port);
+	if (!stub.Ready()) {
+		printf("Could not bind the stub HTTP server to 127.0.0.1:%u\n", options.port);
+		return 1;
+	}
+
+	bool passed = true;
+	std::string base = "http://127.0.0.1:" + std::to_string(options.port);
+	std::string target = "netlib-loadgen-http.tmp";
+	HttpClient client;
+
+	// Keep-alive: Sequential requests share one connection
+	bool ok = true;
+	for (int i = 0; i < 3; i++) {
+		auto response = client.Get(base + "/file");
+		ok &= response.has_value() && response->status == 200 && response->body.size() == StubHttpServer::FILE_SIZE;
+	}
+	passed &= ReportCheck("three requests over one connection", ok && stub.Connections() == 1);
+
+	// Progress totals: The announced size, 0 without a Content-Length
+	uint64_t lastProgress = 0, lastTotal = 1;
+	auto progress = [&](uint64_t current, uint64_t total) { lastProgress = current; lastTotal = total; return true; };
+	std::string body = client.DownloadToBuffer(base + "/file", progress);
+	passed &= ReportCheck("progress total from Content-Length", body.size() == StubHttpServer::FILE_SIZE &&
+		lastProgress == StubHttpServer::FILE_SIZE && lastTotal == StubHttpServer::FILE_SIZE);
+	body = client.DownloadToBuffer(base + "/chunked", progress);
+	passed &= ReportCheck("progress total 0 for a chunked body", body.size() == 65536 && lastProgress == 65536 && lastTotal == 0);
+
+	// Redirects, up to the limit
+	auto redirected = client.Get(base + "/redirect/3", 5);
+	passed &= ReportCheck("redirects followed", redirected.has_value() && redirected->status == 200 &&
+		redirected->body.size() == StubHttpServer::FILE_SIZE);
+	auto limited = client.Get(base + "/redirect/9", 5);
+	passed &= ReportCheck("redirect limit", limited.has_value() && limited->status == 302);
+
+	// Range downloads, the single request path as well
+	HttpDownloadOptions download;
+	download.parallelConnections = 4;
+	download.parallelThreshold = 64 * 1024;
+	download.onProgress = progress;
+	uint64_t rangesBefore = stub.RangeRequests();
+	passed &= ReportCheck("parallel range download", client.DownloadToFile(base + "/file", target, download) &&
+		FileMatches(target) && stub.RangeRequests() - rangesBefore == 4 && lastTotal == StubHttpServer::FILE_SIZE);
+
+	passed &= ReportCheck("200 instead of 206 falls back", client.DownloadToFile(base + "/norange", target, download) &&
+		FileMatches(target) && lastTotal == StubHttpServer::FILE_SIZE);
+
+	passed &= ReportCheck("mismatching Content-Range falls back", client.DownloadToFile(base + "/badrange", target, download) &&
+		FileMatches(target));
+
+	download.parallelConnections = 1;
+	passed &= ReportCheck("single request download", client.DownloadToFile(base + "/file", target, download) &&
+		FileMatches(target) && lastProgress == StubHttpServer::FILE_SIZE && lastTotal == StubHttpServer::FILE_SIZE);
+
+	std::remove(target.c_str());
+	return passed ? 0 : 1;
+#endif
+}
+
+
+
+
+
+
+
+
+// =====================
+// ===      Main     ===
+// =====================
+
+int main(int argc, char** argv) {
+	Options options;
+	if (!ParseArguments(argc, argv, options)) {
+		PrintUsage();
+		return 1;
+	}
+
+	SetLogLevel(LOG_LEVEL_WARN);
+
+	if (options.mode == "alloc-check") {
+		return RunAllocationCheck(options);
+	}
+	if (options.mode == "fec-check") {
+		return RunFecCheck(options);
+	}
+	if (options.mode == "fec-bench") {
+		return RunFecBenchmark(options);
+	}
+	if (options.mode == "resolve-check") {
+		return RunResolverCheck(options);
+	}
+	if (options.mode == "rpc-bench") {
+		return RunRpcBenchmark(options);
+	}
+	if (options.mode == "gather-check") {
+		return RunGatherCheck(options);
+	}
+	if (options.mode == "http-check") {
+		return RunHttpCheck(options);
+	}
+
+	if (options.mode == "send") {
+		std::vector<SenderResult> results;
+		RunSenders(options, results);
+		PrintSenderReport(options, results);
+		return 0;
+	}
+
+	Analyzer analyzer;
+	std::atomic<bool> stop = false;
+	std::atomic<bool> ready = false;
+	std::thread receiver(RunReceiver, std::cref(options), std::ref(analyzer), std::ref(stop), std::ref(ready));
+	while (!ready) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+
+	if (options.mode == "loopback") {
+		std::vector<SenderResult> results;
+		RunSenders(options, results);
+		std::this_thread::sleep_for(std::chrono::milliseconds(200));		// Let the receiver drain
+		PrintSenderReport(options, results);
+	}
+	else {
+		// Print the receive rate once per second
+		auto end = std::chrono::steady_clock::now() + std::chrono::duration<double>(options.duration);
+		uint64_t lastPackets = 0;
+		while (std::chrono::steady_clock::now() < end) {
+			std::this_thread::sleep_for(std::chrono::seconds(1));
+			uint64_t packets = analyzer.packets;
+			printf("%llu pps\n", (unsigned long long)(packets - lastPackets));
+			lastPackets = packets;
+		}
+	}
+
+	stop = true;
+	WakeBlockingReceiver(options);
+	receiver.join();
+	analyzer.PrintReport(options.duration);
+	return 0;
+}